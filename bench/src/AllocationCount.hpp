@@ -0,0 +1,74 @@
+#ifndef _ALLOCATION_COUNT_HPP_
+#define _ALLOCATION_COUNT_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+/**
+ * malloc, calloc and realloc replaced for the whole benchmark binary, the
+ * library included, by ones that count calls on the calling thread before
+ * handing them to glibc's own.  Only on glibc, which exports those under
+ * __libc_*; elsewhere nothing is counted.
+ */
+#ifdef __GLIBC__
+namespace HareBench {
+static __thread uint64_t t_allocations = 0;
+}  // namespace HareBench
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) {
+  HareBench::t_allocations++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  HareBench::t_allocations++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+  HareBench::t_allocations++;
+  return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+namespace HareBench {
+
+inline bool AllocationsCounted() {
+#ifdef __GLIBC__
+  return true;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Allocations made by this thread so far
+ */
+inline uint64_t Allocations() {
+#ifdef __GLIBC__
+  return t_allocations;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Allocations per call of work, averaged over calls calls
+ */
+inline double AllocationsPerCall(int calls, const std::function<void()>& work) {
+  const uint64_t before = Allocations();
+  for (int i = 0; i < calls; i++) work();
+  return static_cast<double>(Allocations() - before) / calls;
+}
+
+}  // namespace HareBench
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef _BENCH_HARNESS_HPP_
+#define _BENCH_HARNESS_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace HareBench {
+
+/**
+ * Broker and run settings handed to every benchmark, filled from the command
+ * line in bench.cpp
+ */
+struct Config {
+  Config()
+      : m_server("localhost"),
+        m_port(5672),
+        m_username("guest"),
+        m_password("guest"),
+        m_seconds(5){};
+  std::string m_server;
+  int m_port;
+  std::string m_username;
+  std::string m_password;
+  int m_seconds;
+  // Unix socket the same broker is reachable on, for Transport.unixVersusTcp
+  std::string m_unixPath;
+};
+
+/**
+ * Results of one benchmark, printed as a table once it finishes
+ */
+class Report {
+ public:
+  explicit Report(const std::string& name) : m_name(name){};
+
+  void Add(const std::string& metric, double value, const std::string& unit) {
+    m_rows.push_back({metric, value, unit});
+  }
+
+  /**
+   * Add mean/p50/p90/p99/p99.9/max of a set of latencies, in microseconds
+   */
+  void AddLatencies(const std::string& metric,
+                    std::vector<double> latenciesMicros) {
+    if (latenciesMicros.empty()) {
+      Add(metric + " samples", 0, "");
+      return;
+    }
+    std::sort(latenciesMicros.begin(), latenciesMicros.end());
+    double total = 0;
+    for (auto latency : latenciesMicros) total += latency;
+
+    Add(metric + " samples", latenciesMicros.size(), "");
+    Add(metric + " mean", total / latenciesMicros.size(), "us");
+    Add(metric + " p50", percentile(latenciesMicros, 0.50), "us");
+    Add(metric + " p90", percentile(latenciesMicros, 0.90), "us");
+    Add(metric + " p99", percentile(latenciesMicros, 0.99), "us");
+    Add(metric + " p99.9", percentile(latenciesMicros, 0.999), "us");
+    Add(metric + " max", latenciesMicros.back(), "us");
+  }
+
+  void Print() const {
+    printf("== %s\n", m_name.c_str());
+    for (const auto& row : m_rows) {
+      printf("  %-40s %14.2f %s\n", row.m_metric.c_str(), row.m_value,
+             row.m_unit.c_str());
+    }
+  }
+
+  /**
+   * Write as one JSON object: {"name": ..., "metrics": [{"metric", "value",
+   * "unit"}, ...]}, rows in the order they were added so runs diff cleanly
+   */
+  void WriteJson(FILE* out) const {
+    fprintf(out, "    {\"name\": %s, \"metrics\": [",
+            JsonString(m_name).c_str());
+    for (size_t i = 0; i < m_rows.size(); i++) {
+      fprintf(out,
+              "%s\n      {\"metric\": %s, \"value\": %.3f, \"unit\": %s}",
+              i == 0 ? "" : ",", JsonString(m_rows[i].m_metric).c_str(),
+              m_rows[i].m_value, JsonString(m_rows[i].m_unit).c_str());
+    }
+    fprintf(out, "%s]}", m_rows.empty() ? "" : "\n    ");
+  }
+
+  static std::string JsonString(const std::string& value) {
+    std::string quoted("\"");
+    for (char c : value) {
+      if (c == '"' || c == '\\') {
+        quoted += '\\';
+        quoted += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        quoted += escaped;
+      } else {
+        quoted += c;
+      }
+    }
+    return quoted + "\"";
+  }
+
+ private:
+  struct row {
+    std::string m_metric;
+    double m_value;
+    std::string m_unit;
+  };
+
+  static double percentile(const std::vector<double>& sorted, double rank) {
+    auto index = static_cast<size_t>(rank * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+  }
+
+  std::string m_name;
+  std::vector<row> m_rows;
+};
+
+typedef std::function<void(const Config&, Report&)> BenchFunction;
+
+struct Benchmark {
+  std::string m_name;
+  BenchFunction m_function;
+};
+
+inline std::vector<Benchmark>& Registry() {
+  static std::vector<Benchmark> benchmarks;
+  return benchmarks;
+}
+
+struct Registrar {
+  Registrar(const std::string& name, const BenchFunction& function) {
+    Registry().push_back({name, function});
+  }
+};
+
+inline double MicrosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/**
+ * Keep the compiler from throwing away a result nothing else reads
+ */
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * Call operation in doubling batches until about seconds have gone by,
+ * returning the mean nanoseconds per call.  Meant for the micro-benchmarks,
+ * where a single call is too short to time on its own.
+ */
+template <typename Operation>
+double NanosPerCall(double seconds, Operation operation) {
+  uint64_t calls = 0;
+  uint64_t batch = 1;
+  auto start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  while (elapsed < seconds * 1e9) {
+    for (uint64_t i = 0; i < batch; i++) operation();
+    calls += batch;
+    if (batch < (1u << 20)) batch *= 2;
+    elapsed = std::chrono::duration<double, std::nano>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  }
+  return elapsed / calls;
+}
+
+}  // namespace HareBench
+
+/**
+ * Define a benchmark, run as "group.name":
+ *
+ *   HARE_BENCH(Connection, contention) { report.Add("ops", 1, ""); }
+ */
+#define HARE_BENCH(group, name)                                             \
+  static void group##_##name##_bench(const HareBench::Config& config,      \
+                                     HareBench::Report& report);           \
+  static HareBench::Registrar group##_##name##_registrar(                   \
+      #group "." #name, group##_##name##_bench);                            \
+  static void group##_##name##_bench(                                       \
+      const HareBench::Config& config __attribute__((unused)),              \
+      HareBench::Report& report)
+
+#endif
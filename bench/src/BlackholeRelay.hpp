@@ -0,0 +1,137 @@
+#ifndef _BLACKHOLE_RELAY_HPP_
+#define _BLACKHOLE_RELAY_HPP_
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace HareBench {
+
+/**
+ * Relays one TCP connection from a local port to the broker.  Blackhole()
+ * stops passing bytes either way while keeping both sockets open, which to the
+ * client looks like a broker that died without closing the connection.
+ */
+class BlackholeRelay {
+ public:
+  BlackholeRelay(const std::string& host, int port)
+      : m_listenFd(-1), m_port(0), m_blackholed(false), m_running(true) {
+    m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if (m_listenFd < 0 ||
+        bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        listen(m_listenFd, 1) != 0 ||
+        getsockname(m_listenFd, reinterpret_cast<sockaddr*>(&address),
+                    &length) != 0) {
+      return;
+    }
+    m_port = ntohs(address.sin_port);
+    m_thread = std::thread(&BlackholeRelay::relay, this, host, port);
+  }
+
+  ~BlackholeRelay() {
+    m_running = false;
+    if (m_thread.joinable()) m_thread.join();
+    if (m_listenFd >= 0) close(m_listenFd);
+  }
+
+  /**
+   * Local port to connect to, 0 if the relay couldn't be set up
+   */
+  int Port() const { return m_port; }
+
+  void Blackhole() { m_blackholed = true; }
+
+ private:
+  static int connectTo(const std::string& host, int port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                    &result) != 0) {
+      return -1;
+    }
+    int fd = -1;
+    for (auto* info = result; info != nullptr; info = info->ai_next) {
+      fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+      if (fd < 0) continue;
+      if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) break;
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+  }
+
+  // Move whatever is readable on from to to, false once either side closes
+  static bool pump(int from, int to) {
+    char buffer[65536];
+    auto count = read(from, buffer, sizeof(buffer));
+    if (count <= 0) return false;
+    for (ssize_t sent = 0; sent < count;) {
+      auto written = write(to, buffer + sent, count - sent);
+      if (written <= 0) return false;
+      sent += written;
+    }
+    return true;
+  }
+
+  void relay(std::string host, int port) {
+    struct pollfd accepting;
+    accepting.fd = m_listenFd;
+    accepting.events = POLLIN;
+    while (m_running && poll(&accepting, 1, 50) <= 0) {
+    }
+    if (false == m_running) return;
+
+    int client = accept(m_listenFd, nullptr, nullptr);
+    int broker = connectTo(host, port);
+
+    while (m_running && client >= 0 && broker >= 0) {
+      if (m_blackholed) {
+        // Hold on to everything, send nothing
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        continue;
+      }
+      struct pollfd fds[2];
+      fds[0].fd = client;
+      fds[0].events = POLLIN;
+      fds[0].revents = 0;
+      fds[1].fd = broker;
+      fds[1].events = POLLIN;
+      fds[1].revents = 0;
+      if (poll(fds, 2, 50) <= 0) continue;
+      const short readable = POLLIN | POLLHUP;
+      if ((fds[0].revents & readable) && false == pump(client, broker)) break;
+      if ((fds[1].revents & readable) && false == pump(broker, client)) break;
+    }
+
+    if (client >= 0) close(client);
+    if (broker >= 0) close(broker);
+  }
+
+  int m_listenFd;
+  int m_port;
+  std::atomic<bool> m_blackholed;
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+};
+
+}  // namespace HareBench
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _CONNECTION_CONTENTION_BENCH_HPP_
+#define _CONNECTION_CONTENTION_BENCH_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "BenchHarness.hpp"
+#include "ConnectionBase.hpp"
+
+/**
+ * K threads share one connection, each on its own channel, doing publishes and
+ * exchange declares (a full round trip to the broker) while a consumer on
+ * another channel sits waiting on an idle queue.  With one lock around the
+ * connection the consumer's wait and every RPC serialize everybody; with per
+ * channel queues the latencies should stay flat as K grows.
+ */
+HARE_BENCH(Connection, channelContention) {
+  const int threadCounts[] = {1, 2, 4, 8};
+
+  for (int threads : threadCounts) {
+    HareCpp::connection::ConnectionBase connection(
+        config.m_server, config.m_port, config.m_username, config.m_password);
+    if (false == HareCpp::noError(connection.Connect())) {
+      report.Add("unable to connect to broker", 0, "");
+      return;
+    }
+
+    // The consumer that used to hold the connection lock while it waited
+    auto consumerId = connection.RegisterClient();
+    auto consumeChannel = connection.AllocateChannel(consumerId);
+    amqp_bytes_t queueName = amqp_empty_bytes;
+    connection.OpenChannel(consumeChannel);
+    connection.DeclareQueue(consumeChannel, HareCpp::helper::queueProperties(),
+                            queueName);
+    connection.StartConsumption(consumeChannel, queueName);
+
+    std::atomic<bool> running(true);
+    std::thread consumer([&]() {
+      while (running) {
+        amqp_envelope_t envelope;
+        if (HareCpp::noError(connection.ConsumeMessage(envelope, consumerId)))
+          amqp_destroy_envelope(&envelope);
+      }
+    });
+
+    std::mutex resultMutex;
+    std::vector<double> publishLatencies;
+    std::vector<double> declareLatencies;
+    std::vector<std::thread> workers;
+    for (int worker = 0; worker < threads; worker++) {
+      workers.push_back(std::thread([&]() {
+        auto clientId = connection.RegisterClient();
+        auto channel = connection.AllocateChannel(clientId);
+        connection.OpenChannel(channel);
+
+        std::vector<double> publishes;
+        std::vector<double> declares;
+        const char body[] = "contention";
+        const auto deadline = std::chrono::steady_clock::now() +
+                              std::chrono::seconds(config.m_seconds);
+        for (int i = 0; std::chrono::steady_clock::now() < deadline; i++) {
+          auto start = std::chrono::steady_clock::now();
+          if (i % 64 == 0) {
+            connection.DeclareExchange(channel, "harecppBenchContention",
+                                       "direct");
+            declares.push_back(HareBench::MicrosSince(start));
+          } else {
+            HareCpp::helper::RawMessage message;
+            message.channel = channel;
+            message.exchange = amqp_cstring_bytes("amq.direct");
+            message.routing_key = amqp_cstring_bytes("harecppBenchNobody");
+            message.properties._flags = 0;
+            message.message.bytes = const_cast<char*>(body);
+            message.message.len = sizeof(body) - 1;
+            connection.PublishMessage(message);
+            publishes.push_back(HareBench::MicrosSince(start));
+          }
+        }
+
+        const std::lock_guard<std::mutex> lock(resultMutex);
+        publishLatencies.insert(publishLatencies.end(), publishes.begin(),
+                                publishes.end());
+        declareLatencies.insert(declareLatencies.end(), declares.begin(),
+                                declares.end());
+      }));
+    }
+    for (auto& worker : workers) worker.join();
+
+    running = false;
+    consumer.join();
+    amqp_bytes_free(queueName);
+
+    auto prefix = std::to_string(threads) + " threads";
+    report.Add(prefix + " publish rate",
+               publishLatencies.size() / static_cast<double>(config.m_seconds),
+               "msg/s");
+    report.AddLatencies(prefix + " publish", publishLatencies);
+    report.AddLatencies(prefix + " declare", declareLatencies);
+  }
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef _END_TO_END_BENCH_HPP_
+#define _END_TO_END_BENCH_HPP_
+
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchHarness.hpp"
+#include "Consumer.hpp"
+#include "Producer.hpp"
+
+namespace HareBench {
+
+/**
+ * A Producer and a Consumer on their own connections, the consumer subscribed
+ * to amq.direct with routingKey.  Ready() is false when either couldn't reach
+ * the broker or nothing made it through within five seconds.
+ */
+class endToEnd {
+ public:
+  endToEnd(const Config& config, const std::string& routingKey)
+      : m_routingKey(routingKey), m_received(0), m_receivedBytes(0),
+        m_ready(false) {
+    bool started =
+        HareCpp::noError(m_consumer.Initialize(config.m_server, config.m_port,
+                                               config.m_username,
+                                               config.m_password)) &&
+        HareCpp::noError(m_consumer.Subscribe(
+            "amq.direct", routingKey,
+            [this](const HareCpp::Message& message) { received(message); })) &&
+        HareCpp::noError(m_consumer.Start()) &&
+        HareCpp::noError(m_producer.Initialize(config.m_server, config.m_port,
+                                               config.m_username,
+                                               config.m_password)) &&
+        HareCpp::noError(m_producer.Start());
+    if (false == started) return;
+
+    // The subscription is set up by the consumer thread, keep knocking until
+    // the first message gets through
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (0 == m_received && std::chrono::steady_clock::now() < deadline) {
+      Send(std::string("warmup"));
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    m_ready = m_received > 0;
+    // Let the stragglers arrive before anybody starts counting
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    m_received = 0;
+    m_receivedBytes = 0;
+  }
+
+  ~endToEnd() {
+    m_producer.Stop();
+    m_consumer.Stop();
+  }
+
+  bool Ready() const { return m_ready; }
+
+  void Send(const std::string& payload) {
+    HareCpp::Message message(payload);
+    m_producer.Send("amq.direct", m_routingKey, message);
+  }
+
+  HareCpp::Producer& Producer() { return m_producer; }
+
+  uint64_t Received() const { return m_received; }
+  uint64_t ReceivedBytes() const { return m_receivedBytes; }
+
+  /**
+   * Set to be called with every payload received, before it is counted
+   */
+  void OnReceive(const std::function<void(const HareCpp::Message&)>& hook) {
+    const std::lock_guard<std::mutex> lock(m_hookMutex);
+    m_hook = hook;
+  }
+
+ private:
+  void received(const HareCpp::Message& message) {
+    {
+      const std::lock_guard<std::mutex> lock(m_hookMutex);
+      if (m_hook) m_hook(message);
+    }
+    m_receivedBytes += message.Length();
+    m_received++;
+  }
+
+  std::string m_routingKey;
+  HareCpp::Producer m_producer;
+  HareCpp::Consumer m_consumer;
+  std::atomic<uint64_t> m_received;
+  std::atomic<uint64_t> m_receivedBytes;
+  bool m_ready;
+  std::mutex m_hookMutex;
+  std::function<void(const HareCpp::Message&)> m_hook;
+};
+
+inline uint64_t steadyNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace HareBench
+
+/**
+ * Producer to Consumer as fast as the producer's queue drains, keeping at
+ * most 10000 messages queued, for 16 B, 40 B (a typical tick), 1 KiB and
+ * 16 KiB payloads
+ */
+HARE_BENCH(EndToEnd, throughput) {
+  const size_t sizes[] = {16, 40, 1024, 16384};
+  for (size_t size : sizes) {
+    HareBench::endToEnd pair(config, "harecppBenchThroughput");
+    if (false == pair.Ready()) {
+      report.Add("unable to connect to broker", 0, "");
+      return;
+    }
+
+    const std::string payload(size, 'x');
+    const std::string label = std::to_string(size) + "B ";
+    uint64_t sent = 0;
+    auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + std::chrono::seconds(config.m_seconds);
+    while (std::chrono::steady_clock::now() < deadline) {
+      if (pair.Producer().QueueSize() >= 10000) {
+        std::this_thread::yield();
+        continue;
+      }
+      pair.Send(payload);
+      sent++;
+    }
+    const double seconds = HareBench::MicrosSince(start) / 1e6;
+    const uint64_t receivedInTime = pair.Received();
+
+    // Whatever is still in flight, so losses can be told from slowness
+    const auto drained = std::chrono::steady_clock::now() +
+                         std::chrono::seconds(2);
+    while (pair.Received() < sent &&
+           std::chrono::steady_clock::now() < drained) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    report.Add(label + "sent", sent / seconds, "msg/s");
+    report.Add(label + "received", receivedInTime / seconds, "msg/s");
+    report.Add(label + "received",
+               pair.ReceivedBytes() / seconds / (1024 * 1024), "MiB/s");
+    report.Add(label + "lost", sent - std::min(sent, pair.Received()), "msg");
+  }
+}
+
+/**
+ * One message in flight at a time from Producer::Send to the Consumer's
+ * callback, the payload carrying its send time
+ */
+HARE_BENCH(EndToEnd, latency) {
+  HareBench::endToEnd pair(config, "harecppBenchLatency");
+  if (false == pair.Ready()) {
+    report.Add("unable to connect to broker", 0, "");
+    return;
+  }
+
+  std::mutex mutex;
+  std::condition_variable arrived;
+  std::vector<double> latencies;
+  pair.OnReceive([&](const HareCpp::Message& message) {
+    auto now = HareBench::steadyNanos();
+    auto payload = message.String();
+    char* end = nullptr;
+    auto sentAt = strtoull(payload.c_str(), &end, 10);
+    // A late warm-up message
+    if (end == payload.c_str()) return;
+    const std::lock_guard<std::mutex> lock(mutex);
+    latencies.push_back((now - sentAt) / 1000.0);
+    arrived.notify_one();
+  });
+
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(config.m_seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    std::unique_lock<std::mutex> lock(mutex);
+    const size_t before = latencies.size();
+    lock.unlock();
+    pair.Send(std::to_string(HareBench::steadyNanos()));
+    lock.lock();
+    if (false == arrived.wait_for(lock, std::chrono::seconds(1), [&]() {
+          return latencies.size() > before;
+        })) {
+      break;
+    }
+  }
+  pair.OnReceive(nullptr);
+
+  const std::lock_guard<std::mutex> lock(mutex);
+  report.AddLatencies("Send to callback", latencies);
+}
+
+#endif
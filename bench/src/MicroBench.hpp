@@ -0,0 +1,648 @@
+#ifndef _MICRO_BENCH_HPP_
+#define _MICRO_BENCH_HPP_
+
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "AllocationCount.hpp"
+#include "BenchHarness.hpp"
+#include "ChannelHandler.hpp"
+#include "Codec.hpp"
+#include "EventLog.hpp"
+#include "HashableBindingPair.hpp"
+#include "HeadersTable.hpp"
+#include "LatencyHistogram.hpp"
+#include "Message.hpp"
+#include "Producer.hpp"
+#include "Streaming.hpp"
+
+/**
+ * The per-message hot paths on their own, no broker involved except for
+ * Producer::Send which needs a connected Producer.  Each one runs for a fifth
+ * of --seconds and reports nanoseconds per call.
+ */
+namespace HareBench {
+
+inline double microSeconds(const Config& config) {
+  return config.m_seconds / 5.0;
+}
+
+// Properties with every string field a consumed message usually carries
+inline amqp_basic_properties_t typicalProperties() {
+  amqp_basic_properties_t properties;
+  properties._flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
+                      AMQP_BASIC_CORRELATION_ID_FLAG |
+                      AMQP_BASIC_REPLY_TO_FLAG | AMQP_BASIC_MESSAGE_ID_FLAG |
+                      AMQP_BASIC_TYPE_FLAG | AMQP_BASIC_TIMESTAMP_FLAG;
+  properties.content_type = amqp_cstring_bytes("application/json");
+  properties.correlation_id =
+      amqp_cstring_bytes("3f2b9c1e-5d4a-4e8b-9a7c-1b2d3e4f5a6b");
+  properties.reply_to = amqp_cstring_bytes("amq.gen-replyQueue");
+  properties.message_id = amqp_cstring_bytes("message-000001");
+  properties.type = amqp_cstring_bytes("order.created");
+  properties.timestamp = 1600000000;
+  return properties;
+}
+
+// Ten headers of the sort routing and tracing put on a message
+inline HareCpp::HeadersTable typicalHeaders() {
+  return HareCpp::HeadersBuilder()
+      .AddString("x-trace-id", "4bf92f3577b34da6a3ce929d0e0e4736")
+      .AddString("x-span-id", "00f067aa0ba902b7")
+      .AddString("x-tenant", "acme-eu")
+      .AddString("x-region", "eu-west-1")
+      .AddString("x-source", "order-service")
+      .AddInt("x-attempt", 1)
+      .AddInt("x-sequence", 123456789)
+      .AddBool("x-replay", false)
+      .AddDouble("x-priority-weight", 0.75)
+      .AddTimestamp("x-created", 1600000000)
+      .Build();
+}
+
+// A 40 byte market data tick, the sort of thing sent with a schema
+struct benchTick {
+  uint64_t m_time;
+  double m_price;
+  double m_size;
+  int32_t m_venue;
+  uint32_t m_flags;
+  char m_symbol[8];
+};
+
+inline void freeDuplicatedProperties(amqp_basic_properties_t& properties) {
+  amqp_bytes_free(properties.content_type);
+  amqp_bytes_free(properties.correlation_id);
+  amqp_bytes_free(properties.reply_to);
+  amqp_bytes_free(properties.message_id);
+  amqp_bytes_free(properties.type);
+}
+
+}  // namespace HareBench
+
+HARE_SCHEMA(HareBench::benchTick, "application/x-harecpp-bench-tick",
+            HARE_FIELD(HareBench::benchTick, m_time),
+            HARE_FIELD(HareBench::benchTick, m_price),
+            HARE_FIELD(HareBench::benchTick, m_size),
+            HARE_FIELD(HareBench::benchTick, m_venue),
+            HARE_FIELD(HareBench::benchTick, m_flags),
+            HARE_FIELD(HareBench::benchTick, m_symbol))
+
+/**
+ * Construction, copy and move either side of MESSAGE_INLINE_BYTES, and from a
+ * received envelope as the Consumer does it, with the allocations each makes
+ */
+HARE_BENCH(Micro, message) {
+  const size_t sizes[] = {16, 40, MESSAGE_INLINE_BYTES,
+                          MESSAGE_INLINE_BYTES + 1, 1024, 65536};
+  for (size_t length : sizes) {
+    const std::string payload(length, 'x');
+    const std::string size = std::to_string(length) + "B";
+    auto construct = [&]() {
+      HareCpp::Message message(payload);
+      HareBench::DoNotOptimize(message);
+    };
+    report.Add("construct " + size,
+               HareBench::NanosPerCall(HareBench::microSeconds(config),
+                                       construct),
+               "ns/op");
+
+    HareCpp::Message original(payload);
+    auto copy = [&]() {
+      HareCpp::Message copy(original);
+      HareBench::DoNotOptimize(copy);
+    };
+    report.Add("copy " + size,
+               HareBench::NanosPerCall(HareBench::microSeconds(config), copy),
+               "ns/op");
+
+    // There and back again, so original still has its payload afterwards
+    auto move = [&]() {
+      HareCpp::Message moved(std::move(original));
+      original = std::move(moved);
+    };
+    report.Add("move and back " + size,
+               HareBench::NanosPerCall(HareBench::microSeconds(config), move),
+               "ns/op");
+
+    amqp_envelope_t envelope;
+    memset(&envelope, 0, sizeof(envelope));
+    envelope.message.body.bytes = const_cast<char*>(payload.data());
+    envelope.message.body.len = payload.size();
+    auto received = [&]() {
+      HareCpp::Message message(envelope);
+      HareBench::DoNotOptimize(message);
+    };
+    report.Add("from envelope " + size,
+               HareBench::NanosPerCall(HareBench::microSeconds(config),
+                                       received),
+               "ns/op");
+
+    if (HareBench::AllocationsCounted()) {
+      report.Add("construct " + size,
+                 HareBench::AllocationsPerCall(1000, construct), "allocs/op");
+      report.Add("copy " + size, HareBench::AllocationsPerCall(1000, copy),
+                 "allocs/op");
+      report.Add("move and back " + size,
+                 HareBench::AllocationsPerCall(1000, move), "allocs/op");
+      report.Add("from envelope " + size,
+                 HareBench::AllocationsPerCall(1000, received), "allocs/op");
+    }
+  }
+}
+
+HARE_BENCH(Micro, propertiesMallocDup) {
+  const auto properties = HareBench::typicalProperties();
+  report.Add("hare_basic_properties_malloc_dup",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               amqp_basic_properties_t copy;
+               HareCpp::hare_basic_properties_malloc_dup(properties, copy);
+               HareBench::DoNotOptimize(copy);
+               HareBench::freeDuplicatedProperties(copy);
+             }),
+             "ns/op");
+}
+
+HARE_BENCH(Micro, producerSend) {
+  HareCpp::Producer producer;
+  if (false == HareCpp::noError(producer.Initialize(
+                   config.m_server, config.m_port, config.m_username,
+                   config.m_password)) ||
+      false == HareCpp::noError(producer.Start())) {
+    report.Add("unable to connect to broker", 0, "");
+    return;
+  }
+
+  // Only the Send() calls are timed; the queue is let drain in between so
+  // it stays short, as it would in a producer that keeps up
+  const int batch = 1000;
+  HareCpp::Message message(std::string(128, 'x'));
+  double sendNanos = 0;
+  uint64_t sends = 0;
+  const auto deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration<double>(HareBench::microSeconds(config));
+  while (std::chrono::steady_clock::now() < deadline) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < batch; i++) {
+      producer.Send("amq.direct", "harecppBenchSend", message);
+    }
+    sendNanos += HareBench::MicrosSince(start) * 1000;
+    sends += batch;
+    while (producer.QueueSize() > batch &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  if (producer.QueueSize() > batch) {
+    report.Add("queue not draining, broker unreachable?", 0, "");
+    return;
+  }
+  report.Add("Send enqueue 128B", sends ? sendNanos / sends : 0, "ns/op");
+}
+
+/**
+ * One 1 MiB snapshot published 12 times (to amq.direct under 12 routing
+ * keys, the exchange makes no difference here), from one Message whose
+ * payload is shared and from a Message per publish, each copying it.  Only
+ * the Send() calls are timed and counted.
+ */
+HARE_BENCH(Micro, fanOut) {
+  HareCpp::Producer producer;
+  if (false == HareCpp::noError(producer.Initialize(
+                   config.m_server, config.m_port, config.m_username,
+                   config.m_password)) ||
+      false == HareCpp::noError(producer.Start())) {
+    report.Add("unable to connect to broker", 0, "");
+    return;
+  }
+
+  const int publishes = 12;
+  const std::string snapshot(1024 * 1024, 'x');
+  const bool modes[] = {true, false};
+  for (bool shared : modes) {
+    double sendNanos = 0;
+    uint64_t allocations = 0;
+    uint64_t rounds = 0;
+    const auto deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::duration<double>(HareBench::microSeconds(config) / 2);
+    while (std::chrono::steady_clock::now() < deadline) {
+      HareCpp::Message message(snapshot);
+      auto start = std::chrono::steady_clock::now();
+      const uint64_t before = HareBench::Allocations();
+      for (int i = 0; i < publishes; i++) {
+        if (shared) {
+          producer.Send("amq.direct", "harecppBenchFanOut" + std::to_string(i),
+                        message);
+        } else {
+          HareCpp::Message copy(snapshot);
+          producer.Send("amq.direct", "harecppBenchFanOut" + std::to_string(i),
+                        copy);
+        }
+      }
+      sendNanos += HareBench::MicrosSince(start) * 1000;
+      allocations += HareBench::Allocations() - before;
+      rounds++;
+      while (producer.QueueSize() > 0 &&
+             std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    }
+    if (producer.QueueSize() > 0) {
+      report.Add("queue not draining, broker unreachable?", 0, "");
+      return;
+    }
+    const std::string label =
+        shared ? "1MiB x12, one Message" : "1MiB x12, Message each";
+    report.Add(label, rounds ? sendNanos / rounds / 1000 : 0, "us/op");
+    if (HareBench::AllocationsCounted()) {
+      report.Add(label, rounds ? allocations / static_cast<double>(rounds) : 0,
+                 "allocs/op");
+    }
+  }
+}
+
+/**
+ * A message made of a 32 byte header struct, 256 bytes of metadata and a
+ * 64 KiB data block, joined into one buffer and set as the payload as
+ * callers had to, and sent as three fragments: the header and metadata
+ * borrowed, the block retained.  Building the Message and Send() are timed,
+ * publishing isn't.
+ */
+HARE_BENCH(Micro, scatter) {
+  HareCpp::Producer producer;
+  if (false == HareCpp::noError(producer.Initialize(
+                   config.m_server, config.m_port, config.m_username,
+                   config.m_password)) ||
+      false == HareCpp::noError(producer.Start())) {
+    report.Add("unable to connect to broker", 0, "");
+    return;
+  }
+
+  const std::string header(32, 'h');
+  const std::string metadata(256, 'm');
+  const HareCpp::SharedPayload block(std::string(64 * 1024, 'd'));
+  const bool modes[] = {false, true};
+  for (bool fragments : modes) {
+    double sendNanos = 0;
+    uint64_t allocations = 0;
+    uint64_t sends = 0;
+    const auto deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::duration<double>(HareBench::microSeconds(config) / 2);
+    while (std::chrono::steady_clock::now() < deadline) {
+      auto start = std::chrono::steady_clock::now();
+      const uint64_t before = HareBench::Allocations();
+      HareCpp::Message message;
+      if (fragments) {
+        message.AddFragment(header.data(), header.size());
+        message.AddFragment(metadata.data(), metadata.size());
+        message.AddFragment(block);
+      } else {
+        std::string joined;
+        joined.reserve(header.size() + metadata.size() + block.Length());
+        joined.append(header);
+        joined.append(metadata);
+        joined.append(block.Data(), block.Length());
+        message.SetPayload(&joined[0], joined.size());
+      }
+      producer.Send("amq.direct", "harecppBenchScatter", message);
+      sendNanos += HareBench::MicrosSince(start) * 1000;
+      allocations += HareBench::Allocations() - before;
+      sends++;
+      // The borrowed pieces have to outlive the publish
+      while (producer.QueueSize() > 0 &&
+             std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+      }
+    }
+    if (producer.QueueSize() > 0) {
+      report.Add("queue not draining, broker unreachable?", 0, "");
+      return;
+    }
+    const std::string label = fragments ? "3 fragments" : "joined";
+    report.Add(label, sends ? sendNanos / sends : 0, "ns/op");
+    if (HareBench::AllocationsCounted()) {
+      report.Add(label, sends ? allocations / static_cast<double>(sends) : 0,
+                 "allocs/op");
+    }
+  }
+}
+
+/**
+ * A ten entry headers table built, copied, encoded the way a publish does,
+ * decoded the way a delivery does, and looked up in
+ */
+HARE_BENCH(Micro, headers) {
+  auto build = [&]() { HareBench::DoNotOptimize(HareBench::typicalHeaders()); };
+  report.Add("build 10",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), build),
+             "ns/op");
+
+  const auto headers = HareBench::typicalHeaders();
+  auto copy = [&]() {
+    HareCpp::HeadersTable copied(headers);
+    HareBench::DoNotOptimize(copied);
+  };
+  report.Add("copy 10",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), copy),
+             "ns/op");
+  if (HareBench::AllocationsCounted()) {
+    report.Add("build 10", HareBench::AllocationsPerCall(1000, build),
+               "allocs/op");
+    report.Add("copy 10", HareBench::AllocationsPerCall(1000, copy),
+               "allocs/op");
+  }
+
+  char buffer[4096];
+  amqp_bytes_t encoded{sizeof(buffer), buffer};
+  size_t encodedLength = 0;
+  report.Add("encode 10",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               encodedLength = 0;
+               amqp_encode_table(
+                   encoded, const_cast<amqp_table_t*>(&headers.Table()),
+                   &encodedLength);
+             }),
+             "ns/op");
+  encoded.len = encodedLength;
+
+  amqp_pool_t pool;
+  init_amqp_pool(&pool, 4096);
+  report.Add("decode 10",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               amqp_table_t decoded;
+               size_t offset = 0;
+               amqp_decode_table(encoded, &pool, &decoded, &offset);
+               HareBench::DoNotOptimize(decoded);
+               recycle_amqp_pool(&pool);
+             }),
+             "ns/op");
+  empty_amqp_pool(&pool);
+
+  HareCpp::Message message(std::string(40, 'x'));
+  message.SetHeaders(HareCpp::HeadersTable(headers));
+  const std::string last("x-created");
+  report.Add("Message::Header, last of 10",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               HareBench::DoNotOptimize(message.Header(last));
+             }),
+             "ns/op");
+  auto copyMessage = [&]() {
+    HareCpp::Message copied(message);
+    HareBench::DoNotOptimize(copied);
+  };
+  report.Add("copy Message with 10",
+             HareBench::NanosPerCall(HareBench::microSeconds(config),
+                                     copyMessage),
+             "ns/op");
+  if (HareBench::AllocationsCounted()) {
+    report.Add("copy Message with 10",
+               HareBench::AllocationsPerCall(1000, copyMessage), "allocs/op");
+  }
+}
+
+/**
+ * A tick written into a reused Message and read back out, with its schema and
+ * with the memcpy code it replaces.  Decoding with the schema also checks the
+ * content type, the hand written code only the length.
+ */
+HARE_BENCH(Micro, codec) {
+  HareBench::benchTick tick{1600000000123456789ull, 101.25, 300, 7, 0,
+                            {'H', 'A', 'R', 'E'}};
+  HareCpp::Message message;
+  auto encode = [&]() {
+    tick.m_time++;
+    HareCpp::hare_encode(tick, message);
+    HareBench::DoNotOptimize(message);
+  };
+  auto encodeByHand = [&]() {
+    tick.m_time++;
+    char buffer[40];
+    memcpy(buffer, &tick.m_time, 8);
+    memcpy(buffer + 8, &tick.m_price, 8);
+    memcpy(buffer + 16, &tick.m_size, 8);
+    memcpy(buffer + 24, &tick.m_venue, 4);
+    memcpy(buffer + 28, &tick.m_flags, 4);
+    memcpy(buffer + 32, tick.m_symbol, 8);
+    message.SetPayload(buffer, sizeof(buffer));
+    HareBench::DoNotOptimize(message);
+  };
+  report.Add("encode 40B schema",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), encode),
+             "ns/op");
+  report.Add("encode 40B memcpy",
+             HareBench::NanosPerCall(HareBench::microSeconds(config),
+                                     encodeByHand),
+             "ns/op");
+
+  HareCpp::hare_encode(tick, message);
+  HareBench::benchTick decoded;
+  auto decode = [&]() {
+    HareCpp::hare_decode(message, decoded);
+    HareBench::DoNotOptimize(decoded);
+  };
+  auto decodeByHand = [&]() {
+    if (message.Length() == 40) {
+      const char* payload = message.Payload();
+      memcpy(&decoded.m_time, payload, 8);
+      memcpy(&decoded.m_price, payload + 8, 8);
+      memcpy(&decoded.m_size, payload + 16, 8);
+      memcpy(&decoded.m_venue, payload + 24, 4);
+      memcpy(&decoded.m_flags, payload + 28, 4);
+      memcpy(decoded.m_symbol, payload + 32, 8);
+    }
+    HareBench::DoNotOptimize(decoded);
+  };
+  report.Add("decode 40B schema",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), decode),
+             "ns/op");
+  report.Add("decode 40B memcpy",
+             HareBench::NanosPerCall(HareBench::microSeconds(config),
+                                     decodeByHand),
+             "ns/op");
+  if (HareBench::AllocationsCounted()) {
+    report.Add("encode 40B schema", HareBench::AllocationsPerCall(1000, encode),
+               "allocs/op");
+    report.Add("decode 40B schema", HareBench::AllocationsPerCall(1000, decode),
+               "allocs/op");
+  }
+}
+
+/**
+ * A 64 MiB stream cut into 1 MiB chunk messages and put back together in a
+ * memory-mapped file, without a broker in between.  Only a chunk at a time
+ * is ever in memory.
+ */
+HARE_BENCH(Micro, stream) {
+  const std::string directory = "/tmp";
+  const std::string streamId =
+      "harecpp_bench_stream_" + std::to_string(getpid());
+  const uint64_t length = 64 * 1024 * 1024;
+  const std::string source(STREAM_CHUNK_BYTES, 's');
+  auto read = [&source](uint64_t, char* bytes, size_t count) {
+    memcpy(bytes, source.data(), count);
+    return true;
+  };
+
+  HareCpp::Producer producer;
+  HareCpp::StreamSender sender(producer);
+  const uint64_t chunks =
+      HareCpp::StreamSender::ChunkCount(length, sender.ChunkBytes());
+  double nanos = 0;
+  uint64_t streams = 0;
+  const auto deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::duration<double>(HareBench::microSeconds(config));
+  do {
+    bool finished = false;
+    HareCpp::StreamReceiver receiver(
+        directory, [&finished](const std::string&) { finished = true; });
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+      HareCpp::Message message;
+      sender.BuildChunk(streamId, length, chunk, read, message);
+      receiver.Receive(message);
+    }
+    nanos += HareBench::MicrosSince(start) * 1000;
+    streams++;
+    unlink((directory + "/" + streamId).c_str());
+    if (false == finished) {
+      report.Add("stream not put back together", 0, "");
+      return;
+    }
+  } while (std::chrono::steady_clock::now() < deadline);
+  report.Add("64MiB in 1MiB chunks", length * streams / (nanos / 1e9) / 1e6,
+             "MB/s");
+}
+
+HARE_BENCH(Micro, channelHandlerProcess) {
+  const int subscriptions[] = {1, 64};
+  for (int count : subscriptions) {
+    HareCpp::ChannelHandler handler;
+    uint64_t delivered = 0;
+    HareCpp::TD_Callback callback = [&delivered](const HareCpp::Message&) {
+      delivered++;
+    };
+    std::vector<HareCpp::HashableBindingPair> pairs;
+    for (int i = 0; i < count; i++) {
+      pairs.push_back({"harecppBench", "orders.region" + std::to_string(i)});
+      handler.AddChannelProcessor(pairs.back(), callback);
+    }
+
+    HareCpp::Message message(std::string(128, 'x'));
+    const auto& target = pairs.back();
+    report.Add("Process, " + std::to_string(count) + " subscriptions",
+               HareBench::NanosPerCall(
+                   HareBench::microSeconds(config),
+                   [&]() { handler.Process(target, message); }),
+               "ns/op");
+    HareBench::DoNotOptimize(delivered);
+  }
+}
+
+HARE_BENCH(Micro, bindingPairHash) {
+  HareCpp::HashableBindingPair pair{"harecppBench.exchange",
+                                    "orders.eu-west.created"};
+  std::hash<HareCpp::HashableBindingPair> hasher;
+  report.Add("hash",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               HareBench::DoNotOptimize(hasher(pair));
+             }),
+             "ns/op");
+
+  std::unordered_map<HareCpp::HashableBindingPair, int> lookup;
+  for (int i = 0; i < 64; i++) {
+    lookup[{"harecppBench.exchange", "orders.region" + std::to_string(i)}] = i;
+  }
+  HareCpp::HashableBindingPair present{"harecppBench.exchange",
+                                       "orders.region63"};
+  report.Add("lookup in 64",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               HareBench::DoNotOptimize(lookup.find(present));
+             }),
+             "ns/op");
+}
+
+HARE_BENCH(Micro, latencyHistogram) {
+  HareCpp::LatencyHistogram histogram;
+  uint64_t value = 1;
+  report.Add("Record",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               histogram.Record(value);
+               value = value * 3 + 1;
+             }),
+             "ns/op");
+  report.Add("RecordSince",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               histogram.RecordSince(HareCpp::LatencyHistogram::Now());
+             }),
+             "ns/op");
+  HareBench::DoNotOptimize(histogram.Snapshot().m_count);
+}
+
+HARE_BENCH(Micro, eventLog) {
+  auto& eventLog = HareCpp::EventLog::Instance();
+  report.Add("Record, closed",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               eventLog.Record(HareCpp::EVENT_E::DELIVERED, 1, 1, 128);
+             }),
+             "ns/op");
+
+  const std::string path =
+      "/tmp/harecpp_bench_eventlog_" + std::to_string(getpid());
+  if (false == HareCpp::noError(eventLog.Open(path))) {
+    report.Add("unable to open " + path, 0, "");
+    return;
+  }
+  report.Add("Record",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               eventLog.Record(HareCpp::EVENT_E::DELIVERED, 1, 1, 128);
+             }),
+             "ns/op");
+  eventLog.Close();
+  unlink(path.c_str());
+}
+
+HARE_BENCH(Micro, log) {
+  const std::string exchange("harecppBench.exchange");
+  report.Add("disabled LOGF",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               LOGF(HareCpp::LOG_DETAILED, "Processing message from %s",
+                    exchange.c_str());
+             }),
+             "ns/op");
+
+  // Enabled, into a sink that does nothing so only the logger is timed.
+  // Flushing every half ring keeps anything from being dropped, and counts
+  // the writing out as well.
+  HareCpp::FLUSH_LOG();
+  HareCpp::CLEAR_LOG_SINKS();
+  HareCpp::ADD_LOG_SINK([](const HareCpp::logRecord&) {});
+  HareCpp::SET_DEBUG_LEVEL(HareCpp::LOG_DETAILED);
+  const auto dropped = HareCpp::LOG_DROPPED();
+  int logged = 0;
+  report.Add("enabled LOGF, written out",
+             HareBench::NanosPerCall(HareBench::microSeconds(config), [&]() {
+               LOGF(HareCpp::LOG_DETAILED, "Processing message from %s",
+                    exchange.c_str());
+               if (++logged % (HareCpp::LOG_RING_RECORDS / 2) == 0) {
+                 HareCpp::FLUSH_LOG();
+               }
+             }),
+             "ns/op");
+  report.Add("enabled LOGF dropped", HareCpp::LOG_DROPPED() - dropped,
+             "records");
+  HareCpp::SET_DEBUG_LEVEL(HareCpp::LOG_NONE);
+  HareCpp::FLUSH_LOG();
+  HareCpp::CLEAR_LOG_SINKS();
+  HareCpp::ADD_LOG_SINK(HareCpp::CONSOLE_LOG_SINK);
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef _RECOVERY_BENCH_HPP_
+#define _RECOVERY_BENCH_HPP_
+
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchHarness.hpp"
+#include "Consumer.hpp"
+#include "FaultProxy.hpp"
+#include "LatencyHistogram.hpp"
+#include "Producer.hpp"
+
+namespace HareBench {
+
+// Messages a second published through every fault
+constexpr int RECOVERY_RATE = 2000;
+// Deliveries are counted in slots this long, to see the dip
+constexpr int RECOVERY_SLOT_MILLISECONDS = 10;
+
+/**
+ * A Producer and a Consumer on their own connections, one of them going
+ * through a FaultProxy, with numbered messages published at RECOVERY_RATE
+ * from a thread of its own.  Keeps track of what arrived when, and of
+ * anything arriving twice.
+ */
+class recoveryRun {
+ public:
+  recoveryRun(const Config& config, bool faultProducer)
+      : m_proxy(config.m_server, config.m_port),
+        m_routingKey("harecppBenchRecovery"),
+        m_sending(false),
+        m_sent(0),
+        m_received(0),
+        m_duplicates(0),
+        m_start(0),
+        m_firstAfterNanos(0),
+        m_firstAfterArrival(0),
+        m_ready(false) {
+    const int producerPort = faultProducer ? m_proxy.Port() : config.m_port;
+    const int consumerPort = faultProducer ? config.m_port : m_proxy.Port();
+    const std::string producerHost =
+        faultProducer ? "127.0.0.1" : config.m_server;
+    const std::string consumerHost =
+        faultProducer ? config.m_server : "127.0.0.1";
+    bool started =
+        0 != m_proxy.Port() &&
+        HareCpp::noError(m_consumer.Initialize(consumerHost, consumerPort,
+                                               config.m_username,
+                                               config.m_password)) &&
+        HareCpp::noError(m_consumer.Subscribe(
+            "amq.direct", m_routingKey,
+            [this](const HareCpp::Message& message) { received(message); })) &&
+        HareCpp::noError(m_consumer.Start()) &&
+        HareCpp::noError(m_producer.Initialize(producerHost, producerPort,
+                                               config.m_username,
+                                               config.m_password)) &&
+        HareCpp::noError(m_producer.Start());
+    if (false == started) return;
+
+    // Sequence 0 is the warm-up, not counted
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (0 == m_received && std::chrono::steady_clock::now() < deadline) {
+      send(0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    m_ready = m_received > 0;
+    // Let the stragglers arrive before anybody starts counting
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  ~recoveryRun() {
+    StopSending();
+    m_producer.Stop();
+    m_consumer.Stop();
+  }
+
+  bool Ready() const { return m_ready; }
+
+  HareTest::FaultProxy& Proxy() { return m_proxy; }
+
+  void StartSending() {
+    {
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      m_start = HareCpp::LatencyHistogram::Now();
+      m_seen.clear();
+      m_slots.clear();
+      m_received = 0;
+      m_duplicates = 0;
+    }
+    m_sending = true;
+    m_sender = std::thread([this]() {
+      const uint64_t start = HareCpp::LatencyHistogram::Now();
+      for (uint64_t sequence = 1; m_sending; sequence++) {
+        const uint64_t due = start + (sequence - 1) * 1000000000ull /
+                                         RECOVERY_RATE;
+        while (m_sending && HareCpp::LatencyHistogram::Now() < due) {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        send(sequence);
+        m_sent = sequence;
+      }
+    });
+  }
+
+  void StopSending() {
+    m_sending = false;
+    if (m_sender.joinable()) m_sender.join();
+  }
+
+  /**
+   * Count from here how long it takes a message published after this point
+   * to arrive
+   */
+  void MarkHealed() {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_firstAfterNanos = HareCpp::LatencyHistogram::Now();
+    m_firstAfterArrival = 0;
+  }
+
+  /**
+   * Nanoseconds from MarkHealed() to the first message published after it
+   * arriving, 0 while none has
+   */
+  uint64_t RecoveryNanos() const {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_firstAfterArrival ? m_firstAfterArrival - m_firstAfterNanos : 0;
+  }
+
+  uint64_t Sent() const { return m_sent; }
+  uint64_t Received() const { return m_received; }
+  uint64_t Duplicates() const { return m_duplicates; }
+
+  /**
+   * Messages delivered per second between two points, as nanoseconds since
+   * StartSending()
+   */
+  double RateBetween(uint64_t fromNanos, uint64_t toNanos) const {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t slotNanos = RECOVERY_SLOT_MILLISECONDS * 1000000ull;
+    uint64_t count = 0;
+    for (size_t slot = fromNanos / slotNanos;
+         slot < toNanos / slotNanos && slot < m_slots.size(); slot++) {
+      count += m_slots[slot];
+    }
+    return toNanos > fromNanos ? count * 1e9 / (toNanos - fromNanos) : 0;
+  }
+
+  /**
+   * Longest stretch of slots with nothing delivered, in milliseconds
+   */
+  double LongestGapMillis() const {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    size_t longest = 0, current = 0;
+    for (auto count : m_slots) {
+      current = count ? 0 : current + 1;
+      longest = std::max(longest, current);
+    }
+    return longest * RECOVERY_SLOT_MILLISECONDS;
+  }
+
+  uint64_t SinceStart() const {
+    return HareCpp::LatencyHistogram::Now() - m_start;
+  }
+
+ private:
+  struct payload {
+    uint64_t m_sequence;
+    uint64_t m_sentNanos;
+  };
+
+  void send(uint64_t sequence) {
+    payload body{sequence, HareCpp::LatencyHistogram::Now()};
+    HareCpp::Message message(
+        std::string(reinterpret_cast<const char*>(&body), sizeof(body)));
+    m_producer.Send("amq.direct", m_routingKey, message);
+  }
+
+  void received(const HareCpp::Message& message) {
+    payload body;
+    if (message.Length() != sizeof(body)) return;
+    memcpy(&body, message.Payload(), sizeof(body));
+    const uint64_t now = HareCpp::LatencyHistogram::Now();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_received++;
+    if (0 == body.m_sequence || 0 == m_start) return;
+
+    if (body.m_sequence >= m_seen.size()) m_seen.resize(body.m_sequence * 2);
+    if (m_seen[body.m_sequence]) {
+      m_duplicates++;
+    } else {
+      m_seen[body.m_sequence] = true;
+    }
+    const size_t slot =
+        (now - m_start) / (RECOVERY_SLOT_MILLISECONDS * 1000000ull);
+    if (slot >= m_slots.size()) m_slots.resize(slot + 1, 0);
+    m_slots[slot]++;
+    if (m_firstAfterNanos != 0 && 0 == m_firstAfterArrival &&
+        body.m_sentNanos >= m_firstAfterNanos) {
+      m_firstAfterArrival = now;
+    }
+  }
+
+  HareTest::FaultProxy m_proxy;
+  HareCpp::Producer m_producer;
+  HareCpp::Consumer m_consumer;
+  std::string m_routingKey;
+
+  std::atomic<bool> m_sending;
+  std::thread m_sender;
+  std::atomic<uint64_t> m_sent;
+  std::atomic<uint64_t> m_received;
+
+  // Guards everything below
+  mutable std::mutex m_mutex;
+  std::vector<bool> m_seen;
+  std::vector<uint64_t> m_slots;
+  uint64_t m_duplicates;
+  uint64_t m_start;
+  uint64_t m_firstAfterNanos;
+  uint64_t m_firstAfterArrival;
+  bool m_ready;
+};
+
+/**
+ * One second steady, a one second fault, then two seconds to recover,
+ * with fresh connections for every kind of fault
+ */
+inline void measureRecovery(const Config& config, Report& report,
+                            bool faultProducer) {
+  const std::string faults[] = {"drop", "reset", "black hole"};
+  for (const auto& fault : faults) {
+    recoveryRun run(config, faultProducer);
+    if (false == run.Ready()) {
+      report.Add("unable to connect to broker", 0, "");
+      return;
+    }
+    auto& proxy = run.Proxy();
+
+    run.StartSending();
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const uint64_t faultAt = run.SinceStart();
+    if (fault == "drop") {
+      proxy.Drop();
+    } else if (fault == "reset") {
+      proxy.Reset();
+    } else {
+      proxy.BlackHole();
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    proxy.Heal();
+    run.MarkHealed();
+    const uint64_t healAt = run.SinceStart();
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    run.StopSending();
+
+    // Whatever is still on its way, so losses can be told from slowness
+    const auto drained =
+        std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (run.Received() < run.Sent() &&
+           std::chrono::steady_clock::now() < drained) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    const uint64_t second = 1000000000ull;
+    const uint64_t recovery = run.RecoveryNanos();
+    report.Add(fault + " recovered", recovery ? 1 : 0, "");
+    report.Add(fault + " recovery after heal", recovery / 1e6, "ms");
+    report.Add(fault + " longest gap", run.LongestGapMillis(), "ms");
+    report.Add(fault + " sent", run.Sent(), "msg");
+    report.Add(fault + " lost",
+               run.Sent() - std::min(run.Sent(),
+                                     run.Received() - run.Duplicates()),
+               "msg");
+    report.Add(fault + " duplicated", run.Duplicates(), "msg");
+    report.Add(fault + " before", run.RateBetween(0, faultAt), "msg/s");
+    report.Add(fault + " during", run.RateBetween(faultAt, healAt), "msg/s");
+    report.Add(fault + " first second after",
+               run.RateBetween(healAt, healAt + second), "msg/s");
+    report.Add(fault + " second second after",
+               run.RateBetween(healAt + second, healAt + 2 * second),
+               "msg/s");
+  }
+}
+
+}  // namespace HareBench
+
+/**
+ * The Producer's connection dropped, reset or black-holed for a second
+ * while it publishes RECOVERY_RATE messages a second, the Consumer's left
+ * alone
+ */
+HARE_BENCH(Recovery, producer) {
+  HareBench::measureRecovery(config, report, true);
+}
+
+/**
+ * The same with the Consumer's connection broken instead
+ */
+HARE_BENCH(Recovery, consumer) {
+  HareBench::measureRecovery(config, report, false);
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef _SOCKET_OPTIONS_BENCH_HPP_
+#define _SOCKET_OPTIONS_BENCH_HPP_
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchHarness.hpp"
+#include "ConnectionBase.hpp"
+
+namespace HareBench {
+
+struct socketVariant {
+  std::string m_name;
+  HareCpp::helper::socketOptions m_options;
+  bool m_pinned;
+};
+
+inline std::vector<socketVariant> socketVariants() {
+  std::vector<socketVariant> variants;
+  HareCpp::helper::socketOptions options;
+  variants.push_back({"nodelay", options, false});
+
+  options.m_flush = HareCpp::helper::tcpFlushStrategy::NAGLE;
+  variants.push_back({"nagle", options, false});
+
+  options.m_flush = HareCpp::helper::tcpFlushStrategy::CORK_BATCHES;
+  variants.push_back({"cork", options, false});
+
+  options = HareCpp::helper::socketOptions();
+  options.m_busyPollMicroseconds = 50;
+  variants.push_back({"busy poll 50us", options, false});
+
+  options = HareCpp::helper::socketOptions();
+  variants.push_back({"nodelay pinned", options, true});
+  return variants;
+}
+
+/**
+ * One message at a time from a publishing connection to a consuming one over
+ * the broker for the configured time, returning how long each took to arrive
+ * in microseconds.  Both connections must already be connected.
+ */
+inline std::vector<double> roundTripLatencies(
+    const Config& config, HareCpp::connection::ConnectionBase& publisher,
+    HareCpp::connection::ConnectionBase& consumer) {
+  auto consumerId = consumer.RegisterClient();
+  auto consumeChannel = consumer.AllocateChannel(consumerId);
+  amqp_bytes_t queueName = amqp_empty_bytes;
+  consumer.OpenChannel(consumeChannel);
+  consumer.DeclareQueue(consumeChannel, HareCpp::helper::queueProperties(),
+                        queueName);
+  consumer.BindQueue(consumeChannel, queueName, "amq.direct",
+                     "harecppBenchLatency");
+  consumer.StartConsumption(consumeChannel, queueName);
+
+  auto publisherId = publisher.RegisterClient();
+  auto publishChannel = publisher.AllocateChannel(publisherId);
+  publisher.OpenChannel(publishChannel);
+
+  const char body[] = "ping";
+  std::vector<double> latencies;
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::seconds(config.m_seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    HareCpp::helper::RawMessage message;
+    message.channel = publishChannel;
+    message.exchange = amqp_cstring_bytes("amq.direct");
+    message.routing_key = amqp_cstring_bytes("harecppBenchLatency");
+    message.properties._flags = 0;
+    message.message.bytes = const_cast<char*>(body);
+    message.message.len = sizeof(body) - 1;
+
+    auto start = std::chrono::steady_clock::now();
+    if (false == HareCpp::noError(publisher.PublishMessage(message))) break;
+    amqp_envelope_t envelope;
+    if (false ==
+        HareCpp::noError(consumer.ConsumeMessage(envelope, consumerId))) {
+      break;
+    }
+    latencies.push_back(HareBench::MicrosSince(start));
+    amqp_destroy_envelope(&envelope);
+  }
+  amqp_bytes_free(queueName);
+  return latencies;
+}
+
+}  // namespace HareBench
+
+/**
+ * Round trips through a broker on loopback, where the network is out of the
+ * picture and what is left is the cost of the socket settings and thread
+ * wakeups.
+ */
+HARE_BENCH(Socket, loopbackLatency) {
+  const int cpus = static_cast<int>(std::thread::hardware_concurrency());
+
+  for (const auto& variant : HareBench::socketVariants()) {
+    if (variant.m_pinned && cpus < 2) continue;
+
+    HareCpp::connection::ConnectionBase publisher(
+        config.m_server, config.m_port, config.m_username, config.m_password);
+    HareCpp::connection::ConnectionBase consumer(
+        config.m_server, config.m_port, config.m_username, config.m_password);
+    publisher.SetSocketOptions(variant.m_options);
+    consumer.SetSocketOptions(variant.m_options);
+    if (false == HareCpp::noError(publisher.Connect()) ||
+        false == HareCpp::noError(consumer.Connect())) {
+      report.Add("unable to connect to broker", 0, "");
+      return;
+    }
+    if (variant.m_pinned) {
+      publisher.SetIoThreadAffinity({0});
+      consumer.SetIoThreadAffinity({1});
+    }
+
+    report.AddLatencies(variant.m_name + " round trip",
+                        HareBench::roundTripLatencies(config, publisher,
+                                                      consumer));
+  }
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef _SYSCALL_BENCH_HPP_
+#define _SYSCALL_BENCH_HPP_
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "BenchHarness.hpp"
+#include "ConnectionBase.hpp"
+#include "UringSocket.hpp"
+
+namespace HareBench {
+
+/**
+ * Counts system calls made by this process, including threads started after
+ * it was created (the connection's I/O thread), through the
+ * raw_syscalls:sys_enter tracepoint.  Needs perf_event_paranoid <= 1 or
+ * CAP_PERFMON, Available() says whether it got it.
+ */
+class SyscallCounter {
+ public:
+  SyscallCounter() : m_fd(-1) {
+    int id = tracepointId();
+    if (id < 0) return;
+
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.type = PERF_TYPE_TRACEPOINT;
+    attributes.size = sizeof(attributes);
+    attributes.config = id;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 0;
+    m_fd = static_cast<int>(
+        syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0));
+  }
+  ~SyscallCounter() {
+    if (m_fd >= 0) close(m_fd);
+  }
+
+  bool Available() const { return m_fd >= 0; }
+
+  uint64_t Count() const {
+    uint64_t count = 0;
+    if (m_fd < 0 || read(m_fd, &count, sizeof(count)) != sizeof(count)) {
+      return 0;
+    }
+    return count;
+  }
+
+ private:
+  static int tracepointId() {
+    const char* paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+    for (auto path : paths) {
+      std::ifstream file(path);
+      int id = -1;
+      if (file >> id) return id;
+    }
+    return -1;
+  }
+
+  int m_fd;
+};
+
+struct transportVariant {
+  std::string m_name;
+  HareCpp::helper::socketTransport m_transport;
+  bool m_nativePublish;
+};
+
+inline std::vector<transportVariant> transportVariants() {
+  using HareCpp::helper::socketTransport;
+  return {{"tcp", socketTransport::TCP, false},
+          {"tcp native", socketTransport::TCP, true},
+          {"io_uring", socketTransport::IO_URING, false},
+          {"io_uring native", socketTransport::IO_URING, true}};
+}
+
+inline std::unique_ptr<HareCpp::connection::ConnectionBase> transportConnection(
+    const Config& config, const transportVariant& variant) {
+  std::unique_ptr<HareCpp::connection::ConnectionBase> connection(
+      new HareCpp::connection::ConnectionBase(config.m_server, config.m_port,
+                                              config.m_username,
+                                              config.m_password));
+  HareCpp::helper::socketOptions options;
+  options.m_transport = variant.m_transport;
+  connection->SetSocketOptions(options);
+  connection->SetNativePublish(variant.m_nativePublish);
+  if (false == HareCpp::noError(connection->Connect())) connection.reset();
+  return connection;
+}
+
+inline std::vector<std::shared_ptr<HareCpp::helper::RawMessage> > publishBatch(
+    int channel, const std::string& routingKey, const std::string& body) {
+  std::vector<std::shared_ptr<HareCpp::helper::RawMessage> > batch;
+  for (int i = 0; i < PRODUCER_PUBLISH_BATCH_SIZE; i++) {
+    std::shared_ptr<HareCpp::helper::RawMessage> message(
+        new HareCpp::helper::RawMessage());
+    message->channel = channel;
+    message->exchange = amqp_cstring_bytes("amq.direct");
+    message->routing_key = amqp_cstring_bytes(routingKey.c_str());
+    message->properties._flags = 0;
+    message->message.bytes = const_cast<char*>(body.data());
+    message->message.len = body.size();
+    batch.push_back(message);
+  }
+  return batch;
+}
+
+}  // namespace HareBench
+
+/**
+ * System calls per message published in batches the way Producer does, and
+ * per message consumed from a queue filled up beforehand, for each transport.
+ */
+HARE_BENCH(Transport, syscalls) {
+  if (false == HareCpp::connection::UringSocket::Supported()) {
+    report.Add("io_uring unavailable, io_uring rows use tcp", 0, "");
+  }
+  const std::string body(64, 's');
+
+  for (const auto& variant : HareBench::transportVariants()) {
+    // Publishing
+    {
+      HareBench::SyscallCounter counter;
+      if (false == counter.Available()) {
+        report.Add("perf_event_open not permitted, no syscall counts", 0, "");
+        return;
+      }
+      auto connection = HareBench::transportConnection(config, variant);
+      if (connection == nullptr) {
+        report.Add("unable to connect to broker", 0, "");
+        return;
+      }
+      auto clientId = connection->RegisterClient();
+      auto channel = connection->AllocateChannel(clientId);
+      connection->OpenChannel(channel);
+      auto batch = HareBench::publishBatch(channel, "harecppBenchNobody", body);
+
+      double published = 0;
+      std::vector<HareCpp::HARE_ERROR_E> results;
+      auto before = counter.Count();
+      auto start = std::chrono::steady_clock::now();
+      while (HareBench::MicrosSince(start) < config.m_seconds * 1e6) {
+        connection->PublishMessages(batch, results);
+        published += batch.size();
+      }
+      auto syscalls = counter.Count() - before;
+      report.Add(variant.m_name + " publish rate",
+                 published / config.m_seconds, "msg/s");
+      report.Add(variant.m_name + " publish syscalls/msg",
+                 syscalls / published, "");
+    }
+
+    // Consuming, from a queue filled up by a plain connection first
+    HareBench::transportVariant filler = {
+        "", HareCpp::helper::socketTransport::TCP, true};
+    auto fill = HareBench::transportConnection(config, filler);
+    if (fill == nullptr) return;
+    auto fillId = fill->RegisterClient();
+    auto fillChannel = fill->AllocateChannel(fillId);
+    fill->OpenChannel(fillChannel);
+    amqp_bytes_t queueName = amqp_empty_bytes;
+    HareCpp::helper::queueProperties properties;
+    properties.m_autoDelete = 0;
+    fill->DeclareQueue(fillChannel, properties, queueName);
+    std::string queue(static_cast<char*>(queueName.bytes), queueName.len);
+    fill->BindQueue(fillChannel, queueName, "amq.direct", queue);
+    auto batch = HareBench::publishBatch(fillChannel, queue, body);
+    std::vector<HareCpp::HARE_ERROR_E> results;
+    const int batches = 400;
+    for (int i = 0; i < batches; i++) fill->PublishMessages(batch, results);
+
+    HareBench::SyscallCounter counter;
+    auto connection = HareBench::transportConnection(config, variant);
+    if (connection == nullptr) return;
+    auto clientId = connection->RegisterClient();
+    auto channel = connection->AllocateChannel(clientId);
+    connection->OpenChannel(channel);
+
+    const double expected = batches * batch.size();
+    double consumed = 0;
+    auto before = counter.Count();
+    auto start = std::chrono::steady_clock::now();
+    connection->StartConsumption(channel, queueName);
+    while (consumed < expected) {
+      amqp_envelope_t envelope;
+      if (false ==
+          HareCpp::noError(connection->ConsumeMessage(envelope, clientId))) {
+        break;
+      }
+      amqp_destroy_envelope(&envelope);
+      consumed++;
+    }
+    auto seconds = HareBench::MicrosSince(start) / 1e6;
+    auto syscalls = counter.Count() - before;
+    report.Add(variant.m_name + " consume rate", consumed / seconds, "msg/s");
+    report.Add(variant.m_name + " consume syscalls/msg",
+               (consumed > 0 ? syscalls / consumed : 0), "");
+
+    // Not auto delete, it has to outlive the filling connection's channel
+    connection->Execute(channel, [&](amqp_connection_state_t conn) {
+      amqp_queue_delete(conn, channel, queueName, 0, 0);
+      return HareCpp::HARE_ERROR_E::ALL_GOOD;
+    });
+    amqp_bytes_free(queueName);
+  }
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef _TUNING_BENCH_HPP_
+#define _TUNING_BENCH_HPP_
+
+#include <memory>
+#include <string>
+
+#include "BenchHarness.hpp"
+#include "BlackholeRelay.hpp"
+#include "ConnectionBase.hpp"
+
+namespace HareBench {
+
+/**
+ * Publish payloadSize messages through the connection for the configured
+ * time, returning how many went out
+ */
+inline double publishFor(HareCpp::connection::ConnectionBase& connection,
+                         size_t payloadSize, int seconds) {
+  auto clientId = connection.RegisterClient();
+  auto channel = connection.AllocateChannel(clientId);
+  connection.OpenChannel(channel);
+
+  std::string body(payloadSize, 'f');
+  double published = 0;
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+  while (std::chrono::steady_clock::now() < deadline) {
+    HareCpp::helper::RawMessage message;
+    message.channel = channel;
+    message.exchange = amqp_cstring_bytes("amq.direct");
+    message.routing_key = amqp_cstring_bytes("harecppBenchNobody");
+    message.properties._flags = 0;
+    message.message.bytes = &body[0];
+    message.message.len = body.size();
+    if (false == HareCpp::noError(connection.PublishMessage(message))) break;
+    published++;
+  }
+  connection.Disconnect(clientId);
+  connection.UnregisterClient(clientId);
+  return published;
+}
+
+}  // namespace HareBench
+
+/**
+ * Large payloads at different frame_max settings, including the one picked
+ * from the payloads themselves
+ */
+HARE_BENCH(Tuning, frameMax) {
+  const size_t payloadSize = 256 * 1024;
+  const int frameSizes[] = {AMQP_FRAME_MIN_SIZE, DEFAULT_FRAME_MAX, 0};
+
+  for (int frameMax : frameSizes) {
+    HareCpp::connection::ConnectionBase connection(
+        config.m_server, config.m_port, config.m_username, config.m_password);
+    HareCpp::helper::connectionTuning tuning;
+    if (frameMax == 0) {
+      // Learn the payload size first, then reconnect with it
+      tuning.m_autoFrameMax = true;
+      connection.SetTuning(tuning);
+      connection.Connect();
+      HareBench::publishFor(connection, payloadSize, 1);
+      connection.CloseConnection();
+    } else {
+      tuning.m_frameMax = frameMax;
+      connection.SetTuning(tuning);
+    }
+
+    if (false == HareCpp::noError(connection.Connect())) {
+      report.Add("unable to connect to broker", 0, "");
+      return;
+    }
+
+    auto published =
+        HareBench::publishFor(connection, payloadSize, config.m_seconds);
+    auto prefix = (frameMax == 0 ? std::string("auto ") : std::string()) +
+                  "frame_max " + std::to_string(connection.FrameMax());
+    report.Add(prefix + " rate", published / config.m_seconds, "msg/s");
+    report.Add(prefix + " throughput",
+               published * payloadSize / config.m_seconds / (1024 * 1024),
+               "MiB/s");
+  }
+}
+
+/**
+ * What heartbeats cost in throughput, and how long it takes to notice a
+ * broker that stopped answering (the relay goes silent without closing)
+ */
+HARE_BENCH(Tuning, heartbeat) {
+  const int heartbeats[] = {0, 2, 5};
+
+  for (int heartbeat : heartbeats) {
+    auto prefix = "heartbeat " + std::to_string(heartbeat) + "s";
+
+    {
+      HareCpp::connection::ConnectionBase connection(
+          config.m_server, config.m_port, config.m_username,
+          config.m_password);
+      HareCpp::helper::connectionTuning tuning;
+      tuning.m_heartbeatSeconds = heartbeat;
+      connection.SetTuning(tuning);
+      if (false == HareCpp::noError(connection.Connect())) {
+        report.Add("unable to connect to broker", 0, "");
+        return;
+      }
+      auto published = HareBench::publishFor(connection, 64, config.m_seconds);
+      report.Add(prefix + " rate", published / config.m_seconds, "msg/s");
+    }
+
+    HareBench::BlackholeRelay relay(config.m_server, config.m_port);
+    HareCpp::connection::ConnectionBase connection(
+        "127.0.0.1", relay.Port(), config.m_username, config.m_password);
+    HareCpp::helper::connectionTuning tuning;
+    tuning.m_heartbeatSeconds = heartbeat;
+    connection.SetTuning(tuning);
+    if (relay.Port() == 0 ||
+        false == HareCpp::noError(connection.Connect())) {
+      report.Add(prefix + " unable to connect through relay", 0, "");
+      continue;
+    }
+
+    // Nobody gives up waiting on a silent broker without heartbeats, so only
+    // wait a few heartbeat intervals before calling it undetected
+    const int limitSeconds = (heartbeat == 0 ? 10 : heartbeat * 4);
+    relay.Blackhole();
+    auto start = std::chrono::steady_clock::now();
+    while (connection.IsConnected() &&
+           HareBench::MicrosSince(start) < limitSeconds * 1e6) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (connection.IsConnected()) {
+      report.Add(prefix + " failure not detected within",
+                 static_cast<double>(limitSeconds), "s");
+    } else {
+      report.Add(prefix + " failure detected after",
+                 HareBench::MicrosSince(start) / 1e6, "s");
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef _UNIX_SOCKET_BENCH_HPP_
+#define _UNIX_SOCKET_BENCH_HPP_
+
+#include <sys/resource.h>
+
+#include "BenchHarness.hpp"
+#include "ConnectionBase.hpp"
+#include "SocketOptionsBench.hpp"
+#include "SyscallBench.hpp"
+
+namespace HareBench {
+
+inline double cpuSecondsUsed() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+}  // namespace HareBench
+
+/**
+ * The same broker reached over loopback TCP and over the Unix socket given
+ * with --unix (RabbitMQ itself only listens on TCP, so usually a local AMQP
+ * proxy in front of it): round trip latency, then publish rate and the CPU
+ * this process spent per message.
+ */
+HARE_BENCH(Transport, unixVersusTcp) {
+  if (config.m_unixPath.empty()) {
+    report.Add("no --unix path given, skipped", 0, "");
+    return;
+  }
+
+  HareCpp::helper::socketOptions tcp;
+  HareCpp::helper::socketOptions unixSocket;
+  unixSocket.m_transport = HareCpp::helper::socketTransport::UNIX;
+  unixSocket.m_unixPath = config.m_unixPath;
+  const std::pair<std::string, HareCpp::helper::socketOptions> variants[] = {
+      {"tcp", tcp}, {"unix", unixSocket}};
+
+  for (const auto& variant : variants) {
+    HareCpp::connection::ConnectionBase publisher(
+        config.m_server, config.m_port, config.m_username, config.m_password);
+    HareCpp::connection::ConnectionBase consumer(
+        config.m_server, config.m_port, config.m_username, config.m_password);
+    publisher.SetSocketOptions(variant.second);
+    consumer.SetSocketOptions(variant.second);
+    if (false == HareCpp::noError(publisher.Connect()) ||
+        false == HareCpp::noError(consumer.Connect())) {
+      report.Add(variant.first + " unable to connect", 0, "");
+      continue;
+    }
+
+    report.AddLatencies(variant.first + " round trip",
+                        HareBench::roundTripLatencies(config, publisher,
+                                                      consumer));
+
+    auto clientId = publisher.RegisterClient();
+    auto channel = publisher.AllocateChannel(clientId);
+    publisher.OpenChannel(channel);
+    auto batch = HareBench::publishBatch(channel, "harecppBenchNobody",
+                                         std::string(64, 'u'));
+    std::vector<HareCpp::HARE_ERROR_E> results;
+    double published = 0;
+    auto cpuBefore = HareBench::cpuSecondsUsed();
+    auto start = std::chrono::steady_clock::now();
+    while (HareBench::MicrosSince(start) < config.m_seconds * 1e6) {
+      publisher.PublishMessages(batch, results);
+      published += batch.size();
+    }
+    auto cpu = HareBench::cpuSecondsUsed() - cpuBefore;
+    report.Add(variant.first + " publish rate", published / config.m_seconds,
+               "msg/s");
+    report.Add(variant.first + " cpu per message", cpu * 1e6 / published,
+               "us");
+  }
+}
+
+#endif
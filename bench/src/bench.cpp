@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include "BenchHarness.hpp"
+
+#include "StandInBroker.hpp"
+
+#include "ConnectionContentionBench.hpp"
+#include "EndToEndBench.hpp"
+#include "MicroBench.hpp"
+#include "RecoveryBench.hpp"
+#include "SocketOptionsBench.hpp"
+#include "SyscallBench.hpp"
+#include "TuningBench.hpp"
+#include "UnixSocketBench.hpp"
+
+// Set by the build to the commit being measured
+#ifndef HARECPP_REVISION
+#define HARECPP_REVISION "unknown"
+#endif
+
+namespace {
+void usage(const char* program) {
+  printf(
+      "Usage: %s [--server host] [--port port] [--user name]\n"
+      "          [--password password] [--seconds n] [--filter substring]\n"
+      "          [--unix path] [--standin] [--json file]\n",
+      program);
+}
+
+/**
+ * Everything that ran, with enough of the setup to tell which runs can be
+ * compared: diff two of these from different commits
+ */
+bool writeJson(const std::string& path, const HareBench::Config& config,
+               bool standIn, const std::vector<HareBench::Report>& reports) {
+  FILE* out = fopen(path.c_str(), "w");
+  if (out == nullptr) return false;
+  fprintf(out, "{\n  \"revision\": %s,\n",
+          HareBench::Report::JsonString(HARECPP_REVISION).c_str());
+  fprintf(out, "  \"broker\": %s,\n",
+          HareBench::Report::JsonString(
+              standIn ? "stand-in"
+                      : config.m_server + ":" + std::to_string(config.m_port))
+              .c_str());
+  fprintf(out, "  \"seconds\": %d,\n  \"benchmarks\": [", config.m_seconds);
+  for (size_t i = 0; i < reports.size(); i++) {
+    fprintf(out, "%s\n", i == 0 ? "" : ",");
+    reports[i].WriteJson(out);
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return 0 == fclose(out);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  HareCpp::SET_DEBUG_LEVEL(HareCpp::LOG_NONE);
+
+  HareBench::Config config;
+  std::string filter;
+  bool standIn = false;
+  std::string jsonPath;
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = (i + 1 < argc);
+    if (0 == strcmp(argv[i], "--server") && hasValue) {
+      config.m_server = argv[++i];
+    } else if (0 == strcmp(argv[i], "--port") && hasValue) {
+      config.m_port = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--user") && hasValue) {
+      config.m_username = argv[++i];
+    } else if (0 == strcmp(argv[i], "--password") && hasValue) {
+      config.m_password = argv[++i];
+    } else if (0 == strcmp(argv[i], "--seconds") && hasValue) {
+      config.m_seconds = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--unix") && hasValue) {
+      config.m_unixPath = argv[++i];
+    } else if (0 == strcmp(argv[i], "--standin")) {
+      standIn = true;
+    } else if (0 == strcmp(argv[i], "--json") && hasValue) {
+      jsonPath = argv[++i];
+    } else if (0 == strcmp(argv[i], "--filter") && hasValue) {
+      filter = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  // Same broker, same behaviour on every run, no RabbitMQ needed
+  std::unique_ptr<HareTest::StandInBroker> broker;
+  if (standIn) {
+    if (config.m_unixPath.empty()) {
+      config.m_unixPath = "@harecppBench." + std::to_string(getpid());
+    }
+    broker.reset(new HareTest::StandInBroker(0, config.m_unixPath,
+                                             config.m_username,
+                                             config.m_password));
+    if (0 == broker->Port()) {
+      fprintf(stderr, "Couldn't start the stand-in broker\n");
+      return 1;
+    }
+    config.m_server = "127.0.0.1";
+    config.m_port = broker->Port();
+  }
+
+  std::vector<HareBench::Report> reports;
+  for (const auto& benchmark : HareBench::Registry()) {
+    if (false == filter.empty() &&
+        benchmark.m_name.find(filter) == std::string::npos)
+      continue;
+    HareBench::Report report(benchmark.m_name);
+    benchmark.m_function(config, report);
+    report.Print();
+    reports.push_back(report);
+  }
+
+  if (false == jsonPath.empty() &&
+      false == writeJson(jsonPath, config, standIn, reports)) {
+    fprintf(stderr, "Couldn't write %s\n", jsonPath.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -31,6 +31,7 @@
 
 #include "HashableBindingPair.hpp"
 #include "HelperStructs.hpp"
+#include "LatencyHistogram.hpp"
 #include "Message.hpp"
 #include "pch.hpp"
 
@@ -54,6 +55,10 @@ class ChannelHandler {
     std::shared_ptr<int> m_channel;
     std::shared_ptr<HashableBindingPair> m_bindingPair;
     TD_Callback m_callback;
+    // How long m_callback takes, shared with whoever asked for it
+    std::shared_ptr<LatencyHistogram> m_callbackDuration;
+    // Publish to arrival, for messages that carry their send time
+    std::shared_ptr<LatencyHistogram> m_oneWayLatency;
 
     amqp_bytes_t m_queueName;
     // Stored so we can access them again if channel not accessible at time of
@@ -92,6 +97,13 @@ class ChannelHandler {
   // to the channelHandler
   int m_nextAvailableChannel;
 
+  /**
+   * Where channel numbers come from when set.  A Consumer on a shared
+   * connection points this at the connection's allocator so its channels
+   * don't collide with anyone else's.  Returns -1 when none are left.
+   */
+  std::function<int()> m_channelAllocator;
+
   /**
    *  Determines if the processing of the consumed messages should be
    * multi-threaded or not. If multi-threaded is turned off, you reduce the
@@ -104,6 +116,12 @@ class ChannelHandler {
   // Mutex to protect the class members
   mutable std::mutex m_handlerMutex;
 
+  /**
+   * Delivery read off the socket to its callback being called, for every
+   * binding (see DispatchDelayHistogram())
+   */
+  std::shared_ptr<LatencyHistogram> m_dispatchDelay;
+
  public:
   ChannelHandler();
 
@@ -142,6 +160,14 @@ class ChannelHandler {
    */
   int RemoveChannelProcessor(const HashableBindingPair& bindingPair);
 
+  /**
+   * Set the function used to get channel numbers for new channel processors,
+   * replacing the default of counting up from 1.
+   *
+   * @param [in] allocator : returns a free channel number, or -1 if none
+   */
+  void SetChannelAllocator(std::function<int()> allocator);
+
   /**
    * set the multiThreaded boolean (default true/on)
    *
@@ -161,8 +187,44 @@ class ChannelHandler {
    * @param [in] bindingPair: the pair of exchange/routingKey used to determine
    * where the message came from and what callback we care about
    * @param [in] message: The message to be processed
+   * @param optional [in] receivedNanos: LatencyHistogram::Now() when the
+   * message came off the socket, 0 if unknown (not recorded then)
+   * @param optional [in] oneWayNanos: publish to arrival, negative if the
+   * message didn't carry its send time (not recorded then)
+   */
+  void Process(const HashableBindingPair& bindingPair, const Message& message,
+               uint64_t receivedNanos = 0, int64_t oneWayNanos = -1);
+
+  /**
+   * Time from a delivery arriving on the socket to its callback starting,
+   * which covers the wait in the consumer's inbox and the lookup here
+   *
+   * @returns the histogram, in nanoseconds
+   */
+  LatencyHistogram& DispatchDelayHistogram();
+
+  /**
+   * How long the callback for a binding pair takes per message.  The
+   * histogram outlives the subscription, and a new callback for the same
+   * pair keeps adding to it.
+   *
+   * @param [in] bindingPair: the pair of exchange/routingKey subscribed to
+   * @returns the histogram in nanoseconds, nullptr if the pair isn't
+   * subscribed to
+   */
+  std::shared_ptr<LatencyHistogram> CallbackDurationHistogram(
+      const HashableBindingPair& bindingPair) const;
+
+  /**
+   * Publish to arrival of the messages for a binding pair that carried
+   * SEND_TIME_HEADER
+   *
+   * @param [in] bindingPair: the pair of exchange/routingKey subscribed to
+   * @returns the histogram in nanoseconds, nullptr if the pair isn't
+   * subscribed to
    */
-  void Process(const HashableBindingPair& bindingPair, const Message& message);
+  std::shared_ptr<LatencyHistogram> OneWayLatencyHistogram(
+      const HashableBindingPair& bindingPair) const;
 
   /**
    * Returns a vector of all channels
@@ -0,0 +1,251 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include <string.h>
+
+#include <type_traits>
+
+#include "Message.hpp"
+#include "pch.hpp"
+
+namespace HareCpp {
+
+/**
+ * Schema
+ *
+ * How a type is laid out as a payload, given with HARE_SCHEMA() for types
+ * sent with Producer::Send<T>() and received with Consumer::Subscribe<T>().
+ * Types without one can't be sent that way.
+ */
+template <typename T>
+struct Schema {
+  static constexpr bool DESCRIBED = false;
+};
+
+namespace helper {
+
+/**
+ * One value on the wire: little-endian, exactly sizeof(T) bytes, no padding.
+ * Copied as it is on little-endian hosts, byte by byte reversed elsewhere.
+ */
+template <typename T, typename Enable = void>
+struct wireFormat {
+  static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value,
+                "schema fields are numbers, enums, bools or arrays of them");
+};
+
+template <typename T>
+struct wireFormat<T, typename std::enable_if<std::is_arithmetic<T>::value ||
+                                             std::is_enum<T>::value>::type> {
+  static constexpr size_t SIZE = sizeof(T);
+  // Same bytes in memory as on the wire
+  static constexpr bool PLAIN = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+  static void Store(const T& value, char* out) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(out, &value, sizeof(T));
+#else
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    for (size_t i = 0; i < sizeof(T); i++) out[i] = bytes[sizeof(T) - 1 - i];
+#endif
+  }
+
+  static void Load(T& value, const char* in) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&value, in, sizeof(T));
+#else
+    char* bytes = reinterpret_cast<char*>(&value);
+    for (size_t i = 0; i < sizeof(T); i++) bytes[i] = in[sizeof(T) - 1 - i];
+#endif
+  }
+};
+
+/**
+ * A bool is one byte, anything but 0 read as true
+ */
+template <>
+struct wireFormat<bool, void> {
+  static constexpr size_t SIZE = 1;
+  static constexpr bool PLAIN = false;
+  static void Store(const bool& value, char* out) { out[0] = value ? 1 : 0; }
+  static void Load(bool& value, const char* in) { value = in[0] != 0; }
+};
+
+template <typename T, size_t N>
+struct wireFormat<T[N], void> {
+  static constexpr size_t SIZE = N * wireFormat<T>::SIZE;
+  static constexpr bool PLAIN = wireFormat<T>::PLAIN;
+
+  static void Store(const T (&value)[N], char* out) {
+    if (PLAIN) {
+      memcpy(out, value, SIZE);
+      return;
+    }
+    for (size_t i = 0; i < N; i++) {
+      wireFormat<T>::Store(value[i], out + i * wireFormat<T>::SIZE);
+    }
+  }
+
+  static void Load(T (&value)[N], const char* in) {
+    if (PLAIN) {
+      memcpy(value, in, SIZE);
+      return;
+    }
+    for (size_t i = 0; i < N; i++) {
+      wireFormat<T>::Load(value[i], in + i * wireFormat<T>::SIZE);
+    }
+  }
+};
+
+/**
+ * One member of C, see HARE_FIELD()
+ */
+template <typename C, typename T, T C::*MEMBER>
+struct schemaField {
+  static constexpr size_t SIZE = wireFormat<T>::SIZE;
+
+  static void Store(const C& object, char* out) {
+    wireFormat<T>::Store(object.*MEMBER, out);
+  }
+
+  static void Load(C& object, const char* in) {
+    wireFormat<T>::Load(object.*MEMBER, in);
+  }
+};
+
+/**
+ * The members of a schema, one after the other in the order given
+ */
+template <typename... F>
+struct schemaFields;
+
+template <>
+struct schemaFields<> {
+  static constexpr size_t SIZE = 0;
+  template <typename C>
+  static void Store(const C&, char*) {}
+  template <typename C>
+  static void Load(C&, const char*) {}
+};
+
+template <typename F, typename... Rest>
+struct schemaFields<F, Rest...> {
+  static constexpr size_t SIZE = F::SIZE + schemaFields<Rest...>::SIZE;
+
+  template <typename C>
+  static void Store(const C& object, char* out) {
+    F::Store(object, out);
+    schemaFields<Rest...>::Store(object, out + F::SIZE);
+  }
+
+  template <typename C>
+  static void Load(C& object, const char* in) {
+    F::Load(object, in);
+    schemaFields<Rest...>::Load(object, in + F::SIZE);
+  }
+};
+
+}  // namespace helper
+
+/**
+ * Write value as the payload of message, straight into it, and tag its
+ * content type
+ *
+ * @param [in] value : the value sent
+ * @param [out] message : its payload and content type are replaced
+ * @returns false if the payload couldn't be allocated
+ */
+template <typename T>
+typename std::enable_if<Schema<T>::DESCRIBED, bool>::type hare_encode(
+    const T& value, Message& message) {
+  char* out = message.AllocatePayload(Schema<T>::Size());
+  if (nullptr == out) return false;
+  Schema<T>::Fields::Store(value, out);
+  if (false == message.ContentTypeIs(Schema<T>::ContentType())) {
+    message.SetContentType(Schema<T>::ContentType());
+  }
+  return true;
+}
+
+/**
+ * Read value back out of the payload of message, where it is
+ *
+ * @param [in] message : received, its content type if it has one must be
+ * the schema's
+ * @param [out] value : every field in the schema is overwritten
+ * @returns false, value untouched, if the payload isn't one of these or is
+ * in fragments
+ */
+template <typename T>
+typename std::enable_if<Schema<T>::DESCRIBED, bool>::type hare_decode(
+    const Message& message, T& value) {
+  if (message.Length() != Schema<T>::Size() || message.IsFragmented()) {
+    return false;
+  }
+  if (message.ContentTypeIsSet() &&
+      false == message.ContentTypeIs(Schema<T>::ContentType())) {
+    return false;
+  }
+  Schema<T>::Fields::Load(value, message.Payload());
+  return true;
+}
+
+}  // namespace HareCpp
+
+/**
+ * A member of a type, for HARE_SCHEMA()
+ */
+#define HARE_FIELD(type, member) \
+  HareCpp::helper::schemaField<type, decltype(type::member), &type::member>
+
+/**
+ * Describe type for Producer::Send<T>() and Consumer::Subscribe<T>(): the
+ * MIME type its messages are tagged with, a string literal, then its fields
+ * in wire order.
+ * Use it outside of any namespace, e.g.
+ *
+ *   HARE_SCHEMA(Tick, "application/x-tick", HARE_FIELD(Tick, m_price),
+ *               HARE_FIELD(Tick, m_size))
+ */
+#define HARE_SCHEMA(type, contentType, ...)                         \
+  namespace HareCpp {                                               \
+  template <>                                                       \
+  struct Schema<type> {                                             \
+    static constexpr bool DESCRIBED = true;                         \
+    typedef helper::schemaFields<__VA_ARGS__> Fields;               \
+    static constexpr size_t Size() { return Fields::SIZE; }         \
+    static HeaderText ContentType() {                               \
+      return HeaderText(contentType, sizeof(contentType) - 1);      \
+    }                                                               \
+  };                                                                \
+  }
+
+#endif  // _CODEC_H_
@@ -1,4 +1,3 @@
-
 /*
  * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
  *
@@ -29,10 +28,22 @@
 #ifndef _CONNECTION_BASE_H_
 #define _CONNECTION_BASE_H_
 
+#include "CustomSocket.hpp"
+#include "EventLog.hpp"
 #include "HelperStructs.hpp"
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
+#include "PublishFrameWriter.hpp"
 #include "pch.hpp"
 
+#include <array>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace HareCpp {
 namespace connection {
@@ -44,23 +55,167 @@ namespace connection {
  * (producer/consumer), and will hopefully ease their usage and allow easier
  * expansion later on.
  *
+ * Threading: a rabbitmq-c connection state can't be used from more than one
+ * thread, so a single I/O thread owns it.  Every public call is turned into a
+ * command on its channel's command queue and the caller waits for that
+ * command's result.  The I/O thread runs one command per channel per round
+ * (so a busy channel can't starve the others), and between rounds it reads
+ * whatever the broker sent, routing deliveries to the consuming client and
+ * RPC replies to the command waiting on them.  While an RPC is waiting on the
+ * broker only its own channel's queue is paused, other channels keep going,
+ * and a Consumer waiting for messages waits on its own inbox, not on the
+ * connection.
  */
 class ConnectionBase {
  protected:
   amqp_socket_t* m_socket;
+
+  /**
+   * m_socket when it is one of ours rather than rabbitmq-c's TCP socket,
+   * owned by m_conn.  Only touched by the I/O thread.
+   */
+  CustomSocket* m_customSocket;
   /**
    * Rabbitmq-c connection state that is used for every amqp connection call.
-   * There should only be one of these per publisher/consumer processing, and
-   * needs to be properly mutex locked. This is why the ConnectionBase class is
-   * important, to handle this.
+   * Only ever touched by the I/O thread (see ioThread()).
    */
   amqp_connection_state_t m_conn;
 
   /**
-   * Mutex lock on the amqp_connection_state_t, amongst other important things
-   * within ConnectionBase
+   * Completion for a command, called exactly once on the I/O thread with the
+   * result of the command
+   */
+  typedef std::function<void(HARE_ERROR_E)> ioCompletion;
+
+  /**
+   * A unit of work for the I/O thread.  It may finish straight away, or start
+   * an RPC (startRpc) and leave the completion to be called once the reply
+   * arrives.
+   */
+  typedef std::function<void(const ioCompletion&)> ioCommand;
+
+  /**
+   * Called on the I/O thread with the broker's reply to an RPC (nullptr if it
+   * failed).  The decoded reply is only valid for the duration of the call.
+   */
+  typedef std::function<HARE_ERROR_E(amqp_method_t*)> rpcReplyHandler;
+
+  struct queuedCommand {
+    ioCommand m_run;
+    ioCompletion m_done;
+  };
+
+  /**
+   * Per channel command queue.  m_scheduled means it is on m_readyChannels,
+   * m_rpcInFlight means it is paused waiting for the broker to answer.
    */
-  mutable std::mutex m_connMutex;
+  struct channelCommands {
+    channelCommands() : m_scheduled(false), m_rpcInFlight(false){};
+    std::deque<queuedCommand> m_commands;
+    bool m_scheduled;
+    bool m_rpcInFlight;
+  };
+
+  /**
+   * Command queues keyed by channel (0 is the connection itself) and the
+   * round robin list of channels that have something to run.
+   */
+  std::unordered_map<int, channelCommands> m_commandQueues;
+  std::deque<int> m_readyChannels;
+  std::mutex m_commandMutex;
+
+  /**
+   * RPC waiting on the broker, one at most per channel as AMQP requires.  Only
+   * touched by the I/O thread.
+   */
+  struct pendingRpc {
+    std::vector<amqp_method_number_t> m_expectedReplies;
+    rpcReplyHandler m_onReply;
+    ioCompletion m_done;
+  };
+  std::unordered_map<int, pendingRpc> m_pendingRpcs;
+
+  /**
+   * The I/O thread, and the eventfd used to wake it up when a command is
+   * queued while it is waiting on the socket
+   */
+  std::thread m_ioThread;
+  std::atomic<bool> m_ioRunning;
+  int m_wakeFd;
+
+  /**
+   * Native publish encoder, used instead of amqp_basic_publish() when
+   * m_nativePublish is set or a message is in fragments.  Only touched by the
+   * I/O thread.
+   */
+  PublishFrameWriter m_frameWriter;
+  std::atomic<bool> m_nativePublish;
+
+  /**
+   * Serializes Connect() and starting the I/O thread, so that two clients
+   * sharing this connection don't both try to establish it
+   */
+  std::mutex m_connectMutex;
+
+  /**
+   * Bookkeeping for the channels handed out on this connection.  Index is the
+   * channel number, channel 0 is reserved for the connection itself.  Guarded
+   * by m_channelMutex.
+   */
+  struct channelSlot {
+    channelSlot() : m_owner(-1), m_isOpen(false){};
+    int m_owner;  // client id, -1 when free
+    bool m_isOpen;
+  };
+  std::vector<channelSlot> m_channels;
+
+  /**
+   * Highest usable channel number.  Before login this is what we will ask the
+   * broker for, after login it is what the broker agreed to.
+   */
+  int m_channelMax;
+
+  /**
+   * Number of channels currently handed out (m_channels entries with owners)
+   */
+  int m_channelsInUse;
+
+  /**
+   * Deliveries routed to one client (Producer/Consumer sharing this
+   * connection), plus channels of theirs the broker closed.  ConsumeMessage()
+   * waits on m_ready.  Client 0 gets deliveries on channels that were opened
+   * without being allocated.
+   */
+  struct inboundDelivery {
+    amqp_envelope_t m_envelope;
+    uint64_t m_receivedNanos;  // LatencyHistogram::Now() when it arrived
+  };
+  struct deliveryInbox {
+    std::deque<inboundDelivery> m_deliveries;
+    std::deque<int> m_closedChannels;
+    std::condition_variable m_ready;
+  };
+  std::unordered_map<int, std::shared_ptr<deliveryInbox> > m_inboxes;
+
+  int m_nextClientId;
+
+  /**
+   * Clients registered and not yet unregistered, they count towards Load()
+   * before they have allocated any channels
+   */
+  std::unordered_set<int> m_clients;
+
+  mutable std::mutex m_channelMutex;
+
+  /**
+   * Incremented every time a connection is (re)established.  Clients sharing
+   * the connection compare it against the generation their channels were
+   * opened on, to find out that somebody else reconnected underneath them.
+   */
+  std::atomic<unsigned int> m_generation;
+
+  // Tells this connection's events apart from other ones' in the EventLog
+  const uint32_t m_eventLogId;
 
   /**
    * Stored credentials for login, this includes username, password, host, and
@@ -99,7 +254,69 @@ class ConnectionBase {
    * Timeout used during consumption of a channel/ any amqp call that may
    * include a timeout or lock the resource.
    */
-  int m_timeout;
+  std::atomic<int> m_timeout;
+
+  /**
+   * What to propose at the next login, guarded by m_channelMutex
+   */
+  helper::connectionTuning m_tuning;
+
+  /**
+   * What the broker agreed to at the last login
+   */
+  std::atomic<int> m_negotiatedFrameMax;
+  std::atomic<int> m_negotiatedHeartbeat;
+
+  /**
+   * Published payload sizes, bucketed by bit length (bucket b holds sizes
+   * below 2^b), used to size frame_max when m_autoFrameMax is set
+   */
+  std::array<std::atomic<uint64_t>, 33> m_payloadSizes;
+
+  void recordPayloadSize(size_t size);
+
+  /**
+   * Applied to the socket on every connect, guarded by m_channelMutex.
+   * m_ioCpus is what the I/O thread gets pinned to when it starts.
+   */
+  helper::socketOptions m_socketOptions;
+  std::vector<int> m_ioCpus;
+
+  /**
+   * Cork the socket while a command round runs (tcpFlushStrategy
+   * CORK_BATCHES).  Only touched by the I/O thread.
+   */
+  bool m_corkRounds;
+
+  /**
+   * Apply m_socketOptions to the freshly opened socket.  Failures are logged
+   * and otherwise ignored, the connection works without them.
+   */
+  void applySocketOptions(int sockfd);
+
+  void setCork(bool cork);
+
+  /**
+   * The broker socket itself, for setsockopt() and native publishing
+   */
+  int socketFd();
+
+  /**
+   * Push out whatever a custom socket is holding (see CustomSocket::Flush()),
+   * tearing the connection down if that fails
+   *
+   * @returns HARE_ERROR_E
+   */
+  HARE_ERROR_E flushSocket();
+
+  /**
+   * Write the publishes m_frameWriter holds, giving up after one heartbeat
+   * interval (PUBLISH_FLUSH_TIMEOUT_SECONDS without heartbeats) of the
+   * broker not reading, so a blocked publisher can't stall the I/O thread
+   *
+   * @returns HARE_ERROR_E
+   */
+  HARE_ERROR_E flushFrames();
 
   /**
    * login using the basic login credentials given in the class' constructor
@@ -131,6 +348,124 @@ class ConnectionBase {
 
   HARE_ERROR_E decodeLibraryException(const amqp_rpc_reply_t& reply);
 
+  /**
+   * Start the I/O thread if it isn't running, m_connectMutex must be held
+   */
+  void startIoThread();
+
+  /**
+   * Stop and join the I/O thread
+   */
+  void stopIoThread();
+
+  /**
+   * Main loop of the I/O thread: run a round of commands, read from the
+   * broker, wait for more work
+   */
+  void ioThread();
+
+  /**
+   * Run at most one command from every channel that has one ready
+   */
+  void runCommandRound();
+
+  /**
+   * Read and dispatch whatever frames the broker has sent, without blocking
+   */
+  void readInbound();
+
+  /**
+   * Wait until a command is queued or the socket is readable
+   */
+  void waitForWork();
+
+  /**
+   * Wake the I/O thread out of waitForWork()
+   */
+  void wakeIoThread();
+
+  /**
+   * Handle one frame read off the wire (I/O thread)
+   */
+  void dispatchFrame(amqp_frame_t& frame);
+
+  /**
+   * Read the rest of a basic.deliver and hand it to the channel's owner
+   */
+  void receiveDelivery(amqp_frame_t& frame);
+
+  /**
+   * Hand a delivery to its owner's inbox, or destroy it if nobody is
+   * listening on that channel anymore
+   */
+  void routeDelivery(amqp_envelope_t& envelope, uint64_t receivedNanos);
+
+  /**
+   * Send an RPC request on the I/O thread and pause the channel until one of
+   * the expected replies arrives, at which point onReply is called and then
+   * done with its result.
+   */
+  void startRpc(int channel, amqp_method_number_t request, void* decoded,
+                const std::vector<amqp_method_number_t>& expectedReplies,
+                const rpcReplyHandler& onReply, const ioCompletion& done);
+
+  /**
+   * Finish the RPC pending on channel (if any) and let its queue run again
+   */
+  void completeRpc(int channel, HARE_ERROR_E retCode, amqp_method_t* reply);
+
+  /**
+   * Drop the connection after a failure or a close from either side, failing
+   * everything waiting on the broker (I/O thread)
+   */
+  void teardown();
+
+  /**
+   * Queue a command on a channel.  post() returns straight away, submit()
+   * waits for the command to complete and returns its result.
+   */
+  void post(int channel, const ioCommand& command, const ioCompletion& done);
+  HARE_ERROR_E submit(int channel, const ioCommand& command);
+
+  /**
+   * Run a synchronous RPC from a caller thread, see startRpc()
+   */
+  HARE_ERROR_E rpc(int channel, amqp_method_number_t request,
+                   std::shared_ptr<void> decoded,
+                   const std::vector<amqp_method_number_t>& expectedReplies,
+                   const rpcReplyHandler& onReply = nullptr);
+
+  /**
+   * The I/O thread's halves of Connect(), CloseConnection() and
+   * PublishMessage()
+   */
+  HARE_ERROR_E connectOnIoThread();
+  HARE_ERROR_E closeOnIoThread();
+  HARE_ERROR_E publishOnIoThread(helper::RawMessage& message);
+
+  /**
+   * Publish several messages on one channel through m_frameWriter, with a
+   * single write to the socket.  Fills in results for the given indexes.
+   */
+  void publishBatchOnIoThread(
+      const std::vector<std::shared_ptr<helper::RawMessage> >& messages,
+      const std::vector<size_t>& indexes, std::vector<HARE_ERROR_E>& results);
+
+  /**
+   * Channel bookkeeping helpers, m_channelMutex must be held.  Opening a
+   * channel that was never allocated grows m_channels to cover it.
+   */
+  void setChannelOpen(int channel, bool isOpen);
+  int channelOwner(int channel) const;
+  std::shared_ptr<deliveryInbox> inbox(int clientId);
+
+  /**
+   * Destroy every waiting delivery, for all clients (or just one),
+   * m_channelMutex must not be held
+   */
+  void clearInboxes();
+  void clearInbox(int clientId);
+
  public:
   /**
    * Default connection base constructor.  It takes in basic credentials to
@@ -161,7 +496,67 @@ class ConnectionBase {
   void SetTimeout(int timeout);
 
   /**
-   * Connect, which calls either basic or ssl connection functions
+   * Set the channel_max, frame_max and heartbeat to propose to the broker.
+   * Takes effect on the next Connect().
+   *
+   * @param [in] tuning : values to propose
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if a value is out of range
+   */
+  HARE_ERROR_E SetTuning(const helper::connectionTuning& tuning);
+
+  helper::connectionTuning Tuning() const;
+
+  /**
+   * frame_max and heartbeat the broker agreed to, 0 before the first login
+   */
+  int FrameMax() const;
+  int Heartbeat() const;
+
+  /**
+   * frame_max that would carry 99% of the payloads published so far in a
+   * single body frame, what m_autoFrameMax proposes on the next login.
+   * Bigger frames mean fewer of them for large messages, but a large message
+   * holds up the other channels on the connection for longer.
+   *
+   * @returns frame_max in bytes, the configured one if nothing was published
+   */
+  int SuggestedFrameMax() const;
+
+  /**
+   * Socket options (Nagle/corking, buffer sizes, busy polling, keepalive) to
+   * apply to the broker socket.  Takes effect on the next Connect().
+   *
+   * @param [in] options : options to apply
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if a value is negative
+   */
+  HARE_ERROR_E SetSocketOptions(const helper::socketOptions& options);
+
+  helper::socketOptions SocketOptions() const;
+
+  /**
+   * Pin the I/O thread to the given CPUs, now if it is running and whenever
+   * it is started again.  An empty list stops pinning it on later starts.
+   *
+   * @param [in] cpus : CPU numbers the I/O thread may run on
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS for a CPU that doesn't exist
+   */
+  HARE_ERROR_E SetIoThreadAffinity(const std::vector<int>& cpus);
+
+  /**
+   * Encode publishes ourselves and write them out in batches (see
+   * PublishFrameWriter) rather than going through amqp_basic_publish().  Off
+   * by default, messages in fragments always go this way.
+   *
+   * @param [in] enabled : true to use the native encoder
+   */
+  void SetNativePublish(bool enabled);
+
+  bool NativePublish() const;
+
+  /**
+   * Connect, which calls either basic or ssl connection functions.  Calling
+   * this on an already established connection does nothing and returns
+   * ALL_GOOD, so every client sharing the connection can call it.
    *
    * @returns HARE_ERROR_E
    */
@@ -174,6 +569,67 @@ class ConnectionBase {
    */
   HARE_ERROR_E CloseConnection();
 
+  /**
+   * Detach a client from the connection.  Its channels are closed and, if no
+   * other client has a channel open, the connection is closed as well.  Used
+   * by Producer/Consumer Stop() in place of CloseConnection(), which would
+   * pull the connection out from under everybody sharing it.
+   *
+   * @param [in] clientId : id returned from RegisterClient()
+   * @returns HARE_ERROR_E
+   */
+  HARE_ERROR_E Disconnect(int clientId);
+
+  /**
+   * Register a user (Producer/Consumer) of this connection.  The returned id
+   * owns the channels it allocates and the deliveries consumed on them.
+   *
+   * @returns client id (> 0)
+   */
+  int RegisterClient();
+
+  /**
+   * Remove a client, releasing every channel it had allocated
+   *
+   * @param [in] clientId : id returned from RegisterClient()
+   */
+  void UnregisterClient(int clientId);
+
+  /**
+   * Allocate the lowest free channel number, bounded by the negotiated
+   * channel_max (or the requested one, if we haven't logged in yet)
+   *
+   * @param [in] clientId : the client that will own the channel
+   * @returns channel number, or -1 if every channel is taken
+   */
+  int AllocateChannel(int clientId);
+
+  /**
+   * Number of channels currently allocated on this connection
+   */
+  int ChannelCount() const;
+
+  /**
+   * Channels allocated, plus one for every registered client that has none
+   * yet, what ConnectionPool balances on
+   */
+  int Load() const;
+
+  /**
+   * Highest usable channel number on this connection
+   */
+  int ChannelMax() const;
+
+  /**
+   * Number of the current (or last) established connection, see m_generation
+   */
+  unsigned int Generation() const;
+
+  /**
+   * The connection number this connection's EventLog records carry
+   */
+  uint32_t EventLogId() const { return m_eventLogId; }
+
   /**
    * Open a channel to the broker using the channel number provided
    *
@@ -210,6 +666,21 @@ class ConnectionBase {
    */
   HARE_ERROR_E PublishMessage(helper::RawMessage& message);
 
+  /**
+   * Publish several messages, waiting once for the whole batch rather than
+   * once per message.  Each message goes on its own channel's queue, so
+   * ordering is kept per channel.  With NativePublish() each channel's share
+   * of the batch is written to the socket at once.
+   *
+   * @param [in] messages : messages to publish
+   * @param [out] results : result for each message, same order as messages
+   * @returns HARE_ERROR_E, a server failure if any message hit one, otherwise
+   * the first error seen
+   */
+  HARE_ERROR_E PublishMessages(
+      const std::vector<std::shared_ptr<helper::RawMessage> >& messages,
+      std::vector<HARE_ERROR_E>& results);
+
   /**
    * Consume a message, filling the amqp_envelope_t with the contents of the
    * message received This does not work in the case of not receiving a full
@@ -222,6 +693,33 @@ class ConnectionBase {
    */
   HARE_ERROR_E ConsumeMessage(amqp_envelope_t& envelope);
 
+  /**
+   * Consume a message for a particular client only, waiting up to the timeout
+   * for the I/O thread to deliver one on any of the client's channels.
+   *
+   * If the broker closed one of the client's channels CHANNEL_EXCEPTION is
+   * returned with envelope.channel set to that channel (and nothing else in
+   * the envelope to free).
+   *
+   * @param [out] envelope : contains the message consumed from the amqp broker
+   * @param [in] clientId : id returned from RegisterClient()
+   * @returns HARE_ERROR_E with success or not
+   */
+  HARE_ERROR_E ConsumeMessage(amqp_envelope_t& envelope, int clientId);
+
+  /**
+   * As above, also giving LatencyHistogram::Now() at the time the delivery
+   * was read off the socket
+   *
+   * @param [out] envelope : contains the message consumed from the amqp broker
+   * @param [in] clientId : id returned from RegisterClient()
+   * @param [out] receivedNanos : when the delivery arrived, untouched if
+   * there wasn't one
+   * @returns HARE_ERROR_E with success or not
+   */
+  HARE_ERROR_E ConsumeMessage(amqp_envelope_t& envelope, int clientId,
+                              uint64_t& receivedNanos);
+
   /**
    * Turn on amqp consumption on the channel/queue.
    * This calls underlying amqp_consume function which starts up consumption. It
@@ -268,10 +766,29 @@ class ConnectionBase {
                          const std::string& exchange,
                          const std::string& bindingKey);
 
+  /**
+   * Run a function against the connection state on the I/O thread, queued
+   * behind whatever else is waiting on that channel.  This is the safe way to
+   * make amqp calls that aren't implemented in this library.  The function
+   * must not call back into this ConnectionBase.
+   *
+   * @param [in] channel : channel queue to run on (0 for the connection)
+   * @param [in] function : called with the connection state, its result is
+   * returned
+   * @returns HARE_ERROR_E from the function, or SERVER_CONNECTION_FAILURE if
+   * not connected
+   */
+  HARE_ERROR_E Execute(
+      int channel,
+      const std::function<HARE_ERROR_E(amqp_connection_state_t)>& function);
+
   /**
    * May not be necessary, but returns a pointer to the current
    * connection state. Useful for running particular amqp commands that are not
-   * implemented in this library
+   * implemented in this library.
+   *
+   * NOTE: the state belongs to the I/O thread, only use it from inside
+   * Execute()
    *
    * @returns amqp_connection_state_t m_conn
    */
@@ -280,9 +797,15 @@ class ConnectionBase {
   /**
    * Destructor should close connections before being destroyed
    */
-  ~ConnectionBase() { CloseConnection(); };
+  ~ConnectionBase() {
+    CloseConnection();
+    stopIoThread();
+    // Channels nobody gave back stop counting with the connection
+    MetricsRegistry::Instance().Add(METRIC_E::CHANNELS_ALLOCATED,
+                                    -m_channelsInUse);
+  };
 };  // Class ConnectionBase
 }  // Namespace connection
 }  // Namespace HareCpp
 
-#endif  // _CONNECTION_BASE_H_
\ No newline at end of file
+#endif  // _CONNECTION_BASE_H_
@@ -0,0 +1,131 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CONNECTION_POOL_H_
+#define _CONNECTION_POOL_H_
+
+#include "ConnectionBase.hpp"
+#include "pch.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+namespace HareCpp {
+namespace connection {
+
+/**
+ * ConnectionPool is a process wide store of ConnectionBase objects that can be
+ * shared between Producers and Consumers.  Instead of each object opening its
+ * own TCP connection (login, heartbeat and all), Acquire() hands back an
+ * existing connection to the same broker/credentials that still has room for
+ * more channels, and only creates a new one when all of them are full.
+ *
+ * Channels themselves are allocated by the ConnectionBase (AllocateChannel),
+ * so every user of a shared connection gets its own channel numbers.
+ *
+ * The pool only keeps weak references, a connection goes away once the last
+ * Producer/Consumer using it is destroyed.
+ *
+ * Usage:
+ *   auto conn = connection::ConnectionPool::Instance().Acquire("rabbit-serv");
+ *   producer.Initialize(conn);
+ *   consumer.Initialize(connection::ConnectionPool::Instance().Acquire(
+ *       "rabbit-serv"));
+ */
+class ConnectionPool {
+ private:
+  ConnectionPool() : m_channelsPerConnection(DEFAULT_CHANNELS_PER_CONNECTION){};
+
+  /**
+   * Connections are only shared between identical broker/credential
+   * combinations, this builds the lookup key for one
+   */
+  static std::string poolKey(const std::string& hostname, int port,
+                             const std::string& username,
+                             const std::string& password);
+
+  /**
+   * Connections handed out so far, grouped by poolKey
+   */
+  std::unordered_map<std::string,
+                     std::vector<std::weak_ptr<ConnectionBase> > >
+      m_connections;
+
+  /**
+   * How many channels a connection may carry before Acquire() opens a new one
+   */
+  int m_channelsPerConnection;
+
+  mutable std::mutex m_poolMutex;
+
+ public:
+  static constexpr int DEFAULT_CHANNELS_PER_CONNECTION = 64;
+
+  /**
+   * The one pool per process
+   */
+  static ConnectionPool& Instance();
+
+  /**
+   * Get a connection to the broker, shared with whoever else asked for the
+   * same broker/credentials, as long as its Load() is below
+   * ChannelsPerConnection().  A Producer/Consumer counts towards the load
+   * from Initialize() on, before it has allocated any channels, so ones
+   * initialized back to back are spread out.  The connection is not
+   * established here, the Producer/Consumer will Connect() it when started.
+   *
+   * @returns shared ConnectionBase, never nullptr
+   */
+  std::shared_ptr<ConnectionBase> Acquire(
+      const std::string& hostname = "localhost", int port = 5672,
+      const std::string& username = "guest",
+      const std::string& password = "guest");
+
+  /**
+   * Set the number of channels one connection should carry.  Only affects
+   * future Acquire() calls.
+   *
+   * @param [in] channels : channels per connection (minimum 1)
+   */
+  void SetChannelsPerConnection(int channels);
+
+  int ChannelsPerConnection() const;
+
+  /**
+   * Number of pooled connections still in use by somebody
+   */
+  int ConnectionCount();
+
+  ConnectionPool(const ConnectionPool&) = delete;
+  ConnectionPool& operator=(const ConnectionPool&) = delete;
+};
+
+}  // namespace connection
+}  // namespace HareCpp
+
+#endif  // _CONNECTION_POOL_H_
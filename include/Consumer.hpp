@@ -30,10 +30,13 @@
 #define _CONSUMER_H_
 
 #include "ChannelHandler.hpp"
+#include "Codec.hpp"
 #include "ConnectionBase.hpp"
 #include "Message.hpp"
+#include "TrafficCapture.hpp"
 #include "pch.hpp"
 
+#include <atomic>
 #include <future>
 #include <mutex>
 #include <queue>
@@ -92,6 +95,20 @@ class Consumer {
    */
   std::shared_ptr<connection::ConnectionBase> m_connection;
 
+  /**
+   * Our id on m_connection, which may be shared with other Producers and
+   * Consumers (see ConnectionPool).  Subscription channels are allocated
+   * under this id, and only deliveries on them are consumed by us.
+   */
+  int m_clientId;
+
+  /**
+   * ConnectionBase::Generation() consumption was last started on.  When it
+   * changes the (shared) connection was re-established by somebody else and
+   * our queues need setting up again.  0 means not started.
+   */
+  unsigned int m_connectionGeneration;
+
   /**
    * Mutex used throughout the class
    */
@@ -116,6 +133,37 @@ class Consumer {
   void thread();
   std::thread m_consumerThread;
 
+  /**
+   * CPUs the consumer thread is pinned to when started, empty for none
+   */
+  std::vector<int> m_cpuAffinity;
+
+  /**
+   * Added to the send time of stamped messages before working out their
+   * one-way latency, see SetClockOffset()/SetClockOffsetHook().  The hook is
+   * guarded by m_consumerMutex.
+   */
+  std::atomic<int64_t> m_clockOffsetNanos;
+  TD_ClockOffset m_clockOffsetHook;
+
+  /**
+   * Where every delivery is recorded, see SetCapture().  Swapped with
+   * std::atomic_store so the consumer thread needn't take a lock per message.
+   */
+  std::shared_ptr<TrafficCapture> m_capture;
+
+  /**
+   * Publish to arrival of a message carrying SEND_TIME_HEADER, corrected by
+   * the clock offset.  Negative clock skew beyond the offset counts as 0.
+   *
+   * @param [in] message : the delivered message
+   * @param [in] sentNanos : its SEND_TIME_HEADER
+   * @param [in] receivedNanos : LatencyHistogram::Now() when it arrived, 0 if
+   * unknown
+   */
+  int64_t oneWayLatency(const Message& message, int64_t sentNanos,
+                        uint64_t receivedNanos) const;
+
   /**
    *  Binds and consumes a queue/exchange
    *  If a channel exception is received, the channel is added to
@@ -245,7 +293,12 @@ class Consumer {
   /**
    * Default constructor
    */
-  Consumer() : m_isInitialized(false), m_threadRunning(false){};
+  Consumer()
+      : m_isInitialized(false),
+        m_clientId(0),
+        m_connectionGeneration(0),
+        m_threadRunning(false),
+        m_clockOffsetNanos(0){};
 
   /**
    * Start() and Stop() the main consumer thread
@@ -274,6 +327,36 @@ class Consumer {
       TD_Callback f,
       helper::queueProperties queueProps = helper::queueProperties());
 
+  /**
+   * Subscribe to values of a type described with HARE_SCHEMA().  Each one is
+   * decoded from the payload into a T on the stack before f is called with
+   * it, T needs a default constructor.  Messages of the wrong length or with
+   * another content type are logged and dropped.
+   *
+   * @param [in] exchange : the name of the exchange we are subscribing to.
+   * @param [in] binding_key : the binding key to a particular exchange route.
+   * @param [in] f : callback function (void CALLBACK(const T& value,
+   * const HareCpp::Message& message)).
+   * @param [in] queueProps : as for Subscribe() taking a TD_Callback
+   */
+  template <typename T>
+  typename std::enable_if<Schema<T>::DESCRIBED, HARE_ERROR_E>::type Subscribe(
+      const std::string& exchange, const std::string& binding_key,
+      std::function<void(const T&, const Message&)> f,
+      helper::queueProperties queueProps = helper::queueProperties()) {
+    return Subscribe(
+        exchange, binding_key,
+        TD_Callback([f](const Message& message) {
+          T value;
+          if (hare_decode(message, value)) {
+            f(value, message);
+          } else {
+            LOG(LOG_WARN, "Dropped a message not matching the type subscribed");
+          }
+        }),
+        queueProps);
+  }
+
   /**
    * Intialize function
    *
@@ -291,6 +374,18 @@ class Consumer {
                           const std::string& username = "guest",
                           const std::string& password = "guest");
 
+  /**
+   * Intialize function using an existing connection, usually one shared with
+   * other Producers/Consumers from connection::ConnectionPool::Acquire().
+   * Subscriptions get their own channels on that connection.
+   *
+   * @param [in] connection : connection to consume on
+   *
+   * @returns HARE_ERROR_E
+   */
+  HARE_ERROR_E Initialize(
+      std::shared_ptr<connection::ConnectionBase> connection);
+
   /**
    * Restart function
    *
@@ -300,6 +395,77 @@ class Consumer {
    */
   HARE_ERROR_E Restart();
 
+  /**
+   * Pin the consumer thread to the given CPUs, straight away if it is running
+   * and on every Start() after.  An empty list leaves later starts unpinned.
+   *
+   * @param [in] cpus : CPU numbers the thread may run on
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS for a CPU that doesn't exist
+   */
+  HARE_ERROR_E SetCpuAffinity(const std::vector<int>& cpus);
+
+  /**
+   * Time from a delivery being read off the broker socket to its callback
+   * starting, across all subscriptions.  Snapshot() it or Reset() it
+   * whenever, from any thread.
+   *
+   * @returns the histogram, in nanoseconds
+   */
+  LatencyHistogram& DispatchDelayHistogram();
+
+  /**
+   * How long the callback of one subscription takes per message
+   *
+   * @param [in] exchange : exchange given to Subscribe()
+   * @param [in] binding_key : binding key given to Subscribe()
+   * @returns the histogram in nanoseconds, nullptr if there is no such
+   * subscription
+   */
+  std::shared_ptr<LatencyHistogram> CallbackDurationHistogram(
+      const std::string& exchange, const std::string& binding_key) const;
+
+  /**
+   * Publish to arrival of the messages of one subscription that were sent by
+   * a Producer with SetSendTimeStamping() on.  Both clocks are wall clocks,
+   * so across hosts this is only as good as their synchronisation plus
+   * whatever SetClockOffset()/SetClockOffsetHook() correct for.
+   *
+   * @param [in] exchange : exchange given to Subscribe()
+   * @param [in] binding_key : binding key given to Subscribe()
+   * @returns the histogram in nanoseconds, nullptr if there is no such
+   * subscription
+   */
+  std::shared_ptr<LatencyHistogram> OneWayLatencyHistogram(
+      const std::string& exchange, const std::string& binding_key) const;
+
+  /**
+   * Nanoseconds to add to every send time to bring it onto this host's clock
+   * (our clock minus the sender's), e.g. as measured by NTP or PTP.  Used
+   * when no hook is set.
+   *
+   * @param [in] offsetNanos : the offset, 0 by default
+   */
+  void SetClockOffset(int64_t offsetNanos);
+
+  /**
+   * Work the clock offset out per message instead, for senders on several
+   * hosts (tell them apart by app_id, a header, the binding...).  Called on
+   * the consumer thread for every stamped message.  nullptr goes back to the
+   * fixed offset.
+   *
+   * @param [in] hook : returns the offset for a message, in nanoseconds
+   */
+  void SetClockOffsetHook(TD_ClockOffset hook);
+
+  /**
+   * Record every message delivered to this Consumer, before its callback is
+   * called, e.g. to replay it later with TrafficReplay.  The capture may be
+   * shared with other Consumers.  nullptr stops recording.
+   *
+   * @param [in] capture : an open TrafficCapture
+   */
+  void SetCapture(std::shared_ptr<TrafficCapture> capture);
+
   /**
    * Copy Constructor
    *
@@ -314,7 +480,10 @@ class Consumer {
    */
   ~Consumer() {
     if (m_threadRunning) Stop();
-    if (m_isInitialized) m_connection->CloseConnection();
+    if (m_isInitialized) {
+      m_connection->Disconnect(m_clientId);
+      m_connection->UnregisterClient(m_clientId);
+    }
     m_isInitialized = false;
   };
 
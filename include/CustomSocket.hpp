@@ -0,0 +1,157 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _CUSTOM_SOCKET_HPP_
+#define _CUSTOM_SOCKET_HPP_
+
+#include "pch.hpp"
+
+#include <sys/time.h>
+#include <sys/types.h>
+
+extern "C" {
+/**
+ * rabbitmq-c's socket interface (librabbitmq/amqp_socket.h).  It isn't
+ * installed with the public headers, but amqp_tcp_socket_new() and
+ * amqp_ssl_socket_new() are built on exactly this table and it hasn't changed
+ * since rabbitmq-c 0.5.  rabbitmq-c only ever looks at klass.
+ */
+typedef ssize_t (*hare_socket_send_fn)(void *, const void *, size_t, int);
+typedef ssize_t (*hare_socket_recv_fn)(void *, void *, size_t, int);
+typedef int (*hare_socket_open_fn)(void *, const char *, int,
+                                   const struct timeval *);
+typedef int (*hare_socket_close_fn)(void *, int);
+typedef int (*hare_socket_get_sockfd_fn)(void *);
+typedef void (*hare_socket_delete_fn)(void *);
+
+struct hare_socket_class_t {
+  hare_socket_send_fn send;
+  hare_socket_recv_fn recv;
+  hare_socket_open_fn open;
+  hare_socket_close_fn close;
+  hare_socket_get_sockfd_fn get_sockfd;
+  hare_socket_delete_fn destroy;
+};
+
+void amqp_set_socket(amqp_connection_state_t state, amqp_socket_t *socket);
+}
+
+namespace HareCpp {
+namespace connection {
+
+// From rabbitmq-c's amqp_socket.h/amqp_private.h, see hare_socket_class_t
+constexpr int AMQP_SOCKET_FLAG_MORE = 1;
+constexpr int AMQP_SOCKET_NEED_READ = -0x1301;
+
+/**
+ * Base for sockets rabbitmq-c talks to the broker through in place of its own
+ * TCP socket.  Attach() hands the socket to a connection, which then owns it
+ * and deletes it from amqp_destroy_connection().
+ *
+ * rabbitmq-c waits for PollFd() to become readable whenever Recv() returns
+ * AMQP_SOCKET_NEED_READ, so it doesn't have to be the socket itself (see
+ * UringSocket), Fd() is the socket for setsockopt() and friends.
+ */
+class CustomSocket {
+ public:
+  CustomSocket();
+  virtual ~CustomSocket(){};
+
+  CustomSocket(const CustomSocket &) = delete;
+  CustomSocket &operator=(const CustomSocket &) = delete;
+
+  /**
+   * Make this the socket conn sends and receives through.  conn owns it from
+   * here on.
+   *
+   * @param [in] conn : connection without a socket yet
+   * @returns the socket as rabbitmq-c sees it, for amqp_socket_open() etc.
+   */
+  amqp_socket_t *Attach(amqp_connection_state_t conn);
+
+  /**
+   * rabbitmq-c's view of this socket, valid once constructed
+   */
+  amqp_socket_t *Socket();
+
+  /**
+   * Same contracts as rabbitmq-c's TCP socket: Send() returns the bytes it
+   * took (AMQP_SOCKET_FLAG_MORE says more of the frame follows), Recv() the
+   * bytes read, AMQP_SOCKET_NEED_READ when there is nothing yet, or an
+   * amqp_status_enum.  Open() and Close() return AMQP_STATUS_OK or an
+   * amqp_status_enum.
+   */
+  virtual ssize_t Send(const void *buffer, size_t length, int flags) = 0;
+  virtual ssize_t Recv(void *buffer, size_t length, int flags) = 0;
+  virtual int Open(const char *host, int port,
+                   const struct timeval *timeout) = 0;
+  virtual int Close(bool force) = 0;
+
+  virtual int PollFd() const = 0;
+  virtual int Fd() const = 0;
+
+  /**
+   * Push out anything Send() is still holding on to.  Sockets that write
+   * straight away have nothing to do.
+   *
+   * @returns HARE_ERROR_E, SERVER_CONNECTION_FAILURE if the socket failed
+   */
+  virtual HARE_ERROR_E Flush() { return HARE_ERROR_E::ALL_GOOD; }
+
+  /**
+   * System calls made sending and receiving, for comparing transports
+   */
+  uint64_t SyscallCount() const { return m_syscalls; }
+
+ protected:
+  /**
+   * send()/recv() on a blocking socket with rabbitmq-c's TCP socket
+   * semantics, counted in m_syscalls.  Receives don't block, they return
+   * AMQP_SOCKET_NEED_READ for rabbitmq-c to poll.
+   */
+  ssize_t plainSend(int fd, const void *buffer, size_t length, int flags);
+  ssize_t plainRecv(int fd, void *buffer, size_t length);
+
+  uint64_t m_syscalls;
+
+ private:
+  // Laid out like rabbitmq-c's amqp_socket_t, with us tacked on the end
+  struct socketHandle {
+    const hare_socket_class_t *klass;
+    CustomSocket *m_owner;
+  };
+  socketHandle m_handle;
+
+  static const hare_socket_class_t s_class;
+
+  static CustomSocket *owner(void *self);
+};
+
+}  // namespace connection
+}  // namespace HareCpp
+
+#endif
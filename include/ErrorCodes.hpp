@@ -117,6 +117,42 @@ inline bool noError(HARE_ERROR_E retCode) {
   return (HARE_ERROR_E::ALL_GOOD == retCode);
 };
 
+/**
+ * Number of HARE_ERROR_E values, for tables indexed by them
+ */
+constexpr unsigned int HARE_ERROR_COUNT =
+    static_cast<unsigned int>(HARE_ERROR_E::NO_RPC_REPLY) + 1;
+
+/**
+ * Name of an error code as written in the enum, for logs and metrics
+ */
+inline const char* errorString(HARE_ERROR_E retCode) {
+  static const char* const names[HARE_ERROR_COUNT] = {
+      "ALL_GOOD",
+      "INVALID_AMQP_VERSION",
+      "TIMEOUT_OCCURED",
+      "PUBLISH_ERROR",
+      "NOT_INITIALIZED",
+      "INITIALIZE_FAILURE",
+      "INVALID_PARAMETERS",
+      "PRODUCER_CREATION_FAILED",
+      "CONSUMER_CREATION_FAILED",
+      "THREAD_ALREADY_RUNNING",
+      "THREAD_NOT_RUNNING",
+      "SERVER_CONNECTION_FAILURE",
+      "SERVER_AUTHENTICATION_FAILURE",
+      "SERVER_EXCEPTION_RESPONSE",
+      "UNABLE_TO_SUBSCRIBE",
+      "PRODUCER_QUEUE_FULL",
+      "UNABLE_TO_OPEN_CHANNEL",
+      "UNABLE_TO_CLOSE_CHANNEL",
+      "CHANNEL_EXCEPTION",
+      "NO_RPC_REPLY",
+  };
+  const unsigned int index = static_cast<unsigned int>(retCode);
+  return index < HARE_ERROR_COUNT ? names[index] : "UNKNOWN";
+}
+
 inline bool serverFailure(HARE_ERROR_E retCode) {
   return (retCode == HARE_ERROR_E::SERVER_CONNECTION_FAILURE ||
           retCode == HARE_ERROR_E::SERVER_EXCEPTION_RESPONSE);
@@ -0,0 +1,178 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _EVENT_LOG_H_
+#define _EVENT_LOG_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "pch.hpp"
+
+namespace HareCpp {
+
+/**
+ * What an event log record is about, and what its m_value holds
+ */
+enum class EVENT_E : uint16_t {
+  NONE,
+  CONNECTED,                 // connection generation
+  CONNECT_FAILED,            // HARE_ERROR_E
+  DISCONNECTED,              // 0
+  CHANNEL_OPENED,            // 0
+  CHANNEL_CLOSED,            // 0
+  CHANNEL_CLOSED_BY_BROKER,  // AMQP reply code
+  RPC_SENT,                  // AMQP method number
+  RPC_REPLY,                 // HARE_ERROR_E
+  PUBLISHED,                 // messages written in one batch
+  PUBLISH_FAILED,            // messages not written in one batch
+  DELIVERED,                 // payload bytes
+  CALLBACK,                  // nanoseconds spent in the callback
+  COUNT
+};
+
+/**
+ * Name of an event type, as the decoder prints it
+ */
+const char* eventString(EVENT_E type);
+
+/**
+ * Always-on binary trace of what the connections are doing, for working out
+ * afterwards what happened to a process.
+ *
+ * Every event is one fixed size record in a ring of records in a memory
+ * mapped file, so recording is a fetch_add and a 32 byte store, and the file
+ * outlives a crash.  Once the ring is full the oldest records are
+ * overwritten.  Decode() (or the harecpp_eventlog tool) turns a file into
+ * text, one line per event, oldest first.
+ *
+ * Nothing is recorded, at the cost of one load per event, until Open().
+ */
+class EventLog {
+ public:
+  static EventLog& Instance();
+
+  /**
+   * Start recording into a new ring file at path
+   *
+   * @param [in] path : file to create (or overwrite)
+   * @param optional [in] records : ring size, rounded up to a power of two
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if the file can't be mapped,
+   * THREAD_ALREADY_RUNNING if already recording
+   */
+  HARE_ERROR_E Open(const std::string& path,
+                    uint32_t records = EVENT_LOG_DEFAULT_RECORDS);
+
+  /**
+   * Stop recording.  The file keeps what was recorded; it stays mapped, so
+   * an event being recorded meanwhile can't fault.
+   */
+  void Close();
+
+  bool IsOpen() const {
+    return m_ring.load(std::memory_order_acquire) != nullptr;
+  }
+
+  /**
+   * Record one event
+   *
+   * @param [in] type : what happened
+   * @param [in] connection : ConnectionBase::EventLogId() it happened on, 0
+   * if none
+   * @param [in] channel : channel it happened on, 0 if none
+   * @param [in] value : see EVENT_E
+   */
+  void Record(EVENT_E type, uint32_t connection, uint16_t channel,
+              int64_t value) {
+    auto ring = m_ring.load(std::memory_order_acquire);
+    if (nullptr == ring) return;
+    record(*ring, type, connection, channel, value);
+  }
+
+  /**
+   * Write the events in a ring file as text, one per line, oldest first
+   *
+   * @param [in] path : ring file written by Open()
+   * @param [in] out : where the text goes
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if it isn't an event log
+   */
+  static HARE_ERROR_E Decode(const std::string& path, std::ostream& out);
+
+  /**
+   * Ring file layout: the header, then m_capacity records.  A writer takes
+   * the next number from m_written, fills record m_written % m_capacity and
+   * sets its m_sequence to the number + 1 last; a record whose m_sequence
+   * doesn't match its position is torn or overwritten and is skipped.
+   */
+  struct fileHeader {
+    char m_magic[8];  // "HAREEVNT"
+    uint32_t m_version;
+    uint32_t m_capacity;
+    std::atomic<uint64_t> m_written;
+    // The same moment on both clocks, to put wall clock times on records
+    int64_t m_openedRealtimeNanos;
+    uint64_t m_openedMonotonicNanos;
+    uint32_t m_pid;
+    uint32_t m_reserved;
+  };
+  struct eventRecord {
+    std::atomic<uint64_t> m_sequence;
+    uint64_t m_monotonicNanos;
+    int64_t m_value;
+    uint32_t m_connection;
+    uint16_t m_type;
+    uint16_t m_channel;
+  };
+
+  EventLog(const EventLog&) = delete;
+  EventLog& operator=(const EventLog&) = delete;
+
+ private:
+  struct mappedRing {
+    fileHeader* m_header;
+    eventRecord* m_records;
+    uint64_t m_mask;
+  };
+
+  EventLog();
+  ~EventLog() = default;
+
+  static void record(mappedRing& ring, EVENT_E type, uint32_t connection,
+                     uint16_t channel, int64_t value);
+
+  // Never freed (nor unmapped), see Close()
+  std::atomic<mappedRing*> m_ring;
+  std::mutex m_openMutex;
+};
+
+}  // namespace HareCpp
+
+#endif  // _EVENT_LOG_H_
@@ -0,0 +1,195 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _HEADERS_TABLE_H_
+#define _HEADERS_TABLE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "pch.hpp"
+
+namespace HareCpp {
+
+/**
+ * A header name or string handed to the headers API, from a std::string or
+ * a C string, neither of them copied
+ */
+struct HeaderText {
+  HeaderText(const char* text) : m_data(text), m_length(strlen(text)){};
+  HeaderText(const std::string& text)
+      : m_data(text.data()), m_length(text.size()){};
+  HeaderText(const char* data, size_t length)
+      : m_data(data), m_length(length){};
+  const char* m_data;
+  size_t m_length;
+};
+
+/**
+ * Find a key in a table without copying anything, the first entry with it
+ *
+ * @param [in] table : the table searched, nested tables aren't
+ * @param [in] key : the key's bytes, no '\0' needed
+ * @param [in] length : the key's length
+ * @returns the entry's value inside table, nullptr if there isn't one
+ */
+inline const amqp_field_value_t* hare_table_find(const amqp_table_t& table,
+                                                 const char* key,
+                                                 size_t length) {
+  for (int i = 0; i < table.num_entries; i++) {
+    const amqp_bytes_t& entryKey = table.entries[i].key;
+    if (entryKey.len == length && 0 == memcmp(entryKey.bytes, key, length)) {
+      return &table.entries[i].value;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * A field value of any of the integer kinds (and booleans and timestamps) as
+ * an int64_t.  An unsigned 64 bit value past INT64_MAX wraps.
+ *
+ * @returns false, leaving integer alone, for any other kind
+ */
+bool hare_field_int(const amqp_field_value_t& value, int64_t& integer);
+
+/**
+ * The bytes of a string (AMQP_FIELD_KIND_UTF8) or byte array field, not
+ * copied
+ *
+ * @returns false, leaving bytes alone, for any other kind
+ */
+bool hare_field_bytes(const amqp_field_value_t& value, amqp_bytes_t& bytes);
+
+/**
+ * HeadersTable
+ *
+ * An amqp_table_t that owns everything in it, entries, keys, strings, nested
+ * tables and arrays, in a single allocation.  Copying one is one allocation
+ * as well.  Messages keep their headers in one, see Message::SetHeaders(),
+ * and build them with a HeadersBuilder.
+ */
+class HeadersTable {
+ public:
+  HeadersTable() : m_arena(nullptr), m_table(amqp_empty_table){};
+
+  /**
+   * A copy of table and everything it points to
+   */
+  explicit HeadersTable(const amqp_table_t& table);
+
+  HeadersTable(const HeadersTable& copiedFrom);
+  HeadersTable(HeadersTable&& movedFrom) noexcept;
+  HeadersTable& operator=(const HeadersTable& copiedFrom);
+  HeadersTable& operator=(HeadersTable&& movedFrom) noexcept;
+
+  ~HeadersTable() { free(m_arena); }
+
+  const amqp_table_t& Table() const { return m_table; }
+
+  int Size() const { return m_table.num_entries; }
+
+  /**
+   * See hare_table_find(), returns a value inside this table
+   */
+  const amqp_field_value_t* Find(const HeaderText& key) const {
+    return hare_table_find(m_table, key.m_data, key.m_length);
+  }
+
+ private:
+  friend class HeadersBuilder;
+
+  void* m_arena;
+  amqp_table_t m_table;
+};
+
+/**
+ * HeadersBuilder
+ *
+ * Builds a HeadersTable an entry at a time into one growing arena, the
+ * entries from its start and their keys and strings from its end.  The
+ * first Add allocates HEADERS_ARENA_BYTES, which a table of ten or so short
+ * headers fits in, and Build() hands that same allocation to the
+ * HeadersTable.  Nested tables and arrays are for HeadersTable(amqp_table_t)
+ * to copy, they can't be added here.
+ *
+ * E.g. message.SetHeaders(HeadersBuilder().AddString("region", "eu")
+ *                                          .AddInt("attempt", 2).Build());
+ */
+class HeadersBuilder {
+ public:
+  HeadersBuilder() : m_arena(nullptr), m_capacity(0), m_entries(0),
+                     m_bytes(0){};
+  HeadersBuilder(const HeadersBuilder&) = delete;
+  HeadersBuilder& operator=(const HeadersBuilder&) = delete;
+  ~HeadersBuilder() { free(m_arena); }
+
+  HeadersBuilder& AddString(const HeaderText& key, const HeaderText& value);
+  HeadersBuilder& AddBytes(const HeaderText& key, const void* bytes,
+                           size_t length);
+  HeadersBuilder& AddInt(const HeaderText& key, int64_t value);
+  HeadersBuilder& AddDouble(const HeaderText& key, double value);
+  HeadersBuilder& AddBool(const HeaderText& key, bool value);
+  HeadersBuilder& AddTimestamp(const HeaderText& key, uint64_t seconds);
+
+  /**
+   * Any value but a table or an array, whose bytes (for strings) are copied
+   */
+  HeadersBuilder& AddValue(const HeaderText& key,
+                           const amqp_field_value_t& value);
+
+  int Size() const { return m_entries; }
+
+  /**
+   * Everything added so far as a HeadersTable, leaving the builder empty
+   */
+  HeadersTable Build();
+
+ private:
+  /**
+   * Make room for another entry and bytes of data, copy the key in
+   *
+   * @returns the new entry, nullptr if no memory; data points at its bytes
+   */
+  amqp_table_entry_t* add(const HeaderText& key, size_t bytes, char*& data);
+
+  bool grow(size_t needed);
+
+  char* m_arena;
+  size_t m_capacity;
+  int m_entries;
+  // Used at the end of the arena, by keys and strings
+  size_t m_bytes;
+};
+
+}  // namespace HareCpp
+
+#endif  // _HEADERS_TABLE_H_
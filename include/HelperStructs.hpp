@@ -25,8 +25,13 @@
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
+#include "HeadersTable.hpp"
+#include "SharedPayload.hpp"
+#include "Utils.hpp"
 #include "pch.hpp"
 
+#include <vector>
+
 #ifndef _HELPER_STRUCTS_H_
 #define _HELPER_STRUCTS_H_
 
@@ -48,7 +53,18 @@ struct RawMessage {
   int channel;
   amqp_bytes_t routing_key;
   amqp_basic_properties_t properties;
+  // The headers properties points at, copied from the Message sent
+  HeadersTable headers;
   amqp_bytes_t message;
+  // When set, message points into it rather than at a copy of its own
+  SharedPayload shared_payload;
+  // When set, the body is these one after the other, message.len long with
+  // message.bytes nullptr
+  std::vector<PayloadFragment> fragments;
+  // LatencyHistogram::Now() when Producer::Send() queued it, 0 if unknown
+  uint64_t enqueued_nanos = 0;
+  // Add SEND_TIME_HEADER as it is published
+  bool stamp_send_time = false;
 };
 
 /**
@@ -60,7 +76,15 @@ struct RawMessage {
  * @returns void
  */
 inline void hare_free_message_risky(RawMessage& rawMessage) {
-  amqp_bytes_free(rawMessage.message);
+  hare_basic_properties_free(rawMessage.properties);
+  rawMessage.headers = HeadersTable();
+  if (rawMessage.shared_payload.Empty() && rawMessage.fragments.empty()) {
+    amqp_bytes_free(rawMessage.message);
+  } else {
+    rawMessage.shared_payload.Reset();
+    rawMessage.fragments.clear();
+  }
+  rawMessage.message = amqp_empty_bytes;
   amqp_bytes_free(rawMessage.routing_key);
   amqp_bytes_free(rawMessage.exchange);
 };
@@ -83,6 +107,78 @@ struct loginCredentials {
   std::string m_password;
 };
 
+/**
+ * Connection parameters proposed to the broker during login (connection.tune).
+ * The broker may lower them, the negotiated values are available from the
+ * connection once it is established.
+ */
+struct connectionTuning {
+  connectionTuning()
+      : m_channelMax(0),
+        m_frameMax(DEFAULT_FRAME_MAX),
+        m_heartbeatSeconds(DEFAULT_HEARTBEAT_SECONDS),
+        m_autoFrameMax(false){};
+  // Highest channel number, 0 takes whatever the broker allows
+  int m_channelMax;
+  // Largest frame in bytes, bodies bigger than this are split into frames
+  int m_frameMax;
+  // Heartbeat interval, the connection is dropped after two are missed.  0
+  // disables heartbeats.
+  int m_heartbeatSeconds;
+  // Pick m_frameMax on reconnect from the payload sizes published so far
+  bool m_autoFrameMax;
+};
+
+/**
+ * When small writes are pushed onto the wire.  NO_DELAY sends every write
+ * straight away (rabbitmq-c's default), CORK_BATCHES holds everything written
+ * during one round of the connection's I/O thread and sends it together,
+ * NAGLE leaves the kernel to coalesce writes while an ack is outstanding.
+ */
+enum class tcpFlushStrategy { NO_DELAY, CORK_BATCHES, NAGLE };
+
+/**
+ * What carries the bytes to the broker.  TCP is rabbitmq-c's own socket,
+ * IO_URING batches sends and receives through io_uring (see UringSocket) and
+ * falls back to TCP where the kernel doesn't support it.  UNIX connects to
+ * socketOptions::m_unixPath instead of the host and port (see UnixSocket).
+ */
+enum class socketTransport { TCP, IO_URING, UNIX };
+
+/**
+ * Options applied to the broker socket once it is connected.  0 leaves the
+ * kernel's setting alone.
+ */
+struct socketOptions {
+  socketOptions()
+      : m_transport(socketTransport::TCP),
+        m_flush(tcpFlushStrategy::NO_DELAY),
+        m_sendBufferBytes(0),
+        m_receiveBufferBytes(0),
+        m_busyPollMicroseconds(0),
+        m_keepAlive(false),
+        m_keepAliveIdleSeconds(0),
+        m_keepAliveIntervalSeconds(0),
+        m_keepAliveProbes(0){};
+  socketTransport m_transport;
+  // Unix domain socket to connect to with socketTransport::UNIX, a leading
+  // '@' for an abstract socket
+  std::string m_unixPath;
+  tcpFlushStrategy m_flush;
+  // SO_SNDBUF/SO_RCVBUF, the kernel doubles these for its own bookkeeping
+  int m_sendBufferBytes;
+  int m_receiveBufferBytes;
+  // SO_BUSY_POLL, spin this long on the device queue before sleeping in a
+  // read.  Raising it above net.core.busy_read needs CAP_NET_ADMIN.
+  int m_busyPollMicroseconds;
+  // SO_KEEPALIVE and TCP_KEEPIDLE/TCP_KEEPINTVL/TCP_KEEPCNT, only used when
+  // m_keepAlive is set
+  bool m_keepAlive;
+  int m_keepAliveIdleSeconds;
+  int m_keepAliveIntervalSeconds;
+  int m_keepAliveProbes;
+};
+
 struct sslCredentials {
   std::string m_pathToCACert;
   std::string m_pathToClientKey;
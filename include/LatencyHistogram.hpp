@@ -0,0 +1,151 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace HareCpp {
+
+/**
+ * HDR-style histogram of latencies in nanoseconds.  Every power of two is
+ * split into LATENCY_SUB_BUCKETS linear buckets, so a recorded value is off by
+ * at most 1/16th (6.25%) at any magnitude, from 1 ns up to centuries.
+ *
+ * Record() is a bucket index computed from the highest set bit and two
+ * relaxed atomic adds, so it can be called from any thread on a hot path
+ * without a lock.  Snapshot() copies the counts out; a Record() racing with
+ * it lands in this snapshot or the next, never in neither.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int LATENCY_SUB_BUCKET_BITS = 4;
+  static constexpr int LATENCY_SUB_BUCKETS = 1 << LATENCY_SUB_BUCKET_BITS;
+  static constexpr int LATENCY_BUCKETS =
+      (64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS;
+
+  /**
+   * Counts copied out of a histogram at one point in time
+   */
+  struct snapshot {
+    snapshot() : m_count(0), m_sumNanos(0){};
+
+    /**
+     * Value below which the given fraction of the recorded values fall,
+     * reported as the top of its bucket
+     *
+     * @param [in] percentile : 0 to 100
+     * @returns nanoseconds, 0 if nothing was recorded
+     */
+    uint64_t Percentile(double percentile) const;
+
+    uint64_t MinNanos() const;
+    uint64_t MaxNanos() const;
+    double MeanNanos() const;
+
+    // Per bucket counts, see LatencyHistogram::BucketLowest()
+    std::vector<uint64_t> m_counts;
+    uint64_t m_count;
+    uint64_t m_sumNanos;
+  };
+
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  /**
+   * Count one latency
+   *
+   * @param [in] nanos : the latency in nanoseconds
+   */
+  void Record(uint64_t nanos) {
+    m_counts[BucketIndex(nanos)].fetch_add(1, std::memory_order_relaxed);
+    m_sumNanos.fetch_add(nanos, std::memory_order_relaxed);
+  }
+
+  /**
+   * Count the time from start (a Now() reading) until now
+   *
+   * @param [in] start : Now() at the start of the interval, 0 for unknown in
+   * which case nothing is recorded
+   */
+  void RecordSince(uint64_t start) {
+    if (0 == start) return;
+    const uint64_t now = Now();
+    Record(now > start ? now - start : 0);
+  }
+
+  snapshot Snapshot() const;
+
+  /**
+   * Snapshot and zero the counts in one go, so that nothing recorded in
+   * between is lost
+   */
+  snapshot SnapshotAndReset();
+
+  void Reset();
+
+  /**
+   * CLOCK_MONOTONIC in nanoseconds, what the intervals are measured with
+   */
+  static uint64_t Now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+  }
+
+  static int BucketIndex(uint64_t nanos) {
+    if (nanos < static_cast<uint64_t>(LATENCY_SUB_BUCKETS)) {
+      return static_cast<int>(nanos);
+    }
+    const int highestBit = 63 - __builtin_clzll(nanos);
+    const int shift = highestBit - LATENCY_SUB_BUCKET_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS +
+           static_cast<int>((nanos >> shift) & (LATENCY_SUB_BUCKETS - 1));
+  }
+
+  /**
+   * Smallest and largest values that land in a bucket
+   */
+  static uint64_t BucketLowest(int index);
+  static uint64_t BucketHighest(int index);
+
+ private:
+  std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> m_counts;
+  std::atomic<uint64_t> m_sumNanos;
+};
+
+}  // namespace HareCpp
+
+#endif  // _LATENCY_HISTOGRAM_H_
@@ -28,16 +28,58 @@
 #ifndef _LOGGER_H_
 #define _LOGGER_H_
 
+#include <stdint.h>
 #include <stdio.h>
 #include <time.h>
+#include <atomic>
+#include <functional>
 #include <string>
 
+/**
+ * Levels above this are compiled out: -DHARECPP_LOG_LEVEL=1 leaves only
+ * LOG_FATAL and LOG_ERROR in the library (and in anything else built with
+ * it).  By default everything is kept and SET_DEBUG_LEVEL() decides at run
+ * time.
+ */
+#ifndef HARECPP_LOG_LEVEL
+#define HARECPP_LOG_LEVEL 5
+#endif
+
 namespace HareCpp {
 
-#define LOG(a, b) LOG_FULL(a, b, __LINE__, __FILE__);
+/**
+ * Neither macro evaluates its message unless the level is enabled, so a
+ * disabled LOG costs a load and a compare (nothing, if compiled out).
+ * Enabled records are copied into the calling thread's ring and written out
+ * by the log writer thread, see ADD_LOG_SINK().
+ */
+#define LOG(a, b)                                  \
+  do {                                             \
+    if (HareCpp::LOG_ENABLED(a)) {                 \
+      HareCpp::LOG_FULL(a, b, __LINE__, __FILE__); \
+    }                                              \
+  } while (0);
+
+// printf style, formatted straight into the log record
+#define LOGF(a, ...)                                             \
+  do {                                                           \
+    if (HareCpp::LOG_ENABLED(a)) {                               \
+      HareCpp::LOG_FORMAT(a, __LINE__, __FILE__, __VA_ARGS__);   \
+    }                                                            \
+  } while (0);
 
 constexpr int LOG_MAX_CHAR_SIZE{80};
 
+// Longest message a log record holds, the rest is cut off
+constexpr int LOG_RECORD_MESSAGE_SIZE{240};
+
+// Records a thread can have waiting for the writer thread.  When its ring is
+// full further records are dropped (see LOG_DROPPED()), logging never blocks.
+constexpr int LOG_RING_RECORDS{256};
+
+// How often the writer thread looks for records if nobody wakes it
+constexpr int LOG_DRAIN_INTERVAL_MILLISECONDS{20};
+
 enum HARE_LOG_E {
   LOG_FATAL = 0,
   LOG_ERROR = 1,
@@ -48,11 +90,66 @@ enum HARE_LOG_E {
   LOG_NONE = 6
 };
 
+/**
+ * One log line as sinks see it
+ */
+struct logRecord {
+  int m_level;
+  int m_line;          // 0 from LOG_SIMPLE
+  const char* m_file;  // nullptr from LOG_SIMPLE
+  int64_t m_realtimeNanos;
+  unsigned int m_thread;  // numbered in the order threads first log
+  char m_message[LOG_RECORD_MESSAGE_SIZE];
+};
+
+typedef std::function<void(const logRecord&)> TD_LogSink;
+
+extern std::atomic<int> dbgLevel;
+
+inline bool LOG_ENABLED(int logLevel) {
+  const int level = dbgLevel.load(std::memory_order_relaxed);
+  return logLevel <= HARECPP_LOG_LEVEL && logLevel <= level &&
+         level != LOG_NONE;
+}
+
 extern void SET_DEBUG_LEVEL(int debugLevel);
 extern void LOG_SIMPLE(int logLevel, const char* str);
 extern void LOG_FULL(int logLevel, const char* str, int line, const char* file);
 extern void LOG_FULL(int logLevel, std::string str, int line, const char* file);
 extern void LOG_SIMPLE(int logLevel, std::string str);
+extern void LOG_FORMAT(int logLevel, int line, const char* file,
+                       const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/**
+ * Add somewhere for records to go.  Sinks are called on the log writer
+ * thread, one record at a time, in order for records from the same thread.
+ * CONSOLE_LOG_SINK is the only one to begin with.
+ *
+ * @param [in] sink : called with every record, must not call FLUSH_LOG() or
+ * change the sinks
+ */
+extern void ADD_LOG_SINK(const TD_LogSink& sink);
+
+/**
+ * Remove every sink, the console one included
+ */
+extern void CLEAR_LOG_SINKS();
+
+/**
+ * The default sink, prints to stdout
+ */
+extern void CONSOLE_LOG_SINK(const logRecord& record);
+
+/**
+ * Hand every record logged so far to the sinks before returning
+ */
+extern void FLUSH_LOG();
+
+/**
+ * Records dropped so far because a thread's ring was full
+ */
+extern uint64_t LOG_DROPPED();
 
 }  // namespace HareCpp
 #endif /*_LOGGER_H*/
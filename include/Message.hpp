@@ -29,9 +29,13 @@
 #ifndef _MESSAGE_H_
 #define _MESSAGE_H_
 
+#include "HeadersTable.hpp"
+#include "SharedPayload.hpp"
 #include "Utils.hpp"
 #include "pch.hpp"
 
+#include <vector>
+
 namespace HareCpp {
 
 class Message {
@@ -41,24 +45,95 @@ class Message {
 
   amqp_basic_properties_t m_properties;
 
+  // Payloads up to MESSAGE_INLINE_BYTES are kept here rather than allocated,
+  // m_body.bytes then points into it.  Always followed by a '\0'.
+  alignas(8) char m_inline[MESSAGE_INLINE_BYTES + 1];
+
+  // Set when the payload is shared, m_body.bytes then points into it
+  SharedPayload m_shared;
+
+  // Set when the payload is in pieces, the body is left unset then
+  std::vector<PayloadFragment> m_fragments;
+  size_t m_fragmentsLength;
+
+  // Headers set on or copied into this Message, m_properties.headers then
+  // is its table.  Empty when they are borrowed from an envelope.
+  HeadersTable m_headers;
+
+  /**
+   * Replace the payload with a copy of length bytes, inline if they fit.
+   * With bytes nullptr the payload is left for the caller to fill in.
+   */
+  void setBody(const void* bytes, size_t length);
+
+  /**
+   * Free the payload if it was allocated and drop any fragments, leaving the
+   * body unset
+   */
+  void releaseBody();
+
+  bool bodyIsInline() const { return m_body.bytes == m_inline; }
+
+  /**
+   * Make shared the payload, as SharePayload() does for an allocated one
+   */
+  void shareBody(const SharedPayload& shared);
+
+  /**
+   * Take other's payload and properties, leaving it blank.  Whatever this
+   * held must have been released already.
+   */
+  void takeFrom(Message& other) noexcept;
+
+  /**
+   * Set one of the short string properties to a copy of value
+   */
+  void setShortString(amqp_flags_t flag, amqp_bytes_t& field,
+                      const char* value, size_t length);
+
  public:
   /**
    * Constructor declarations
    */
-  explicit Message() : m_bodyHasBeenSet{false} { m_properties._flags = 0; };
+  explicit Message()
+      : m_body{0, nullptr}, m_bodyHasBeenSet{false}, m_fragmentsLength{0} {
+    m_properties._flags = 0;
+  };
   explicit Message(std::string&& message);
   explicit Message(const std::string& message);
+  /**
+   * The payload and short strings are copied, the headers are not: they are
+   * looked at where they are, in the envelope, which has to outlive the
+   * Message.  A copy of the Message copies them.
+   */
   explicit Message(const amqp_envelope_t& envelope);
+  explicit Message(const SharedPayload& payload);
 
   /**
    * Copy Constructor
    *
-   * Needs the logic to do full copy of properties and message body.
+   * Needs the logic to do full copy of properties and message body.  A
+   * shared payload is shared with the copy, not copied.
    */
   Message(const Message& copiedFrom);
 
-  Message& operator=(const Message&) = default;
+  /**
+   * Move Constructor
+   *
+   * Takes the payload and properties, an allocated payload without copying
+   * it.  movedFrom is left a blank Message.
+   */
+  Message(Message&& movedFrom) noexcept;
+
+  Message& operator=(const Message& copiedFrom);
 
+  Message& operator=(Message&& movedFrom) noexcept;
+
+  /**
+   * The Message owns the short strings in these and frees them, anything
+   * set through here must be malloc'd (amqp_bytes_malloc_dup()).  Headers
+   * set through here are neither copied nor freed, see SetHeaders().
+   */
   amqp_basic_properties_t* AmqpProperties() { return &m_properties; }
 
   /**
@@ -72,7 +147,8 @@ class Message {
   /**
    * Payload()
    *
-   * Returns a char* to the payload, or nullptr if body wasn't set
+   * Returns a char* to the payload, or nullptr if body wasn't set or is in
+   * fragments
    */
   const char* Payload() const;
 
@@ -80,14 +156,16 @@ class Message {
    * Bytes()
    *
    * Returns a pointer to the amqp_bytes_t used as the payload.
-   * This contains a len (length) and bytes (body) as void*
+   * This contains a len (length) and bytes (body) as void*, which may point
+   * inside the Message itself so is only good for as long as it is
    */
   const amqp_bytes_t* Bytes() const;
 
   /**
    * Length()
    *
-   * Returns length of the payload
+   * Returns length of the payload, all of its fragments together if it is in
+   * pieces
    */
   unsigned int Length() const;
 
@@ -130,10 +208,75 @@ class Message {
    */
   void SetPayload(void* payload, const int size);
 
+  /**
+   * Make room for a payload of length bytes to be written in place, inline
+   * if it fits, instead of building it elsewhere and copying it in
+   *
+   * @param [in] length : of the payload
+   * @returns where to write it, only good until the payload is next set,
+   * nullptr if it couldn't be allocated
+   */
+  char* AllocatePayload(size_t length);
+
+  /**
+   * SetPayload - sharing a SharedPayload
+   *
+   * @param [in] payload: the bytes to share, not copied
+   * @return void
+   */
+  void SetPayload(const SharedPayload& payload);
+
+  /**
+   * The payload as a SharedPayload, for sending it from several places
+   * without copying.  A payload too big to be kept inline is handed over
+   * rather than copied and the Message shares it from then on, a small one
+   * is copied.  Producer::Send() does this itself for big payloads.
+   *
+   * @returns SharedPayload, empty if body wasn't set
+   */
+  SharedPayload SharePayload();
+
+  bool PayloadIsShared() const { return false == m_shared.Empty(); }
+
+  /**
+   * AddFragment - retained
+   *
+   * Append a piece to a payload sent as several, so pieces built separately
+   * (a header struct, some metadata, a large block) go out one after the
+   * other without being put together first.  The publish writes them
+   * straight into the body frames.  The first fragment replaces a payload
+   * set any other way, setting one any other way drops the fragments.
+   *
+   * @param [in] fragment : shared, not copied, for as long as the Message or
+   * any publish of it needs it
+   * @return void
+   */
+  void AddFragment(const SharedPayload& fragment);
+
+  /**
+   * AddFragment - borrowed
+   *
+   * @param [in] bytes : neither copied nor held on to, it must stay valid
+   * until every Send() of this Message (or of a copy) has been published,
+   * see Producer::QueueSize()
+   * @param [in] length : number of bytes
+   * @return void
+   */
+  void AddFragment(const void* bytes, size_t length);
+
+  bool IsFragmented() const { return false == m_fragments.empty(); }
+
+  /**
+   * The pieces of the payload in order, empty unless it is in fragments
+   */
+  const std::vector<PayloadFragment>& Fragments() const { return m_fragments; }
+
   bool TimestampIsSet() const;
 
   /**
-   * Assumed Microseconds
+   * Seconds since the epoch, as AMQP defines it.  The connection sets it
+   * when publishing if it isn't set, see Producer::SetSendTimeStamping() for
+   * finer resolution.
    */
   void SetTimestamp(uint64_t timestamp);
 
@@ -148,11 +291,76 @@ class Message {
 
   bool HasCorrelationId();
 
+  /**
+   * SetContentType - the MIME type of the payload, see Codec.hpp
+   */
+  void SetContentType(const HeaderText& contentType);
+
+  const std::string ContentType() const;
+
+  bool ContentTypeIsSet() const;
+
+  /**
+   * Compare the content type without copying it out
+   *
+   * @returns true if it is set and is contentType
+   */
+  bool ContentTypeIs(const HeaderText& contentType) const;
+
+  /**
+   * SetHeaders - copying a table
+   *
+   * @param [in] headers: copied, nested tables and all, in one allocation
+   * @return void
+   */
+  void SetHeaders(const amqp_table_t& headers);
+
+  /**
+   * SetHeaders - taking a table, usually from HeadersBuilder::Build()
+   *
+   * @param [in] headers: moved in, not copied
+   * @return void
+   */
+  void SetHeaders(HeadersTable&& headers);
+
+  void ClearHeaders();
+
+  bool HasHeaders() const;
+
+  /**
+   * The headers, an empty table if there are none
+   */
+  const amqp_table_t& Headers() const;
+
+  /**
+   * Look a header up, nothing decoded or copied: received headers are
+   * searched where they are in the envelope
+   *
+   * @param [in] key : the header's name
+   * @returns its value inside the headers, nullptr if there is no such header
+   */
+  const amqp_field_value_t* Header(const HeaderText& key) const;
+
+  /**
+   * A header of any integer kind, see hare_field_int()
+   *
+   * @returns false if there is no such header or it isn't an integer
+   */
+  bool HeaderInt(const HeaderText& key, int64_t& value) const;
+
+  /**
+   * A string or byte array header, pointing into the headers
+   *
+   * @returns false if there is no such header or it isn't a string
+   */
+  bool HeaderBytes(const HeaderText& key, amqp_bytes_t& value) const;
+
   /**
    *  Default Destructor
    */
   ~Message() {
-    if (m_bodyHasBeenSet) free(m_body.bytes);
+    releaseBody();
+    hare_basic_properties_free(m_properties);
   }
 };
 
@@ -0,0 +1,252 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pch.hpp"
+
+namespace HareCpp {
+
+/**
+ * A counter (or up/down gauge) split into METRICS_SHARDS cache line sized
+ * slots.  Each thread always adds to the same slot, picked the first time it
+ * touches any counter, so threads updating the same metric don't bounce a
+ * cache line between them.  Reading sums the slots.
+ */
+class ShardedCounter {
+ public:
+  ShardedCounter() {
+    for (auto& slot : m_shards) slot.m_value.store(0);
+  }
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+  void Add(int64_t delta) {
+    m_shards[threadShard()].m_value.fetch_add(delta,
+                                              std::memory_order_relaxed);
+  }
+
+  int64_t Value() const {
+    int64_t total = 0;
+    for (auto& slot : m_shards) {
+      total += slot.m_value.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  /**
+   * The calling thread's slot, handed out round robin
+   */
+  static int threadShard() {
+    static std::atomic<int> nextShard(0);
+    static thread_local int shard = nextShard++ % METRICS_SHARDS;
+    return shard;
+  }
+
+ private:
+  struct alignas(64) slot {
+    std::atomic<int64_t> m_value;
+  };
+  std::array<slot, METRICS_SHARDS> m_shards;
+};
+
+/**
+ * What the library counts, see MetricsRegistry
+ */
+enum class METRIC_E : unsigned int {
+  MESSAGES_PUBLISHED,
+  BYTES_PUBLISHED,
+  MESSAGES_DELIVERED,
+  BYTES_DELIVERED,
+  // Messages waiting in Producer send queues
+  SEND_QUEUE_DEPTH,
+  // Deliveries read from the broker, not yet taken by their Consumer
+  INBOX_DEPTH,
+  CONNECTS,
+  RECONNECTS,
+  CONNECTIONS_OPEN,
+  CHANNELS_ALLOCATED,
+  CALLBACKS,
+  CALLBACK_NANOSECONDS,
+  COUNT
+};
+
+/**
+ * Process wide registry of the library's metrics: publish and delivery
+ * counts and bytes, queue depths, connects and reconnects, RPCs failed by
+ * HARE_ERROR_E, channels in use and time spent in Consumer callbacks.
+ *
+ * Updating is a relaxed atomic add on the calling thread's shard, reading
+ * never blocks an update.  There are two ways to get the numbers out without
+ * going near the hot path:
+ *
+ *  - StartPrometheusEndpoint() serves PrometheusText() over HTTP on a local
+ *    port, from a thread of its own.
+ *  - StartStatsFile() has a thread copy every value into a memory mapped
+ *    file once per interval (layout in statsFileHeader/statsFileEntry), which
+ *    a sidecar can read with ReadStatsFile() or its own mmap.
+ */
+class MetricsRegistry {
+ public:
+  /**
+   * The one registry per process
+   */
+  static MetricsRegistry& Instance();
+
+  void Add(METRIC_E metric, int64_t delta) {
+    m_metrics[static_cast<unsigned int>(metric)].Add(delta);
+  }
+
+  /**
+   * Count an RPC (or connect) that failed with the given code
+   */
+  void RpcError(HARE_ERROR_E retCode) {
+    const unsigned int index = static_cast<unsigned int>(retCode);
+    if (index < HARE_ERROR_COUNT) m_rpcErrors[index].Add(1);
+  }
+
+  int64_t Value(METRIC_E metric) const;
+  int64_t RpcErrors(HARE_ERROR_E retCode) const;
+
+  /**
+   * Every metric with its current value, named as in PrometheusText()
+   * including labels, e.g. harecpp_rpc_errors_total{code="TIMEOUT_OCCURED"}
+   */
+  std::vector<std::pair<std::string, int64_t> > Values() const;
+
+  /**
+   * Prometheus text exposition format (version 0.0.4)
+   */
+  std::string PrometheusText() const;
+
+  /**
+   * Serve PrometheusText() to any HTTP GET on address:port
+   *
+   * @param [in] port : port to listen on, 0 picks a free one (see
+   * PrometheusPort())
+   * @param optional [in] address : address to bind, loopback by default
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if it can't listen there,
+   * THREAD_ALREADY_RUNNING if it is already serving
+   */
+  HARE_ERROR_E StartPrometheusEndpoint(
+      int port, const std::string& address = "127.0.0.1");
+  void StopPrometheusEndpoint();
+
+  /**
+   * Port the endpoint is listening on, 0 when it isn't
+   */
+  int PrometheusPort() const;
+
+  /**
+   * Write every value into a memory mapped file at path, and keep doing so
+   * every intervalMilliseconds until StopStatsFile()
+   *
+   * @param [in] path : file to create (or overwrite)
+   * @param optional [in] intervalMilliseconds : how often it is refreshed
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if the file can't be mapped,
+   * THREAD_ALREADY_RUNNING if a file is already being written
+   */
+  HARE_ERROR_E StartStatsFile(const std::string& path,
+                              int intervalMilliseconds = 1000);
+  void StopStatsFile();
+
+  /**
+   * Read a file written by StartStatsFile(), retrying while it is being
+   * updated
+   *
+   * @param [in] path : the stats file
+   * @param [out] values : name and value of every metric in it
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if it isn't a stats file,
+   * TIMEOUT_OCCURED if it never held still long enough to be read
+   */
+  static HARE_ERROR_E ReadStatsFile(
+      const std::string& path,
+      std::vector<std::pair<std::string, int64_t> >& values);
+
+  /**
+   * Stats file layout: the header, then m_entryCount entries.  m_sequence is
+   * odd while the writer is updating the entries; a reader takes a copy
+   * between two equal, even readings of it.
+   */
+  struct statsFileHeader {
+    char m_magic[8];  // "HARESTAT"
+    uint32_t m_version;
+    uint32_t m_entryCount;
+    std::atomic<uint64_t> m_sequence;
+    uint64_t m_updatedNanos;  // CLOCK_REALTIME of the last update
+  };
+  struct statsFileEntry {
+    char m_name[120];  // nul terminated
+    int64_t m_value;
+  };
+
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+ private:
+  MetricsRegistry();
+  ~MetricsRegistry();
+
+  void prometheusThread();
+  void statsFileThread();
+  void writeStatsFile();
+
+  std::array<ShardedCounter, static_cast<unsigned int>(METRIC_E::COUNT)>
+      m_metrics;
+  std::array<ShardedCounter, HARE_ERROR_COUNT> m_rpcErrors;
+
+  // Prometheus endpoint
+  std::thread m_prometheusThread;
+  std::atomic<bool> m_prometheusRunning;
+  int m_listenFd;
+  int m_prometheusPort;
+
+  // Stats file
+  std::thread m_statsThread;
+  std::atomic<bool> m_statsRunning;
+  void* m_statsMap;
+  size_t m_statsMapSize;
+  int m_statsIntervalMilliseconds;
+
+  mutable std::mutex m_exportMutex;
+};
+
+}  // namespace HareCpp
+
+#endif  // _METRICS_H_
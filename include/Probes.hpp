@@ -0,0 +1,77 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/**
+ * USDT (statically defined tracing) probes, provider "harecpp", for perf,
+ * bpftrace or SystemTap to attach to at run time.  A probe nobody is
+ * attached to is a single nop; see tools/bpftrace for what can be done with
+ * them and the README for the list.
+ *
+ * They need systemtap's <sys/sdt.h> at build time (systemtap-sdt-dev or
+ * systemtap-sdt-devel), without it or with -DHARECPP_NO_USDT they compile to
+ * nothing.
+ */
+#if defined(__linux__) && !defined(HARECPP_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HARE_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef HARE_HAVE_USDT
+#define HARE_PROBE(name) DTRACE_PROBE(harecpp, name)
+#define HARE_PROBE1(name, a) DTRACE_PROBE1(harecpp, name, a)
+#define HARE_PROBE2(name, a, b) DTRACE_PROBE2(harecpp, name, a, b)
+#define HARE_PROBE3(name, a, b, c) DTRACE_PROBE3(harecpp, name, a, b, c)
+#define HARE_PROBE4(name, a, b, c, d) DTRACE_PROBE4(harecpp, name, a, b, c, d)
+#define HARE_PROBE5(name, a, b, c, d, e) \
+  DTRACE_PROBE5(harecpp, name, a, b, c, d, e)
+#else
+#define HARE_PROBE(name) \
+  do {                   \
+  } while (0)
+#define HARE_PROBE1(name, a) \
+  do {                       \
+  } while (0)
+#define HARE_PROBE2(name, a, b) \
+  do {                          \
+  } while (0)
+#define HARE_PROBE3(name, a, b, c) \
+  do {                             \
+  } while (0)
+#define HARE_PROBE4(name, a, b, c, d) \
+  do {                                \
+  } while (0)
+#define HARE_PROBE5(name, a, b, c, d, e) \
+  do {                                   \
+  } while (0)
+#endif
+
+#endif  // _PROBES_H_
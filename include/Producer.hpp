@@ -29,15 +29,19 @@
 #ifndef _PRODUCER_H_
 #define _PRODUCER_H_
 
+#include "Codec.hpp"
 #include "ConnectionBase.hpp"
+#include "LatencyHistogram.hpp"
 #include "Message.hpp"
 #include "pch.hpp"
 
+#include <condition_variable>
+#include <deque>
 #include <future>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace HareCpp {
 
@@ -132,18 +136,42 @@ class Producer {
   bool m_channelsConnected;
 
   /**
-   * Keeps track of current channel number to use when making a new one.  It
-   * will increment with every new channel created.
+   * Our id on m_connection, which may be shared with other Producers and
+   * Consumers (see ConnectionPool).  Channel numbers for the exchanges are
+   * allocated from the connection under this id.
    */
-  int m_curChannelNumber;
+  int m_clientId;
+
+  /**
+   * ConnectionBase::Generation() the channels were last opened on.  If it
+   * changes someone reconnected the (shared) connection and the channels have
+   * to be opened again.
+   */
+  unsigned int m_connectionGeneration;
 
   void thread();
 
+  /**
+   * Use the given connection from here on, registering as a client on it and
+   * allocating channels for any exchange we already know about
+   */
+  void attachConnection(std::shared_ptr<connection::ConnectionBase> connection);
+
+  /**
+   * Allocate a channel from m_connection, m_producerMutex must be held
+   *
+   * @returns channel number, 0 if there is no connection yet (Initialize()
+   * will allocate it) or -1 if the connection has no free channels
+   */
+  int allocateChannel();
+
   int addExchange(const std::string& exchange);
   int addExchange(const std::string& exchange, const std::string& type);
 
   /**
-   *  Publish the next message in the m_sendQueue
+   *  Publish the next batch (up to PRODUCER_PUBLISH_BATCH_SIZE) of messages
+   *  in the m_sendQueue, waiting a little for Send() if it is empty.  Messages
+   *  that fail go back to the front of the queue.
    */
   void publishNextInQueue();
 
@@ -184,14 +212,37 @@ class Producer {
 
   std::thread m_producerThread;
 
-  std::queue<std::shared_ptr<helper::RawMessage> > m_sendQueue;
+  std::deque<std::shared_ptr<helper::RawMessage> > m_sendQueue;
+
+  /**
+   * Signalled by Send() and Stop(), so an idle producer thread sleeps instead
+   * of spinning on an empty m_sendQueue
+   */
+  std::condition_variable m_sendReady;
+
+  /**
+   * CPUs the producer thread is pinned to when started, empty for none
+   */
+  std::vector<int> m_cpuAffinity;
+
+  /**
+   * Send() to the broker having taken the message, see QueueDwellHistogram()
+   */
+  LatencyHistogram m_queueDwell;
+
+  /**
+   * Whether Send() asks for SEND_TIME_HEADER, see SetSendTimeStamping()
+   */
+  bool m_stampSendTime;
 
  public:
   Producer()
       : m_isInitialized(false),
         m_threadRunning(false),
         m_channelsConnected(false),
-        m_curChannelNumber(1){};
+        m_clientId(0),
+        m_connectionGeneration(0),
+        m_stampSendTime(false){};
 
   /**
    * Sends a message given both the exchange and routing key used.  The exchange
@@ -199,7 +250,13 @@ class Producer {
    * Send(routing_value,message) declaration.  Though, this may change later.
    * The message given gets converted to a HareCpp::helper::RawMessage structure
    * to be put on a queue to be sent out in the main Producer thread (assuming
-   * its been started).
+   * its been started).  A payload bigger than MESSAGE_INLINE_BYTES is not
+   * copied, it becomes the Message's SharedPayload and the queue holds a
+   * reference to it: sending the same Message to several exchanges, or from
+   * several Producers, keeps one copy of it.  Share it (SharePayload())
+   * before sending the same Message from more than one thread.  A payload in
+   * fragments is queued as it is, retained ones held and borrowed ones
+   * pointed at, and written out without being joined.
    *
    * @param [in] exchange : the rabbitmq exchange the message is sent on
    *
@@ -213,6 +270,28 @@ class Producer {
   HARE_ERROR_E Send(const std::string& exchange, const std::string& routingKey,
                     Message& message);
 
+  /**
+   * Sends a value of a type described with HARE_SCHEMA(), encoded straight
+   * into the payload and tagged with the schema's content type
+   *
+   * @param [in] exchange : the rabbitmq exchange the message is sent on
+   * @param [in] routingKey : the routing key used to route the message on
+   * the exchange
+   * @param [in] value : what is sent
+   *
+   * @returns HARE_ERROR_E error code
+   */
+  template <typename T>
+  typename std::enable_if<Schema<T>::DESCRIBED, HARE_ERROR_E>::type Send(
+      const std::string& exchange, const std::string& routingKey,
+      const T& value) {
+    Message message;
+    if (false == hare_encode(value, message)) {
+      return HARE_ERROR_E::PUBLISH_ERROR;
+    }
+    return Send(exchange, routingKey, message);
+  }
+
   HARE_ERROR_E DeclareExchange(const std::string& exchange,
                                const std::string& type = "direct");
 
@@ -229,6 +308,18 @@ class Producer {
                           const std::string& username = "guest",
                           const std::string& password = "guest");
 
+  /**
+   * Initialize function using an existing connection, usually one shared with
+   * other Producers/Consumers from connection::ConnectionPool::Acquire().
+   * Exchanges get their own channels on that connection.
+   *
+   * @param [in] connection : connection to publish on
+   *
+   * @returns HARE_ERROR_E
+   */
+  HARE_ERROR_E Initialize(
+      std::shared_ptr<connection::ConnectionBase> connection);
+
   /**
    * No Copy Constructor
    */
@@ -242,6 +333,36 @@ class Producer {
    */
   int QueueSize() const;
 
+  /**
+   * Time messages spend between Send() and the connection having written
+   * them to the broker (amqp_basic_publish() or the native writer returning),
+   * which is mostly time waiting in the send queue.  Snapshot() it or Reset()
+   * it whenever, from any thread.
+   *
+   * @returns the histogram, in nanoseconds
+   */
+  LatencyHistogram& QueueDwellHistogram();
+
+  /**
+   * Add a SEND_TIME_HEADER header to every message sent from here on, holding
+   * the wall clock time in nanoseconds at the moment the connection publishes
+   * it.  A Consumer receiving it records the one-way latency (see
+   * Consumer::OneWayLatencyHistogram()).  Off by default; messages with the
+   * header aren't eligible for the native publisher's header cache.
+   *
+   * @param [in] enabled : true to stamp messages
+   */
+  void SetSendTimeStamping(bool enabled);
+
+  /**
+   * Pin the producer thread to the given CPUs, straight away if it is running
+   * and on every Start() after.  An empty list leaves later starts unpinned.
+   *
+   * @param [in] cpus : CPU numbers the thread may run on
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS for a CPU that doesn't exist
+   */
+  HARE_ERROR_E SetCpuAffinity(const std::vector<int>& cpus);
+
   /**
    * Destructor
    */
@@ -0,0 +1,158 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _PUBLISH_FRAME_WRITER_H_
+#define _PUBLISH_FRAME_WRITER_H_
+
+#include <sys/uio.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "HelperStructs.hpp"
+#include "pch.hpp"
+
+namespace HareCpp {
+namespace connection {
+
+/**
+ * Encodes basic.publish frames (method, content header, body) ourselves, so a
+ * batch of messages can go to the socket in one sendmsg() instead of three or
+ * more writes per message through amqp_basic_publish().  The bytes are the
+ * same as rabbitmq-c would send.
+ *
+ * The method frame of a route (channel/exchange/routing key) never changes,
+ * so it is encoded once and reused.  The content header is encoded once per
+ * channel and properties template, after that only the body size and
+ * timestamp are patched in.  Message bodies aren't copied, they are pointed at
+ * until Flush(), and bodies in fragments aren't joined either.
+ *
+ * Not thread safe, it belongs to the connection's I/O thread.
+ */
+class PublishFrameWriter {
+ public:
+  explicit PublishFrameWriter(size_t frameMax = 131072);
+
+  /**
+   * Largest frame the broker accepts, bodies are split to fit
+   *
+   * @param [in] frameMax : negotiated frame_max, amqp_get_frame_max()
+   */
+  void SetFrameMax(size_t frameMax);
+
+  size_t FrameMax() const;
+
+  /**
+   * Encode the frames for one message, to be sent by the next Flush().  The
+   * message body, or its fragments, must stay valid until then.
+   *
+   * @param [in] message : message to publish
+   * @returns HARE_ERROR_E, PUBLISH_ERROR if it can't be encoded (nothing was
+   * added in that case)
+   */
+  HARE_ERROR_E Add(const helper::RawMessage& message);
+
+  /**
+   * Number of messages added since the last Flush()/Clear()
+   */
+  size_t Pending() const;
+
+  /**
+   * Everything added so far as one string, exactly as Flush() would send it
+   */
+  std::string Encoded() const;
+
+  /**
+   * Write everything added so far to the socket, waiting for it to drain if
+   * it is non-blocking, then Clear()
+   *
+   * @param [in] sockfd : connection's socket
+   * @param [in] timeoutMilliseconds : longest to wait for the socket to take
+   * any more, -1 for no limit
+   * @returns HARE_ERROR_E, SERVER_CONNECTION_FAILURE if the socket failed or
+   * took nothing for timeoutMilliseconds
+   */
+  HARE_ERROR_E Flush(int sockfd, int timeoutMilliseconds = -1);
+
+  /**
+   * Drop everything added since the last Flush()
+   */
+  void Clear();
+
+  /**
+   * Drop the cached frames as well, for a new connection
+   */
+  void Reset();
+
+ private:
+  /**
+   * What a cached content header was encoded from, minus the body size and
+   * timestamp which are patched.  Strings are copied, the message they came
+   * from may be long gone.
+   */
+  struct headerTemplate {
+    amqp_flags_t m_flags;
+    uint8_t m_deliveryMode;
+    uint8_t m_priority;
+    std::vector<std::string> m_fields;
+    std::string m_frame;
+    size_t m_timestampOffset;  // 0 when there is no timestamp
+  };
+
+  /**
+   * Cached frames for the message, encoding them on a miss.  nullptr if the
+   * message can't be encoded.
+   */
+  const std::string* methodFrame(const helper::RawMessage& message);
+  const headerTemplate* headerFrame(const helper::RawMessage& message);
+  bool matches(const headerTemplate& cached,
+               const amqp_basic_properties_t& properties) const;
+  HARE_ERROR_E encodeHeader(int channel,
+                            const amqp_basic_properties_t& properties,
+                            headerTemplate& encoded) const;
+  void addIov(const void* base, size_t len);
+
+  size_t m_frameMax;
+
+  std::unordered_map<std::string, std::string> m_methodFrames;
+  std::unordered_map<int, headerTemplate> m_headerFrames;
+
+  /**
+   * Per message header frame and body frame prefixes, sized up front so the
+   * iovecs pointing into them stay valid
+   */
+  std::deque<std::string> m_scratch;
+  std::vector<struct iovec> m_iov;
+  size_t m_pending;
+};
+
+}  // namespace connection
+}  // namespace HareCpp
+
+#endif  // _PUBLISH_FRAME_WRITER_H_
@@ -0,0 +1,140 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SHARED_PAYLOAD_H_
+#define _SHARED_PAYLOAD_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+
+#include "pch.hpp"
+
+namespace HareCpp {
+
+/**
+ * SharedPayload
+ *
+ * An immutable payload shared by reference count.  Every Message, and every
+ * message waiting in a Producer's queue, holding one points at the same
+ * bytes, so publishing one payload to several exchanges (or from several
+ * Producers) allocates and copies it once.  The bytes are freed when the
+ * last holder lets go, usually as the last publish of it completes.
+ *
+ * Copying a SharedPayload is a reference count increment and is safe from
+ * any thread, the bytes are never written after construction.
+ */
+class SharedPayload {
+ public:
+  SharedPayload() : m_length(0){};
+
+  /**
+   * A shared copy of length bytes, followed by a '\0' like a Message payload
+   */
+  SharedPayload(const void* bytes, size_t length) : m_length(0) {
+    char* copy = static_cast<char*>(malloc(length + 1));
+    if (nullptr == copy) {
+      LOG(LOG_ERROR, "Unable to allocate shared payload");
+      return;
+    }
+    if (length > 0) memcpy(copy, bytes, length);
+    copy[length] = '\0';
+    m_bytes.reset(copy, release);
+    m_length = length;
+  }
+
+  explicit SharedPayload(const std::string& bytes)
+      : SharedPayload(bytes.data(), bytes.size()){};
+
+  /**
+   * Share bytes already allocated with malloc() without copying them, they
+   * are handed to free() once nothing refers to them
+   *
+   * @param [in] bytes : malloc'd, owned by the SharedPayload from here on
+   * @param [in] length : number of bytes in the payload
+   * @returns SharedPayload, empty if bytes is nullptr
+   */
+  static SharedPayload Adopt(void* bytes, size_t length) {
+    SharedPayload adopted;
+    if (nullptr == bytes) return adopted;
+    adopted.m_bytes.reset(static_cast<const char*>(bytes), release);
+    adopted.m_length = length;
+    return adopted;
+  }
+
+  const char* Data() const { return m_bytes.get(); }
+
+  size_t Length() const { return m_length; }
+
+  bool Empty() const { return nullptr == m_bytes; }
+
+  /**
+   * The bytes as rabbitmq-c takes them, valid for as long as this or a copy
+   * of it is around
+   */
+  amqp_bytes_t Bytes() const {
+    amqp_bytes_t bytes;
+    bytes.len = m_length;
+    bytes.bytes = const_cast<char*>(m_bytes.get());
+    return bytes;
+  }
+
+  /**
+   * Holders of these bytes right now, Messages and queued publishes
+   */
+  long UseCount() const { return m_bytes.use_count(); }
+
+  void Reset() {
+    m_bytes.reset();
+    m_length = 0;
+  }
+
+ private:
+  static void release(const char* bytes) { free(const_cast<char*>(bytes)); }
+
+  std::shared_ptr<const char> m_bytes;
+  size_t m_length;
+};
+
+/**
+ * PayloadFragment
+ *
+ * One piece of a payload sent as several, see Message::AddFragment().
+ * Retained when m_retained holds the bytes, borrowed when it is empty.
+ */
+struct PayloadFragment {
+  const char* m_data;
+  size_t m_length;
+  SharedPayload m_retained;
+};
+
+}  // namespace HareCpp
+
+#endif  // _SHARED_PAYLOAD_H_
@@ -0,0 +1,361 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _STREAMING_H_
+#define _STREAMING_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Message.hpp"
+#include "pch.hpp"
+
+namespace HareCpp {
+
+class Producer;
+
+/**
+ * Fills bytes with length bytes of a stream starting at offset
+ *
+ * @returns false if they can't be read
+ */
+typedef std::function<bool(uint64_t offset, char* bytes, size_t length)>
+    TD_StreamRead;
+
+/**
+ * Given the bytes of a stream as they arrive, in order
+ */
+typedef std::function<void(const std::string& streamId, const char* bytes,
+                           size_t length, uint64_t offset)>
+    TD_StreamData;
+
+/**
+ * Told once every chunk of a stream has arrived
+ */
+typedef std::function<void(const std::string& streamId)> TD_StreamDone;
+
+/**
+ * StreamSender
+ *
+ * Sends a payload too big to hold in memory as a run of chunk messages,
+ * each STREAM_CHUNK_BYTES of it (the last one shorter) with headers saying
+ * which stream it belongs to and where it goes (STREAM_ID_HEADER and the
+ * rest).  Chunks are read from the source straight into the payload of
+ * their message, and no more than a window of them is left queued in the
+ * Producer at a time, so memory use stays at about window + 1 chunks
+ * whatever the size of the stream.  A StreamReceiver puts them back
+ * together.
+ *
+ * Any chunk can be sent again, those a StreamReceiver says are Missing()
+ * after a loss, so nothing has to start over.  Passing a list of chunks
+ * always sends just those, none for an empty list.
+ */
+class StreamSender {
+ public:
+  /**
+   * @param [in] producer : started, chunks are sent with it.  Its queue as a
+   * whole is kept within the window, not only the chunks.
+   * @param optional [in] chunkBytes : payload bytes in each chunk
+   * @param optional [in] windowChunks : most messages left queued in the
+   * Producer before waiting
+   */
+  explicit StreamSender(Producer& producer,
+                        size_t chunkBytes = STREAM_CHUNK_BYTES,
+                        size_t windowChunks = STREAM_WINDOW_CHUNKS);
+
+  /**
+   * Send a whole stream
+   *
+   * @param [in] exchange : the rabbitmq exchange the chunks are sent on
+   * @param [in] routingKey : the routing key used to route them
+   * @param [in] streamId : names the stream, the same for a resend.  A
+   * StreamReceiver writing files uses it as the file name.
+   * @param [in] length : bytes in the stream
+   * @param [in] read : reads the stream, from any offset
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS for a chunk that can't be
+   * read, TIMEOUT_OCCURED if the Producer's queue stopped going down for
+   * STREAM_SEND_TIMEOUT_SECONDS, or what Send() returned
+   */
+  HARE_ERROR_E Send(const std::string& exchange, const std::string& routingKey,
+                    const std::string& streamId, uint64_t length,
+                    const TD_StreamRead& read);
+
+  /**
+   * Send some chunks of a stream again, usually what Missing() returned
+   *
+   * @param [in] chunks : only these chunks, nothing is sent if it is empty
+   * @returns HARE_ERROR_E as above, INVALID_PARAMETERS for a chunk past the
+   * end as well
+   */
+  HARE_ERROR_E Send(const std::string& exchange, const std::string& routingKey,
+                    const std::string& streamId, uint64_t length,
+                    const TD_StreamRead& read,
+                    const std::vector<uint64_t>& chunks);
+
+  /**
+   * Send a whole file, read as it goes
+   *
+   * @param [in] path : file sent
+   * @returns HARE_ERROR_E as Send(), INVALID_PARAMETERS if the file can't
+   * be opened
+   */
+  HARE_ERROR_E SendFile(const std::string& exchange,
+                        const std::string& routingKey,
+                        const std::string& streamId, const std::string& path);
+
+  /**
+   * Send some chunks of a file again
+   *
+   * @param [in] chunks : only these chunks, nothing is sent if it is empty
+   */
+  HARE_ERROR_E SendFile(const std::string& exchange,
+                        const std::string& routingKey,
+                        const std::string& streamId, const std::string& path,
+                        const std::vector<uint64_t>& chunks);
+
+  /**
+   * Build one chunk message, what Send() does for each chunk
+   *
+   * @param [in] chunk : which chunk, from 0
+   * @param [out] message : payload and headers replaced
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if chunk is past the end or
+   * can't be read
+   */
+  HARE_ERROR_E BuildChunk(const std::string& streamId, uint64_t length,
+                          uint64_t chunk, const TD_StreamRead& read,
+                          Message& message) const;
+
+  /**
+   * Chunks a stream of length bytes is sent as, at least one
+   */
+  static uint64_t ChunkCount(uint64_t length, size_t chunkBytes);
+
+  size_t ChunkBytes() const { return m_chunkBytes; }
+
+ private:
+  /**
+   * Wait for the Producer's queue to be under the window
+   */
+  HARE_ERROR_E waitForWindow();
+
+  /**
+   * What Send() and SendFile() do, for the chunks listed or, with chunks
+   * nullptr, every chunk
+   */
+  HARE_ERROR_E sendChunks(const std::string& exchange,
+                          const std::string& routingKey,
+                          const std::string& streamId, uint64_t length,
+                          const TD_StreamRead& read,
+                          const std::vector<uint64_t>* chunks);
+
+  HARE_ERROR_E sendFile(const std::string& exchange,
+                        const std::string& routingKey,
+                        const std::string& streamId, const std::string& path,
+                        const std::vector<uint64_t>* chunks);
+
+  Producer& m_producer;
+  size_t m_chunkBytes;
+  size_t m_windowChunks;
+};
+
+/**
+ * StreamReceiver
+ *
+ * Puts the chunks of StreamSender streams back together as they arrive,
+ * any number of streams at once, either
+ *
+ * - into files in a directory, memory-mapped, each chunk copied straight to
+ *   where it goes whatever order it comes in.  Which chunks have arrived is
+ *   kept next to the file (<streamId>.progress), so a receiver started again
+ *   after a crash or restart carries on where the last one stopped.  A file
+ *   without one is complete, chunks of it turning up again are ignored; or
+ * - into a callback, given the bytes in order.  Chunks arriving after a
+ *   missing one are held, STREAM_REORDER_CHUNKS of them at most, until it
+ *   turns up.
+ *
+ * Missing() lists what a stream still lacks, for the sender to send again.
+ * Give Callback() to Consumer::Subscribe(), or call Receive() from a
+ * subscription callback.  Safe to use from several Consumer threads; the
+ * data and done callbacks are called with the receiver locked, so must not
+ * call back into it.
+ */
+class StreamReceiver {
+ public:
+  /**
+   * Write every stream to directory/<streamId>
+   *
+   * @param [in] directory : existing, streams already in progress there are
+   * carried on with
+   * @param optional [in] done : called once a file is complete
+   */
+  explicit StreamReceiver(const std::string& directory,
+                          TD_StreamDone done = TD_StreamDone());
+
+  /**
+   * Hand every stream's bytes to data in order
+   *
+   * @param [in] data : called with each piece as it can be given in order
+   * @param optional [in] done : called after the last piece
+   */
+  explicit StreamReceiver(TD_StreamData data,
+                          TD_StreamDone done = TD_StreamDone());
+
+  /**
+   * Unmaps whatever is in progress, keeping the progress files
+   */
+  ~StreamReceiver();
+
+  StreamReceiver(const StreamReceiver&) = delete;
+  StreamReceiver& operator=(const StreamReceiver&) = delete;
+
+  /**
+   * Take one chunk
+   *
+   * @param [in] message : a chunk message as StreamSender sends them
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if it isn't a chunk, doesn't
+   * fit the stream it says it belongs to, or its file can't be written
+   */
+  HARE_ERROR_E Receive(const Message& message);
+
+  /**
+   * Receive() as a Consumer::Subscribe() callback, logging what it rejects.
+   * The receiver has to outlive the subscription.
+   */
+  TD_Callback Callback();
+
+  /**
+   * Chunks of a stream not received yet, most maxChunks of them.  A stream
+   * written to a file that this receiver hasn't seen yet is looked for in
+   * the directory.
+   *
+   * @param [in] streamId : stream asked about
+   * @param optional [in] maxChunks : longest list returned
+   * @returns the chunk numbers in order, empty for a stream that is
+   * complete or unknown.  StreamSender sends nothing for an empty list.
+   */
+  std::vector<uint64_t> Missing(const std::string& streamId,
+                                size_t maxChunks = SIZE_MAX);
+
+  /**
+   * Streams started and not complete yet
+   */
+  size_t InProgress() const;
+
+  /**
+   * Layout of a progress file: the header, then a byte per chunk, 1 once it
+   * has been written to the stream's file
+   */
+  struct progressHeader {
+    char m_magic[8];  // "HARESTRM"
+    uint32_t m_version;
+    uint32_t m_reserved;
+    uint64_t m_length;
+    uint64_t m_chunkBytes;
+    uint64_t m_chunks;
+  };
+
+ private:
+  struct stream {
+    uint64_t m_length;
+    uint64_t m_chunkBytes;
+    uint64_t m_chunks;
+    uint64_t m_received;
+    // One byte per chunk, into m_progress or m_haveMemory
+    uint8_t* m_have;
+
+    // Written to a file
+    char* m_data;
+    progressHeader* m_progress;
+    size_t m_progressSize;
+
+    // Given to a callback
+    std::vector<uint8_t> m_haveMemory;
+    uint64_t m_nextChunk;
+    std::map<uint64_t, Message> m_held;
+  };
+
+  /**
+   * The stream streamId, started (or resumed from its progress file) if
+   * need be with the shape given.  nullptr if the shape doesn't match, or
+   * files can't be set up.  Called with m_mutex held.
+   */
+  stream* openStream(const std::string& streamId, uint64_t length,
+                     uint64_t chunkBytes);
+
+  /**
+   * A stream written to a file, resumed from its progress file, nullptr if
+   * there isn't one.  Called with m_mutex held.
+   */
+  stream* resumeStream(const std::string& streamId);
+
+  /**
+   * Map the file and progress of a stream.  Called with m_mutex held.
+   */
+  bool mapStream(const std::string& streamId, stream& opened, bool resume);
+
+  /**
+   * Hand the callback every chunk now in order.  Called with m_mutex held.
+   */
+  void deliverHeld(const std::string& streamId, stream& active);
+
+  /**
+   * Forget a finished stream, keeping its file.  Called with m_mutex held.
+   */
+  void finishStream(const std::string& streamId);
+
+  /**
+   * Add to m_finished, dropping the oldest past STREAM_FINISHED_IDS.  Called
+   * with m_mutex held.
+   */
+  void rememberFinished(const std::string& streamId);
+
+  void closeStream(stream& active, bool complete);
+
+  std::string m_directory;  // empty when streams go to m_data
+  TD_StreamData m_data;
+  TD_StreamDone m_done;
+
+  mutable std::mutex m_mutex;
+  std::unordered_map<std::string, stream> m_streams;
+  // Chunks of these may still turn up, from a resend, and are ignored.  The
+  // most recent STREAM_FINISHED_IDS, oldest first in m_finishedOrder.
+  std::set<std::string> m_finished;
+  std::deque<std::string> m_finishedOrder;
+};
+
+}  // namespace HareCpp
+
+#endif  // _STREAMING_H_
@@ -0,0 +1,232 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _TRAFFIC_CAPTURE_H_
+#define _TRAFFIC_CAPTURE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pch.hpp"
+
+namespace HareCpp {
+
+class ChannelHandler;
+class Producer;
+
+/**
+ * Records consumed messages (exchange, routing key, properties, body and
+ * when they arrived) into memory mapped segment files, for TrafficReplay to
+ * play back later, e.g. to load test a new consumer with real traffic.  Hand
+ * one to Consumer::SetCapture(), several Consumers may share one.
+ *
+ * A message is written straight from the delivered envelope into the
+ * mapping, nothing is copied on the way.  Segments are path.000000,
+ * path.000001 and so on, each CAPTURE_SEGMENT_BYTES unless Open() is told
+ * otherwise, and are cut down to what they hold once full or closed.  What
+ * was recorded survives the process crashing.
+ */
+class TrafficCapture {
+ public:
+  TrafficCapture();
+  ~TrafficCapture();
+
+  TrafficCapture(const TrafficCapture&) = delete;
+  TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+  /**
+   * Start recording into new segment files
+   *
+   * @param [in] path : segment files are path.000000 onwards, existing ones
+   * are overwritten
+   * @param optional [in] segmentBytes : size of each segment file
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if the first segment can't be
+   * created, THREAD_ALREADY_RUNNING if already recording
+   */
+  HARE_ERROR_E Open(const std::string& path,
+                    size_t segmentBytes = CAPTURE_SEGMENT_BYTES);
+
+  /**
+   * Stop recording and unmap the current segment
+   */
+  void Close();
+
+  bool IsOpen() const;
+
+  /**
+   * Append one delivered message
+   *
+   * @param [in] envelope : the delivery, as amqp_consume_message() gave it
+   * @param optional [in] receivedNanos : LatencyHistogram::Now() when it came
+   * off the socket, 0 for now
+   * @returns HARE_ERROR_E, NOT_INITIALIZED when not open, INVALID_PARAMETERS
+   * if the headers can't be encoded or no segment could be mapped for it
+   */
+  HARE_ERROR_E Record(const amqp_envelope_t& envelope,
+                      uint64_t receivedNanos = 0);
+
+  /**
+   * Messages recorded since Open()
+   */
+  uint64_t Recorded() const;
+
+  /**
+   * Segment file layout: the header, then m_used bytes of records, each a
+   * recordHeader followed by the exchange, routing key, properties and body,
+   * padded to 8 bytes.  Properties are the flags, delivery mode, priority
+   * and timestamp, each short string property present as a length byte and
+   * its bytes, then the headers as amqp_encode_table() writes them.
+   * m_used only ever moves past complete records.
+   */
+  struct segmentHeader {
+    char m_magic[8];  // "HARECAPT"
+    uint32_t m_version;
+    uint32_t m_index;
+    uint64_t m_size;
+    std::atomic<uint64_t> m_used;
+  };
+
+  struct recordHeader {
+    uint64_t m_length;  // whole record, padding included
+    uint64_t m_bodyLength;
+    uint64_t m_receivedNanos;  // LatencyHistogram::Now()
+    int64_t m_realtimeNanos;
+    uint32_t m_propertiesLength;
+    uint16_t m_exchangeLength;
+    uint16_t m_routingKeyLength;
+  };
+
+ private:
+  /**
+   * Map the next segment, big enough for at least minimumBytes of records.
+   * Called with m_mutex held.
+   */
+  HARE_ERROR_E openSegment(size_t minimumBytes);
+  void closeSegment();
+
+  mutable std::mutex m_mutex;
+  std::string m_path;
+  size_t m_segmentBytes;
+  uint32_t m_nextSegment;
+  segmentHeader* m_segment;  // nullptr when closed
+  uint64_t m_recorded;
+};
+
+/**
+ * One message of a capture, pointing into the mapped segment (and, for
+ * headers, into the replay's pool), valid during the replay callback only
+ */
+struct capturedMessage {
+  amqp_bytes_t m_exchange;
+  amqp_bytes_t m_routingKey;
+  amqp_basic_properties_t m_properties;
+  amqp_bytes_t m_body;
+  uint64_t m_receivedNanos;
+  int64_t m_realtimeNanos;
+};
+
+typedef std::function<void(const capturedMessage&)> TD_ReplaySink;
+
+/**
+ * Plays back what a TrafficCapture recorded, in order, either at the pace
+ * it arrived at, speeded up or slowed down, or as fast as it can be read.
+ * The segments are mapped, not read, so memory use doesn't grow with the
+ * size of the capture.
+ */
+class TrafficReplay {
+ public:
+  TrafficReplay();
+  ~TrafficReplay();
+
+  TrafficReplay(const TrafficReplay&) = delete;
+  TrafficReplay& operator=(const TrafficReplay&) = delete;
+
+  /**
+   * Map every segment of a capture
+   *
+   * @param [in] path : path given to TrafficCapture::Open()
+   * @returns HARE_ERROR_E, INVALID_PARAMETERS if there is no capture there
+   */
+  HARE_ERROR_E Open(const std::string& path);
+
+  void Close();
+
+  /**
+   * Messages in the capture
+   */
+  uint64_t Size() const;
+
+  /**
+   * Call sink with every message in turn
+   *
+   * @param [in] sink : called on this thread
+   * @param optional [in] speed : 1 for the pace they were captured at, 2 for
+   * twice as fast and so on, 0 for as fast as possible
+   * @returns HARE_ERROR_E, NOT_INITIALIZED if not open, INVALID_PARAMETERS
+   * if the capture is damaged (what came before was replayed)
+   */
+  HARE_ERROR_E Replay(const TD_ReplaySink& sink, double speed = 1.0);
+
+  /**
+   * Publish every message again, to the exchange and routing key it was
+   * delivered from
+   */
+  HARE_ERROR_E Replay(Producer& producer, double speed = 1.0);
+
+  /**
+   * Hand every message to the callback subscribed to its exchange and
+   * routing key, without any broker involved
+   */
+  HARE_ERROR_E Replay(ChannelHandler& handler, double speed = 1.0);
+
+  /**
+   * End a Replay() running on another thread after its current message
+   */
+  void Stop();
+
+ private:
+  struct mappedSegment {
+    const TrafficCapture::segmentHeader* m_header;
+    size_t m_size;
+  };
+
+  HARE_ERROR_E replay(const TD_ReplaySink& sink, double speed);
+
+  std::vector<mappedSegment> m_segments;
+  uint64_t m_messages;
+  amqp_pool_t m_pool;
+  std::atomic<bool> m_stop;
+};
+
+}  // namespace HareCpp
+
+#endif  // _TRAFFIC_CAPTURE_H_
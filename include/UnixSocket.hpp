@@ -0,0 +1,61 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _UNIX_SOCKET_HPP_
+#define _UNIX_SOCKET_HPP_
+
+#include "CustomSocket.hpp"
+
+namespace HareCpp {
+namespace connection {
+
+/**
+ * Connects to a broker, or an AMQP proxy, listening on a Unix domain socket
+ * on the same host, skipping the TCP stack loopback traffic goes through.
+ * The host given to Open() is the socket's path (port is ignored), a leading
+ * '@' names a Linux abstract socket.
+ */
+class UnixSocket : public CustomSocket {
+ public:
+  UnixSocket();
+  ~UnixSocket();
+
+  ssize_t Send(const void* buffer, size_t length, int flags) override;
+  ssize_t Recv(void* buffer, size_t length, int flags) override;
+  int Open(const char* path, int port, const struct timeval* timeout) override;
+  int Close(bool force) override;
+  int PollFd() const override;
+  int Fd() const override;
+
+ private:
+  int m_fd;
+};
+
+}  // namespace connection
+}  // namespace HareCpp
+
+#endif
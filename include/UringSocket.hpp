@@ -0,0 +1,125 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef _URING_SOCKET_HPP_
+#define _URING_SOCKET_HPP_
+
+#include "CustomSocket.hpp"
+
+#include <deque>
+#include <memory>
+
+namespace HareCpp {
+namespace connection {
+
+/**
+ * TCP socket driven through io_uring.  Sends are copied into a registered
+ * buffer and go out together, one io_uring_enter() per Flush() (ConnectionBase
+ * flushes once per round of its I/O thread) instead of a send() per frame.
+ * Receives come from a multishot recv into a ring of provided buffers, so
+ * incoming data is picked up off the completion queue without a system call.
+ *
+ * PollFd() is the io_uring descriptor, readable whenever completions are
+ * waiting.  If the ring can't be set up (see Supported()) the socket quietly
+ * works like rabbitmq-c's own, with plain send()/recv().
+ */
+class UringSocket : public CustomSocket {
+ public:
+  /**
+   * @param [in] sendBufferBytes : size of the registered send buffer, a
+   * Send() that doesn't fit flushes what is there first
+   */
+  explicit UringSocket(size_t sendBufferBytes = URING_SEND_BUFFER_BYTES);
+  ~UringSocket();
+
+  /**
+   * Whether this kernel has everything used here (multishot recv and
+   * provided buffer rings, Linux 6.0 and up) and lets us create rings.
+   * Checked once.
+   */
+  static bool Supported();
+
+  ssize_t Send(const void* buffer, size_t length, int flags) override;
+  ssize_t Recv(void* buffer, size_t length, int flags) override;
+  int Open(const char* host, int port, const struct timeval* timeout) override;
+  int Close(bool force) override;
+  int PollFd() const override;
+  int Fd() const override;
+
+  /**
+   * Write out everything Send() took, waiting for it to reach the socket
+   */
+  HARE_ERROR_E Flush() override;
+
+  /**
+   * Whether this socket ended up on io_uring or on plain send()/recv()
+   */
+  bool UsingRing() const;
+
+ private:
+  struct ring;
+  std::unique_ptr<ring> m_ring;
+
+  int m_fd;
+  size_t m_sendBufferBytes;
+  bool m_failed;
+  bool m_closed;
+
+  // What the multishot recv handed us that rabbitmq-c hasn't read yet
+  struct received {
+    uint16_t m_bufferId;
+    size_t m_offset;
+    size_t m_length;
+  };
+  std::deque<received> m_received;
+
+  bool setupRing();
+  void teardownRing();
+
+  /**
+   * Queue the multishot recv, again after the kernel ends it
+   */
+  bool armRecv();
+
+  /**
+   * Submit queued entries, waiting for at least waitFor completions
+   */
+  bool enter(unsigned int waitFor);
+
+  /**
+   * Handle everything on the completion queue
+   */
+  void reap();
+
+  void recycle(uint16_t bufferId);
+  bool writePending();
+};
+
+}  // namespace connection
+}  // namespace HareCpp
+
+#endif
@@ -32,6 +32,13 @@
 #include "cstring"
 #include "pch.hpp"
 
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+
 namespace HareCpp {
 /**
  *  This is because using the default rabbitmq-c library calls
@@ -58,6 +65,67 @@ inline __attribute__((always_inline)) amqp_bytes_t hare_void_bytes(const void *d
   return result;
 }
 
+/**
+ * Restrict a running thread to the given CPUs, an empty list leaves it where
+ * the scheduler put it.
+ *
+ * @param [in] thread : the thread to pin, must have been started
+ * @param [in] cpus : CPU numbers the thread may run on
+ * @returns HARE_ERROR_E, INVALID_PARAMETERS if a CPU doesn't exist or the
+ * thread isn't running
+ */
+inline HARE_ERROR_E hare_set_thread_affinity(std::thread &thread,
+                                             const std::vector<int> &cpus) {
+  if (cpus.empty()) return HARE_ERROR_E::ALL_GOOD;
+  if (false == thread.joinable()) return HARE_ERROR_E::INVALID_PARAMETERS;
+
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (auto cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return HARE_ERROR_E::INVALID_PARAMETERS;
+    CPU_SET(cpu, &cpuSet);
+  }
+
+  if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpuSet),
+                             &cpuSet) != 0) {
+    LOG(LOG_ERROR, "Unable to set thread CPU affinity");
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+/**
+ * CLOCK_REALTIME in nanoseconds, what SEND_TIME_HEADER is stamped with
+ */
+inline int64_t hare_realtime_nanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000ll + now.tv_nsec;
+}
+
+/**
+ * Find the SEND_TIME_HEADER among a message's headers
+ *
+ * @param [in] properties : the message's properties
+ * @param [out] sentNanos : the publish time, untouched if there isn't one
+ * @returns true if the header was there
+ */
+inline bool hare_send_time(const amqp_basic_properties_t &properties,
+                           int64_t &sentNanos) {
+  if (0 == (properties._flags & AMQP_BASIC_HEADERS_FLAG)) return false;
+  const size_t keyLength = sizeof(SEND_TIME_HEADER) - 1;
+  for (int i = 0; i < properties.headers.num_entries; i++) {
+    const amqp_table_entry_t &entry = properties.headers.entries[i];
+    if (entry.key.len == keyLength &&
+        0 == memcmp(entry.key.bytes, SEND_TIME_HEADER, keyLength) &&
+        entry.value.kind == AMQP_FIELD_KIND_I64) {
+      sentNanos = entry.value.value.i64;
+      return true;
+    }
+  }
+  return false;
+}
+
 /**
  * Turns amqp_bytes_t into a string (via static cast and creation of
  * std::string)
@@ -90,7 +158,9 @@ inline __attribute__((always_inline)) void hare_basic_properties_malloc_dup(
       (properties._flags & AMQP_BASIC_CONTENT_ENCODING_FLAG))
     clonedProperties.content_encoding =
         amqp_bytes_malloc_dup(properties.content_encoding);
-  clonedProperties.headers = properties.headers;  // TODO may be incorrect
+  // Not copied, the clone points at the same table: see HeadersTable for a
+  // copy of its own
+  clonedProperties.headers = properties.headers;
   clonedProperties.delivery_mode = properties.delivery_mode;
   clonedProperties.priority = properties.priority;
   if (AMQP_BASIC_CORRELATION_ID_FLAG ==
@@ -118,6 +188,34 @@ inline __attribute__((always_inline)) void hare_basic_properties_malloc_dup(
     clonedProperties.cluster_id = amqp_bytes_malloc_dup(properties.cluster_id);
 }
 
+/**
+ * Free what hare_basic_properties_malloc_dup() allocated, every short string
+ * whose flag is set.  The headers are left alone, they aren't duplicated.
+ *
+ * @param [in] properties : properties cloned by
+ * hare_basic_properties_malloc_dup(), or holding only malloc'd strings
+ */
+inline void hare_basic_properties_free(amqp_basic_properties_t &properties) {
+  const amqp_flags_t flags = properties._flags;
+  if (flags & AMQP_BASIC_CONTENT_TYPE_FLAG)
+    amqp_bytes_free(properties.content_type);
+  if (flags & AMQP_BASIC_CONTENT_ENCODING_FLAG)
+    amqp_bytes_free(properties.content_encoding);
+  if (flags & AMQP_BASIC_CORRELATION_ID_FLAG)
+    amqp_bytes_free(properties.correlation_id);
+  if (flags & AMQP_BASIC_REPLY_TO_FLAG) amqp_bytes_free(properties.reply_to);
+  if (flags & AMQP_BASIC_EXPIRATION_FLAG)
+    amqp_bytes_free(properties.expiration);
+  if (flags & AMQP_BASIC_MESSAGE_ID_FLAG)
+    amqp_bytes_free(properties.message_id);
+  if (flags & AMQP_BASIC_TYPE_FLAG) amqp_bytes_free(properties.type);
+  if (flags & AMQP_BASIC_USER_ID_FLAG) amqp_bytes_free(properties.user_id);
+  if (flags & AMQP_BASIC_APP_ID_FLAG) amqp_bytes_free(properties.app_id);
+  if (flags & AMQP_BASIC_CLUSTER_ID_FLAG)
+    amqp_bytes_free(properties.cluster_id);
+  properties._flags = 0;
+}
+
 /**
  * Turn rpc reply into a char* exception string.  This is convenient for
  * logging.
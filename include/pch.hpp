@@ -52,7 +52,98 @@ extern "C" {
 constexpr int CONNECTION_TIMEOUT_SECONDS = 1;
 constexpr int CONNECTION_RETRY_TIMEOUT_MILLISECONDS = 1000;
 
+// Defaults proposed to the broker at login, see helper::connectionTuning
+constexpr int DEFAULT_FRAME_MAX = 131072;
+constexpr int DEFAULT_HEARTBEAT_SECONDS = 60;
+
+// Longest a publish waits for a socket the broker has stopped reading from,
+// when heartbeats are off.  Otherwise it waits one heartbeat interval.
+constexpr int PUBLISH_FLUSH_TIMEOUT_SECONDS = DEFAULT_HEARTBEAT_SECONDS;
+
+// Largest frame_max we pick on our own when sizing it from payloads, the
+// smallest is AMQP_FRAME_MIN_SIZE from rabbitmq-c
+constexpr int AUTO_FRAME_MAX_LIMIT = 1048576;
+
+// Largest channel number AMQP 0-9-1 allows, used when the broker doesn't
+// impose its own channel_max
+constexpr int AMQP_MAX_CHANNEL_NUMBER = 65535;
+
+// How long the connection's I/O thread sleeps waiting for the socket or a
+// command before checking whether it should stop
+constexpr int IO_IDLE_POLL_MILLISECONDS = 100;
+
+// Frames the I/O thread reads in a row before going back to queued commands
+constexpr int IO_MAX_FRAMES_PER_ROUND = 64;
+
+// Most messages a Producer hands to the connection at once
+constexpr int PRODUCER_PUBLISH_BATCH_SIZE = 256;
+
+// Routes whose encoded basic.publish frame is kept for reuse
+constexpr size_t PUBLISH_METHOD_CACHE_SIZE = 1024;
+
+// io_uring transport (UringSocket): registered send buffer, and the provided
+// buffers (count must be a power of two) its multishot recv reads into
+constexpr size_t URING_SEND_BUFFER_BYTES = 262144;
+constexpr unsigned int URING_RECV_BUFFERS = 64;
+constexpr size_t URING_RECV_BUFFER_BYTES = 16384;
+constexpr unsigned int URING_QUEUE_DEPTH = 16;
+
+// Shards per metrics counter (see MetricsRegistry), threads are spread over
+// them so concurrent updates rarely share a cache line
+constexpr int METRICS_SHARDS = 16;
+
+// Records in an EventLog ring file unless Open() is told otherwise, 32 bytes
+// each
+constexpr uint32_t EVENT_LOG_DEFAULT_RECORDS = 65536;
+
+// Size of each segment file a TrafficCapture writes, a message bigger than
+// that gets a segment of its own
+constexpr size_t CAPTURE_SEGMENT_BYTES = 64 * 1024 * 1024;
+
+// Header carrying the publish time in nanoseconds since the epoch, see
+// Producer::SetSendTimeStamping()
+constexpr char SEND_TIME_HEADER[] = "x-harecpp-sent-ns";
+
+// Payload bytes in each chunk of a StreamSender, and chunks it lets queue
+// up in the Producer before waiting for them to go out
+constexpr size_t STREAM_CHUNK_BYTES = 1024 * 1024;
+constexpr size_t STREAM_WINDOW_CHUNKS = 8;
+// How long a StreamSender waits for the Producer's queue to go down
+constexpr int STREAM_SEND_TIMEOUT_SECONDS = 30;
+// Chunks a StreamReceiver holds on to, for a callback taking them in order,
+// while one before them is missing
+constexpr size_t STREAM_REORDER_CHUNKS = 64;
+// Most chunks a StreamReceiver takes a stream in, it keeps a byte per chunk
+// so a shape from the headers beyond this is refused rather than allocated
+constexpr uint64_t STREAM_MAX_CHUNKS = 16 * 1024 * 1024;
+// Finished streams a StreamReceiver remembers, to ignore chunks of them
+// sent again, before forgetting the oldest
+constexpr size_t STREAM_FINISHED_IDS = 1024;
+
+// Headers saying which stream a chunk belongs to and where in it it goes,
+// see StreamSender
+constexpr char STREAM_ID_HEADER[] = "x-harecpp-stream";
+constexpr char STREAM_LENGTH_HEADER[] = "x-harecpp-stream-length";
+constexpr char STREAM_CHUNK_BYTES_HEADER[] = "x-harecpp-stream-chunk-bytes";
+constexpr char STREAM_CHUNK_HEADER[] = "x-harecpp-stream-chunk";
+
+/**
+ * Payloads up to this many bytes are kept inside the Message, bigger ones
+ * are allocated.  -DHARECPP_MESSAGE_INLINE_BYTES=n changes it, and with it
+ * sizeof(Message), so the library and everything using it must agree.
+ */
+#ifndef HARECPP_MESSAGE_INLINE_BYTES
+#define HARECPP_MESSAGE_INLINE_BYTES 128
+#endif
+constexpr size_t MESSAGE_INLINE_BYTES = HARECPP_MESSAGE_INLINE_BYTES;
+
+// First allocation of a HeadersBuilder, enough for a dozen or so short
+// headers without growing
+constexpr size_t HEADERS_ARENA_BYTES = 1024;
+
 namespace HareCpp {
 typedef std::function<void(const class Message&)> TD_Callback;
+// Nanoseconds to add to a message's send time to put it on our clock
+typedef std::function<int64_t(const class Message&)> TD_ClockOffset;
 }
 #endif
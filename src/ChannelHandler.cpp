@@ -26,11 +26,32 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include "ChannelHandler.hpp"
+#include "EventLog.hpp"
+#include "Metrics.hpp"
+#include "Probes.hpp"
 
 namespace HareCpp {
 
+namespace {
+
+void recordCallback(LatencyHistogram& duration, uint64_t start,
+                    int channel) {
+  const uint64_t now = LatencyHistogram::Now();
+  const uint64_t elapsed = now > start ? now - start : 0;
+  duration.Record(elapsed);
+  auto& metrics = MetricsRegistry::Instance();
+  metrics.Add(METRIC_E::CALLBACKS, 1);
+  metrics.Add(METRIC_E::CALLBACK_NANOSECONDS, elapsed);
+  EventLog::Instance().Record(EVENT_E::CALLBACK, 0, channel, elapsed);
+  HARE_PROBE2(callback_done, channel, elapsed);
+}
+
+}  // namespace
+
 ChannelHandler::ChannelHandler()
-    : m_nextAvailableChannel(1), m_multiThreaded(false) {}
+    : m_nextAvailableChannel(1),
+      m_multiThreaded(false),
+      m_dispatchDelay(std::make_shared<LatencyHistogram>()) {}
 
 int ChannelHandler::AddChannelProcessor(const HashableBindingPair& bindingPair,
                                         TD_Callback& callback) {
@@ -41,39 +62,47 @@ int ChannelHandler::AddChannelProcessor(const HashableBindingPair& bindingPair,
   auto it{m_bindingPairLookup.find(bindingPair)};
 
   if (it != m_bindingPairLookup.end()) {
-    char log[LOG_MAX_CHAR_SIZE];
-    snprintf(
-        log, LOG_MAX_CHAR_SIZE, "%s : %s already exists, updating callback",
-        bindingPair.m_exchangeName.c_str(), bindingPair.m_routingKey.c_str());
-    LOG(LOG_WARN, log);
+    LOGF(LOG_WARN, "%s : %s already exists, updating callback",
+         bindingPair.m_exchangeName.c_str(), bindingPair.m_routingKey.c_str());
     // Set new callback
     it->second->m_callback = callback;
   } else /* New Pairing */
   {
-    char log[LOG_MAX_CHAR_SIZE];
-    snprintf(log, LOG_MAX_CHAR_SIZE, "%s : %s doesn't exist, creating in map",
-             bindingPair.m_exchangeName.c_str(),
-             bindingPair.m_routingKey.c_str());
-    LOG(LOG_DETAILED, log);
-
-    m_channelLookup[m_nextAvailableChannel] =
-        std::make_shared<channelProcessingInfo>();
-    m_bindingPairLookup.insert(
-        std::make_pair(bindingPair, m_channelLookup[m_nextAvailableChannel]));
+    LOGF(LOG_DETAILED, "%s : %s doesn't exist, creating in map",
+         bindingPair.m_exchangeName.c_str(), bindingPair.m_routingKey.c_str());
+
+    auto channel = (m_channelAllocator ? m_channelAllocator()
+                                       : m_nextAvailableChannel++);
+    if (channel < 1) {
+      LOG(LOG_ERROR, "No channel available for new subscription");
+      return retCode;
+    }
 
+    m_channelLookup[channel] = std::make_shared<channelProcessingInfo>();
+    m_bindingPairLookup.insert(
+        std::make_pair(bindingPair, m_channelLookup[channel]));
 
-    m_channelLookup[m_nextAvailableChannel]->m_callback = callback;
+    m_channelLookup[channel]->m_channel = std::make_shared<int>(channel);
+    m_channelLookup[channel]->m_callback = callback;
+    m_channelLookup[channel]->m_callbackDuration =
+        std::make_shared<LatencyHistogram>();
+    m_channelLookup[channel]->m_oneWayLatency =
+        std::make_shared<LatencyHistogram>();
 
     it = m_bindingPairLookup.find(bindingPair);
-    m_channelLookup[m_nextAvailableChannel]->m_bindingPair =
+    m_channelLookup[channel]->m_bindingPair =
       std::make_shared<HashableBindingPair>(it->first);
 
-    retCode = m_nextAvailableChannel;
-    m_nextAvailableChannel++;
+    retCode = channel;
   }
   return retCode;
 }
 
+void ChannelHandler::SetChannelAllocator(std::function<int()> allocator) {
+  std::lock_guard<std::mutex> lock(m_handlerMutex);
+  m_channelAllocator = allocator;
+}
+
 int ChannelHandler::RemoveChannelProcessor(
     const HashableBindingPair& bindingPair) {
   auto it{m_bindingPairLookup.find(bindingPair)};
@@ -92,15 +121,11 @@ void ChannelHandler::SetMultiThreaded(bool multiThread) {
 }
 
 void ChannelHandler::Process(const HashableBindingPair& bindingPair,
-                             const Message& message) {
+                             const Message& message, uint64_t receivedNanos,
+                             int64_t oneWayNanos) {
   /* Log receipt of processing */
-  {
-    char log[LOG_MAX_CHAR_SIZE];
-    snprintf(log, LOG_MAX_CHAR_SIZE, "Processing message from %s : %s",
-             bindingPair.m_exchangeName.c_str(),
-             bindingPair.m_routingKey.c_str());
-    LOG(LOG_DETAILED, log);
-  }
+  LOGF(LOG_DETAILED, "Processing message from %s : %s",
+       bindingPair.m_exchangeName.c_str(), bindingPair.m_routingKey.c_str());
 
   std::lock_guard<std::mutex> lock(m_handlerMutex);
   auto it{m_bindingPairLookup.find(bindingPair)};
@@ -108,17 +133,55 @@ void ChannelHandler::Process(const HashableBindingPair& bindingPair,
     return;  // Error
   }
 
+  if (oneWayNanos >= 0) it->second->m_oneWayLatency->Record(oneWayNanos);
+  const int channel = it->second->m_channel ? *it->second->m_channel : 0;
+
   if (m_multiThreaded) {
     // This makes a copy of the function, in order to avoid race condition
-    // as m_handlerMutex doesn't follow to this thread
-    std::thread callbackThread([message](TD_Callback func) { func(message); },
-                               it->second->m_callback);
+    // as m_handlerMutex doesn't follow to this thread.  The histograms go
+    // with it, this handler may be gone before the callback finishes.
+    auto dispatchDelay = m_dispatchDelay;
+    std::thread callbackThread(
+        [message, receivedNanos, dispatchDelay, channel](
+            TD_Callback func, std::shared_ptr<LatencyHistogram> duration) {
+          dispatchDelay->RecordSince(receivedNanos);
+          HARE_PROBE3(callback_start, channel, message.Length(),
+                      receivedNanos);
+          const uint64_t start = LatencyHistogram::Now();
+          func(message);
+          recordCallback(*duration, start, channel);
+        },
+        it->second->m_callback, it->second->m_callbackDuration);
     callbackThread.detach();
   } else {
+    m_dispatchDelay->RecordSince(receivedNanos);
+    HARE_PROBE3(callback_start, channel, message.Length(), receivedNanos);
+    const uint64_t start = LatencyHistogram::Now();
     it->second->m_callback(message);
+    recordCallback(*it->second->m_callbackDuration, start, channel);
   }
 }
 
+LatencyHistogram& ChannelHandler::DispatchDelayHistogram() {
+  return *m_dispatchDelay;
+}
+
+std::shared_ptr<LatencyHistogram> ChannelHandler::CallbackDurationHistogram(
+    const HashableBindingPair& bindingPair) const {
+  std::lock_guard<std::mutex> lock(m_handlerMutex);
+  auto it{m_bindingPairLookup.find(bindingPair)};
+  if (it == m_bindingPairLookup.end()) return nullptr;
+  return it->second->m_callbackDuration;
+}
+
+std::shared_ptr<LatencyHistogram> ChannelHandler::OneWayLatencyHistogram(
+    const HashableBindingPair& bindingPair) const {
+  std::lock_guard<std::mutex> lock(m_handlerMutex);
+  auto it{m_bindingPairLookup.find(bindingPair)};
+  if (it == m_bindingPairLookup.end()) return nullptr;
+  return it->second->m_oneWayLatency;
+}
+
 std::vector<int> ChannelHandler::GetChannelList() const {
   std::vector<int> retVec;
   std::lock_guard<std::mutex> lock(m_handlerMutex);
@@ -26,51 +26,827 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include "ConnectionBase.hpp"
+#include "Probes.hpp"
+#include "UnixSocket.hpp"
+#include "UringSocket.hpp"
+#include "Utils.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <future>
 
 namespace HareCpp {
 namespace connection {
 
+namespace {
+// Id each connection records its EventLog events under
+std::atomic<uint32_t> nextEventLogId(1);
+
+// If timestamp isn't set, set it here.  AMQP timestamps are in seconds.
+void stampTimestamp(helper::RawMessage& message) {
+  if (AMQP_BASIC_TIMESTAMP_FLAG !=
+      (message.properties._flags & AMQP_BASIC_TIMESTAMP_FLAG)) {
+    message.properties._flags |= AMQP_BASIC_TIMESTAMP_FLAG;
+    auto curTimeInSecs =
+        std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    message.properties.timestamp = curTimeInSecs;
+  }
+}
+
+/**
+ * Adds SEND_TIME_HEADER to a message that asked for it, for as long as it is
+ * in scope.  The headers are put back afterwards, a message that fails to
+ * publish goes back on the Producer's queue and the table added here would be
+ * gone by the time it is retried.
+ */
+class sendTimeStamp {
+ public:
+  explicit sendTimeStamp(helper::RawMessage& message)
+      : m_message(message),
+        m_flags(message.properties._flags),
+        m_headers(message.properties.headers) {
+    if (false == message.stamp_send_time) return;
+
+    amqp_table_t& headers = message.properties.headers;
+    if (m_flags & AMQP_BASIC_HEADERS_FLAG) {
+      m_entries.assign(headers.entries, headers.entries + headers.num_entries);
+    }
+    amqp_table_entry_t* stamp = nullptr;
+    for (auto& entry : m_entries) {
+      if (entry.key.len == sizeof(SEND_TIME_HEADER) - 1 &&
+          0 == memcmp(entry.key.bytes, SEND_TIME_HEADER, entry.key.len)) {
+        stamp = &entry;
+      }
+    }
+    if (stamp == nullptr) {
+      m_entries.push_back(amqp_table_entry_t());
+      stamp = &m_entries.back();
+      stamp->key = amqp_cstring_bytes(SEND_TIME_HEADER);
+    }
+    stamp->value.kind = AMQP_FIELD_KIND_I64;
+    stamp->value.value.i64 = hare_realtime_nanos();
+
+    message.properties._flags |= AMQP_BASIC_HEADERS_FLAG;
+    headers.num_entries = static_cast<int>(m_entries.size());
+    headers.entries = m_entries.data();
+  }
+
+  ~sendTimeStamp() {
+    m_message.properties._flags = m_flags;
+    m_message.properties.headers = m_headers;
+  }
+
+ private:
+  helper::RawMessage& m_message;
+  amqp_flags_t m_flags;
+  amqp_table_t m_headers;
+  std::vector<amqp_table_entry_t> m_entries;
+};
+}  // namespace
+
 bool ConnectionBase::IsConnected() const {
   return m_isConnected.load(std::memory_order_relaxed);
 }
 
 void ConnectionBase::setConnected(bool connect) {
-  m_isConnected.store(connect, std::memory_order_relaxed);
+  if (connect != m_isConnected.exchange(connect, std::memory_order_relaxed)) {
+    MetricsRegistry::Instance().Add(METRIC_E::CONNECTIONS_OPEN,
+                                    connect ? 1 : -1);
+    EventLog::Instance().Record(
+        connect ? EVENT_E::CONNECTED : EVENT_E::DISCONNECTED, m_eventLogId, 0,
+        connect ? m_generation.load() : 0);
+  }
 }
 
 HARE_ERROR_E ConnectionBase::login() {
-  const std::lock_guard<std::mutex> lock(m_connMutex);
   LOG(LOG_DETAILED, "Attempting to log in to rabbitMQ  broker");
   auto retCode = HARE_ERROR_E::ALL_GOOD;
-  auto amqpReply = amqp_login(m_conn, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN,
-                              m_basicCredentials.m_username.c_str(),
-                              m_basicCredentials.m_password.c_str());
+
+  auto tuning = Tuning();
+  auto frameMax =
+      (tuning.m_autoFrameMax ? SuggestedFrameMax() : tuning.m_frameMax);
+
+  auto amqpReply = amqp_login(
+      m_conn, "/", tuning.m_channelMax, frameMax, tuning.m_heartbeatSeconds,
+      AMQP_SASL_METHOD_PLAIN, m_basicCredentials.m_username.c_str(),
+      m_basicCredentials.m_password.c_str());
   if (amqpReply.reply_type != 1) {
     LOG(LOG_FATAL, "Unable to log into rabbitMQ broker");
     retCode = HARE_ERROR_E::SERVER_AUTHENTICATION_FAILURE;
+  } else {
+    m_negotiatedFrameMax = amqp_get_frame_max(m_conn);
+    m_negotiatedHeartbeat = amqp_get_heartbeat(m_conn);
+
+    LOGF(LOG_INFO, "Negotiated channel_max %d, frame_max %d, heartbeat %d",
+         amqp_get_channel_max(m_conn), m_negotiatedFrameMax.load(),
+         m_negotiatedHeartbeat.load());
+
+    // 0 means the broker doesn't limit us, anything else is what was
+    // negotiated during connection.tune
+    auto negotiatedMax = amqp_get_channel_max(m_conn);
+    const std::lock_guard<std::mutex> channelLock(m_channelMutex);
+    m_channelMax =
+        (negotiatedMax <= 0 ? AMQP_MAX_CHANNEL_NUMBER : negotiatedMax);
+    if (static_cast<int>(m_channels.size()) > m_channelMax + 1) {
+      LOGF(LOG_ERROR, "Channels allocated above negotiated channel_max %d",
+           m_channelMax);
+    }
   }
   return retCode;
 }
 
-amqp_connection_state_t& ConnectionBase::Connection() {
-  const std::lock_guard<std::mutex> lock(m_connMutex);
-  return m_conn;
+HARE_ERROR_E ConnectionBase::SetTuning(const helper::connectionTuning& tuning) {
+  if (tuning.m_channelMax < 0 ||
+      tuning.m_channelMax > AMQP_MAX_CHANNEL_NUMBER ||
+      tuning.m_frameMax < AMQP_FRAME_MIN_SIZE ||
+      tuning.m_heartbeatSeconds < 0 || tuning.m_heartbeatSeconds > UINT16_MAX) {
+    LOG(LOG_ERROR, "Invalid connection tuning");
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  m_tuning = tuning;
+  // Until we log in, this is what we will ask for
+  if (false == IsConnected()) {
+    m_channelMax = (tuning.m_channelMax == 0 ? AMQP_MAX_CHANNEL_NUMBER
+                                             : tuning.m_channelMax);
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+helper::connectionTuning ConnectionBase::Tuning() const {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  return m_tuning;
+}
+
+int ConnectionBase::FrameMax() const { return m_negotiatedFrameMax; }
+
+int ConnectionBase::Heartbeat() const { return m_negotiatedHeartbeat; }
+
+void ConnectionBase::recordPayloadSize(size_t size) {
+  size_t bucket = 0;
+  while (size != 0 && bucket < m_payloadSizes.size() - 1) {
+    size >>= 1;
+    bucket++;
+  }
+  m_payloadSizes[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+int ConnectionBase::SuggestedFrameMax() const {
+  uint64_t total = 0;
+  for (const auto& bucket : m_payloadSizes) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  if (total == 0) return Tuning().m_frameMax;
+
+  // Smallest power of two covering 99% of the payloads, plus the frame's own
+  // header and end marker
+  uint64_t covered = 0;
+  size_t bucket = 0;
+  for (; bucket < m_payloadSizes.size(); bucket++) {
+    covered += m_payloadSizes[bucket].load(std::memory_order_relaxed);
+    if (covered * 100 >= total * 99) break;
+  }
+
+  uint64_t frameMax = (uint64_t(1) << bucket) + 8;
+  if (frameMax < static_cast<uint64_t>(AMQP_FRAME_MIN_SIZE))
+    frameMax = AMQP_FRAME_MIN_SIZE;
+  if (frameMax > static_cast<uint64_t>(AUTO_FRAME_MAX_LIMIT))
+    frameMax = AUTO_FRAME_MAX_LIMIT;
+  return static_cast<int>(frameMax);
 }
 
+HARE_ERROR_E ConnectionBase::SetSocketOptions(
+    const helper::socketOptions& options) {
+  if (options.m_sendBufferBytes < 0 || options.m_receiveBufferBytes < 0 ||
+      options.m_busyPollMicroseconds < 0 ||
+      options.m_keepAliveIdleSeconds < 0 ||
+      options.m_keepAliveIntervalSeconds < 0 ||
+      options.m_keepAliveProbes < 0) {
+    LOG(LOG_ERROR, "Invalid socket options");
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  if (options.m_transport == helper::socketTransport::UNIX &&
+      (options.m_unixPath.empty() ||
+       options.m_unixPath.size() >= sizeof(sockaddr_un::sun_path))) {
+    LOG(LOG_ERROR, "Unix socket transport needs a path that fits sun_path");
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  m_socketOptions = options;
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+helper::socketOptions ConnectionBase::SocketOptions() const {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  return m_socketOptions;
+}
+
+HARE_ERROR_E ConnectionBase::SetIoThreadAffinity(const std::vector<int>& cpus) {
+  for (auto cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const std::lock_guard<std::mutex> lock(m_connectMutex);
+  {
+    const std::lock_guard<std::mutex> channelLock(m_channelMutex);
+    m_ioCpus = cpus;
+  }
+  if (m_ioRunning) return hare_set_thread_affinity(m_ioThread, cpus);
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+void ConnectionBase::applySocketOptions(int sockfd) {
+  auto options = SocketOptions();
+
+  auto setOption = [&](int level, int name, int value, const char* what) {
+    if (setsockopt(sockfd, level, name, &value, sizeof(value)) != 0) {
+      LOGF(LOG_WARN, "Unable to set %s to %d: %s", what, value,
+           strerror(errno));
+    }
+  };
+
+  // Nagle, corking, busy polling and keepalive are TCP (or IP) things
+  const bool tcp = (options.m_transport != helper::socketTransport::UNIX);
+
+  // rabbitmq-c turns TCP_NODELAY on when it opens the socket
+  m_corkRounds =
+      tcp && (options.m_flush == helper::tcpFlushStrategy::CORK_BATCHES);
+  if (tcp && options.m_flush == helper::tcpFlushStrategy::NAGLE) {
+    setOption(IPPROTO_TCP, TCP_NODELAY, 0, "TCP_NODELAY");
+  }
+
+  if (options.m_sendBufferBytes > 0) {
+    setOption(SOL_SOCKET, SO_SNDBUF, options.m_sendBufferBytes, "SO_SNDBUF");
+  }
+  if (options.m_receiveBufferBytes > 0) {
+    setOption(SOL_SOCKET, SO_RCVBUF, options.m_receiveBufferBytes,
+              "SO_RCVBUF");
+  }
+
+  if (tcp && options.m_busyPollMicroseconds > 0) {
+#ifdef SO_BUSY_POLL
+    setOption(SOL_SOCKET, SO_BUSY_POLL, options.m_busyPollMicroseconds,
+              "SO_BUSY_POLL");
+#else
+    LOG(LOG_WARN, "SO_BUSY_POLL is not supported on this platform");
+#endif
+  }
+
+  if (tcp && options.m_keepAlive) {
+    setOption(SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+    if (options.m_keepAliveIdleSeconds > 0) {
+      setOption(IPPROTO_TCP, TCP_KEEPIDLE, options.m_keepAliveIdleSeconds,
+                "TCP_KEEPIDLE");
+    }
+    if (options.m_keepAliveIntervalSeconds > 0) {
+      setOption(IPPROTO_TCP, TCP_KEEPINTVL, options.m_keepAliveIntervalSeconds,
+                "TCP_KEEPINTVL");
+    }
+    if (options.m_keepAliveProbes > 0) {
+      setOption(IPPROTO_TCP, TCP_KEEPCNT, options.m_keepAliveProbes,
+                "TCP_KEEPCNT");
+    }
+  }
+}
+
+void ConnectionBase::setCork(bool cork) {
+  if (false == m_corkRounds || m_conn == nullptr) return;
+  int value = (cork ? 1 : 0);
+  // Uncorking sends whatever the round wrote
+  setsockopt(socketFd(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+
+int ConnectionBase::socketFd() {
+  if (m_customSocket != nullptr) return m_customSocket->Fd();
+  return (m_conn == nullptr ? -1 : amqp_get_sockfd(m_conn));
+}
+
+HARE_ERROR_E ConnectionBase::flushSocket() {
+  if (m_customSocket == nullptr) return HARE_ERROR_E::ALL_GOOD;
+  auto retCode = m_customSocket->Flush();
+  if (false == noError(retCode)) {
+    LOG(LOG_FATAL, "Unable to write to broker socket");
+    teardown();
+  }
+  return retCode;
+}
+
+HARE_ERROR_E ConnectionBase::flushFrames() {
+  const int heartbeat = m_negotiatedHeartbeat;
+  const int timeoutSeconds =
+      heartbeat > 0 ? heartbeat : PUBLISH_FLUSH_TIMEOUT_SECONDS;
+  return m_frameWriter.Flush(socketFd(), timeoutSeconds * 1000);
+}
+
+amqp_connection_state_t& ConnectionBase::Connection() { return m_conn; }
+
 ConnectionBase::ConnectionBase(const std::string& hostname, int port,
                                const std::string& username,
                                const std::string& password)
     : m_socket(nullptr),
+      m_customSocket(nullptr),
+      m_conn(nullptr),
+      m_ioRunning(false),
+      m_wakeFd(-1),
+      m_nativePublish(false),
+      m_channels(1),
+      m_channelMax(AMQP_MAX_CHANNEL_NUMBER),
+      m_channelsInUse(0),
+      m_nextClientId(1),
+      m_generation(0),
+      m_eventLogId(nextEventLogId++),
       m_basicCredentials(hostname, port, username, password),
       m_isConnected(false),
       m_isSSL(false),
       m_connectionFailure(false),
-      m_timeout(CONNECTION_TIMEOUT_SECONDS) {}
+      m_timeout(CONNECTION_TIMEOUT_SECONDS),
+      m_negotiatedFrameMax(0),
+      m_negotiatedHeartbeat(0),
+      m_corkRounds(false) {
+  for (auto& bucket : m_payloadSizes) bucket = 0;
+}
+
+void ConnectionBase::startIoThread() {
+  if (m_ioRunning) return;
+
+  if (m_ioThread.joinable()) m_ioThread.join();
+
+  if (m_wakeFd < 0) {
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0) {
+      // Still works, commands just wait for the idle poll to time out
+      LOG(LOG_ERROR, "Unable to create eventfd for the I/O thread");
+    }
+  }
+
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    m_ioRunning = true;
+  }
+  m_ioThread = std::thread(&ConnectionBase::ioThread, this);
+
+  std::vector<int> cpus;
+  {
+    const std::lock_guard<std::mutex> lock(m_channelMutex);
+    cpus = m_ioCpus;
+  }
+  hare_set_thread_affinity(m_ioThread, cpus);
+}
+
+void ConnectionBase::stopIoThread() {
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    m_ioRunning = false;
+  }
+  wakeIoThread();
+
+  if (m_ioThread.joinable()) m_ioThread.join();
+
+  if (m_wakeFd >= 0) {
+    close(m_wakeFd);
+    m_wakeFd = -1;
+  }
+}
+
+void ConnectionBase::wakeIoThread() {
+  if (m_wakeFd < 0) return;
+  uint64_t one = 1;
+  if (write(m_wakeFd, &one, sizeof(one)) < 0) {
+    // Counter is already non zero, the thread will wake up regardless
+  }
+}
+
+void ConnectionBase::ioThread() {
+  while (m_ioRunning) {
+    runCommandRound();
+    readInbound();
+    waitForWork();
+  }
+
+  // Nobody left to send anything for, let go of the broker and fail whatever
+  // was still queued
+  if (m_conn != nullptr) teardown();
+
+  std::vector<queuedCommand> abandoned;
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    for (auto& queue : m_commandQueues) {
+      for (auto& command : queue.second.m_commands) {
+        abandoned.push_back(std::move(command));
+      }
+      queue.second.m_commands.clear();
+      queue.second.m_scheduled = false;
+      queue.second.m_rpcInFlight = false;
+    }
+    m_readyChannels.clear();
+  }
+  for (auto& command : abandoned) {
+    command.m_done(HARE_ERROR_E::SERVER_CONNECTION_FAILURE);
+  }
+}
+
+void ConnectionBase::runCommandRound() {
+  std::deque<int> round;
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    round.swap(m_readyChannels);
+  }
+
+  if (round.empty()) return;
+  setCork(true);
+
+  for (int channel : round) {
+    queuedCommand command;
+    {
+      const std::lock_guard<std::mutex> lock(m_commandMutex);
+      auto& queue = m_commandQueues[channel];
+      if (queue.m_rpcInFlight || queue.m_commands.empty()) {
+        queue.m_scheduled = false;
+        continue;
+      }
+      command = std::move(queue.m_commands.front());
+      queue.m_commands.pop_front();
+    }
+
+    command.m_run(command.m_done);
+
+    // Back of the line, so every other channel gets its turn first
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    auto& queue = m_commandQueues[channel];
+    if (false == queue.m_rpcInFlight && false == queue.m_commands.empty()) {
+      m_readyChannels.push_back(channel);
+    } else {
+      queue.m_scheduled = false;
+    }
+  }
+
+  // Everything the round wrote goes out together
+  flushSocket();
+  setCork(false);
+}
+
+void ConnectionBase::readInbound() {
+  if (false == IsConnected() || m_conn == nullptr) return;
+
+  for (int frames = 0; frames < IO_MAX_FRAMES_PER_ROUND; frames++) {
+    amqp_frame_t frame;
+    // Only what has already arrived, commands may be waiting.  rabbitmq-c
+    // also sends our heartbeats and checks for the broker's in here, which is
+    // why waitForWork() never sleeps longer than IO_IDLE_POLL_MILLISECONDS.
+    struct timeval noWait = {0, 0};
+    auto status = amqp_simple_wait_frame_noblock(m_conn, &frame, &noWait);
+    if (status == AMQP_STATUS_TIMEOUT) break;
+
+    if (status == AMQP_STATUS_HEARTBEAT_TIMEOUT) {
+      LOG(LOG_FATAL, "Missed heartbeats from broker, dropping connection");
+      teardown();
+      return;
+    }
+    if (status != AMQP_STATUS_OK) {
+      LOG(LOG_FATAL, amqp_error_string2(status));
+      teardown();
+      return;
+    }
+
+    dispatchFrame(frame);
+    if (false == IsConnected()) return;
+  }
+
+  amqp_maybe_release_buffers(m_conn);
+}
+
+void ConnectionBase::waitForWork() {
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    if (false == m_readyChannels.empty() || false == m_ioRunning) return;
+  }
+
+  struct pollfd fds[2];
+  nfds_t count = 0;
+  if (m_wakeFd >= 0) {
+    fds[count].fd = m_wakeFd;
+    fds[count].events = POLLIN;
+    fds[count].revents = 0;
+    count++;
+  }
+  if (IsConnected() && m_conn != nullptr) {
+    if (false == noError(flushSocket())) return;
+    // rabbitmq-c may already be holding frames it read for us
+    if (amqp_frames_enqueued(m_conn) || amqp_data_in_buffer(m_conn)) return;
+    fds[count].fd = amqp_get_sockfd(m_conn);
+    fds[count].events = POLLIN;
+    fds[count].revents = 0;
+    count++;
+  }
+
+  poll(fds, count, IO_IDLE_POLL_MILLISECONDS);
+
+  if (m_wakeFd >= 0 && (fds[0].revents & POLLIN)) {
+    uint64_t wakeups;
+    if (read(m_wakeFd, &wakeups, sizeof(wakeups)) < 0) {
+      // Somebody else already reset it
+    }
+  }
+}
+
+void ConnectionBase::dispatchFrame(amqp_frame_t& frame) {
+  if (frame.frame_type != AMQP_FRAME_METHOD) {
+    // Content of a message we aren't reading, amqp_read_message() picks up
+    // the ones we want
+    return;
+  }
+
+  const int channel = frame.channel;
+  switch (frame.payload.method.id) {
+    case AMQP_BASIC_DELIVER_METHOD: {
+      receiveDelivery(frame);
+      break;
+    }
+    case AMQP_BASIC_RETURN_METHOD: {
+      amqp_message_t message;
+      auto reply = amqp_read_message(m_conn, channel, &message, 0);
+      if (reply.reply_type == AMQP_RESPONSE_NORMAL) {
+        amqp_destroy_message(&message);
+      }
+      LOG(LOG_WARN, "Broker returned an unroutable message");
+      break;
+    }
+    case AMQP_CHANNEL_CLOSE_METHOD: {
+      LOGF(LOG_ERROR, "Broker closed channel: %d", channel);
+      EventLog::Instance().Record(
+          EVENT_E::CHANNEL_CLOSED_BY_BROKER, m_eventLogId, channel,
+          static_cast<amqp_channel_close_t*>(frame.payload.method.decoded)
+              ->reply_code);
+
+      amqp_channel_close_ok_t closeOk;
+      if (amqp_send_method(m_conn, channel, AMQP_CHANNEL_CLOSE_OK_METHOD,
+                           &closeOk) != AMQP_STATUS_OK) {
+        LOG(LOG_FATAL, "Unable to close channel");
+      }
+
+      int owner;
+      {
+        const std::lock_guard<std::mutex> lock(m_channelMutex);
+        owner = channelOwner(channel);
+        setChannelOpen(channel, false);
+      }
+
+      if (m_pendingRpcs.count(channel)) {
+        completeRpc(channel, HARE_ERROR_E::CHANNEL_EXCEPTION, nullptr);
+      } else if (owner != -1) {
+        // Let its consumer know so it can set the channel back up
+        const std::lock_guard<std::mutex> lock(m_channelMutex);
+        auto clientInbox = inbox(owner);
+        clientInbox->m_closedChannels.push_back(channel);
+        clientInbox->m_ready.notify_all();
+      }
+      break;
+    }
+    case AMQP_CONNECTION_CLOSE_METHOD: {
+      LOG(LOG_FATAL, "Connection Close Exception received");
+      amqp_connection_close_ok_t closeOk;
+      amqp_send_method(m_conn, 0, AMQP_CONNECTION_CLOSE_OK_METHOD, &closeOk);
+      teardown();
+      break;
+    }
+    default: {
+      auto rpc = m_pendingRpcs.find(channel);
+      if (rpc != m_pendingRpcs.end()) {
+        for (auto expected : rpc->second.m_expectedReplies) {
+          if (expected == frame.payload.method.id) {
+            completeRpc(channel, HARE_ERROR_E::ALL_GOOD,
+                        &frame.payload.method);
+            return;
+          }
+        }
+      }
+      LOGF(LOG_WARN, "Unexpected method 0x%08x on channel %d",
+           frame.payload.method.id, channel);
+      break;
+    }
+  }
+}
+
+void ConnectionBase::receiveDelivery(amqp_frame_t& frame) {
+  const uint64_t receivedNanos = LatencyHistogram::Now();
+  auto* deliver =
+      static_cast<amqp_basic_deliver_t*>(frame.payload.method.decoded);
+
+  // Same as amqp_consume_message(), but we already have the method frame
+  amqp_envelope_t envelope;
+  envelope.channel = frame.channel;
+  envelope.consumer_tag = amqp_bytes_malloc_dup(deliver->consumer_tag);
+  envelope.delivery_tag = deliver->delivery_tag;
+  envelope.redelivered = deliver->redelivered;
+  envelope.exchange = amqp_bytes_malloc_dup(deliver->exchange);
+  envelope.routing_key = amqp_bytes_malloc_dup(deliver->routing_key);
+
+  auto reply =
+      amqp_read_message(m_conn, envelope.channel, &envelope.message, 0);
+  if (reply.reply_type != AMQP_RESPONSE_NORMAL) {
+    amqp_bytes_free(envelope.consumer_tag);
+    amqp_bytes_free(envelope.exchange);
+    amqp_bytes_free(envelope.routing_key);
+    if (serverFailure(decodeRpcReply(reply))) teardown();
+    return;
+  }
+
+  routeDelivery(envelope, receivedNanos);
+}
+
+void ConnectionBase::routeDelivery(amqp_envelope_t& envelope,
+                                   uint64_t receivedNanos) {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  const int channel = envelope.channel;
+  if (channel <= 0 || channel >= static_cast<int>(m_channels.size()) ||
+      false == m_channels[channel].m_isOpen) {
+    // Nobody is listening on this channel anymore
+    amqp_destroy_envelope(&envelope);
+    return;
+  }
+
+  auto owner = channelOwner(channel);
+  auto clientInbox = inbox(owner == -1 ? 0 : owner);
+  clientInbox->m_deliveries.push_back({envelope, receivedNanos});
+  clientInbox->m_ready.notify_one();
+  MetricsRegistry::Instance().Add(METRIC_E::INBOX_DEPTH, 1);
+  EventLog::Instance().Record(EVENT_E::DELIVERED, m_eventLogId, channel,
+                              envelope.message.body.len);
+}
+
+void ConnectionBase::startRpc(
+    int channel, amqp_method_number_t request, void* decoded,
+    const std::vector<amqp_method_number_t>& expectedReplies,
+    const rpcReplyHandler& onReply, const ioCompletion& done) {
+  EventLog::Instance().Record(EVENT_E::RPC_SENT, m_eventLogId, channel,
+                              request);
+  auto status = amqp_send_method(m_conn, channel, request, decoded);
+  if (status != AMQP_STATUS_OK) {
+    amqp_rpc_reply_t reply;
+    reply.reply_type = AMQP_RESPONSE_LIBRARY_EXCEPTION;
+    reply.library_error = status;
+    auto retCode = decodeLibraryException(reply);
+    if (noError(retCode)) retCode = HARE_ERROR_E::NO_RPC_REPLY;
+    MetricsRegistry::Instance().RpcError(retCode);
+    EventLog::Instance().Record(EVENT_E::RPC_REPLY, m_eventLogId, channel,
+                                static_cast<int64_t>(retCode));
+    if (serverFailure(retCode)) teardown();
+    done(retCode);
+    return;
+  }
+
+  pendingRpc rpc;
+  rpc.m_expectedReplies = expectedReplies;
+  rpc.m_onReply = onReply;
+  rpc.m_done = done;
+  m_pendingRpcs[channel] = std::move(rpc);
+
+  // Nothing else runs on this channel until the broker answers
+  const std::lock_guard<std::mutex> lock(m_commandMutex);
+  m_commandQueues[channel].m_rpcInFlight = true;
+}
+
+void ConnectionBase::completeRpc(int channel, HARE_ERROR_E retCode,
+                                 amqp_method_t* reply) {
+  auto it = m_pendingRpcs.find(channel);
+  if (it == m_pendingRpcs.end()) return;
+  pendingRpc rpc = std::move(it->second);
+  m_pendingRpcs.erase(it);
+
+  if (noError(retCode) && rpc.m_onReply) retCode = rpc.m_onReply(reply);
+  if (false == noError(retCode)) MetricsRegistry::Instance().RpcError(retCode);
+  EventLog::Instance().Record(EVENT_E::RPC_REPLY, m_eventLogId, channel,
+                              static_cast<int64_t>(retCode));
+
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    auto& queue = m_commandQueues[channel];
+    queue.m_rpcInFlight = false;
+    if (false == queue.m_commands.empty() && false == queue.m_scheduled) {
+      queue.m_scheduled = true;
+      m_readyChannels.push_back(channel);
+    }
+  }
+
+  rpc.m_done(retCode);
+}
+
+void ConnectionBase::teardown() {
+  if (m_conn != nullptr) {
+    amqp_destroy_connection(m_conn);
+    m_conn = nullptr;
+    m_socket = nullptr;
+    m_customSocket = nullptr;
+  }
+  setConnected(false);
+
+  std::vector<int> channels;
+  for (auto& rpc : m_pendingRpcs) channels.push_back(rpc.first);
+  for (int channel : channels) {
+    completeRpc(channel, HARE_ERROR_E::SERVER_CONNECTION_FAILURE, nullptr);
+  }
+
+  {
+    const std::lock_guard<std::mutex> lock(m_channelMutex);
+    for (auto& slot : m_channels) slot.m_isOpen = false;
+  }
+  clearInboxes();
+}
+
+void ConnectionBase::post(int channel, const ioCommand& command,
+                          const ioCompletion& done) {
+  {
+    const std::lock_guard<std::mutex> lock(m_commandMutex);
+    if (m_ioRunning) {
+      auto& queue = m_commandQueues[channel];
+      queuedCommand queued;
+      queued.m_run = command;
+      queued.m_done = done;
+      queue.m_commands.push_back(std::move(queued));
+      if (false == queue.m_scheduled && false == queue.m_rpcInFlight) {
+        queue.m_scheduled = true;
+        m_readyChannels.push_back(channel);
+      }
+    } else {
+      // Fall through and fail it outside the lock
+      channel = -1;
+    }
+  }
+
+  if (channel == -1) {
+    done(HARE_ERROR_E::SERVER_CONNECTION_FAILURE);
+    return;
+  }
+  wakeIoThread();
+}
+
+HARE_ERROR_E ConnectionBase::submit(int channel, const ioCommand& command) {
+  auto result = std::make_shared<std::promise<HARE_ERROR_E> >();
+  auto future = result->get_future();
+  post(channel, command,
+       [result](HARE_ERROR_E retCode) { result->set_value(retCode); });
+  return future.get();
+}
+
+HARE_ERROR_E ConnectionBase::rpc(
+    int channel, amqp_method_number_t request, std::shared_ptr<void> decoded,
+    const std::vector<amqp_method_number_t>& expectedReplies,
+    const rpcReplyHandler& onReply) {
+  return submit(channel, [this, channel, request, decoded, expectedReplies,
+                          onReply](const ioCompletion& done) {
+    if (false == IsConnected()) {
+      done(HARE_ERROR_E::SERVER_CONNECTION_FAILURE);
+      return;
+    }
+    startRpc(channel, request, decoded.get(), expectedReplies, onReply, done);
+  });
+}
+
+HARE_ERROR_E ConnectionBase::Execute(
+    int channel,
+    const std::function<HARE_ERROR_E(amqp_connection_state_t)>& function) {
+  return submit(channel, [this, &function](const ioCompletion& done) {
+    if (false == IsConnected()) {
+      done(HARE_ERROR_E::SERVER_CONNECTION_FAILURE);
+      return;
+    }
+    done(function(m_conn));
+  });
+}
 
 HARE_ERROR_E ConnectionBase::CloseConnection() {
+  HARE_PROBE1(close_connection, m_eventLogId);
+  if (false == m_ioRunning) {
+    setConnected(false);
+    {
+      const std::lock_guard<std::mutex> lock(m_channelMutex);
+      for (auto& slot : m_channels) slot.m_isOpen = false;
+    }
+    clearInboxes();
+    return HARE_ERROR_E::ALL_GOOD;
+  }
+
+  return submit(0, [this](const ioCompletion& done) {
+    done(closeOnIoThread());
+  });
+}
+
+HARE_ERROR_E ConnectionBase::closeOnIoThread() {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
-  if (IsConnected()) {
-    const std::lock_guard<std::mutex> lock(m_connMutex);
+  // Checked on the I/O thread, several clients sharing this connection may
+  // try to close it at once
+  if (IsConnected() && m_conn != nullptr) {
     LOG(LOG_WARN, "Closing Connection");
 
     auto amqpReply = amqp_connection_close(m_conn, AMQP_REPLY_SUCCESS);
@@ -89,42 +865,216 @@ HARE_ERROR_E ConnectionBase::CloseConnection() {
       default:
         break;
     }
-    amqp_destroy_connection(m_conn);
   }
 
-  setConnected(false);
+  teardown();
+
   return retCode;
 }
 
-void ConnectionBase::SetTimeout(int timeout) {
-  const std::lock_guard<std::mutex> lock(m_connMutex);
-  m_timeout = timeout;
+HARE_ERROR_E ConnectionBase::Disconnect(int clientId) {
+  auto retCode = HARE_ERROR_E::ALL_GOOD;
+  std::vector<int> clientChannels;
+  bool othersOpen{false};
+
+  {
+    const std::lock_guard<std::mutex> lock(m_channelMutex);
+    for (int channel = 1; channel < static_cast<int>(m_channels.size());
+         channel++) {
+      if (false == m_channels[channel].m_isOpen) continue;
+      if (m_channels[channel].m_owner == clientId)
+        clientChannels.push_back(channel);
+      else
+        othersOpen = true;
+    }
+  }
+
+  clearInbox(clientId);
+
+  // Last one out closes the connection
+  if (false == othersOpen) return CloseConnection();
+
+  for (int channel : clientChannels) {
+    auto closeCode = CloseChannel(channel);
+    if (false == noError(closeCode)) retCode = closeCode;
+  }
+
+  return retCode;
+}
+
+int ConnectionBase::RegisterClient() {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  m_clients.insert(m_nextClientId);
+  return m_nextClientId++;
+}
+
+void ConnectionBase::UnregisterClient(int clientId) {
+  {
+    const std::lock_guard<std::mutex> lock(m_channelMutex);
+    m_clients.erase(clientId);
+    for (auto& slot : m_channels) {
+      if (slot.m_owner == clientId) {
+        slot.m_owner = -1;
+        slot.m_isOpen = false;
+        m_channelsInUse--;
+        MetricsRegistry::Instance().Add(METRIC_E::CHANNELS_ALLOCATED, -1);
+      }
+    }
+  }
+  clearInbox(clientId);
+}
+
+int ConnectionBase::AllocateChannel(int clientId) {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+
+  // Lowest free number first, keeps the channel numbers (and the broker's
+  // per-channel tables) compact
+  for (int channel = 1; channel <= m_channelMax; channel++) {
+    if (channel >= static_cast<int>(m_channels.size())) {
+      m_channels.resize(channel + 1);
+    }
+    if (m_channels[channel].m_owner == -1) {
+      m_channels[channel].m_owner = clientId;
+      m_channels[channel].m_isOpen = false;
+      m_channelsInUse++;
+      MetricsRegistry::Instance().Add(METRIC_E::CHANNELS_ALLOCATED, 1);
+      return channel;
+    }
+  }
+
+  LOGF(LOG_ERROR, "All %d channels are in use", m_channelMax);
+  return -1;
+}
+
+int ConnectionBase::ChannelCount() const {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  return m_channelsInUse;
+}
+
+int ConnectionBase::Load() const {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  std::unordered_set<int> withoutChannels(m_clients);
+  for (const auto& slot : m_channels) withoutChannels.erase(slot.m_owner);
+  return m_channelsInUse + static_cast<int>(withoutChannels.size());
 }
 
+int ConnectionBase::ChannelMax() const {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  return m_channelMax;
+}
+
+unsigned int ConnectionBase::Generation() const {
+  return m_generation.load(std::memory_order_acquire);
+}
+
+void ConnectionBase::setChannelOpen(int channel, bool isOpen) {
+  if (channel <= 0 || channel > AMQP_MAX_CHANNEL_NUMBER) return;
+  if (channel >= static_cast<int>(m_channels.size())) {
+    if (false == isOpen) return;
+    m_channels.resize(channel + 1);
+  }
+  if (m_channels[channel].m_isOpen != isOpen) {
+    EventLog::Instance().Record(
+        isOpen ? EVENT_E::CHANNEL_OPENED : EVENT_E::CHANNEL_CLOSED,
+        m_eventLogId, channel, 0);
+  }
+  m_channels[channel].m_isOpen = isOpen;
+}
+
+int ConnectionBase::channelOwner(int channel) const {
+  if (channel > 0 && channel < static_cast<int>(m_channels.size())) {
+    return m_channels[channel].m_owner;
+  }
+  return -1;
+}
+
+std::shared_ptr<ConnectionBase::deliveryInbox> ConnectionBase::inbox(
+    int clientId) {
+  auto& clientInbox = m_inboxes[clientId];
+  if (false == static_cast<bool>(clientInbox)) {
+    clientInbox = std::make_shared<deliveryInbox>();
+  }
+  return clientInbox;
+}
+
+void ConnectionBase::clearInboxes() {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  for (auto& clientInbox : m_inboxes) {
+    MetricsRegistry::Instance().Add(
+        METRIC_E::INBOX_DEPTH,
+        -static_cast<int64_t>(clientInbox.second->m_deliveries.size()));
+    for (auto& delivery : clientInbox.second->m_deliveries) {
+      amqp_destroy_envelope(&delivery.m_envelope);
+    }
+    clientInbox.second->m_deliveries.clear();
+    clientInbox.second->m_closedChannels.clear();
+    // Anyone waiting finds out the connection is gone
+    clientInbox.second->m_ready.notify_all();
+  }
+}
+
+void ConnectionBase::clearInbox(int clientId) {
+  const std::lock_guard<std::mutex> lock(m_channelMutex);
+  auto it = m_inboxes.find(clientId);
+  if (it == m_inboxes.end()) return;
+  MetricsRegistry::Instance().Add(
+      METRIC_E::INBOX_DEPTH,
+      -static_cast<int64_t>(it->second->m_deliveries.size()));
+  for (auto& delivery : it->second->m_deliveries) {
+    amqp_destroy_envelope(&delivery.m_envelope);
+  }
+  it->second->m_deliveries.clear();
+  it->second->m_closedChannels.clear();
+  it->second->m_ready.notify_all();
+  m_inboxes.erase(it);
+}
+
+void ConnectionBase::SetTimeout(int timeout) { m_timeout = timeout; }
+
 HARE_ERROR_E ConnectionBase::connectBasic() {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
 
   m_socket = nullptr;
+  m_customSocket = nullptr;
+
+  auto options = SocketOptions();
+  // Where amqp_socket_open() connects to, a path for Unix sockets
+  auto host = m_basicCredentials.m_hostname;
 
-  const std::lock_guard<std::mutex> lock(m_connMutex);
   m_conn = amqp_new_connection();
-  m_socket = amqp_tcp_socket_new(m_conn);
+  if (m_conn != nullptr) {
+    if (options.m_transport == helper::socketTransport::UNIX) {
+      m_customSocket = new UnixSocket();
+      host = options.m_unixPath;
+    } else if (options.m_transport == helper::socketTransport::IO_URING) {
+      if (UringSocket::Supported()) {
+        m_customSocket = new UringSocket();
+      } else {
+        LOG(LOG_WARN, "io_uring not available, using TCP socket");
+      }
+    }
+  }
+  if (m_customSocket != nullptr) {
+    m_socket = m_customSocket->Attach(m_conn);
+  } else {
+    m_socket = amqp_tcp_socket_new(m_conn);
+  }
   if (m_socket == nullptr) {
     LOG(LOG_FATAL, "Failed to create socket to amqp Connection");
     retCode = HARE_ERROR_E::INITIALIZE_FAILURE;
   }
 
   if (noError(retCode)) {
-    LOG(LOG_DETAILED, "Attempting to connect to TCP Socket");
+    LOG(LOG_DETAILED, "Attempting to connect to broker socket");
     struct timeval timeout = {2, 0};
-    auto status = amqp_socket_open_noblock(
-        m_socket, m_basicCredentials.m_hostname.c_str(),
-        m_basicCredentials.m_port, &timeout);
+    auto status = amqp_socket_open_noblock(m_socket, host.c_str(),
+                                           m_basicCredentials.m_port, &timeout);
     if (status) {
-      LOG(LOG_FATAL, "Unable to open TCP Socket to hostname");
+      LOGF(LOG_FATAL, "Unable to open socket to %s", host.c_str());
       retCode = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
     } else {
-      LOG(LOG_INFO, "Opened TCP Socket to broker");
+      LOG(LOG_INFO, "Opened socket to broker");
+      applySocketOptions(socketFd());
     }
   }
 
@@ -132,8 +1082,28 @@ HARE_ERROR_E ConnectionBase::connectBasic() {
 }
 
 HARE_ERROR_E ConnectionBase::Connect() {
+  const std::lock_guard<std::mutex> connectLock(m_connectMutex);
+
+  // Someone sharing this connection got here first
+  if (IsConnected()) return HARE_ERROR_E::ALL_GOOD;
+
+  HARE_PROBE1(connect_start, m_eventLogId);
+  startIoThread();
+
+  auto retCode = submit(0, [this](const ioCompletion& done) {
+    done(connectOnIoThread());
+  });
+  HARE_PROBE3(connect_done, m_eventLogId, static_cast<int>(retCode),
+              m_generation.load());
+  return retCode;
+}
+
+HARE_ERROR_E ConnectionBase::connectOnIoThread() {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
 
+  // Left over from a connection that failed underneath us
+  if (m_conn != nullptr) teardown();
+
   // Set up connection information
   if (m_isSSL) {
     // TODO ssl connection
@@ -146,7 +1116,23 @@ HARE_ERROR_E ConnectionBase::Connect() {
   }
 
   if (noError(retCode)) {
+    // Frames cached for the old connection may not fit the new frame_max
+    m_frameWriter.Reset();
+    m_frameWriter.SetFrameMax(amqp_get_frame_max(m_conn));
+    auto& metrics = MetricsRegistry::Instance();
+    metrics.Add(METRIC_E::CONNECTS, 1);
+    if (++m_generation > 1) metrics.Add(METRIC_E::RECONNECTS, 1);
     setConnected(true);
+  } else {
+    MetricsRegistry::Instance().RpcError(retCode);
+    EventLog::Instance().Record(EVENT_E::CONNECT_FAILED, m_eventLogId, 0,
+                                static_cast<int64_t>(retCode));
+    if (m_conn != nullptr) {
+      amqp_destroy_connection(m_conn);
+      m_conn = nullptr;
+      m_socket = nullptr;
+      m_customSocket = nullptr;
+    }
   }
 
   return retCode;
@@ -159,69 +1145,181 @@ HARE_ERROR_E ConnectionBase::DeclareExchange(int channel,
     return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
   }
 
-  const std::lock_guard<std::mutex> lock(m_connMutex);
-  amqp_exchange_declare(m_conn, channel, amqp_cstring_bytes(exchange.c_str()),
-                        amqp_cstring_bytes(type.c_str()), 0, 0, 0, 0,
-                        amqp_empty_table);  // TODO MORE POWER TO USER
-  return (decodeRpcReply(amqp_get_rpc_reply(m_conn)));
+  auto request = std::make_shared<amqp_exchange_declare_t>();
+  request->ticket = 0;
+  request->exchange = amqp_cstring_bytes(exchange.c_str());
+  request->type = amqp_cstring_bytes(type.c_str());
+  // TODO MORE POWER TO USER
+  request->passive = 0;
+  request->durable = 0;
+  request->auto_delete = 0;
+  request->internal = 0;
+  request->nowait = 0;
+  request->arguments = amqp_empty_table;
+
+  return rpc(channel, AMQP_EXCHANGE_DECLARE_METHOD, request,
+             {AMQP_EXCHANGE_DECLARE_OK_METHOD});
 }
 
 HARE_ERROR_E ConnectionBase::OpenChannel(int channel) {
-  auto retCode = HARE_ERROR_E::ALL_GOOD;
-
   if (false == IsConnected()) {
     return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
   }
 
-  const std::lock_guard<std::mutex> lock(m_connMutex);
-  amqp_channel_open(m_conn, channel);
+  auto request = std::make_shared<amqp_channel_open_t>();
+  request->out_of_band = amqp_empty_bytes;
 
-  retCode = decodeRpcReply(amqp_get_rpc_reply(m_conn));
+  // Marked open on the I/O thread, so deliveries arriving right behind the
+  // open-ok are routed
+  return rpc(channel, AMQP_CHANNEL_OPEN_METHOD, request,
+             {AMQP_CHANNEL_OPEN_OK_METHOD}, [this, channel](amqp_method_t*) {
+               const std::lock_guard<std::mutex> lock(m_channelMutex);
+               setChannelOpen(channel, true);
+               return HARE_ERROR_E::ALL_GOOD;
+             });
+}
 
-  if (retCode == HARE_ERROR_E::CHANNEL_EXCEPTION) {
-    amqp_channel_close_ok_t close_ok;
-    auto res = amqp_send_method(m_conn, channel, AMQP_CHANNEL_CLOSE_OK_METHOD,
-                                &close_ok);
-    if (res != AMQP_STATUS_OK) {
-      LOG(LOG_FATAL, "Unable to close channel");
-    }
+HARE_ERROR_E ConnectionBase::CloseChannel(int channel) {
+  if (false == IsConnected()) {
+    return HARE_ERROR_E::UNABLE_TO_CLOSE_CHANNEL;
   }
 
-  return retCode;
+  {
+    // Anything still arriving on it is dropped from here on
+    const std::lock_guard<std::mutex> lock(m_channelMutex);
+    setChannelOpen(channel, false);
+  }
+
+  auto request = std::make_shared<amqp_channel_close_t>();
+  request->reply_code = AMQP_REPLY_SUCCESS;
+  request->reply_text = amqp_cstring_bytes("OK");
+  request->class_id = 0;
+  request->method_id = 0;
+
+  return rpc(channel, AMQP_CHANNEL_CLOSE_METHOD, request,
+             {AMQP_CHANNEL_CLOSE_OK_METHOD});
 }
 
-HARE_ERROR_E ConnectionBase::CloseChannel(int channel) {
-  auto retCode = HARE_ERROR_E::ALL_GOOD;
-  const std::lock_guard<std::mutex> lock(m_connMutex);
+HARE_ERROR_E ConnectionBase::PublishMessage(helper::RawMessage& message) {
+  if (false == IsConnected()) {
+    return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+  }
+
+  HARE_PROBE3(publish_start, m_eventLogId, message.channel,
+              message.message.len);
+  auto retCode =
+      submit(message.channel, [this, &message](const ioCompletion& done) {
+        done(publishOnIoThread(message));
+      });
+  HARE_PROBE3(publish_done, m_eventLogId, message.channel,
+              static_cast<int>(retCode));
+  EventLog::Instance().Record(
+      noError(retCode) ? EVENT_E::PUBLISHED : EVENT_E::PUBLISH_FAILED,
+      m_eventLogId, message.channel, 1);
+  return retCode;
+}
 
+HARE_ERROR_E ConnectionBase::PublishMessages(
+    const std::vector<std::shared_ptr<helper::RawMessage> >& messages,
+    std::vector<HARE_ERROR_E>& results) {
   if (false == IsConnected()) {
-    return HARE_ERROR_E::UNABLE_TO_CLOSE_CHANNEL;
+    results.assign(messages.size(), HARE_ERROR_E::SERVER_CONNECTION_FAILURE);
+    return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+  }
+
+  results.assign(messages.size(), HARE_ERROR_E::ALL_GOOD);
+  if (messages.empty()) return HARE_ERROR_E::ALL_GOOD;
+  HARE_PROBE2(publish_batch_start, m_eventLogId, messages.size());
+
+  auto finished = std::make_shared<std::promise<void> >();
+  auto allDone = finished->get_future();
+
+  if (m_nativePublish) {
+    // One command (and one write) per channel, in the order given
+    std::vector<int> channels;
+    std::unordered_map<int, std::vector<size_t> > byChannel;
+    for (size_t i = 0; i < messages.size(); i++) {
+      auto& indexes = byChannel[messages[i]->channel];
+      if (indexes.empty()) channels.push_back(messages[i]->channel);
+      indexes.push_back(i);
+    }
+
+    auto remaining = std::make_shared<std::atomic<size_t> >(channels.size());
+    for (int channel : channels) {
+      const auto& indexes = byChannel[channel];
+      post(channel,
+           [this, &messages, &results, indexes](const ioCompletion& done) {
+             publishBatchOnIoThread(messages, indexes, results);
+             done(HARE_ERROR_E::ALL_GOOD);
+           },
+           [&results, indexes, remaining, finished](HARE_ERROR_E retCode) {
+             // Never ran, the I/O thread went away
+             if (false == noError(retCode)) {
+               for (auto i : indexes) results[i] = retCode;
+             }
+             if (--(*remaining) == 0) finished->set_value();
+           });
+    }
+  } else {
+    auto remaining = std::make_shared<std::atomic<size_t> >(messages.size());
+    for (size_t i = 0; i < messages.size(); i++) {
+      auto message = messages[i];
+      post(message->channel,
+           [this, message](const ioCompletion& done) {
+             done(publishOnIoThread(*message));
+           },
+           [&results, i, remaining, finished](HARE_ERROR_E retCode) {
+             results[i] = retCode;
+             if (--(*remaining) == 0) finished->set_value();
+           });
+    }
   }
 
-  amqp_channel_close(m_conn, channel, AMQP_REPLY_SUCCESS);
+  allDone.wait();
+
+  int64_t published = 0;
+  for (auto result : results) published += noError(result) ? 1 : 0;
+  HARE_PROBE3(publish_batch_done, m_eventLogId, messages.size(), published);
+  auto& eventLog = EventLog::Instance();
+  if (published > 0) {
+    eventLog.Record(EVENT_E::PUBLISHED, m_eventLogId, 0, published);
+  }
+  if (published < static_cast<int64_t>(results.size())) {
+    eventLog.Record(EVENT_E::PUBLISH_FAILED, m_eventLogId, 0,
+                    results.size() - published);
+  }
 
+  auto retCode = HARE_ERROR_E::ALL_GOOD;
+  for (auto result : results) {
+    if (serverFailure(result)) return result;
+    if (noError(retCode)) retCode = result;
+  }
   return retCode;
 }
 
-HARE_ERROR_E ConnectionBase::PublishMessage(helper::RawMessage& message) {
+HARE_ERROR_E ConnectionBase::publishOnIoThread(helper::RawMessage& message) {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
 
   if (false == IsConnected()) {
     return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
   }
 
-  // If timestamp isn't set, set it here
-  if (AMQP_BASIC_TIMESTAMP_FLAG !=
-      (message.properties._flags & AMQP_BASIC_TIMESTAMP_FLAG)) {
-    message.properties._flags |= AMQP_BASIC_TIMESTAMP_FLAG;
-    auto curTimeInMicroSecs =
-        std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::system_clock::now().time_since_epoch())
-            .count();
-    message.properties.timestamp = curTimeInMicroSecs;
+  stampTimestamp(message);
+  recordPayloadSize(message.message.len);
+  const sendTimeStamp sendTime(message);
+
+  // amqp_basic_publish() needs the body in one piece
+  if (m_nativePublish || false == message.fragments.empty()) {
+    retCode = m_frameWriter.Add(message);
+    // Anything rabbitmq-c wrote through a custom socket goes first
+    if (noError(retCode)) retCode = flushSocket();
+    if (noError(retCode)) {
+      retCode = flushFrames();
+      if (serverFailure(retCode)) teardown();
+    }
+    return retCode;
   }
 
-  const std::lock_guard<std::mutex> lock(m_connMutex);
   auto errorVal = amqp_basic_publish(m_conn, message.channel, message.exchange,
                                      message.routing_key, 0, 0,
                                      &message.properties, message.message);
@@ -231,6 +1329,7 @@ HARE_ERROR_E ConnectionBase::PublishMessage(helper::RawMessage& message) {
 
     if (errorVal == AMQP_STATUS_SOCKET_ERROR) {
       retCode = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+      teardown();
     } else {
       retCode = HARE_ERROR_E::PUBLISH_ERROR;
     }
@@ -238,53 +1337,139 @@ HARE_ERROR_E ConnectionBase::PublishMessage(helper::RawMessage& message) {
 
   return retCode;
 }
+
+void ConnectionBase::publishBatchOnIoThread(
+    const std::vector<std::shared_ptr<helper::RawMessage> >& messages,
+    const std::vector<size_t>& indexes, std::vector<HARE_ERROR_E>& results) {
+  if (false == IsConnected()) {
+    for (auto i : indexes) results[i] = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+    return;
+  }
+
+  std::vector<size_t> added;
+  for (auto i : indexes) {
+    stampTimestamp(*messages[i]);
+    recordPayloadSize(messages[i]->message.len);
+    // Add() encodes the headers straight away
+    const sendTimeStamp sendTime(*messages[i]);
+    results[i] = m_frameWriter.Add(*messages[i]);
+    if (noError(results[i])) added.push_back(i);
+  }
+
+  if (added.empty()) return;
+
+  auto retCode = flushSocket();
+  if (noError(retCode)) retCode = flushFrames();
+  if (false == noError(retCode)) {
+    for (auto i : added) results[i] = retCode;
+    if (serverFailure(retCode)) teardown();
+  }
+}
+
+void ConnectionBase::SetNativePublish(bool enabled) {
+  m_nativePublish = enabled;
+}
+
+bool ConnectionBase::NativePublish() const { return m_nativePublish; }
+
 HARE_ERROR_E ConnectionBase::ConsumeMessage(amqp_envelope_t& envelope) {
+  // Client 0 isn't a registered client, it gets deliveries on channels that
+  // were opened without being allocated
+  return ConsumeMessage(envelope, 0);
+}
+
+HARE_ERROR_E ConnectionBase::ConsumeMessage(amqp_envelope_t& envelope,
+                                            int clientId) {
+  uint64_t receivedNanos;
+  return ConsumeMessage(envelope, clientId, receivedNanos);
+}
+
+HARE_ERROR_E ConnectionBase::ConsumeMessage(amqp_envelope_t& envelope,
+                                            int clientId,
+                                            uint64_t& receivedNanos) {
   if (false == IsConnected()) return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
-  const std::lock_guard<std::mutex> lock(m_connMutex);
+
+  std::unique_lock<std::mutex> lock(m_channelMutex);
+  auto clientInbox = inbox(clientId);
 
   // TODO allow millisecs/seconds to be used here
   // Currently just does seconds
-  struct timeval timeout = {m_timeout, 0};
+  auto ready = clientInbox->m_ready.wait_for(
+      lock, std::chrono::seconds(m_timeout.load()), [this, &clientInbox]() {
+        return false == clientInbox->m_deliveries.empty() ||
+               false == clientInbox->m_closedChannels.empty() ||
+               false == IsConnected();
+      });
+
+  if (false == clientInbox->m_deliveries.empty()) {
+    envelope = clientInbox->m_deliveries.front().m_envelope;
+    receivedNanos = clientInbox->m_deliveries.front().m_receivedNanos;
+    clientInbox->m_deliveries.pop_front();
+    MetricsRegistry::Instance().Add(METRIC_E::INBOX_DEPTH, -1);
+    HARE_PROBE5(deliver, m_eventLogId, clientId, envelope.channel,
+                envelope.message.body.len, receivedNanos);
+    return HARE_ERROR_E::ALL_GOOD;
+  }
+
+  if (false == clientInbox->m_closedChannels.empty()) {
+    envelope.channel = clientInbox->m_closedChannels.front();
+    clientInbox->m_closedChannels.pop_front();
+    return HARE_ERROR_E::CHANNEL_EXCEPTION;
+  }
+
+  if (false == ready) {
+    LOG(LOG_DETAILED, "Timeout Occured");
+    return HARE_ERROR_E::TIMEOUT_OCCURED;
+  }
 
-  return decodeRpcReply(amqp_consume_message(m_conn, &envelope, &timeout, 0));
+  return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
 }
 
 HARE_ERROR_E ConnectionBase::StartConsumption(int channel,
                                               amqp_bytes_t queueName) {
-  const std::lock_guard<std::mutex> lock(m_connMutex);
+  auto request = std::make_shared<amqp_basic_consume_t>();
+  request->ticket = 0;
+  request->queue = queueName;
+  request->consumer_tag = amqp_empty_bytes;
+  request->no_local = 0;
+  request->no_ack = 1;
+  request->exclusive = 0;
+  request->nowait = 0;
+  request->arguments = amqp_empty_table;
 
-  amqp_basic_consume(m_conn, channel, queueName, amqp_empty_bytes, 0, 1, 0,
-                     amqp_empty_table);
-
-  return decodeRpcReply(amqp_get_rpc_reply(m_conn));
+  return rpc(channel, AMQP_BASIC_CONSUME_METHOD, request,
+             {AMQP_BASIC_CONSUME_OK_METHOD});
 }
 
 HARE_ERROR_E ConnectionBase::DeclareQueue(
     int channel, const helper::queueProperties& queueProps,
     amqp_bytes_t& retQueue) {
-  const std::lock_guard<std::mutex> lock(m_connMutex);
-  auto retCode = HARE_ERROR_E::ALL_GOOD;
+  // Should be configurable TODO
+  auto request = std::make_shared<amqp_queue_declare_t>();
+  request->ticket = 0;
+  request->queue = amqp_empty_bytes;
+  request->passive = queueProps.m_passive;
+  request->durable = queueProps.m_durable;
+  request->exclusive = queueProps.m_exclusive;
+  request->auto_delete = queueProps.m_autoDelete;
+  request->nowait = 0;
+  request->arguments = amqp_empty_table;
 
-  {
-    // Should be configurable TODO
-    // TODO Possible memory leak here?
-    amqp_queue_declare_ok_t* r = amqp_queue_declare(
-        m_conn, channel, amqp_empty_bytes, queueProps.m_passive,
-        queueProps.m_durable, queueProps.m_exclusive, queueProps.m_autoDelete,
-        amqp_empty_table);
-
-    auto retCode = decodeRpcReply(amqp_get_rpc_reply(m_conn));
-    if (noError(retCode)) {
-      retQueue = amqp_bytes_malloc_dup(r->queue);
-    } else {
-      char log[LOG_MAX_CHAR_SIZE];
-      snprintf(log, LOG_MAX_CHAR_SIZE, "Failed to declare queue on Channel: %d",
-               channel);
-      LOG(LOG_ERROR, log);
-    }
-    if (retQueue.bytes == NULL) {
-      LOG(LOG_FATAL, "Out of memory");
-    }
+  auto retCode = rpc(channel, AMQP_QUEUE_DECLARE_METHOD, request,
+                     {AMQP_QUEUE_DECLARE_OK_METHOD},
+                     [&retQueue](amqp_method_t* reply) {
+                       auto* declared = static_cast<amqp_queue_declare_ok_t*>(
+                           reply->decoded);
+                       retQueue = amqp_bytes_malloc_dup(declared->queue);
+                       if (retQueue.bytes == NULL) {
+                         LOG(LOG_FATAL, "Out of memory");
+                         return HARE_ERROR_E::INITIALIZE_FAILURE;
+                       }
+                       return HARE_ERROR_E::ALL_GOOD;
+                     });
+
+  if (false == noError(retCode)) {
+    LOGF(LOG_ERROR, "Failed to declare queue on Channel: %d", channel);
   }
 
   return retCode;
@@ -294,13 +1479,16 @@ HARE_ERROR_E ConnectionBase::BindQueue(int channel,
                                        const amqp_bytes_t& queueName,
                                        const std::string& exchange,
                                        const std::string& bindingKey) {
-  std::lock_guard<std::mutex> lock(m_connMutex);
-
-  amqp_queue_bind(m_conn, channel, queueName,
-                  amqp_cstring_bytes(exchange.c_str()),
-                  amqp_cstring_bytes(bindingKey.c_str()), amqp_empty_table);
+  auto request = std::make_shared<amqp_queue_bind_t>();
+  request->ticket = 0;
+  request->queue = queueName;
+  request->exchange = amqp_cstring_bytes(exchange.c_str());
+  request->routing_key = amqp_cstring_bytes(bindingKey.c_str());
+  request->nowait = 0;
+  request->arguments = amqp_empty_table;
 
-  return decodeRpcReply(amqp_get_rpc_reply(m_conn));
+  return rpc(channel, AMQP_QUEUE_BIND_METHOD, request,
+             {AMQP_QUEUE_BIND_OK_METHOD});
 }
 
 HARE_ERROR_E ConnectionBase::decodeRpcReply(const amqp_rpc_reply_t& reply) {
@@ -366,6 +1554,11 @@ HARE_ERROR_E ConnectionBase::decodeLibraryException(
       LOG(LOG_DETAILED, "Timeout Occured");
       break;
     }
+    case AMQP_STATUS_HEARTBEAT_TIMEOUT: {
+      retCode = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+      LOG(LOG_FATAL, "Heartbeat Timeout received");
+      break;
+    }
     case AMQP_STATUS_SOCKET_CLOSED: {
       retCode = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
       LOG(LOG_FATAL, "Socket Closed Error received");
@@ -387,8 +1580,8 @@ HARE_ERROR_E ConnectionBase::decodeLibraryException(
       break;
     }
     default:
-      LOG(LOG_ERROR, "HareCpp doesn't have this error known");
-      printf("%d\n", reply.library_error);
+      LOGF(LOG_ERROR, "HareCpp doesn't have this error known: %d",
+           reply.library_error);
       break;
   }
   return retCode;
@@ -0,0 +1,104 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ConnectionPool.hpp"
+
+namespace HareCpp {
+namespace connection {
+
+constexpr int ConnectionPool::DEFAULT_CHANNELS_PER_CONNECTION;
+
+ConnectionPool& ConnectionPool::Instance() {
+  static ConnectionPool pool;
+  return pool;
+}
+
+std::string ConnectionPool::poolKey(const std::string& hostname, int port,
+                                    const std::string& username,
+                                    const std::string& password) {
+  return username + ":" + password + "@" + hostname + ":" +
+         std::to_string(port);
+}
+
+std::shared_ptr<ConnectionBase> ConnectionPool::Acquire(
+    const std::string& hostname, int port, const std::string& username,
+    const std::string& password) {
+  const std::lock_guard<std::mutex> lock(m_poolMutex);
+  auto& connections = m_connections[poolKey(hostname, port, username, password)];
+
+  std::shared_ptr<ConnectionBase> selected;
+  int selectedLoad{m_channelsPerConnection};
+
+  // Least loaded connection that still has room, dropping dead ones as we go
+  for (auto it = connections.begin(); it != connections.end();) {
+    auto connection = it->lock();
+    if (connection == nullptr) {
+      it = connections.erase(it);
+      continue;
+    }
+    auto load = connection->Load();
+    if (load < selectedLoad) {
+      selected = connection;
+      selectedLoad = load;
+    }
+    ++it;
+  }
+
+  if (selected == nullptr) {
+    LOG(LOG_DETAILED, "Pool creating new connection");
+    selected = std::make_shared<ConnectionBase>(hostname, port, username,
+                                                password);
+    connections.push_back(selected);
+  }
+
+  return selected;
+}
+
+void ConnectionPool::SetChannelsPerConnection(int channels) {
+  const std::lock_guard<std::mutex> lock(m_poolMutex);
+  m_channelsPerConnection = (channels < 1 ? 1 : channels);
+}
+
+int ConnectionPool::ChannelsPerConnection() const {
+  const std::lock_guard<std::mutex> lock(m_poolMutex);
+  return m_channelsPerConnection;
+}
+
+int ConnectionPool::ConnectionCount() {
+  const std::lock_guard<std::mutex> lock(m_poolMutex);
+  int count{0};
+  for (auto& group : m_connections) {
+    for (auto& connection : group.second) {
+      if (false == connection.expired()) count++;
+    }
+  }
+  return count;
+}
+
+}  // namespace connection
+}  // namespace HareCpp
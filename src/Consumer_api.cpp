@@ -45,10 +45,8 @@ HARE_ERROR_E Consumer::Subscribe(const std::string& exchange,
         m_channelHandler.AddChannelProcessor({exchange, binding_key}, f);
 
     if (channel == -1) {
-      char log[LOG_MAX_CHAR_SIZE];
-      snprintf(log, LOG_MAX_CHAR_SIZE, "Unable to subscribe to %s : %s",
-               exchange.c_str(), binding_key.c_str());
-      LOG(LOG_ERROR, log);
+      LOGF(LOG_ERROR, "Unable to subscribe to %s : %s", exchange.c_str(),
+           binding_key.c_str());
       retCode = HARE_ERROR_E::UNABLE_TO_SUBSCRIBE;
     }
     if (noError(retCode)) {
@@ -82,6 +80,7 @@ HARE_ERROR_E Consumer::Start() {
 
     // Start up the consumer thread
     m_consumerThread = std::thread(&Consumer::thread, this);
+    hare_set_thread_affinity(m_consumerThread, m_cpuAffinity);
 
     LOG(LOG_INFO, "Consumer Thread Started");
   }
@@ -89,6 +88,46 @@ HARE_ERROR_E Consumer::Start() {
   return retCode;
 }
 
+HARE_ERROR_E Consumer::SetCpuAffinity(const std::vector<int>& cpus) {
+  for (auto cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  std::lock_guard<std::mutex> lock(m_consumerMutex);
+  m_cpuAffinity = cpus;
+  if (m_threadRunning) {
+    return hare_set_thread_affinity(m_consumerThread, m_cpuAffinity);
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+LatencyHistogram& Consumer::DispatchDelayHistogram() {
+  return m_channelHandler.DispatchDelayHistogram();
+}
+
+std::shared_ptr<LatencyHistogram> Consumer::CallbackDurationHistogram(
+    const std::string& exchange, const std::string& binding_key) const {
+  return m_channelHandler.CallbackDurationHistogram({exchange, binding_key});
+}
+
+std::shared_ptr<LatencyHistogram> Consumer::OneWayLatencyHistogram(
+    const std::string& exchange, const std::string& binding_key) const {
+  return m_channelHandler.OneWayLatencyHistogram({exchange, binding_key});
+}
+
+void Consumer::SetClockOffset(int64_t offsetNanos) {
+  m_clockOffsetNanos = offsetNanos;
+}
+
+void Consumer::SetClockOffsetHook(TD_ClockOffset hook) {
+  std::lock_guard<std::mutex> lock(m_consumerMutex);
+  m_clockOffsetHook = hook;
+}
+
+void Consumer::SetCapture(std::shared_ptr<TrafficCapture> capture) {
+  std::atomic_store(&m_capture, capture);
+}
+
 HARE_ERROR_E Consumer::Stop() {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
   emptyPendingChannels();
@@ -105,7 +144,9 @@ HARE_ERROR_E Consumer::Stop() {
 
     m_consumerThread.join();
 
-    retCode = m_connection->CloseConnection();
+    // Only takes the connection down if nobody else is using it
+    retCode = m_connection->Disconnect(m_clientId);
+    m_connectionGeneration = 0;
   }
 
   return retCode;
@@ -117,9 +158,34 @@ HARE_ERROR_E Consumer::Stop() {
 HARE_ERROR_E Consumer::Initialize(const std::string& server, int port,
                                   const std::string& username,
                                   const std::string& password) {
+  return Initialize(std::make_shared<connection::ConnectionBase>(
+      server, port, username, password));
+}
+
+HARE_ERROR_E Consumer::Initialize(
+    std::shared_ptr<connection::ConnectionBase> connection) {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
-  m_connection = std::make_shared<connection::ConnectionBase>(
-      server, port, username, password);
+
+  if (connection == nullptr) {
+    LOG(LOG_ERROR, "Consumer given an empty connection");
+    retCode = HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  if (noError(retCode)) {
+    if (m_connection != nullptr) m_connection->UnregisterClient(m_clientId);
+    m_connection = connection;
+    m_clientId = m_connection->RegisterClient();
+    m_connectionGeneration = 0;
+
+    // Channel numbers must be unique across everyone sharing the connection
+    auto clientId = m_clientId;
+    std::weak_ptr<connection::ConnectionBase> weakConnection = m_connection;
+    m_channelHandler.SetChannelAllocator([weakConnection, clientId]() {
+      auto connection = weakConnection.lock();
+      return (connection == nullptr ? -1
+                                    : connection->AllocateChannel(clientId));
+    });
+  }
 
   if (noError(retCode)) {
     m_isInitialized = true;
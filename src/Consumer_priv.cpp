@@ -30,6 +30,7 @@
 #include <cstring>
 
 #include "Consumer.hpp"
+#include "Metrics.hpp"
 #include "Utils.hpp"
 
 namespace HareCpp {
@@ -42,14 +43,9 @@ void Consumer::setRunning(bool running) {
 HARE_ERROR_E Consumer::openChannel(const int channel) {
   auto retCode = m_connection->OpenChannel(channel);
   if (noError(retCode)) {
-    char log[LOG_MAX_CHAR_SIZE];
-    snprintf(log, LOG_MAX_CHAR_SIZE, "Successfully opened channel: %d",
-             channel);
-    LOG(LOG_INFO, log);
+    LOGF(LOG_INFO, "Successfully opened channel: %d", channel);
   } else {
-    char log[LOG_MAX_CHAR_SIZE];
-    snprintf(log, LOG_MAX_CHAR_SIZE, "Unable to open channel: %d", channel);
-    LOG(LOG_ERROR, log);
+    LOGF(LOG_ERROR, "Unable to open channel: %d", channel);
   }
   return retCode;
 }
@@ -59,10 +55,8 @@ HARE_ERROR_E Consumer::declareQueue(const int channel,
   auto retCode = m_connection->DeclareQueue(
       channel, m_channelHandler.GetQueueProperties(channel), queueName);
   if (noError(retCode)) {
-    char log[LOG_MAX_CHAR_SIZE];
-    snprintf(log, LOG_MAX_CHAR_SIZE, "Created Queue: %s",
-             hare_bytes_to_string(queueName).c_str());
-    LOG(LOG_INFO, log);
+    LOGF(LOG_INFO, "Created Queue: %s",
+         hare_bytes_to_string(queueName).c_str());
 
     m_channelHandler.SetQueueName(channel, queueName);
   }
@@ -71,12 +65,10 @@ HARE_ERROR_E Consumer::declareQueue(const int channel,
 
 HARE_ERROR_E Consumer::bindQueue(const int channel,
                                  const amqp_bytes_t& queueName) {
-  char log[LOG_MAX_CHAR_SIZE];
-  snprintf(log, LOG_MAX_CHAR_SIZE, "Binding: %s %s %s %d",
-           hare_bytes_to_string(queueName).c_str(),
-           m_channelHandler.GetExchange(channel).c_str(),
-           m_channelHandler.GetBindingKey(channel).c_str(), channel);
-  LOG(LOG_DETAILED, log);
+  LOGF(LOG_DETAILED, "Binding: %s %s %s %d",
+       hare_bytes_to_string(queueName).c_str(),
+       m_channelHandler.GetExchange(channel).c_str(),
+       m_channelHandler.GetBindingKey(channel).c_str(), channel);
 
   auto retCode = m_connection->BindQueue(
       channel, queueName, m_channelHandler.GetExchange(channel),
@@ -118,9 +110,7 @@ HARE_ERROR_E Consumer::setupAndConsume(int channel) {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
   amqp_bytes_t queueName;
 
-  char log[LOG_MAX_CHAR_SIZE];
-  snprintf(log, LOG_MAX_CHAR_SIZE, "Registering channel: %d", channel);
-  LOG(LOG_DETAILED, log);
+  LOGF(LOG_DETAILED, "Registering channel: %d", channel);
 
   if (noError(retCode)) retCode = openChannel(channel);
   if (noError(retCode)) retCode = declareQueue(channel, queueName);
@@ -159,7 +149,10 @@ void Consumer::thread() {
   HARE_ERROR_E retCode;
   while (IsRunning()) {
     retCode = HARE_ERROR_E::ALL_GOOD;
-    if (false == m_connection->IsConnected()) {
+    // Not connected, or a shared connection was re-established by someone
+    // else and our channels went with the old one
+    if (false == m_connection->IsConnected() ||
+        m_connectionGeneration != m_connection->Generation()) {
       retCode = connectAndStartConsumption();
     }
 
@@ -177,9 +170,12 @@ void Consumer::thread() {
 HARE_ERROR_E Consumer::connectAndStartConsumption() {
   auto retCode = m_connection->Connect();
   if (noError(retCode)) {
+    auto generation = m_connection->Generation();
     retCode = startConsumption();
     if (serverFailure(retCode)) {
       m_connection->CloseConnection();
+    } else {
+      m_connectionGeneration = generation;
     }
   } else {
     // Sleep a configurable amount of time to reduce spamming a
@@ -191,15 +187,35 @@ HARE_ERROR_E Consumer::connectAndStartConsumption() {
   return retCode;
 }
 
+int64_t Consumer::oneWayLatency(const Message& message, int64_t sentNanos,
+                                uint64_t receivedNanos) const {
+  TD_ClockOffset hook;
+  {
+    const std::lock_guard<std::mutex> lock(m_consumerMutex);
+    hook = m_clockOffsetHook;
+  }
+  // Outside the lock, the hook may well call back into us
+  const int64_t offsetNanos = hook ? hook(message) : m_clockOffsetNanos.load();
+
+  // Wall clock time it arrived, going back from now by the monotonic time
+  // it has been waiting
+  int64_t arrivedNanos = hare_realtime_nanos();
+  if (receivedNanos != 0) {
+    arrivedNanos -= static_cast<int64_t>(LatencyHistogram::Now() -
+                                         receivedNanos);
+  }
+
+  const int64_t latency = arrivedNanos - (sentNanos + offsetNanos);
+  return latency > 0 ? latency : 0;
+}
+
 void Consumer::pullNextMessage() {
-  if (m_connection->IsConnected())
-    amqp_maybe_release_buffers(m_connection->Connection());
-  else
-    return;
+  if (false == m_connection->IsConnected()) return;
 
   amqp_envelope_t envelope;
+  uint64_t receivedNanos = 0;
 
-  auto ret = m_connection->ConsumeMessage(envelope);
+  auto ret = m_connection->ConsumeMessage(envelope, m_clientId, receivedNanos);
 
   if (noError(ret)) {
     Message newMessage(envelope);
@@ -210,15 +226,31 @@ void Consumer::pullNextMessage() {
       return;
     }
 
+    auto& metrics = MetricsRegistry::Instance();
+    metrics.Add(METRIC_E::MESSAGES_DELIVERED, 1);
+    metrics.Add(METRIC_E::BYTES_DELIVERED, envelope.message.body.len);
+
+    const auto capture = std::atomic_load(&m_capture);
+    if (capture) capture->Record(envelope, receivedNanos);
+
+    int64_t sentNanos;
+    int64_t oneWayNanos = -1;
+    if (hare_send_time(envelope.message.properties, sentNanos)) {
+      oneWayNanos = oneWayLatency(newMessage, sentNanos, receivedNanos);
+    }
+
     m_channelHandler.Process(
         {std::string(static_cast<char*>(envelope.exchange.bytes),
                      envelope.exchange.len),
          std::string(static_cast<char*>(envelope.routing_key.bytes),
                      envelope.routing_key.len)},
-        newMessage);
+        newMessage, receivedNanos, oneWayNanos);
 
     amqp_destroy_envelope(&envelope);
 
+  } else if (ret == HARE_ERROR_E::CHANNEL_EXCEPTION) {
+    // The broker closed one of our channels, set it back up from the thread
+    pushIntoPendingChannels(envelope.channel);
   } else if (serverFailure(ret) && IsRunning()) {
     LOG(LOG_FATAL, "Restarting Consumer due to server error");
     m_connection->CloseConnection();
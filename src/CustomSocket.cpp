@@ -0,0 +1,100 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "CustomSocket.hpp"
+
+#include <sys/socket.h>
+
+#include <cerrno>
+
+namespace HareCpp {
+namespace connection {
+
+const hare_socket_class_t CustomSocket::s_class = {
+    [](void* self, const void* buffer, size_t length, int flags) -> ssize_t {
+      return owner(self)->Send(buffer, length, flags);
+    },
+    [](void* self, void* buffer, size_t length, int flags) -> ssize_t {
+      return owner(self)->Recv(buffer, length, flags);
+    },
+    [](void* self, const char* host, int port,
+       const struct timeval* timeout) -> int {
+      return owner(self)->Open(host, port, timeout);
+    },
+    [](void* self, int force) -> int {
+      return owner(self)->Close(force != 0);
+    },
+    [](void* self) -> int { return owner(self)->PollFd(); },
+    [](void* self) {
+      auto socket = owner(self);
+      socket->Close(true);
+      delete socket;
+    }};
+
+CustomSocket::CustomSocket() : m_syscalls(0) {
+  m_handle.klass = &s_class;
+  m_handle.m_owner = this;
+}
+
+CustomSocket* CustomSocket::owner(void* self) {
+  return static_cast<socketHandle*>(self)->m_owner;
+}
+
+amqp_socket_t* CustomSocket::Socket() {
+  return reinterpret_cast<amqp_socket_t*>(&m_handle);
+}
+
+amqp_socket_t* CustomSocket::Attach(amqp_connection_state_t conn) {
+  amqp_set_socket(conn, Socket());
+  return Socket();
+}
+
+ssize_t CustomSocket::plainSend(int fd, const void* buffer, size_t length,
+                                int flags) {
+  int sendFlags = MSG_NOSIGNAL;
+  if (flags & AMQP_SOCKET_FLAG_MORE) sendFlags |= MSG_MORE;
+  for (;;) {
+    m_syscalls++;
+    auto sent = send(fd, buffer, length, sendFlags);
+    if (sent >= 0) return sent;
+    if (errno != EINTR) return AMQP_STATUS_SOCKET_ERROR;
+  }
+}
+
+ssize_t CustomSocket::plainRecv(int fd, void* buffer, size_t length) {
+  for (;;) {
+    m_syscalls++;
+    auto count = recv(fd, buffer, length, MSG_DONTWAIT);
+    if (count > 0) return count;
+    if (count == 0) return AMQP_STATUS_CONNECTION_CLOSED;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return AMQP_SOCKET_NEED_READ;
+    if (errno != EINTR) return AMQP_STATUS_SOCKET_ERROR;
+  }
+}
+
+}  // namespace connection
+}  // namespace HareCpp
@@ -0,0 +1,255 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "EventLog.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Utils.hpp"
+
+namespace HareCpp {
+
+namespace {
+
+constexpr char EVENT_LOG_MAGIC[8] = {'H', 'A', 'R', 'E',
+                                     'E', 'V', 'N', 'T'};
+constexpr uint32_t EVENT_LOG_VERSION = 1;
+
+uint64_t monotonicNanos() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+std::string formatTime(int64_t realtimeNanos) {
+  const time_t seconds = realtimeNanos / 1000000000;
+  tm utc;
+  gmtime_r(&seconds, &utc);
+  char text[48];
+  const size_t length = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(text + length, sizeof(text) - length, ".%09lldZ",
+           static_cast<long long>(realtimeNanos % 1000000000));
+  return text;
+}
+
+std::string formatValue(EVENT_E type, int64_t value) {
+  switch (type) {
+    case EVENT_E::CONNECTED:
+      return "generation " + std::to_string(value);
+    case EVENT_E::CONNECT_FAILED:
+    case EVENT_E::RPC_REPLY:
+      return errorString(static_cast<HARE_ERROR_E>(value));
+    case EVENT_E::CHANNEL_CLOSED_BY_BROKER:
+      return "reply code " + std::to_string(value);
+    case EVENT_E::RPC_SENT: {
+      const char* name =
+          amqp_method_name(static_cast<amqp_method_number_t>(value));
+      if (name != nullptr) return name;
+      char hex[16];
+      snprintf(hex, sizeof(hex), "0x%08llx",
+               static_cast<unsigned long long>(value));
+      return hex;
+    }
+    case EVENT_E::PUBLISHED:
+    case EVENT_E::PUBLISH_FAILED:
+      return std::to_string(value) + " messages";
+    case EVENT_E::DELIVERED:
+      return std::to_string(value) + " bytes";
+    case EVENT_E::CALLBACK:
+      return std::to_string(value) + " ns";
+    default:
+      return "";
+  }
+}
+
+}  // namespace
+
+const char* eventString(EVENT_E type) {
+  static const char* const names[] = {
+      "NONE",
+      "CONNECTED",
+      "CONNECT_FAILED",
+      "DISCONNECTED",
+      "CHANNEL_OPENED",
+      "CHANNEL_CLOSED",
+      "CHANNEL_CLOSED_BY_BROKER",
+      "RPC_SENT",
+      "RPC_REPLY",
+      "PUBLISHED",
+      "PUBLISH_FAILED",
+      "DELIVERED",
+      "CALLBACK",
+  };
+  static_assert(sizeof(names) / sizeof(names[0]) ==
+                    static_cast<size_t>(EVENT_E::COUNT),
+                "eventString out of step with EVENT_E");
+  const auto index = static_cast<size_t>(type);
+  return index < static_cast<size_t>(EVENT_E::COUNT) ? names[index]
+                                                     : "UNKNOWN";
+}
+
+EventLog& EventLog::Instance() {
+  static EventLog eventLog;
+  return eventLog;
+}
+
+EventLog::EventLog() : m_ring(nullptr) {}
+
+HARE_ERROR_E EventLog::Open(const std::string& path, uint32_t records) {
+  const std::lock_guard<std::mutex> lock(m_openMutex);
+  if (IsOpen()) return HARE_ERROR_E::THREAD_ALREADY_RUNNING;
+  if (0 == records || records > (1u << 30)) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  uint32_t capacity = 1;
+  while (capacity < records) capacity <<= 1;
+
+  const size_t size = sizeof(fileHeader) + capacity * sizeof(eventRecord);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG(LOG_ERROR, "Unable to create event log " + path + ", " +
+                       strerror(errno));
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  void* map = MAP_FAILED;
+  if (0 == ftruncate(fd, size)) {
+    map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == map) {
+    LOG(LOG_ERROR, "Unable to map event log " + path + ", " +
+                       strerror(errno));
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  // ftruncate left the records zeroed, i.e. never written
+  auto header = static_cast<fileHeader*>(map);
+  memcpy(header->m_magic, EVENT_LOG_MAGIC, sizeof(header->m_magic));
+  header->m_version = EVENT_LOG_VERSION;
+  header->m_capacity = capacity;
+  header->m_written.store(0);
+  header->m_openedRealtimeNanos = hare_realtime_nanos();
+  header->m_openedMonotonicNanos = monotonicNanos();
+  header->m_pid = getpid();
+  header->m_reserved = 0;
+
+  auto ring = new mappedRing;
+  ring->m_header = header;
+  ring->m_records = reinterpret_cast<eventRecord*>(header + 1);
+  ring->m_mask = capacity - 1;
+  m_ring.store(ring, std::memory_order_release);
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+void EventLog::Close() {
+  const std::lock_guard<std::mutex> lock(m_openMutex);
+  m_ring.store(nullptr, std::memory_order_release);
+}
+
+void EventLog::record(mappedRing& ring, EVENT_E type, uint32_t connection,
+                      uint16_t channel, int64_t value) {
+  const uint64_t number =
+      ring.m_header->m_written.fetch_add(1, std::memory_order_relaxed);
+  auto& slot = ring.m_records[number & ring.m_mask];
+  // Mark it torn while it is being filled, a reader skips it until done
+  slot.m_sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.m_monotonicNanos = monotonicNanos();
+  slot.m_value = value;
+  slot.m_connection = connection;
+  slot.m_type = static_cast<uint16_t>(type);
+  slot.m_channel = channel;
+  slot.m_sequence.store(number + 1, std::memory_order_release);
+}
+
+HARE_ERROR_E EventLog::Decode(const std::string& path, std::ostream& out) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return HARE_ERROR_E::INVALID_PARAMETERS;
+  const off_t size = lseek(fd, 0, SEEK_END);
+  void* map = MAP_FAILED;
+  if (size >= static_cast<off_t>(sizeof(fileHeader))) {
+    map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == map) return HARE_ERROR_E::INVALID_PARAMETERS;
+
+  auto header = static_cast<const fileHeader*>(map);
+  const uint64_t capacity = header->m_capacity;
+  if (0 != memcmp(header->m_magic, EVENT_LOG_MAGIC,
+                  sizeof(header->m_magic)) ||
+      EVENT_LOG_VERSION != header->m_version || 0 == capacity ||
+      0 != (capacity & (capacity - 1)) ||
+      static_cast<uint64_t>(size) <
+          sizeof(fileHeader) + capacity * sizeof(eventRecord)) {
+    munmap(map, size);
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  auto records = reinterpret_cast<const eventRecord*>(header + 1);
+  const uint64_t written = header->m_written.load(std::memory_order_acquire);
+  const uint64_t first = written > capacity ? written - capacity : 0;
+  out << "# pid " << header->m_pid << ", opened "
+      << formatTime(header->m_openedRealtimeNanos) << ", " << written
+      << " events recorded, last " << (written - first) << " kept\n";
+
+  for (uint64_t number = first; number < written; number++) {
+    const auto& slot = records[number & (capacity - 1)];
+    if (slot.m_sequence.load(std::memory_order_acquire) != number + 1) {
+      continue;  // torn, or already overwritten by a later event
+    }
+    const uint64_t monotonic = slot.m_monotonicNanos;
+    const int64_t eventValue = slot.m_value;
+    const uint32_t connection = slot.m_connection;
+    const auto type = static_cast<EVENT_E>(slot.m_type);
+    const uint16_t channel = slot.m_channel;
+    // The process may still be recording, make sure it didn't just now
+    // overwrite the record under us
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.m_sequence.load(std::memory_order_relaxed) != number + 1) {
+      continue;
+    }
+
+    const int64_t realtime =
+        header->m_openedRealtimeNanos +
+        static_cast<int64_t>(monotonic - header->m_openedMonotonicNanos);
+    out << formatTime(realtime) << " conn " << connection << " ch " << channel
+        << " " << eventString(type);
+    const auto value = formatValue(type, eventValue);
+    if (false == value.empty()) out << " " << value;
+    out << "\n";
+  }
+
+  munmap(map, size);
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+}  // namespace HareCpp
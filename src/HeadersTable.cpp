@@ -0,0 +1,338 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "HeadersTable.hpp"
+
+namespace HareCpp {
+
+namespace {
+
+size_t align8(size_t bytes) { return (bytes + 7) & ~static_cast<size_t>(7); }
+
+size_t valueBytes(const amqp_field_value_t& value);
+
+size_t tableBytes(const amqp_table_t& table) {
+  size_t total = align8(sizeof(amqp_table_entry_t) * table.num_entries);
+  for (int i = 0; i < table.num_entries; i++) {
+    total += align8(table.entries[i].key.len) +
+             valueBytes(table.entries[i].value);
+  }
+  return total;
+}
+
+size_t arrayBytes(const amqp_array_t& array) {
+  size_t total = align8(sizeof(amqp_field_value_t) * array.num_entries);
+  for (int i = 0; i < array.num_entries; i++) {
+    total += valueBytes(array.entries[i]);
+  }
+  return total;
+}
+
+// What a value needs beside itself, nothing for the fixed size kinds
+size_t valueBytes(const amqp_field_value_t& value) {
+  switch (value.kind) {
+    case AMQP_FIELD_KIND_UTF8:
+    case AMQP_FIELD_KIND_BYTES:
+      return align8(value.value.bytes.len);
+    case AMQP_FIELD_KIND_TABLE:
+      return tableBytes(value.value.table);
+    case AMQP_FIELD_KIND_ARRAY:
+      return arrayBytes(value.value.array);
+    default:
+      return 0;
+  }
+}
+
+void copyBytes(const amqp_bytes_t& from, amqp_bytes_t& to, char*& out) {
+  to.len = from.len;
+  to.bytes = out;
+  if (from.len > 0) memcpy(out, from.bytes, from.len);
+  out += align8(from.len);
+}
+
+void copyValue(const amqp_field_value_t& from, amqp_field_value_t& to,
+               char*& out);
+
+void copyTable(const amqp_table_t& from, amqp_table_t& to, char*& out) {
+  to.num_entries = from.num_entries;
+  to.entries = reinterpret_cast<amqp_table_entry_t*>(out);
+  out += align8(sizeof(amqp_table_entry_t) * from.num_entries);
+  for (int i = 0; i < from.num_entries; i++) {
+    copyBytes(from.entries[i].key, to.entries[i].key, out);
+    copyValue(from.entries[i].value, to.entries[i].value, out);
+  }
+}
+
+void copyArray(const amqp_array_t& from, amqp_array_t& to, char*& out) {
+  to.num_entries = from.num_entries;
+  to.entries = reinterpret_cast<amqp_field_value_t*>(out);
+  out += align8(sizeof(amqp_field_value_t) * from.num_entries);
+  for (int i = 0; i < from.num_entries; i++) {
+    copyValue(from.entries[i], to.entries[i], out);
+  }
+}
+
+void copyValue(const amqp_field_value_t& from, amqp_field_value_t& to,
+               char*& out) {
+  to = from;
+  switch (from.kind) {
+    case AMQP_FIELD_KIND_UTF8:
+    case AMQP_FIELD_KIND_BYTES:
+      copyBytes(from.value.bytes, to.value.bytes, out);
+      break;
+    case AMQP_FIELD_KIND_TABLE:
+      copyTable(from.value.table, to.value.table, out);
+      break;
+    case AMQP_FIELD_KIND_ARRAY:
+      copyArray(from.value.array, to.value.array, out);
+      break;
+    default:
+      break;
+  }
+}
+
+}  // namespace
+
+bool hare_field_int(const amqp_field_value_t& value, int64_t& integer) {
+  switch (value.kind) {
+    case AMQP_FIELD_KIND_BOOLEAN:
+      integer = value.value.boolean ? 1 : 0;
+      return true;
+    case AMQP_FIELD_KIND_I8:
+      integer = value.value.i8;
+      return true;
+    case AMQP_FIELD_KIND_U8:
+      integer = value.value.u8;
+      return true;
+    case AMQP_FIELD_KIND_I16:
+      integer = value.value.i16;
+      return true;
+    case AMQP_FIELD_KIND_U16:
+      integer = value.value.u16;
+      return true;
+    case AMQP_FIELD_KIND_I32:
+      integer = value.value.i32;
+      return true;
+    case AMQP_FIELD_KIND_U32:
+      integer = value.value.u32;
+      return true;
+    case AMQP_FIELD_KIND_I64:
+      integer = value.value.i64;
+      return true;
+    case AMQP_FIELD_KIND_U64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+      integer = static_cast<int64_t>(value.value.u64);
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool hare_field_bytes(const amqp_field_value_t& value, amqp_bytes_t& bytes) {
+  if (value.kind != AMQP_FIELD_KIND_UTF8 &&
+      value.kind != AMQP_FIELD_KIND_BYTES) {
+    return false;
+  }
+  bytes = value.value.bytes;
+  return true;
+}
+
+HeadersTable::HeadersTable(const amqp_table_t& table)
+    : m_arena(nullptr), m_table(amqp_empty_table) {
+  if (table.num_entries <= 0) return;
+  m_arena = malloc(tableBytes(table));
+  if (nullptr == m_arena) {
+    LOG(LOG_ERROR, "Unable to allocate headers");
+    return;
+  }
+  char* out = static_cast<char*>(m_arena);
+  copyTable(table, m_table, out);
+}
+
+HeadersTable::HeadersTable(const HeadersTable& copiedFrom)
+    : HeadersTable(copiedFrom.m_table){};
+
+HeadersTable::HeadersTable(HeadersTable&& movedFrom) noexcept
+    : m_arena(movedFrom.m_arena), m_table(movedFrom.m_table) {
+  movedFrom.m_arena = nullptr;
+  movedFrom.m_table = amqp_empty_table;
+}
+
+HeadersTable& HeadersTable::operator=(const HeadersTable& copiedFrom) {
+  if (this != &copiedFrom) *this = HeadersTable(copiedFrom);
+  return *this;
+}
+
+HeadersTable& HeadersTable::operator=(HeadersTable&& movedFrom) noexcept {
+  if (this != &movedFrom) {
+    free(m_arena);
+    m_arena = movedFrom.m_arena;
+    m_table = movedFrom.m_table;
+    movedFrom.m_arena = nullptr;
+    movedFrom.m_table = amqp_empty_table;
+  }
+  return *this;
+}
+
+bool HeadersBuilder::grow(size_t needed) {
+  size_t capacity = m_capacity ? m_capacity * 2 : HEADERS_ARENA_BYTES;
+  while (capacity < needed) capacity *= 2;
+  char* arena = static_cast<char*>(malloc(capacity));
+  if (nullptr == arena) {
+    LOG(LOG_ERROR, "Unable to allocate headers");
+    return false;
+  }
+
+  // Entries stay at the start, bytes move to the new end and everything
+  // pointing at them with them
+  const char* oldEnd = m_arena + m_capacity;
+  char* newEnd = arena + capacity;
+  if (m_arena != nullptr) {
+    memcpy(arena, m_arena, sizeof(amqp_table_entry_t) * m_entries);
+    memcpy(newEnd - m_bytes, oldEnd - m_bytes, m_bytes);
+  }
+  auto* entries = reinterpret_cast<amqp_table_entry_t*>(arena);
+  for (int i = 0; i < m_entries; i++) {
+    auto& key = entries[i].key;
+    key.bytes = newEnd - (oldEnd - static_cast<char*>(key.bytes));
+    auto& value = entries[i].value;
+    if (value.kind == AMQP_FIELD_KIND_UTF8 ||
+        value.kind == AMQP_FIELD_KIND_BYTES) {
+      value.value.bytes.bytes =
+          newEnd - (oldEnd - static_cast<char*>(value.value.bytes.bytes));
+    }
+  }
+  free(m_arena);
+  m_arena = arena;
+  m_capacity = capacity;
+  return true;
+}
+
+amqp_table_entry_t* HeadersBuilder::add(const HeaderText& key, size_t bytes,
+                                        char*& data) {
+  const size_t needed = sizeof(amqp_table_entry_t) * (m_entries + 1) +
+                        m_bytes + key.m_length + bytes;
+  if (needed > m_capacity && false == grow(needed)) return nullptr;
+
+  char* end = m_arena + m_capacity;
+  m_bytes += key.m_length + bytes;
+  data = end - m_bytes;
+  auto& entry = reinterpret_cast<amqp_table_entry_t*>(m_arena)[m_entries++];
+  entry.key.len = key.m_length;
+  entry.key.bytes = data + bytes;
+  if (key.m_length > 0) memcpy(entry.key.bytes, key.m_data, key.m_length);
+  return &entry;
+}
+
+HeadersBuilder& HeadersBuilder::AddString(const HeaderText& key,
+                                          const HeaderText& value) {
+  amqp_field_value_t field;
+  field.kind = AMQP_FIELD_KIND_UTF8;
+  field.value.bytes.len = value.m_length;
+  field.value.bytes.bytes = const_cast<char*>(value.m_data);
+  return AddValue(key, field);
+}
+
+HeadersBuilder& HeadersBuilder::AddBytes(const HeaderText& key,
+                                         const void* bytes, size_t length) {
+  amqp_field_value_t field;
+  field.kind = AMQP_FIELD_KIND_BYTES;
+  field.value.bytes.len = length;
+  field.value.bytes.bytes = const_cast<void*>(bytes);
+  return AddValue(key, field);
+}
+
+HeadersBuilder& HeadersBuilder::AddInt(const HeaderText& key,
+                                       int64_t value) {
+  amqp_field_value_t field;
+  field.kind = AMQP_FIELD_KIND_I64;
+  field.value.i64 = value;
+  return AddValue(key, field);
+}
+
+HeadersBuilder& HeadersBuilder::AddDouble(const HeaderText& key,
+                                          double value) {
+  amqp_field_value_t field;
+  field.kind = AMQP_FIELD_KIND_F64;
+  field.value.f64 = value;
+  return AddValue(key, field);
+}
+
+HeadersBuilder& HeadersBuilder::AddBool(const HeaderText& key, bool value) {
+  amqp_field_value_t field;
+  field.kind = AMQP_FIELD_KIND_BOOLEAN;
+  field.value.boolean = value ? 1 : 0;
+  return AddValue(key, field);
+}
+
+HeadersBuilder& HeadersBuilder::AddTimestamp(const HeaderText& key,
+                                             uint64_t seconds) {
+  amqp_field_value_t field;
+  field.kind = AMQP_FIELD_KIND_TIMESTAMP;
+  field.value.u64 = seconds;
+  return AddValue(key, field);
+}
+
+HeadersBuilder& HeadersBuilder::AddValue(const HeaderText& key,
+                                         const amqp_field_value_t& value) {
+  if (value.kind == AMQP_FIELD_KIND_TABLE ||
+      value.kind == AMQP_FIELD_KIND_ARRAY) {
+    LOG(LOG_ERROR, "Nested tables can't be added to a HeadersBuilder");
+    return *this;
+  }
+  const bool hasBytes = value.kind == AMQP_FIELD_KIND_UTF8 ||
+                        value.kind == AMQP_FIELD_KIND_BYTES;
+  const size_t bytes = hasBytes ? value.value.bytes.len : 0;
+  char* data = nullptr;
+  auto* entry = add(key, bytes, data);
+  if (nullptr == entry) return *this;
+
+  entry->value = value;
+  if (hasBytes) {
+    if (bytes > 0) memcpy(data, value.value.bytes.bytes, bytes);
+    entry->value.value.bytes.bytes = data;
+  }
+  return *this;
+}
+
+HeadersTable HeadersBuilder::Build() {
+  HeadersTable table;
+  if (m_entries > 0) {
+    table.m_arena = m_arena;
+    table.m_table.num_entries = m_entries;
+    table.m_table.entries = reinterpret_cast<amqp_table_entry_t*>(m_arena);
+  } else {
+    free(m_arena);
+  }
+  m_arena = nullptr;
+  m_capacity = 0;
+  m_entries = 0;
+  m_bytes = 0;
+  return table;
+}
+
+}  // namespace HareCpp
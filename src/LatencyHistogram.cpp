@@ -0,0 +1,114 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "LatencyHistogram.hpp"
+
+namespace HareCpp {
+
+constexpr int LatencyHistogram::LATENCY_SUB_BUCKET_BITS;
+constexpr int LatencyHistogram::LATENCY_SUB_BUCKETS;
+constexpr int LatencyHistogram::LATENCY_BUCKETS;
+
+LatencyHistogram::LatencyHistogram() { Reset(); }
+
+uint64_t LatencyHistogram::BucketLowest(int index) {
+  if (index < LATENCY_SUB_BUCKETS) return index;
+  const int shift = index / LATENCY_SUB_BUCKETS - 1;
+  const uint64_t subBucket = index % LATENCY_SUB_BUCKETS;
+  return (LATENCY_SUB_BUCKETS + subBucket) << shift;
+}
+
+uint64_t LatencyHistogram::BucketHighest(int index) {
+  if (index < LATENCY_SUB_BUCKETS) return index;
+  const int shift = index / LATENCY_SUB_BUCKETS - 1;
+  return BucketLowest(index) + ((uint64_t(1) << shift) - 1);
+}
+
+LatencyHistogram::snapshot LatencyHistogram::Snapshot() const {
+  snapshot copy;
+  copy.m_counts.resize(LATENCY_BUCKETS);
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    copy.m_counts[i] = m_counts[i].load(std::memory_order_relaxed);
+    copy.m_count += copy.m_counts[i];
+  }
+  copy.m_sumNanos = m_sumNanos.load(std::memory_order_relaxed);
+  return copy;
+}
+
+LatencyHistogram::snapshot LatencyHistogram::SnapshotAndReset() {
+  snapshot copy;
+  copy.m_counts.resize(LATENCY_BUCKETS);
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    copy.m_counts[i] = m_counts[i].exchange(0, std::memory_order_relaxed);
+    copy.m_count += copy.m_counts[i];
+  }
+  copy.m_sumNanos = m_sumNanos.exchange(0, std::memory_order_relaxed);
+  return copy;
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& count : m_counts) count.store(0, std::memory_order_relaxed);
+  m_sumNanos.store(0, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::snapshot::Percentile(double percentile) const {
+  if (0 == m_count) return 0;
+  if (percentile < 0) percentile = 0;
+  if (percentile > 100) percentile = 100;
+
+  // Rank of the value we want, counting from 1
+  uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * m_count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > m_count) rank = m_count;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < m_counts.size(); i++) {
+    seen += m_counts[i];
+    if (seen >= rank) return LatencyHistogram::BucketHighest(i);
+  }
+  return MaxNanos();
+}
+
+uint64_t LatencyHistogram::snapshot::MinNanos() const {
+  for (size_t i = 0; i < m_counts.size(); i++) {
+    if (m_counts[i] != 0) return LatencyHistogram::BucketLowest(i);
+  }
+  return 0;
+}
+
+uint64_t LatencyHistogram::snapshot::MaxNanos() const {
+  for (size_t i = m_counts.size(); i-- > 0;) {
+    if (m_counts[i] != 0) return LatencyHistogram::BucketHighest(i);
+  }
+  return 0;
+}
+
+double LatencyHistogram::snapshot::MeanNanos() const {
+  return m_count ? static_cast<double>(m_sumNanos) / m_count : 0;
+}
+
+}  // namespace HareCpp
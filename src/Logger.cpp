@@ -26,9 +26,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include "Logger.hpp"
+#include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 const char* COL_NORM = "\x1B[0m";     // Normal
 const char* COL_FATAL = "\x1B[31m";   // Red
 const char* COL_ERROR = "\x1B[91m";   // Light Red
@@ -38,7 +47,247 @@ const char* COL_DETAIL = "\x1B[32m";  // Green
 const char* COL_TEST = "\x1B[34m";    // Blue
 
 namespace HareCpp {
-static int dbgLevel = LOG_TEST;
+std::atomic<int> dbgLevel{LOG_TEST};
+
+namespace {
+
+int64_t realtimeNanos() {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Records from one thread on their way to the writer.  Only the owning
+ * thread fills it, only the holder of loggerState::m_drainMutex empties it.
+ */
+struct logRing {
+  explicit logRing(unsigned int thread)
+      : m_head(0), m_tail(0), m_thread(thread), m_abandoned(false) {}
+
+  alignas(64) std::atomic<uint64_t> m_head;  // next record to write out
+  alignas(64) std::atomic<uint64_t> m_tail;  // next record to fill
+  unsigned int m_thread;
+  std::atomic<bool> m_abandoned;  // the owning thread has exited
+  logRecord m_records[LOG_RING_RECORDS];
+};
+
+// Gives the ring up when its thread exits, the writer frees it once empty
+struct ringHolder {
+  std::shared_ptr<logRing> m_ring;
+  ~ringHolder() {
+    if (m_ring) m_ring->m_abandoned = true;
+  }
+};
+
+class loggerState {
+ public:
+  /**
+   * Never destroyed: threads and static destructors may log while the
+   * process exits, which is written straight to the sinks once the writer
+   * thread has stopped
+   */
+  static loggerState& Instance() {
+    static loggerState* state = new loggerState();
+    return *state;
+  }
+
+  /**
+   * Where this thread's next record goes, nullptr if it should be written
+   * synchronously instead (the writer has stopped) or dropped (its ring is
+   * full, then dropped is set)
+   */
+  logRecord* Reserve(logRing*& ring, bool& dropped) {
+    dropped = false;
+    ring = nullptr;
+    if (false == m_writerRunning.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    ring = threadRing();
+    const uint64_t tail = ring->m_tail.load(std::memory_order_relaxed);
+    if (tail - ring->m_head.load(std::memory_order_acquire) >=
+        static_cast<uint64_t>(LOG_RING_RECORDS)) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      dropped = true;
+      return nullptr;
+    }
+    return &ring->m_records[tail % LOG_RING_RECORDS];
+  }
+
+  void Commit(logRing* ring, int logLevel) {
+    const uint64_t tail = ring->m_tail.load(std::memory_order_relaxed) + 1;
+    ring->m_tail.store(tail, std::memory_order_release);
+    // Errors shouldn't wait for the next interval, nor should a ring that is
+    // filling up
+    if (logLevel <= LOG_ERROR ||
+        tail - ring->m_head.load(std::memory_order_relaxed) >=
+            static_cast<uint64_t>(LOG_RING_RECORDS / 2)) {
+      m_wake.notify_one();
+    }
+  }
+
+  void WriteOut(const logRecord& record) {
+    const std::lock_guard<std::mutex> lock(m_drainMutex);
+    for (auto& sink : m_sinks) sink(record);
+  }
+
+  void Drain() {
+    const std::lock_guard<std::mutex> lock(m_drainMutex);
+    drainLocked();
+  }
+
+  // Waits out a drain in progress, no sink is called after it is removed
+  void AddSink(const TD_LogSink& sink) {
+    const std::lock_guard<std::mutex> lock(m_drainMutex);
+    m_sinks.push_back(sink);
+  }
+
+  void ClearSinks() {
+    const std::lock_guard<std::mutex> lock(m_drainMutex);
+    m_sinks.clear();
+  }
+
+  uint64_t Dropped() const { return m_dropped.load(); }
+
+ private:
+  loggerState()
+      : m_writerRunning(true),
+        m_stopping(false),
+        m_dropped(0),
+        m_reportedDropped(0),
+        m_nextThread(1),
+        m_sinks(1, CONSOLE_LOG_SINK) {
+    m_writer = std::thread(&loggerState::writerThread, this);
+    // Whatever is still in the rings gets written before the process ends
+    atexit([]() { Instance().stopWriter(); });
+  }
+
+  logRing* threadRing() {
+    static thread_local ringHolder holder;
+    if (false == static_cast<bool>(holder.m_ring)) {
+      holder.m_ring = std::make_shared<logRing>(m_nextThread++);
+      const std::lock_guard<std::mutex> lock(m_ringsMutex);
+      m_rings.push_back(holder.m_ring);
+    }
+    return holder.m_ring.get();
+  }
+
+  void writerThread() {
+    while (false == m_stopping) {
+      {
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wake.wait_for(
+            lock, std::chrono::milliseconds(LOG_DRAIN_INTERVAL_MILLISECONDS));
+      }
+      Drain();
+    }
+    Drain();
+  }
+
+  void stopWriter() {
+    m_stopping = true;
+    m_wake.notify_one();
+    if (m_writer.joinable()) m_writer.join();
+    m_writerRunning.store(false, std::memory_order_release);
+    // Anything that slipped in while the writer was finishing
+    Drain();
+  }
+
+  void drainLocked() {
+    std::vector<std::shared_ptr<logRing> > rings;
+    {
+      const std::lock_guard<std::mutex> lock(m_ringsMutex);
+      rings = m_rings;
+    }
+
+    for (auto& ring : rings) {
+      // Read before the tail, so an abandoned ring seen empty stays empty
+      const bool abandoned = ring->m_abandoned.load();
+      uint64_t head = ring->m_head.load(std::memory_order_relaxed);
+      const uint64_t tail = ring->m_tail.load(std::memory_order_acquire);
+      for (; head != tail; head++) {
+        const auto& record = ring->m_records[head % LOG_RING_RECORDS];
+        for (auto& sink : m_sinks) sink(record);
+        ring->m_head.store(head + 1, std::memory_order_release);
+      }
+      if (abandoned) {
+        const std::lock_guard<std::mutex> lock(m_ringsMutex);
+        for (auto it = m_rings.begin(); it != m_rings.end(); ++it) {
+          if (*it == ring) {
+            m_rings.erase(it);
+            break;
+          }
+        }
+      }
+    }
+
+    const uint64_t dropped = m_dropped.load();
+    if (dropped != m_reportedDropped) {
+      logRecord record;
+      record.m_level = LOG_WARN;
+      record.m_line = 0;
+      record.m_file = nullptr;
+      record.m_realtimeNanos = realtimeNanos();
+      record.m_thread = 0;
+      snprintf(record.m_message, sizeof(record.m_message),
+               "%llu log records dropped, logging faster than written out",
+               static_cast<unsigned long long>(dropped - m_reportedDropped));
+      for (auto& sink : m_sinks) sink(record);
+      m_reportedDropped = dropped;
+    }
+  }
+
+  std::atomic<bool> m_writerRunning;
+  std::atomic<bool> m_stopping;
+  std::atomic<uint64_t> m_dropped;
+  uint64_t m_reportedDropped;  // guarded by m_drainMutex
+  std::atomic<unsigned int> m_nextThread;
+
+  std::thread m_writer;
+  std::mutex m_wakeMutex;
+  std::condition_variable m_wake;
+  std::mutex m_drainMutex;  // also guards m_sinks
+
+  std::mutex m_ringsMutex;
+  std::vector<std::shared_ptr<logRing> > m_rings;
+
+  std::vector<TD_LogSink> m_sinks;
+};
+
+/**
+ * Fill a record for this thread and pass it on, fill writes the message
+ */
+template <typename Fill>
+void submit(int logLevel, int line, const char* file, Fill fill) {
+  auto& state = loggerState::Instance();
+  logRing* ring;
+  bool dropped;
+  logRecord synchronous;
+  logRecord* record = state.Reserve(ring, dropped);
+  if (dropped) return;
+  if (nullptr == record) record = &synchronous;
+
+  record->m_level = logLevel;
+  record->m_line = line;
+  record->m_file = file;
+  record->m_realtimeNanos = realtimeNanos();
+  record->m_thread = ring ? ring->m_thread : 0;
+  fill(record->m_message, sizeof(record->m_message));
+
+  if (ring) {
+    state.Commit(ring, logLevel);
+  } else {
+    state.WriteOut(*record);
+  }
+}
+
+void copyMessage(const char* message, char* buffer, size_t size) {
+  const size_t length = strnlen(message, size - 1);
+  memcpy(buffer, message, length);
+  buffer[length] = '\0';
+}
+
+}  // namespace
 
 void SET_DEBUG_LEVEL(int debugLevel) {
   if (debugLevel > LOG_NONE || debugLevel < LOG_FATAL) {
@@ -82,27 +331,37 @@ void GET_LOG_DISPLAY(int logLevel, const char*& logColor, std::string& level) {
   }
 }
 
-void LOG_SIMPLE(int logLevel, const char* message) {
-  if (logLevel <= dbgLevel && dbgLevel != LOG_NONE) {
-    const char* logColor;
-    std::string level;
-    GET_LOG_DISPLAY(logLevel, logColor, level);
+void CONSOLE_LOG_SINK(const logRecord& record) {
+  const char* logColor = COL_NORM;
+  std::string level;
+  GET_LOG_DISPLAY(record.m_level, logColor, level);
+  if (nullptr == record.m_file) {
     printf("\e[1;34mHareCpp:\e[0m\t%s%s: %s\e[0m\n", logColor, level.c_str(),
-           message);
+           record.m_message);
+  } else {
+    char callLocation[32];
+    snprintf(callLocation, 32, "%d:%s", record.m_line, record.m_file);
+    printf("\e[1;34mHareCpp: %-32s\e[0m %s%s: %s\e[0m\n", callLocation,
+           logColor, level.c_str(), record.m_message);
   }
 }
+
+void LOG_SIMPLE(int logLevel, const char* message) {
+  if (LOG_ENABLED(logLevel)) {
+    submit(logLevel, 0, nullptr, [message](char* buffer, size_t size) {
+      copyMessage(message, buffer, size);
+    });
+  }
+}
+
 void LOG_FULL(int logLevel, const char* message, int line, const char* file) {
   /**
    * Are we in the proper debug level set by user or default (LOG_INFO)
    */
-  if (logLevel <= dbgLevel && dbgLevel != LOG_NONE) {
-    const char* logColor;
-    std::string level;
-    GET_LOG_DISPLAY(logLevel, logColor, level);
-    char callLocation[32];
-    snprintf(callLocation, 32, "%d:%s", line, file);
-    printf("\e[1;34mHareCpp: %-32s\e[0m %s%s: %s\e[0m\n", callLocation,
-           logColor, level.c_str(), message);
+  if (LOG_ENABLED(logLevel)) {
+    submit(logLevel, line, file, [message](char* buffer, size_t size) {
+      copyMessage(message, buffer, size);
+    });
   }
 }
 
@@ -113,4 +372,25 @@ void LOG_SIMPLE(int logLevel, std::string message) {
   LOG_SIMPLE(logLevel, message.c_str());
 }
 
+void LOG_FORMAT(int logLevel, int line, const char* file, const char* format,
+                ...) {
+  if (false == LOG_ENABLED(logLevel)) return;
+  va_list args;
+  va_start(args, format);
+  submit(logLevel, line, file, [format, &args](char* buffer, size_t size) {
+    vsnprintf(buffer, size, format, args);
+  });
+  va_end(args);
+}
+
+void ADD_LOG_SINK(const TD_LogSink& sink) {
+  if (sink) loggerState::Instance().AddSink(sink);
+}
+
+void CLEAR_LOG_SINKS() { loggerState::Instance().ClearSinks(); }
+
+void FLUSH_LOG() { loggerState::Instance().Drain(); }
+
+uint64_t LOG_DROPPED() { return loggerState::Instance().Dropped(); }
+
 }  // namespace HareCpp
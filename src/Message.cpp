@@ -29,34 +29,133 @@
 
 namespace HareCpp {
 
-Message::Message(std::string&& message)
-    : m_body{hare_cstring_bytes(message.c_str())} {
+void Message::setBody(const void* bytes, size_t length) {
+  releaseBody();
+  m_body.bytes = m_inline;
+  if (length > MESSAGE_INLINE_BYTES) {
+    m_body.bytes = malloc(length + 1);
+    if (nullptr == m_body.bytes) {
+      LOG(LOG_ERROR, "Unable to allocate message payload");
+      m_body.bytes = m_inline;
+      length = 0;
+    }
+  }
+  if (length > 0 && bytes != nullptr) memcpy(m_body.bytes, bytes, length);
+  static_cast<char*>(m_body.bytes)[length] = '\0';
+  m_body.len = length;
   m_bodyHasBeenSet = true;
-  m_properties._flags = 0;
 }
 
-Message::Message(const std::string& message)
-    : m_body{hare_cstring_bytes(message.c_str())} {
+void Message::releaseBody() {
+  if (m_bodyHasBeenSet && false == bodyIsInline() && m_shared.Empty()) {
+    free(m_body.bytes);
+  }
+  m_shared.Reset();
+  m_fragments.clear();
+  m_fragmentsLength = 0;
+  m_body = amqp_empty_bytes;
+  m_bodyHasBeenSet = false;
+}
+
+void Message::shareBody(const SharedPayload& shared) {
+  releaseBody();
+  if (shared.Empty()) return;
+  m_shared = shared;
+  m_body = shared.Bytes();
   m_bodyHasBeenSet = true;
-  m_properties._flags = 0;
+}
+
+void Message::takeFrom(Message& other) noexcept {
+  m_properties = other.m_properties;
+  other.m_properties._flags = 0;
+
+  m_bodyHasBeenSet = other.m_bodyHasBeenSet;
+  m_body = other.m_body;
+  m_shared = std::move(other.m_shared);
+  m_fragments = std::move(other.m_fragments);
+  m_fragmentsLength = other.m_fragmentsLength;
+  m_headers = std::move(other.m_headers);
+  if (other.m_bodyHasBeenSet && other.bodyIsInline()) {
+    memcpy(m_inline, other.m_inline, other.m_body.len + 1);
+    m_body.bytes = m_inline;
+  }
+  other.m_shared.Reset();
+  other.m_fragments.clear();
+  other.m_fragmentsLength = 0;
+  other.m_body = amqp_empty_bytes;
+  other.m_bodyHasBeenSet = false;
+}
+
+void Message::setShortString(amqp_flags_t flag, amqp_bytes_t& field,
+                             const char* value, size_t length) {
+  if (m_properties._flags & flag) amqp_bytes_free(field);
+  amqp_bytes_t borrowed;
+  borrowed.len = length;
+  borrowed.bytes = const_cast<char*>(value);
+  field = amqp_bytes_malloc_dup(borrowed);
+  m_properties._flags |= flag;
+}
+
+Message::Message(std::string&& message) : Message() {
+  setBody(message.data(), message.size());
+}
+
+Message::Message(const std::string& message) : Message() {
+  setBody(message.data(), message.size());
 }
 
 /**
  * Message created by receiving an envelope
  */
-Message::Message(const amqp_envelope_t& envelope) {
-  m_bodyHasBeenSet = true;
-  m_body = amqp_bytes_malloc_dup(envelope.message.body);
+Message::Message(const amqp_envelope_t& envelope) : Message() {
+  setBody(envelope.message.body.bytes, envelope.message.body.len);
   hare_basic_properties_malloc_dup(envelope.message.properties, m_properties);
 }
 
-Message::Message(const Message& copiedFrom) {
+Message::Message(const SharedPayload& payload) : Message() {
+  shareBody(payload);
+}
+
+Message::Message(const Message& copiedFrom) : Message() {
   hare_basic_properties_malloc_dup(copiedFrom.m_properties, m_properties);
-  m_bodyHasBeenSet = copiedFrom.m_bodyHasBeenSet;
-  m_body = amqp_bytes_malloc_dup(copiedFrom.m_body);
+  if (copiedFrom.HasHeaders()) SetHeaders(copiedFrom.m_properties.headers);
+  if (copiedFrom.IsFragmented()) {
+    m_fragments = copiedFrom.m_fragments;
+    m_fragmentsLength = copiedFrom.m_fragmentsLength;
+  } else if (copiedFrom.PayloadIsShared()) {
+    shareBody(copiedFrom.m_shared);
+  } else if (copiedFrom.m_bodyHasBeenSet) {
+    setBody(copiedFrom.m_body.bytes, copiedFrom.m_body.len);
+  }
+}
+
+Message::Message(Message&& movedFrom) noexcept : Message() {
+  takeFrom(movedFrom);
+}
+
+Message& Message::operator=(const Message& copiedFrom) {
+  if (this != &copiedFrom) *this = Message(copiedFrom);
+  return *this;
+}
+
+Message& Message::operator=(Message&& movedFrom) noexcept {
+  if (this != &movedFrom) {
+    releaseBody();
+    hare_basic_properties_free(m_properties);
+    takeFrom(movedFrom);
+  }
+  return *this;
 }
 
 std::string Message::String() const {
+  if (IsFragmented()) {
+    std::string joined;
+    joined.reserve(m_fragmentsLength);
+    for (const auto& fragment : m_fragments) {
+      joined.append(fragment.m_data, fragment.m_length);
+    }
+    return joined;
+  }
   return (m_bodyHasBeenSet
               ? std::string(static_cast<char*>(m_body.bytes), m_body.len)
               : std::string(""));
@@ -69,20 +168,22 @@ const char* Message::Payload() const {
 const amqp_bytes_t* Message::Bytes() const { return &m_body; }
 
 unsigned int Message::Length() const {
-  if (m_bodyHasBeenSet)
+  if (IsFragmented())
+    return m_fragmentsLength;
+  else if (m_bodyHasBeenSet)
     return m_body.len;
   else
     return 0;
 }
 
 void Message::SetReplyTo(const std::string& replyTo) {
-  m_properties._flags |= AMQP_BASIC_REPLY_TO_FLAG;
-  m_properties.reply_to = amqp_cstring_bytes(replyTo.c_str());
+  setShortString(AMQP_BASIC_REPLY_TO_FLAG, m_properties.reply_to,
+                 replyTo.data(), replyTo.size());
 }
 
 void Message::SetReplyTo(const char*& replyTo) {
-  m_properties._flags |= AMQP_BASIC_REPLY_TO_FLAG;
-  m_properties.reply_to = amqp_cstring_bytes(replyTo);
+  setShortString(AMQP_BASIC_REPLY_TO_FLAG, m_properties.reply_to, replyTo,
+                 strlen(replyTo));
 }
 
 const std::string Message::ReplyTo() {
@@ -99,13 +200,45 @@ bool Message::ReplyToIsSet() const {
 }
 
 void Message::SetPayload(const char* payload) {
-  m_bodyHasBeenSet = true;
-  m_body = hare_cstring_bytes(payload);
+  setBody(payload, strlen(payload));
 }
 
 void Message::SetPayload(void* payload, const int size) {
-  m_bodyHasBeenSet = true;
-  m_body = hare_void_bytes(payload, size);
+  setBody(payload, size);
+}
+
+void Message::SetPayload(const SharedPayload& payload) { shareBody(payload); }
+
+void Message::AddFragment(const SharedPayload& fragment) {
+  if (false == IsFragmented()) releaseBody();
+  if (fragment.Empty()) return;
+  m_fragments.push_back(
+      PayloadFragment{fragment.Data(), fragment.Length(), fragment});
+  m_fragmentsLength += fragment.Length();
+}
+
+void Message::AddFragment(const void* bytes, size_t length) {
+  if (false == IsFragmented()) releaseBody();
+  if (0 == length) return;
+  m_fragments.push_back(PayloadFragment{static_cast<const char*>(bytes),
+                                        length, SharedPayload()});
+  m_fragmentsLength += length;
+}
+
+char* Message::AllocatePayload(size_t length) {
+  setBody(nullptr, length);
+  return m_body.len == length ? static_cast<char*>(m_body.bytes) : nullptr;
+}
+
+SharedPayload Message::SharePayload() {
+  if (false == m_bodyHasBeenSet) return SharedPayload();
+  if (PayloadIsShared()) return m_shared;
+  if (bodyIsInline()) return SharedPayload(m_body.bytes, m_body.len);
+
+  // Allocated by setBody(), hand it over as it is
+  auto shared = SharedPayload::Adopt(m_body.bytes, m_body.len);
+  m_shared = shared;
+  return shared;
 }
 
 bool Message::TimestampIsSet() const {
@@ -126,13 +259,13 @@ uint64_t Message::Timestamp() const {
   return retVal;
 }
 void Message::SetCorrelationId(const char*& correlationId) {
-  m_properties._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-  m_properties.correlation_id = amqp_cstring_bytes(correlationId);
+  setShortString(AMQP_BASIC_CORRELATION_ID_FLAG, m_properties.correlation_id,
+                 correlationId, strlen(correlationId));
 };
 
 void Message::SetCorrelationId(const std::string& correlationId) {
-  m_properties._flags |= AMQP_BASIC_CORRELATION_ID_FLAG;
-  m_properties.correlation_id = amqp_cstring_bytes(correlationId.c_str());
+  setShortString(AMQP_BASIC_CORRELATION_ID_FLAG, m_properties.correlation_id,
+                 correlationId.data(), correlationId.size());
 };
 
 bool Message::HasCorrelationId() {
@@ -140,4 +273,67 @@ bool Message::HasCorrelationId() {
           (m_properties._flags & AMQP_BASIC_CORRELATION_ID_FLAG));
 }
 
+void Message::SetContentType(const HeaderText& contentType) {
+  setShortString(AMQP_BASIC_CONTENT_TYPE_FLAG, m_properties.content_type,
+                 contentType.m_data, contentType.m_length);
+}
+
+const std::string Message::ContentType() const {
+  if (ContentTypeIsSet()) {
+    return hare_bytes_to_string(m_properties.content_type);
+  } else {
+    return "";
+  }
+}
+
+bool Message::ContentTypeIsSet() const {
+  return (AMQP_BASIC_CONTENT_TYPE_FLAG ==
+          (m_properties._flags & AMQP_BASIC_CONTENT_TYPE_FLAG));
+}
+
+bool Message::ContentTypeIs(const HeaderText& contentType) const {
+  return ContentTypeIsSet() &&
+         m_properties.content_type.len == contentType.m_length &&
+         0 == memcmp(m_properties.content_type.bytes, contentType.m_data,
+                     contentType.m_length);
+}
+
+void Message::SetHeaders(const amqp_table_t& headers) {
+  SetHeaders(HeadersTable(headers));
+}
+
+void Message::SetHeaders(HeadersTable&& headers) {
+  m_headers = std::move(headers);
+  m_properties.headers = m_headers.Table();
+  m_properties._flags |= AMQP_BASIC_HEADERS_FLAG;
+}
+
+void Message::ClearHeaders() {
+  m_headers = HeadersTable();
+  m_properties._flags &= ~AMQP_BASIC_HEADERS_FLAG;
+}
+
+bool Message::HasHeaders() const {
+  return (AMQP_BASIC_HEADERS_FLAG ==
+          (m_properties._flags & AMQP_BASIC_HEADERS_FLAG));
+}
+
+const amqp_table_t& Message::Headers() const {
+  return HasHeaders() ? m_properties.headers : amqp_empty_table;
+}
+
+const amqp_field_value_t* Message::Header(const HeaderText& key) const {
+  return hare_table_find(Headers(), key.m_data, key.m_length);
+}
+
+bool Message::HeaderInt(const HeaderText& key, int64_t& value) const {
+  const auto* field = Header(key);
+  return field != nullptr && hare_field_int(*field, value);
+}
+
+bool Message::HeaderBytes(const HeaderText& key, amqp_bytes_t& value) const {
+  const auto* field = Header(key);
+  return field != nullptr && hare_field_bytes(*field, value);
+}
+
 }  // namespace HareCpp
@@ -0,0 +1,393 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Metrics.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "Utils.hpp"
+
+namespace HareCpp {
+
+namespace {
+
+constexpr char STATS_FILE_MAGIC[8] = {'H', 'A', 'R', 'E',
+                                      'S', 'T', 'A', 'T'};
+constexpr uint32_t STATS_FILE_VERSION = 1;
+
+struct metricInfo {
+  const char* m_name;
+  const char* m_type;
+  const char* m_help;
+};
+
+// In METRIC_E order
+const metricInfo METRIC_INFO[] = {
+    {"harecpp_messages_published_total", "counter",
+     "Messages written to the broker by Producers"},
+    {"harecpp_published_bytes_total", "counter",
+     "Payload bytes written to the broker by Producers"},
+    {"harecpp_messages_delivered_total", "counter",
+     "Messages received by Consumers"},
+    {"harecpp_delivered_bytes_total", "counter",
+     "Payload bytes received by Consumers"},
+    {"harecpp_send_queue_depth", "gauge",
+     "Messages waiting in Producer send queues"},
+    {"harecpp_inbox_depth", "gauge",
+     "Deliveries read from the broker not yet taken by their Consumer"},
+    {"harecpp_connects_total", "counter", "Successful broker logins"},
+    {"harecpp_reconnects_total", "counter",
+     "Successful broker logins after the first on the same connection"},
+    {"harecpp_connections_open", "gauge", "Connections logged in"},
+    {"harecpp_channels_allocated", "gauge",
+     "Channels handed out to Producers and Consumers"},
+    {"harecpp_callbacks_total", "counter", "Consumer callbacks run"},
+    {"harecpp_callback_nanoseconds_total", "counter",
+     "Time spent in Consumer callbacks"},
+};
+static_assert(sizeof(METRIC_INFO) / sizeof(METRIC_INFO[0]) ==
+                  static_cast<unsigned int>(METRIC_E::COUNT),
+              "METRIC_INFO out of step with METRIC_E");
+
+constexpr char RPC_ERRORS_NAME[] = "harecpp_rpc_errors_total";
+
+std::string rpcErrorsLabel(unsigned int index) {
+  return std::string(RPC_ERRORS_NAME) + "{code=\"" +
+         errorString(static_cast<HARE_ERROR_E>(index)) + "\"}";
+}
+
+size_t statsFileSize(size_t entries) {
+  return sizeof(MetricsRegistry::statsFileHeader) +
+         entries * sizeof(MetricsRegistry::statsFileEntry);
+}
+
+size_t statsFileEntries() {
+  return static_cast<unsigned int>(METRIC_E::COUNT) + HARE_ERROR_COUNT;
+}
+
+// Read the request headers and drop them, the answer is the same for any
+void hare_drain_request(int fd) {
+  char buffer[1024];
+  std::string request;
+  pollfd readable = {fd, POLLIN, 0};
+  while (request.find("\r\n\r\n") == std::string::npos &&
+         request.size() < 16384 && poll(&readable, 1, 1000) > 0) {
+    ssize_t bytes = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytes <= 0) break;
+    request.append(buffer, bytes);
+  }
+}
+
+void hare_send_all(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t bytes =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (bytes <= 0) return;
+    sent += bytes;
+  }
+}
+
+}  // namespace
+
+MetricsRegistry& MetricsRegistry::Instance() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsRegistry::MetricsRegistry()
+    : m_prometheusRunning(false),
+      m_listenFd(-1),
+      m_prometheusPort(0),
+      m_statsRunning(false),
+      m_statsMap(nullptr),
+      m_statsMapSize(0),
+      m_statsIntervalMilliseconds(1000) {}
+
+MetricsRegistry::~MetricsRegistry() {
+  StopPrometheusEndpoint();
+  StopStatsFile();
+}
+
+int64_t MetricsRegistry::Value(METRIC_E metric) const {
+  const unsigned int index = static_cast<unsigned int>(metric);
+  return index < m_metrics.size() ? m_metrics[index].Value() : 0;
+}
+
+int64_t MetricsRegistry::RpcErrors(HARE_ERROR_E retCode) const {
+  const unsigned int index = static_cast<unsigned int>(retCode);
+  return index < HARE_ERROR_COUNT ? m_rpcErrors[index].Value() : 0;
+}
+
+std::vector<std::pair<std::string, int64_t> > MetricsRegistry::Values() const {
+  std::vector<std::pair<std::string, int64_t> > values;
+  values.reserve(statsFileEntries());
+  for (unsigned int i = 0; i < m_metrics.size(); i++) {
+    values.emplace_back(METRIC_INFO[i].m_name, m_metrics[i].Value());
+  }
+  for (unsigned int i = 0; i < HARE_ERROR_COUNT; i++) {
+    values.emplace_back(rpcErrorsLabel(i), m_rpcErrors[i].Value());
+  }
+  return values;
+}
+
+std::string MetricsRegistry::PrometheusText() const {
+  std::string text;
+  text.reserve(4096);
+  for (unsigned int i = 0; i < m_metrics.size(); i++) {
+    const auto& info = METRIC_INFO[i];
+    text += std::string("# HELP ") + info.m_name + " " + info.m_help + "\n";
+    text += std::string("# TYPE ") + info.m_name + " " + info.m_type + "\n";
+    text += std::string(info.m_name) + " " +
+            std::to_string(m_metrics[i].Value()) + "\n";
+  }
+  text += std::string("# HELP ") + RPC_ERRORS_NAME +
+          " RPCs and logins that failed, by error code\n";
+  text += std::string("# TYPE ") + RPC_ERRORS_NAME + " counter\n";
+  // ALL_GOOD is never an error
+  for (unsigned int i = 1; i < HARE_ERROR_COUNT; i++) {
+    text += rpcErrorsLabel(i) + " " + std::to_string(m_rpcErrors[i].Value()) +
+            "\n";
+  }
+  return text;
+}
+
+HARE_ERROR_E MetricsRegistry::StartPrometheusEndpoint(
+    int port, const std::string& address) {
+  const std::lock_guard<std::mutex> lock(m_exportMutex);
+  if (m_prometheusRunning) return HARE_ERROR_E::THREAD_ALREADY_RUNNING;
+
+  sockaddr_in bindAddress;
+  memset(&bindAddress, 0, sizeof(bindAddress));
+  bindAddress.sin_family = AF_INET;
+  bindAddress.sin_port = htons(port);
+  if (port < 0 || port > 65535 ||
+      1 != inet_pton(AF_INET, address.c_str(), &bindAddress.sin_addr)) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return HARE_ERROR_E::INVALID_PARAMETERS;
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  socklen_t length = sizeof(bindAddress);
+  if (0 != bind(fd, reinterpret_cast<sockaddr*>(&bindAddress),
+                sizeof(bindAddress)) ||
+      0 != listen(fd, 16) ||
+      0 != getsockname(fd, reinterpret_cast<sockaddr*>(&bindAddress),
+                       &length)) {
+    LOG(LOG_ERROR, "Unable to listen for Prometheus on " + address + ":" +
+                       std::to_string(port) + ", " + strerror(errno));
+    close(fd);
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  m_listenFd = fd;
+  m_prometheusPort = ntohs(bindAddress.sin_port);
+  m_prometheusRunning = true;
+  m_prometheusThread = std::thread(&MetricsRegistry::prometheusThread, this);
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+void MetricsRegistry::StopPrometheusEndpoint() {
+  const std::lock_guard<std::mutex> lock(m_exportMutex);
+  if (false == m_prometheusRunning) return;
+  m_prometheusRunning = false;
+  if (m_prometheusThread.joinable()) m_prometheusThread.join();
+  close(m_listenFd);
+  m_listenFd = -1;
+  m_prometheusPort = 0;
+}
+
+int MetricsRegistry::PrometheusPort() const {
+  const std::lock_guard<std::mutex> lock(m_exportMutex);
+  return m_prometheusPort;
+}
+
+void MetricsRegistry::prometheusThread() {
+  pollfd listening = {m_listenFd, POLLIN, 0};
+  while (m_prometheusRunning) {
+    // Wake up now and then to notice StopPrometheusEndpoint()
+    if (poll(&listening, 1, 100) <= 0) continue;
+    int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) continue;
+    hare_drain_request(fd);
+    const std::string body = PrometheusText();
+    hare_send_all(fd,
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: " +
+                      std::to_string(body.size()) +
+                      "\r\nConnection: close\r\n\r\n" + body);
+    close(fd);
+  }
+}
+
+HARE_ERROR_E MetricsRegistry::StartStatsFile(const std::string& path,
+                                             int intervalMilliseconds) {
+  const std::lock_guard<std::mutex> lock(m_exportMutex);
+  if (m_statsRunning) return HARE_ERROR_E::THREAD_ALREADY_RUNNING;
+  if (intervalMilliseconds <= 0) return HARE_ERROR_E::INVALID_PARAMETERS;
+
+  const size_t size = statsFileSize(statsFileEntries());
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG(LOG_ERROR, "Unable to create stats file " + path + ", " +
+                       strerror(errno));
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  void* map = MAP_FAILED;
+  if (0 == ftruncate(fd, size)) {
+    map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == map) {
+    LOG(LOG_ERROR, "Unable to map stats file " + path + ", " +
+                       strerror(errno));
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  auto header = static_cast<statsFileHeader*>(map);
+  memcpy(header->m_magic, STATS_FILE_MAGIC, sizeof(header->m_magic));
+  header->m_version = STATS_FILE_VERSION;
+  header->m_entryCount = statsFileEntries();
+  header->m_sequence.store(0);
+  header->m_updatedNanos = 0;
+
+  m_statsMap = map;
+  m_statsMapSize = size;
+  m_statsIntervalMilliseconds = intervalMilliseconds;
+  writeStatsFile();
+  m_statsRunning = true;
+  m_statsThread = std::thread(&MetricsRegistry::statsFileThread, this);
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+void MetricsRegistry::StopStatsFile() {
+  const std::lock_guard<std::mutex> lock(m_exportMutex);
+  if (false == m_statsRunning) return;
+  m_statsRunning = false;
+  if (m_statsThread.joinable()) m_statsThread.join();
+  // Leave the final values behind for whoever reads the file next
+  writeStatsFile();
+  munmap(m_statsMap, m_statsMapSize);
+  m_statsMap = nullptr;
+  m_statsMapSize = 0;
+}
+
+void MetricsRegistry::statsFileThread() {
+  auto next = std::chrono::steady_clock::now();
+  while (m_statsRunning) {
+    next += std::chrono::milliseconds(m_statsIntervalMilliseconds);
+    // Sleep in short steps so StopStatsFile() doesn't wait out an interval
+    while (m_statsRunning && std::chrono::steady_clock::now() < next) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(
+          std::min(m_statsIntervalMilliseconds, 50)));
+    }
+    if (m_statsRunning) writeStatsFile();
+  }
+}
+
+void MetricsRegistry::writeStatsFile() {
+  auto header = static_cast<statsFileHeader*>(m_statsMap);
+  auto entries = reinterpret_cast<statsFileEntry*>(header + 1);
+  const auto values = Values();
+
+  const uint64_t sequence = header->m_sequence.load();
+  header->m_sequence.store(sequence + 1);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < values.size() && i < header->m_entryCount; i++) {
+    strncpy(entries[i].m_name, values[i].first.c_str(),
+            sizeof(entries[i].m_name) - 1);
+    entries[i].m_name[sizeof(entries[i].m_name) - 1] = '\0';
+    entries[i].m_value = values[i].second;
+  }
+  header->m_updatedNanos = hare_realtime_nanos();
+  header->m_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+HARE_ERROR_E MetricsRegistry::ReadStatsFile(
+    const std::string& path,
+    std::vector<std::pair<std::string, int64_t> >& values) {
+  values.clear();
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return HARE_ERROR_E::INVALID_PARAMETERS;
+  const off_t size = lseek(fd, 0, SEEK_END);
+  void* map = MAP_FAILED;
+  if (size >= static_cast<off_t>(sizeof(statsFileHeader))) {
+    map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == map) return HARE_ERROR_E::INVALID_PARAMETERS;
+
+  auto header = static_cast<const statsFileHeader*>(map);
+  auto entries = reinterpret_cast<const statsFileEntry*>(header + 1);
+  HARE_ERROR_E retCode = HARE_ERROR_E::INVALID_PARAMETERS;
+  if (0 == memcmp(header->m_magic, STATS_FILE_MAGIC,
+                  sizeof(header->m_magic)) &&
+      STATS_FILE_VERSION == header->m_version &&
+      static_cast<size_t>(size) >= statsFileSize(header->m_entryCount)) {
+    retCode = HARE_ERROR_E::TIMEOUT_OCCURED;
+    // The writer holds the sequence odd for microseconds, give it plenty
+    for (int attempt = 0; attempt < 1000; attempt++) {
+      const uint64_t before =
+          header->m_sequence.load(std::memory_order_acquire);
+      if (before & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      values.clear();
+      for (uint32_t i = 0; i < header->m_entryCount; i++) {
+        values.emplace_back(
+            std::string(entries[i].m_name,
+                        strnlen(entries[i].m_name, sizeof(entries[i].m_name))),
+            entries[i].m_value);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (header->m_sequence.load(std::memory_order_relaxed) == before) {
+        retCode = HARE_ERROR_E::ALL_GOOD;
+        break;
+      }
+    }
+  }
+  munmap(map, size);
+  if (false == noError(retCode)) values.clear();
+  return retCode;
+}
+
+}  // namespace HareCpp
@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 
+#include "Metrics.hpp"
 #include "Producer.hpp"
 #include "Utils.hpp"
 
@@ -38,6 +39,13 @@ int Producer::QueueSize() const {
   return m_sendQueue.size();
 }
 
+LatencyHistogram& Producer::QueueDwellHistogram() { return m_queueDwell; }
+
+void Producer::SetSendTimeStamping(bool enabled) {
+  std::lock_guard<std::mutex> lock{m_producerMutex};
+  m_stampSendTime = enabled;
+}
+
 HARE_ERROR_E Producer::Send(const std::string& exchange,
                             const std::string& routingKey, Message& message) {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
@@ -53,13 +61,37 @@ HARE_ERROR_E Producer::Send(const std::string& exchange,
 
     builtMessage->routing_key = hare_cstring_bytes(routingKey.c_str());
 
-    builtMessage->properties = *message.AmqpProperties();
+    // The Message frees its own, this one lives until published
+    hare_basic_properties_malloc_dup(*message.AmqpProperties(),
+                                     builtMessage->properties);
+    if (message.HasHeaders()) {
+      builtMessage->headers = HeadersTable(message.Headers());
+      builtMessage->properties.headers = builtMessage->headers.Table();
+    }
 
-    builtMessage->message = amqp_bytes_malloc_dup(*message.Bytes());
+    // Anything too big to be inline is shared, not copied: sending the same
+    // Message again, or a copy of it, reuses the bytes.  Fragments are
+    // neither copied nor joined, the connection writes them out one by one.
+    if (message.IsFragmented()) {
+      builtMessage->fragments = message.Fragments();
+      builtMessage->message.len = message.Length();
+      builtMessage->message.bytes = nullptr;
+    } else if (message.Length() > MESSAGE_INLINE_BYTES) {
+      builtMessage->shared_payload = message.SharePayload();
+      builtMessage->message = builtMessage->shared_payload.Bytes();
+    } else {
+      builtMessage->message = amqp_bytes_malloc_dup(*message.Bytes());
+    }
 
     builtMessage->channel = m_exchangeList[exchange].m_channel;
 
-    m_sendQueue.push(builtMessage);
+    builtMessage->enqueued_nanos = LatencyHistogram::Now();
+
+    builtMessage->stamp_send_time = m_stampSendTime;
+
+    m_sendQueue.push_back(builtMessage);
+    m_sendReady.notify_one();
+    MetricsRegistry::Instance().Add(METRIC_E::SEND_QUEUE_DEPTH, 1);
   }
 
   return retCode;
@@ -79,6 +111,7 @@ HARE_ERROR_E Producer::Start() {
     setRunning(true);
     const std::lock_guard<std::mutex> lock(m_producerMutex);
     m_producerThread = std::thread(&Producer::thread, this);
+    hare_set_thread_affinity(m_producerThread, m_cpuAffinity);
     LOG(LOG_INFO, "Producer Thread Started");
   }
 
@@ -96,13 +129,15 @@ HARE_ERROR_E Producer::Stop() {
     retCode = HARE_ERROR_E::THREAD_NOT_RUNNING;
   } else {
     setRunning(false);
+    m_sendReady.notify_all();
     LOG(LOG_WARN, "Producer thread stopping");
     m_producerThread.join();
     m_channelsConnected = false;  // Needs to reconnect
   }
 
-  m_connection->CloseConnection();
-  for (std::pair<std::string, ExchangeProperties> element : m_exchangeList) {
+  // Only takes the connection down if nobody else is using it
+  if (m_connection != nullptr) m_connection->Disconnect(m_clientId);
+  for (auto& element : m_exchangeList) {
     element.second.m_connected = false;
   }
 
@@ -117,12 +152,21 @@ HARE_ERROR_E Producer::Stop() {
 HARE_ERROR_E Producer::Initialize(const std::string& server, int port,
                                   const std::string& username,
                                   const std::string& password) {
+  return Initialize(std::make_shared<connection::ConnectionBase>(
+      server, port, username, password));
+}
+
+HARE_ERROR_E Producer::Initialize(
+    std::shared_ptr<connection::ConnectionBase> connection) {
   auto retCode = HARE_ERROR_E::ALL_GOOD;
 
-  {
-    const std::lock_guard<std::mutex> lock{m_producerMutex};
-    m_connection = std::make_shared<connection::ConnectionBase>(
-        server, port, username, password);
+  if (connection == nullptr) {
+    LOG(LOG_ERROR, "Producer given an empty connection");
+    retCode = HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  if (noError(retCode)) {
+    attachConnection(connection);
   }
 
   if (noError(retCode)) {
@@ -137,14 +181,13 @@ HARE_ERROR_E Producer::Initialize(const std::string& server, int port,
 Producer::~Producer() {
   if (IsInitialized()) {
     if (IsRunning()) Stop();
-    // Close each channel, not entirely necessary with the CloseConnection()
-    // call, however its safe.
-    for (std::pair<std::string, ExchangeProperties> element : m_exchangeList) {
-      m_connection->CloseChannel(element.second.m_channel);
-      element.second.m_connected = false;
-    }
-    m_connection->CloseConnection();
+    // Closes our channels, or the whole connection if nobody else shares it,
+    // then gives the channel numbers back
+    m_connection->Disconnect(m_clientId);
+    m_connection->UnregisterClient(m_clientId);
   }
+  // Whatever never made it out, so it stops counting as queued
+  clearActiveSendQueue();
 
   LOG(LOG_INFO, "Producer deconstructed");
 }
@@ -164,6 +207,19 @@ HARE_ERROR_E Producer::Restart() {
   return retCode;
 }
 
+HARE_ERROR_E Producer::SetCpuAffinity(const std::vector<int>& cpus) {
+  for (auto cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const std::lock_guard<std::mutex> lock{m_producerMutex};
+  m_cpuAffinity = cpus;
+  if (m_threadRunning) {
+    return hare_set_thread_affinity(m_producerThread, m_cpuAffinity);
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
 bool Producer::IsRunning() const {
   const std::lock_guard<std::mutex> lock{m_producerMutex};
   return m_threadRunning;
@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 
+#include "Metrics.hpp"
+#include "Probes.hpp"
 #include "Producer.hpp"
 #include "Utils.hpp"
 
@@ -59,6 +61,35 @@ void Producer::setRunning(bool running) {
   m_threadRunning = running;
 }
 
+int Producer::allocateChannel() {
+  // Not initialized yet, Initialize() hands out the channel numbers
+  if (m_connection == nullptr) return 0;
+  return m_connection->AllocateChannel(m_clientId);
+}
+
+void Producer::attachConnection(
+    std::shared_ptr<connection::ConnectionBase> connection) {
+  const std::lock_guard<std::mutex> lock(m_producerMutex);
+
+  if (m_connection != nullptr) m_connection->UnregisterClient(m_clientId);
+
+  m_connection = connection;
+  m_clientId = m_connection->RegisterClient();
+  m_channelsConnected = false;
+
+  // Exchanges added before we had this connection need channels on it
+  for (auto& element : m_exchangeList) {
+    element.second.m_channel = m_connection->AllocateChannel(m_clientId);
+    element.second.m_connected = false;
+  }
+
+  // As do any messages already waiting to go out on them
+  for (auto& message : m_sendQueue) {
+    auto it = m_exchangeList.find(hare_bytes_to_string(message->exchange));
+    if (it != m_exchangeList.end()) message->channel = it->second.m_channel;
+  }
+}
+
 int Producer::addExchange(const std::string& exchange,
                           const std::string& type) {
   const std::lock_guard<std::mutex> lock(m_producerMutex);
@@ -66,11 +97,10 @@ int Producer::addExchange(const std::string& exchange,
   int selectedChannel = -1;
 
   if (m_exchangeList.find(exchange) == m_exchangeList.end()) {
-    m_exchangeList[exchange] =
-        ExchangeProperties(m_curChannelNumber, true, type);
+    selectedChannel = allocateChannel();
+    if (selectedChannel < 0) return selectedChannel;
+    m_exchangeList[exchange] = ExchangeProperties(selectedChannel, true, type);
     m_channelsConnected = false;
-    selectedChannel = m_curChannelNumber;
-    m_curChannelNumber++;
   } else {
     // hopefully this is never hit...
     // things could get weird if you declare after using it
@@ -89,11 +119,11 @@ int Producer::addExchange(const std::string& exchange) {
   int selectedChannel = -1;
 
   if (m_exchangeList.find(exchange) == m_exchangeList.end()) {
+    selectedChannel = allocateChannel();
+    if (selectedChannel < 0) return selectedChannel;
     m_exchangeList[exchange] = ExchangeProperties();
-    m_exchangeList[exchange].m_channel = m_curChannelNumber;
+    m_exchangeList[exchange].m_channel = selectedChannel;
     m_channelsConnected = false;
-    selectedChannel = m_curChannelNumber;
-    m_curChannelNumber++;
   } else {
     selectedChannel = m_exchangeList[exchange].m_channel;
   }
@@ -101,20 +131,25 @@ int Producer::addExchange(const std::string& exchange) {
 }
 
 void Producer::clearActiveSendQueue() {
+  MetricsRegistry::Instance().Add(METRIC_E::SEND_QUEUE_DEPTH,
+                                  -static_cast<int64_t>(m_sendQueue.size()));
   while (false == m_sendQueue.empty()) {
     hare_free_message_risky(*m_sendQueue.front());
-    m_sendQueue.pop();
+    m_sendQueue.pop_front();
   }
 }
 
 bool Producer::channelsConnected() const {
   const std::lock_guard<std::mutex> lock(m_producerMutex);
-  return m_channelsConnected;
+  // A shared connection may have been re-established by somebody else, in
+  // which case our channels are gone
+  return m_channelsConnected &&
+         m_connectionGeneration == m_connection->Generation();
 }
 
 void Producer::closeConnection() {
   m_connection->CloseConnection();
-  for (auto element : m_exchangeList) element.second.m_connected = false;
+  for (auto& element : m_exchangeList) element.second.m_connected = false;
   clearActiveSendQueue();
 }
 
@@ -124,7 +159,19 @@ void Producer::connectChannels() {
   if (false == isConnected() || false == IsRunning()) return;
 
   m_producerMutex.lock();
-  for (auto it : m_exchangeList) {
+
+  // New connection underneath us, every channel needs opening again
+  auto generation = m_connection->Generation();
+  if (generation != m_connectionGeneration) {
+    for (auto& element : m_exchangeList) element.second.m_connected = false;
+    m_connectionGeneration = generation;
+  }
+
+  for (auto& it : m_exchangeList) {
+    if (it.second.m_channel <= 0) {
+      allGood = false;
+      continue;
+    }
     if (false == it.second.m_connected) {
       auto retCode = m_connection->OpenChannel(it.second.m_channel);
       if (serverFailure(retCode)) {
@@ -162,20 +209,52 @@ void Producer::connectChannels() {
 void Producer::publishNextInQueue() {
   if (false == isConnected()) return;
 
-  if (m_sendQueue.size() != 0) {
-    auto retCode = m_connection->PublishMessage(*m_sendQueue.front());
-    if (serverFailure(retCode)) {
-      closeConnection();
-      return;
+  std::vector<std::shared_ptr<helper::RawMessage> > batch;
+  {
+    std::unique_lock<std::mutex> lock{m_producerMutex};
+    m_sendReady.wait_for(
+        lock, std::chrono::milliseconds(IO_IDLE_POLL_MILLISECONDS),
+        [this]() { return false == m_sendQueue.empty() || !m_threadRunning; });
+
+    while (false == m_sendQueue.empty() &&
+           batch.size() < static_cast<size_t>(PRODUCER_PUBLISH_BATCH_SIZE)) {
+      batch.push_back(m_sendQueue.front());
+      m_sendQueue.pop_front();
     }
+  }
 
-    // If sent, pop it off the queue
-    if (noError(retCode)) {
-      const std::lock_guard<std::mutex> lock{m_producerMutex};
-      hare_free_message_risky(*m_sendQueue.front());
-      m_sendQueue.pop();
+  if (batch.empty()) return;
+  HARE_PROBE1(producer_batch, batch.size());
+
+  // One wait on the connection for the whole batch
+  std::vector<HARE_ERROR_E> results;
+  auto retCode = m_connection->PublishMessages(batch, results);
+
+  int64_t published = 0;
+  int64_t publishedBytes = 0;
+  {
+    const std::lock_guard<std::mutex> lock{m_producerMutex};
+    // If sent, free it, otherwise put it back where it was
+    for (size_t i = batch.size(); i-- > 0;) {
+      if (noError(results[i])) {
+        m_queueDwell.RecordSince(batch[i]->enqueued_nanos);
+        HARE_PROBE2(producer_sent, batch[i]->message.len,
+                    batch[i]->enqueued_nanos);
+        published++;
+        publishedBytes += batch[i]->message.len;
+        hare_free_message_risky(*batch[i]);
+      } else {
+        m_sendQueue.push_front(batch[i]);
+      }
     }
   }
+
+  auto& metrics = MetricsRegistry::Instance();
+  metrics.Add(METRIC_E::MESSAGES_PUBLISHED, published);
+  metrics.Add(METRIC_E::BYTES_PUBLISHED, publishedBytes);
+  metrics.Add(METRIC_E::SEND_QUEUE_DEPTH, -published);
+
+  if (serverFailure(retCode)) closeConnection();
 }
 
 bool Producer::isConnected() const {
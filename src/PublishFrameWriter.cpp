@@ -0,0 +1,461 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "PublishFrameWriter.hpp"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace HareCpp {
+namespace connection {
+
+namespace {
+// Frame type, channel and payload size in front, frame end marker behind
+constexpr size_t FRAME_HEADER_SIZE = 7;
+constexpr size_t FRAME_FOOTER_SIZE = 1;
+
+// Offsets into an encoded content header frame
+constexpr size_t BODY_SIZE_OFFSET = FRAME_HEADER_SIZE + 4;
+
+const char FRAME_END = static_cast<char>(AMQP_FRAME_END);
+
+// Shortstr properties in the order they are encoded, the table, octets and
+// timestamp are handled on their own
+struct shortProperty {
+  amqp_flags_t m_flag;
+  amqp_bytes_t amqp_basic_properties_t::*m_member;
+};
+const shortProperty SHORT_PROPERTIES[] = {
+    {AMQP_BASIC_CONTENT_TYPE_FLAG, &amqp_basic_properties_t::content_type},
+    {AMQP_BASIC_CONTENT_ENCODING_FLAG,
+     &amqp_basic_properties_t::content_encoding},
+    {AMQP_BASIC_CORRELATION_ID_FLAG, &amqp_basic_properties_t::correlation_id},
+    {AMQP_BASIC_REPLY_TO_FLAG, &amqp_basic_properties_t::reply_to},
+    {AMQP_BASIC_EXPIRATION_FLAG, &amqp_basic_properties_t::expiration},
+    {AMQP_BASIC_MESSAGE_ID_FLAG, &amqp_basic_properties_t::message_id},
+    {AMQP_BASIC_TYPE_FLAG, &amqp_basic_properties_t::type},
+    {AMQP_BASIC_USER_ID_FLAG, &amqp_basic_properties_t::user_id},
+    {AMQP_BASIC_APP_ID_FLAG, &amqp_basic_properties_t::app_id},
+    {AMQP_BASIC_CLUSTER_ID_FLAG, &amqp_basic_properties_t::cluster_id},
+};
+constexpr size_t SHORT_PROPERTY_COUNT =
+    sizeof(SHORT_PROPERTIES) / sizeof(SHORT_PROPERTIES[0]);
+
+void put8(std::string& out, uint8_t value) {
+  out.push_back(static_cast<char>(value));
+}
+
+void put16(std::string& out, uint16_t value) {
+  put8(out, value >> 8);
+  put8(out, value & 0xFF);
+}
+
+void put32(std::string& out, uint32_t value) {
+  put16(out, value >> 16);
+  put16(out, value & 0xFFFF);
+}
+
+void put64(std::string& out, uint64_t value) {
+  put32(out, value >> 32);
+  put32(out, value & 0xFFFFFFFF);
+}
+
+void patch32(char* out, uint32_t value) {
+  for (int i = 3; i >= 0; i--) {
+    out[i] = static_cast<char>(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+void patch64(char* out, uint64_t value) {
+  for (int i = 7; i >= 0; i--) {
+    out[i] = static_cast<char>(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+void putFrameHeader(std::string& out, uint8_t type, int channel,
+                    uint32_t size) {
+  put8(out, type);
+  put16(out, static_cast<uint16_t>(channel));
+  put32(out, size);
+}
+
+bool putShortString(std::string& out, const amqp_bytes_t& bytes) {
+  if (bytes.len > UINT8_MAX) return false;
+  put8(out, static_cast<uint8_t>(bytes.len));
+  out.append(static_cast<const char*>(bytes.bytes), bytes.len);
+  return true;
+}
+
+// Fill in the frame payload size once the payload is written
+void closeFrame(std::string& frame) {
+  patch32(&frame[3], frame.size() - FRAME_HEADER_SIZE);
+  frame.push_back(FRAME_END);
+}
+}  // namespace
+
+PublishFrameWriter::PublishFrameWriter(size_t frameMax)
+    : m_frameMax(frameMax), m_pending(0) {}
+
+void PublishFrameWriter::SetFrameMax(size_t frameMax) {
+  m_frameMax = frameMax;
+}
+
+size_t PublishFrameWriter::FrameMax() const { return m_frameMax; }
+
+size_t PublishFrameWriter::Pending() const { return m_pending; }
+
+void PublishFrameWriter::addIov(const void* base, size_t len) {
+  struct iovec iov;
+  iov.iov_base = const_cast<void*>(base);
+  iov.iov_len = len;
+  m_iov.push_back(iov);
+}
+
+const std::string* PublishFrameWriter::methodFrame(
+    const helper::RawMessage& message) {
+  if (message.exchange.len > UINT8_MAX || message.routing_key.len > UINT8_MAX) {
+    LOG(LOG_ERROR, "Exchange or routing key too long to publish");
+    return nullptr;
+  }
+
+  // The exchange is a shortstr, so its length fits the one byte separating it
+  // from the routing key
+  std::string key;
+  put16(key, static_cast<uint16_t>(message.channel));
+  put8(key, static_cast<uint8_t>(message.exchange.len));
+  key.append(static_cast<const char*>(message.exchange.bytes),
+             message.exchange.len);
+  key.append(static_cast<const char*>(message.routing_key.bytes),
+             message.routing_key.len);
+
+  auto it = m_methodFrames.find(key);
+  if (it != m_methodFrames.end()) return &it->second;
+
+  std::string frame;
+  putFrameHeader(frame, AMQP_FRAME_METHOD, message.channel, 0);
+  put32(frame, AMQP_BASIC_PUBLISH_METHOD);
+  put16(frame, 0);  // ticket
+  putShortString(frame, message.exchange);
+  putShortString(frame, message.routing_key);
+  put8(frame, 0);  // mandatory, immediate
+  closeFrame(frame);
+
+  return &m_methodFrames.emplace(key, std::move(frame)).first->second;
+}
+
+bool PublishFrameWriter::matches(
+    const headerTemplate& cached,
+    const amqp_basic_properties_t& properties) const {
+  // Tables aren't worth comparing, those headers are encoded every time
+  if (cached.m_flags != properties._flags ||
+      (properties._flags & AMQP_BASIC_HEADERS_FLAG)) {
+    return false;
+  }
+  if ((properties._flags & AMQP_BASIC_DELIVERY_MODE_FLAG) &&
+      cached.m_deliveryMode != properties.delivery_mode) {
+    return false;
+  }
+  if ((properties._flags & AMQP_BASIC_PRIORITY_FLAG) &&
+      cached.m_priority != properties.priority) {
+    return false;
+  }
+  for (size_t i = 0; i < SHORT_PROPERTY_COUNT; i++) {
+    if (0 == (properties._flags & SHORT_PROPERTIES[i].m_flag)) continue;
+    const amqp_bytes_t& value = properties.*(SHORT_PROPERTIES[i].m_member);
+    if (value.len != cached.m_fields[i].size() ||
+        0 != memcmp(value.bytes, cached.m_fields[i].data(), value.len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HARE_ERROR_E PublishFrameWriter::encodeHeader(
+    int channel, const amqp_basic_properties_t& properties,
+    headerTemplate& encoded) const {
+  encoded.m_flags = properties._flags;
+  encoded.m_deliveryMode = properties.delivery_mode;
+  encoded.m_priority = properties.priority;
+  encoded.m_fields.assign(SHORT_PROPERTY_COUNT, std::string());
+  encoded.m_timestampOffset = 0;
+
+  std::string& frame = encoded.m_frame;
+  frame.clear();
+  putFrameHeader(frame, AMQP_FRAME_HEADER, channel, 0);
+  put16(frame, AMQP_BASIC_CLASS);
+  put16(frame, 0);  // weight
+  put64(frame, 0);  // body size, patched per message
+
+  // Same flag word(s) as amqp_encode_properties(), continuation bit set while
+  // there are more flags
+  amqp_flags_t flags = properties._flags;
+  do {
+    amqp_flags_t remainder = flags >> 16;
+    uint16_t partialFlags = flags & 0xFFFE;
+    if (remainder != 0) partialFlags |= 1;
+    put16(frame, partialFlags);
+    flags = remainder;
+  } while (flags != 0);
+
+  const amqp_flags_t present = properties._flags;
+  auto shortField = [&](size_t index) {
+    if (0 == (present & SHORT_PROPERTIES[index].m_flag)) return true;
+    const amqp_bytes_t& value = properties.*(SHORT_PROPERTIES[index].m_member);
+    encoded.m_fields[index].assign(static_cast<const char*>(value.bytes),
+                                   value.len);
+    return putShortString(frame, value);
+  };
+
+  bool valid = shortField(0) && shortField(1);
+
+  if (valid && (present & AMQP_BASIC_HEADERS_FLAG)) {
+    // rabbitmq-c's own table encoder, grown until the table fits
+    std::string table(256, '\0');
+    int res;
+    size_t offset;
+    do {
+      offset = 0;
+      amqp_bytes_t buffer;
+      buffer.bytes = &table[0];
+      buffer.len = table.size();
+      res = amqp_encode_table(
+          buffer, const_cast<amqp_table_t*>(&properties.headers), &offset);
+      if (res == AMQP_STATUS_TABLE_TOO_BIG) table.resize(table.size() * 2);
+    } while (res == AMQP_STATUS_TABLE_TOO_BIG && table.size() <= m_frameMax);
+    valid = (res >= 0);
+    if (valid) frame.append(table, 0, offset);
+  }
+
+  if (valid && (present & AMQP_BASIC_DELIVERY_MODE_FLAG))
+    put8(frame, properties.delivery_mode);
+  if (valid && (present & AMQP_BASIC_PRIORITY_FLAG))
+    put8(frame, properties.priority);
+
+  valid = valid && shortField(2) && shortField(3) && shortField(4) &&
+          shortField(5);
+
+  if (valid && (present & AMQP_BASIC_TIMESTAMP_FLAG)) {
+    encoded.m_timestampOffset = frame.size();
+    put64(frame, properties.timestamp);
+  }
+
+  valid = valid && shortField(6) && shortField(7) && shortField(8) &&
+          shortField(9);
+
+  if (false == valid || frame.size() + FRAME_FOOTER_SIZE > m_frameMax) {
+    LOG(LOG_ERROR, "Message properties can't be encoded");
+    return HARE_ERROR_E::PUBLISH_ERROR;
+  }
+
+  closeFrame(frame);
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+const PublishFrameWriter::headerTemplate* PublishFrameWriter::headerFrame(
+    const helper::RawMessage& message) {
+  auto it = m_headerFrames.find(message.channel);
+  if (it != m_headerFrames.end() && matches(it->second, message.properties)) {
+    return &it->second;
+  }
+
+  headerTemplate encoded;
+  if (false ==
+      noError(encodeHeader(message.channel, message.properties, encoded))) {
+    return nullptr;
+  }
+  auto& cached = m_headerFrames[message.channel];
+  cached = std::move(encoded);
+  return &cached;
+}
+
+HARE_ERROR_E PublishFrameWriter::Add(const helper::RawMessage& message) {
+  if (m_frameMax <= FRAME_HEADER_SIZE + FRAME_FOOTER_SIZE) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const std::string* method = methodFrame(message);
+  if (method == nullptr) return HARE_ERROR_E::PUBLISH_ERROR;
+
+  const headerTemplate* header = headerFrame(message);
+  if (header == nullptr) return HARE_ERROR_E::PUBLISH_ERROR;
+
+  const size_t bodyLength = message.message.len;
+  if (false == message.fragments.empty()) {
+    size_t fragmentsLength = 0;
+    for (const auto& fragment : message.fragments) {
+      fragmentsLength += fragment.m_length;
+    }
+    if (fragmentsLength != bodyLength) {
+      LOG(LOG_ERROR, "Message fragments don't add up to its length");
+      return HARE_ERROR_E::PUBLISH_ERROR;
+    }
+  }
+
+  const size_t usable = m_frameMax - (FRAME_HEADER_SIZE + FRAME_FOOTER_SIZE);
+  const size_t bodyFrames = (bodyLength + usable - 1) / usable;
+
+  m_scratch.push_back(std::string());
+  std::string& scratch = m_scratch.back();
+  scratch.reserve(header->m_frame.size() + bodyFrames * FRAME_HEADER_SIZE);
+
+  // Only the body size and timestamp differ from the cached header
+  scratch.append(header->m_frame);
+  patch64(&scratch[BODY_SIZE_OFFSET], bodyLength);
+  if (header->m_timestampOffset != 0) {
+    patch64(&scratch[header->m_timestampOffset], message.properties.timestamp);
+  }
+
+  addIov(method->data(), method->size());
+  addIov(scratch.data(), scratch.size());
+
+  // The body is one piece, or the fragments one after the other with frames
+  // ending wherever they end, pointed at either way
+  const char* piece = static_cast<const char*>(message.message.bytes);
+  size_t pieceLeft = message.fragments.empty() ? bodyLength : 0;
+  size_t nextFragment = 0;
+  for (size_t offset = 0; offset < bodyLength; offset += usable) {
+    const size_t length = std::min(usable, bodyLength - offset);
+    const size_t prefix = scratch.size();
+    putFrameHeader(scratch, AMQP_FRAME_BODY, message.channel, length);
+    addIov(scratch.data() + prefix, FRAME_HEADER_SIZE);
+    for (size_t left = length; left > 0;) {
+      while (0 == pieceLeft) {
+        const auto& fragment = message.fragments[nextFragment++];
+        piece = fragment.m_data;
+        pieceLeft = fragment.m_length;
+      }
+      const size_t taken = std::min(left, pieceLeft);
+      addIov(piece, taken);
+      piece += taken;
+      pieceLeft -= taken;
+      left -= taken;
+    }
+    addIov(&FRAME_END, FRAME_FOOTER_SIZE);
+  }
+
+  m_pending++;
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+std::string PublishFrameWriter::Encoded() const {
+  std::string encoded;
+  for (const auto& iov : m_iov) {
+    encoded.append(static_cast<const char*>(iov.iov_base), iov.iov_len);
+  }
+  return encoded;
+}
+
+HARE_ERROR_E PublishFrameWriter::Flush(int sockfd, int timeoutMilliseconds) {
+  typedef std::chrono::steady_clock clock;
+  auto retCode = HARE_ERROR_E::ALL_GOOD;
+  size_t next = 0;
+  // Moved on every write, the broker only has to keep taking something
+  auto deadline = clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+
+  while (next < m_iov.size()) {
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &m_iov[next];
+    header.msg_iovlen = std::min(m_iov.size() - next, size_t(IOV_MAX));
+
+    auto written = sendmsg(sockfd, &header, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // rabbitmq-c keeps the socket non-blocking, wait for room
+        int waitMilliseconds = -1;
+        if (timeoutMilliseconds >= 0) {
+          waitMilliseconds = std::max<int>(
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                  deadline - clock::now())
+                  .count(),
+              0);
+        }
+        struct pollfd pfd;
+        pfd.fd = sockfd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        const int ready = poll(&pfd, 1, waitMilliseconds);
+        if (ready > 0 || (ready < 0 && errno == EINTR)) continue;
+        if (0 == ready) {
+          // A broker blocking publishers (memory or disk alarm) stops reading,
+          // don't hold up every other channel on the connection for it
+          LOGF(LOG_ERROR, "Socket took no publish frames for %d ms",
+               timeoutMilliseconds);
+          retCode = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+          break;
+        }
+      }
+      LOGF(LOG_ERROR, "Unable to write publish frames: %s", strerror(errno));
+      retCode = HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+      break;
+    }
+
+    deadline = clock::now() + std::chrono::milliseconds(timeoutMilliseconds);
+
+    // Skip what went out, a partial write leaves the rest of an iovec
+    size_t sent = static_cast<size_t>(written);
+    while (next < m_iov.size() && sent >= m_iov[next].iov_len) {
+      sent -= m_iov[next].iov_len;
+      next++;
+    }
+    if (sent > 0) {
+      m_iov[next].iov_base = static_cast<char*>(m_iov[next].iov_base) + sent;
+      m_iov[next].iov_len -= sent;
+    }
+  }
+
+  Clear();
+  return retCode;
+}
+
+void PublishFrameWriter::Clear() {
+  m_iov.clear();
+  m_scratch.clear();
+  m_pending = 0;
+
+  // Nothing points into the cache anymore, keep it from growing without
+  // bound when routing keys keep changing
+  if (m_methodFrames.size() > PUBLISH_METHOD_CACHE_SIZE) m_methodFrames.clear();
+}
+
+void PublishFrameWriter::Reset() {
+  Clear();
+  m_methodFrames.clear();
+  m_headerFrames.clear();
+}
+
+}  // namespace connection
+}  // namespace HareCpp
@@ -0,0 +1,518 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "Streaming.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "HeadersTable.hpp"
+#include "Producer.hpp"
+
+namespace HareCpp {
+
+namespace {
+
+constexpr char STREAM_PROGRESS_MAGIC[8] = {'H', 'A', 'R', 'E',
+                                           'S', 'T', 'R', 'M'};
+constexpr uint32_t STREAM_PROGRESS_VERSION = 1;
+
+// Where a chunk goes, from its headers
+struct chunkHeaders {
+  std::string m_streamId;
+  int64_t m_length;
+  int64_t m_chunkBytes;
+  int64_t m_chunk;
+};
+
+bool readChunkHeaders(const Message& message, chunkHeaders& headers) {
+  amqp_bytes_t streamId;
+  if (false == message.HeaderBytes(STREAM_ID_HEADER, streamId) ||
+      false == message.HeaderInt(STREAM_LENGTH_HEADER, headers.m_length) ||
+      false ==
+          message.HeaderInt(STREAM_CHUNK_BYTES_HEADER, headers.m_chunkBytes) ||
+      false == message.HeaderInt(STREAM_CHUNK_HEADER, headers.m_chunk)) {
+    return false;
+  }
+  headers.m_streamId = hare_bytes_to_string(streamId);
+  return headers.m_length >= 0 && headers.m_chunkBytes > 0 &&
+         headers.m_chunk >= 0;
+}
+
+// Stream ids name files, keep them to one plain file name
+bool validStreamId(const std::string& streamId) {
+  return false == streamId.empty() && streamId != "." && streamId != ".." &&
+         std::string::npos == streamId.find('/');
+}
+
+uint64_t chunkLength(uint64_t length, uint64_t chunkBytes, uint64_t chunk) {
+  const uint64_t offset = chunk * chunkBytes;
+  return offset < length ? std::min(chunkBytes, length - offset) : 0;
+}
+
+}  // namespace
+
+StreamSender::StreamSender(Producer& producer, size_t chunkBytes,
+                           size_t windowChunks)
+    : m_producer(producer),
+      m_chunkBytes(std::max<size_t>(chunkBytes, 1)),
+      m_windowChunks(std::max<size_t>(windowChunks, 1)) {}
+
+uint64_t StreamSender::ChunkCount(uint64_t length, size_t chunkBytes) {
+  return std::max<uint64_t>((length + chunkBytes - 1) / chunkBytes, 1);
+}
+
+HARE_ERROR_E StreamSender::BuildChunk(const std::string& streamId,
+                                      uint64_t length, uint64_t chunk,
+                                      const TD_StreamRead& read,
+                                      Message& message) const {
+  if (chunk >= ChunkCount(length, m_chunkBytes)) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const size_t bytes = chunkLength(length, m_chunkBytes, chunk);
+  char* payload = message.AllocatePayload(bytes);
+  if (nullptr == payload ||
+      (bytes > 0 && false == read(chunk * m_chunkBytes, payload, bytes))) {
+    LOG(LOG_ERROR, "Unable to read chunk " + std::to_string(chunk) +
+                       " of stream " + streamId);
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  message.SetHeaders(
+      HeadersBuilder()
+          .AddString(STREAM_ID_HEADER, streamId)
+          .AddInt(STREAM_LENGTH_HEADER, static_cast<int64_t>(length))
+          .AddInt(STREAM_CHUNK_BYTES_HEADER,
+                  static_cast<int64_t>(m_chunkBytes))
+          .AddInt(STREAM_CHUNK_HEADER, static_cast<int64_t>(chunk))
+          .Build());
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+HARE_ERROR_E StreamSender::waitForWindow() {
+  const auto timeout = std::chrono::seconds(STREAM_SEND_TIMEOUT_SECONDS);
+  int queued = m_producer.QueueSize();
+  auto lastProgress = std::chrono::steady_clock::now();
+  while (static_cast<size_t>(queued) >= m_windowChunks) {
+    if (false == m_producer.IsRunning()) {
+      return HARE_ERROR_E::THREAD_NOT_RUNNING;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    const int remaining = m_producer.QueueSize();
+    const auto now = std::chrono::steady_clock::now();
+    if (remaining < queued) {
+      lastProgress = now;
+    } else if (now - lastProgress > timeout) {
+      LOG(LOG_ERROR, "Producer queue not going down, stream send stopped");
+      return HARE_ERROR_E::TIMEOUT_OCCURED;
+    }
+    queued = remaining;
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+HARE_ERROR_E StreamSender::Send(const std::string& exchange,
+                                const std::string& routingKey,
+                                const std::string& streamId, uint64_t length,
+                                const TD_StreamRead& read) {
+  return sendChunks(exchange, routingKey, streamId, length, read, nullptr);
+}
+
+HARE_ERROR_E StreamSender::Send(const std::string& exchange,
+                                const std::string& routingKey,
+                                const std::string& streamId, uint64_t length,
+                                const TD_StreamRead& read,
+                                const std::vector<uint64_t>& chunks) {
+  return sendChunks(exchange, routingKey, streamId, length, read, &chunks);
+}
+
+HARE_ERROR_E StreamSender::SendFile(const std::string& exchange,
+                                    const std::string& routingKey,
+                                    const std::string& streamId,
+                                    const std::string& path) {
+  return sendFile(exchange, routingKey, streamId, path, nullptr);
+}
+
+HARE_ERROR_E StreamSender::SendFile(const std::string& exchange,
+                                    const std::string& routingKey,
+                                    const std::string& streamId,
+                                    const std::string& path,
+                                    const std::vector<uint64_t>& chunks) {
+  return sendFile(exchange, routingKey, streamId, path, &chunks);
+}
+
+HARE_ERROR_E StreamSender::sendChunks(const std::string& exchange,
+                                      const std::string& routingKey,
+                                      const std::string& streamId,
+                                      uint64_t length,
+                                      const TD_StreamRead& read,
+                                      const std::vector<uint64_t>* chunks) {
+  const uint64_t count =
+      nullptr == chunks ? ChunkCount(length, m_chunkBytes) : chunks->size();
+  for (uint64_t i = 0; i < count; i++) {
+    auto retCode = waitForWindow();
+    if (false == noError(retCode)) return retCode;
+
+    // A fresh Message for each, its payload is handed to the queue rather
+    // than copied
+    Message message;
+    retCode = BuildChunk(streamId, length,
+                         nullptr == chunks ? i : (*chunks)[i], read, message);
+    if (noError(retCode)) {
+      retCode = m_producer.Send(exchange, routingKey, message);
+    }
+    if (false == noError(retCode)) return retCode;
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+HARE_ERROR_E StreamSender::sendFile(const std::string& exchange,
+                                    const std::string& routingKey,
+                                    const std::string& streamId,
+                                    const std::string& path,
+                                    const std::vector<uint64_t>* chunks) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0) {
+    LOG(LOG_ERROR, "Unable to open " + path + ", " + strerror(errno));
+    if (fd >= 0) close(fd);
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  auto retCode = sendChunks(
+      exchange, routingKey, streamId, status.st_size,
+      [fd](uint64_t offset, char* bytes, size_t length) {
+        while (length > 0) {
+          const ssize_t count = pread(fd, bytes, length, offset);
+          if (count < 0 && errno == EINTR) continue;
+          if (count <= 0) return false;
+          bytes += count;
+          offset += count;
+          length -= count;
+        }
+        return true;
+      },
+      chunks);
+  close(fd);
+  return retCode;
+}
+
+StreamReceiver::StreamReceiver(const std::string& directory,
+                               TD_StreamDone done)
+    : m_directory(directory), m_done(done) {}
+
+StreamReceiver::StreamReceiver(TD_StreamData data, TD_StreamDone done)
+    : m_data(data), m_done(done) {}
+
+StreamReceiver::~StreamReceiver() {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto& active : m_streams) closeStream(active.second, false);
+}
+
+void StreamReceiver::closeStream(stream& active, bool complete) {
+  if (active.m_data != nullptr) {
+    if (complete) msync(active.m_data, active.m_length, MS_SYNC);
+    munmap(active.m_data, active.m_length);
+    active.m_data = nullptr;
+  }
+  if (active.m_progress != nullptr) {
+    munmap(active.m_progress, active.m_progressSize);
+    active.m_progress = nullptr;
+  }
+}
+
+bool StreamReceiver::mapStream(const std::string& streamId, stream& opened,
+                               bool resume) {
+  const std::string path = m_directory + "/" + streamId;
+  const std::string progressPath = path + ".progress";
+  const int flags = O_RDWR | O_CLOEXEC | (resume ? 0 : O_CREAT | O_TRUNC);
+
+  // The progress file goes first, a stream file without one is never taken
+  // for a partly written stream
+  opened.m_progressSize = sizeof(progressHeader) + opened.m_chunks;
+  const int progressFd = open(progressPath.c_str(), flags, 0644);
+  void* progress = MAP_FAILED;
+  if (progressFd >= 0 &&
+      (resume || 0 == ftruncate(progressFd, opened.m_progressSize))) {
+    progress = mmap(nullptr, opened.m_progressSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, progressFd, 0);
+  }
+  if (progressFd >= 0) close(progressFd);
+
+  const int fd = open(path.c_str(), flags, 0644);
+  void* data = MAP_FAILED;
+  if (fd >= 0 && (resume || 0 == ftruncate(fd, opened.m_length))) {
+    // Nothing to map for an empty stream, only the file to create
+    data = opened.m_length > 0
+               ? mmap(nullptr, opened.m_length, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0)
+               : nullptr;
+  }
+  if (fd >= 0) close(fd);
+
+  if (MAP_FAILED == progress || MAP_FAILED == data) {
+    LOG(LOG_ERROR, "Unable to map " + path + ", " + strerror(errno));
+    if (progress != MAP_FAILED) munmap(progress, opened.m_progressSize);
+    if (data != MAP_FAILED && data != nullptr) munmap(data, opened.m_length);
+    return false;
+  }
+
+  opened.m_progress = static_cast<progressHeader*>(progress);
+  opened.m_data = static_cast<char*>(data);
+  opened.m_have = reinterpret_cast<uint8_t*>(opened.m_progress + 1);
+  if (false == resume) {
+    memcpy(opened.m_progress->m_magic, STREAM_PROGRESS_MAGIC,
+           sizeof(STREAM_PROGRESS_MAGIC));
+    opened.m_progress->m_version = STREAM_PROGRESS_VERSION;
+    opened.m_progress->m_reserved = 0;
+    opened.m_progress->m_length = opened.m_length;
+    opened.m_progress->m_chunkBytes = opened.m_chunkBytes;
+    opened.m_progress->m_chunks = opened.m_chunks;
+  }
+  return true;
+}
+
+StreamReceiver::stream* StreamReceiver::resumeStream(
+    const std::string& streamId) {
+  if (m_directory.empty() || false == validStreamId(streamId)) return nullptr;
+
+  const std::string progressPath = m_directory + "/" + streamId + ".progress";
+  const int fd = open(progressPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return nullptr;
+  progressHeader header;
+  struct stat status;
+  const bool valid =
+      sizeof(header) == pread(fd, &header, sizeof(header), 0) &&
+      0 == fstat(fd, &status) &&
+      0 == memcmp(header.m_magic, STREAM_PROGRESS_MAGIC,
+                  sizeof(STREAM_PROGRESS_MAGIC)) &&
+      STREAM_PROGRESS_VERSION == header.m_version && header.m_chunkBytes > 0 &&
+      header.m_chunks ==
+          StreamSender::ChunkCount(header.m_length, header.m_chunkBytes) &&
+      header.m_chunks <= STREAM_MAX_CHUNKS &&
+      static_cast<uint64_t>(status.st_size) ==
+          sizeof(header) + header.m_chunks;
+  close(fd);
+  if (false == valid) {
+    LOG(LOG_WARN, "Ignoring damaged " + progressPath);
+    return nullptr;
+  }
+
+  // A stream file cut short or replaced would fault once written through the
+  // mapping, it has to be exactly as long as the stream
+  const std::string path = m_directory + "/" + streamId;
+  if (0 != stat(path.c_str(), &status) ||
+      static_cast<uint64_t>(status.st_size) != header.m_length) {
+    LOG(LOG_WARN, "Ignoring damaged " + path);
+    return nullptr;
+  }
+
+  stream resumed{};
+  resumed.m_length = header.m_length;
+  resumed.m_chunkBytes = header.m_chunkBytes;
+  resumed.m_chunks = header.m_chunks;
+  if (false == mapStream(streamId, resumed, true)) return nullptr;
+  resumed.m_received = std::count(resumed.m_have,
+                                  resumed.m_have + resumed.m_chunks, 1);
+  if (resumed.m_received == resumed.m_chunks) {
+    // Stopped between the last chunk and the progress file going
+    m_streams.emplace(streamId, std::move(resumed));
+    finishStream(streamId);
+    return nullptr;
+  }
+  LOGF(LOG_INFO, "Resuming stream %s, %llu of %llu chunks there",
+       streamId.c_str(), static_cast<unsigned long long>(resumed.m_received),
+       static_cast<unsigned long long>(resumed.m_chunks));
+  return &m_streams.emplace(streamId, std::move(resumed)).first->second;
+}
+
+StreamReceiver::stream* StreamReceiver::openStream(const std::string& streamId,
+                                                   uint64_t length,
+                                                   uint64_t chunkBytes) {
+  auto it = m_streams.find(streamId);
+  stream* active = it != m_streams.end() ? &it->second : resumeStream(streamId);
+  if (active != nullptr) {
+    if (active->m_length != length || active->m_chunkBytes != chunkBytes) {
+      LOG(LOG_ERROR, "Chunk doesn't fit stream " + streamId);
+      return nullptr;
+    }
+    return active;
+  }
+
+  const uint64_t chunks = StreamSender::ChunkCount(length, chunkBytes);
+  if (chunks > STREAM_MAX_CHUNKS) {
+    LOGF(LOG_ERROR, "Stream %s would take %llu chunks, more than %llu",
+         streamId.c_str(), static_cast<unsigned long long>(chunks),
+         static_cast<unsigned long long>(STREAM_MAX_CHUNKS));
+    return nullptr;
+  }
+
+  stream started{};
+  started.m_length = length;
+  started.m_chunkBytes = chunkBytes;
+  started.m_chunks = chunks;
+  if (m_directory.empty()) {
+    started.m_haveMemory.assign(started.m_chunks, 0);
+  } else if (false == validStreamId(streamId)) {
+    LOG(LOG_ERROR, "Stream id " + streamId + " can't be a file name");
+    return nullptr;
+  } else if (0 == access((m_directory + "/" + streamId).c_str(), F_OK) &&
+             0 != access((m_directory + "/" + streamId + ".progress").c_str(),
+                         F_OK)) {
+    // Finished before this receiver started, the progress file goes last
+    LOG(LOG_DETAILED, "Stream " + streamId + " already complete");
+    rememberFinished(streamId);
+    return nullptr;
+  } else if (false == mapStream(streamId, started, false)) {
+    return nullptr;
+  }
+  active = &m_streams.emplace(streamId, std::move(started)).first->second;
+  // The vector moved, point at it where it is now
+  if (m_directory.empty()) active->m_have = active->m_haveMemory.data();
+  return active;
+}
+
+void StreamReceiver::deliverHeld(const std::string& streamId, stream& active) {
+  for (auto it = active.m_held.begin();
+       it != active.m_held.end() && it->first == active.m_nextChunk;
+       it = active.m_held.erase(it)) {
+    m_data(streamId, it->second.Payload(), it->second.Length(),
+           it->first * active.m_chunkBytes);
+    active.m_nextChunk++;
+  }
+}
+
+void StreamReceiver::finishStream(const std::string& streamId) {
+  auto it = m_streams.find(streamId);
+  closeStream(it->second, true);
+  if (false == m_directory.empty()) {
+    unlink((m_directory + "/" + streamId + ".progress").c_str());
+  }
+  m_streams.erase(it);
+  rememberFinished(streamId);
+  if (m_done) m_done(streamId);
+}
+
+void StreamReceiver::rememberFinished(const std::string& streamId) {
+  if (false == m_finished.insert(streamId).second) return;
+  m_finishedOrder.push_back(streamId);
+  if (m_finishedOrder.size() > STREAM_FINISHED_IDS) {
+    m_finished.erase(m_finishedOrder.front());
+    m_finishedOrder.pop_front();
+  }
+}
+
+HARE_ERROR_E StreamReceiver::Receive(const Message& message) {
+  chunkHeaders headers;
+  if (false == readChunkHeaders(message, headers)) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_finished.count(headers.m_streamId)) return HARE_ERROR_E::ALL_GOOD;
+
+  stream* active =
+      openStream(headers.m_streamId, headers.m_length, headers.m_chunkBytes);
+  if (nullptr == active) {
+    return m_finished.count(headers.m_streamId)
+               ? HARE_ERROR_E::ALL_GOOD
+               : HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  const uint64_t chunk = headers.m_chunk;
+  if (chunk >= active->m_chunks ||
+      message.Length() !=
+          chunkLength(active->m_length, active->m_chunkBytes, chunk)) {
+    LOG(LOG_ERROR, "Chunk doesn't fit stream " + headers.m_streamId);
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  // Sent again, or delivered twice
+  if (active->m_have[chunk]) return HARE_ERROR_E::ALL_GOOD;
+
+  if (active->m_data != nullptr) {
+    memcpy(active->m_data + chunk * active->m_chunkBytes, message.Payload(),
+           message.Length());
+  } else if (m_directory.empty()) {
+    if (chunk == active->m_nextChunk) {
+      m_data(headers.m_streamId, message.Payload(), message.Length(),
+             chunk * active->m_chunkBytes);
+      active->m_nextChunk++;
+      deliverHeld(headers.m_streamId, *active);
+    } else if (active->m_held.size() < STREAM_REORDER_CHUNKS) {
+      active->m_held.emplace(chunk, Message(message));
+    } else {
+      // Left missing, to be sent again once the gap is filled
+      return HARE_ERROR_E::ALL_GOOD;
+    }
+  }
+
+  active->m_have[chunk] = 1;
+  if (++active->m_received == active->m_chunks) {
+    finishStream(headers.m_streamId);
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+TD_Callback StreamReceiver::Callback() {
+  return [this](const Message& message) {
+    if (false == noError(Receive(message))) {
+      LOG(LOG_WARN, "Dropped a message that isn't a stream chunk");
+    }
+  };
+}
+
+std::vector<uint64_t> StreamReceiver::Missing(const std::string& streamId,
+                                              size_t maxChunks) {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  std::vector<uint64_t> missing;
+  auto it = m_streams.find(streamId);
+  const stream* active =
+      it != m_streams.end() ? &it->second : resumeStream(streamId);
+  if (nullptr == active) return missing;
+
+  for (uint64_t chunk = 0;
+       chunk < active->m_chunks && missing.size() < maxChunks; chunk++) {
+    if (0 == active->m_have[chunk]) missing.push_back(chunk);
+  }
+  return missing;
+}
+
+size_t StreamReceiver::InProgress() const {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  return m_streams.size();
+}
+
+}  // namespace HareCpp
@@ -0,0 +1,562 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "TrafficCapture.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "ChannelHandler.hpp"
+#include "LatencyHistogram.hpp"
+#include "Message.hpp"
+#include "Producer.hpp"
+#include "Utils.hpp"
+
+namespace HareCpp {
+
+namespace {
+
+constexpr char CAPTURE_MAGIC[8] = {'H', 'A', 'R', 'E', 'C', 'A', 'P', 'T'};
+constexpr uint32_t CAPTURE_VERSION = 1;
+
+// Below this a replay spins instead of sleeping, sleeps overshoot by about
+// as much
+constexpr uint64_t REPLAY_SPIN_NANOS = 200000;
+
+// Shortstr properties in the order they are recorded
+amqp_bytes_t amqp_basic_properties_t::*const SHORT_PROPERTIES[] = {
+    &amqp_basic_properties_t::content_type,
+    &amqp_basic_properties_t::content_encoding,
+    &amqp_basic_properties_t::correlation_id,
+    &amqp_basic_properties_t::reply_to,
+    &amqp_basic_properties_t::expiration,
+    &amqp_basic_properties_t::message_id,
+    &amqp_basic_properties_t::type,
+    &amqp_basic_properties_t::user_id,
+    &amqp_basic_properties_t::app_id,
+    &amqp_basic_properties_t::cluster_id,
+};
+const amqp_flags_t SHORT_PROPERTY_FLAGS[] = {
+    AMQP_BASIC_CONTENT_TYPE_FLAG,   AMQP_BASIC_CONTENT_ENCODING_FLAG,
+    AMQP_BASIC_CORRELATION_ID_FLAG, AMQP_BASIC_REPLY_TO_FLAG,
+    AMQP_BASIC_EXPIRATION_FLAG,     AMQP_BASIC_MESSAGE_ID_FLAG,
+    AMQP_BASIC_TYPE_FLAG,           AMQP_BASIC_USER_ID_FLAG,
+    AMQP_BASIC_APP_ID_FLAG,         AMQP_BASIC_CLUSTER_ID_FLAG,
+};
+constexpr size_t SHORT_PROPERTY_COUNT =
+    sizeof(SHORT_PROPERTY_FLAGS) / sizeof(SHORT_PROPERTY_FLAGS[0]);
+
+// Everything but the short strings and headers
+struct fixedProperties {
+  uint32_t m_flags;
+  uint8_t m_deliveryMode;
+  uint8_t m_priority;
+  uint16_t m_reserved;
+  uint64_t m_timestamp;
+};
+
+size_t padded(size_t length) { return (length + 7) & ~static_cast<size_t>(7); }
+
+std::string segmentName(const std::string& path, uint32_t index) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%06u", index);
+  return path + suffix;
+}
+
+size_t tableLength(const amqp_table_t& table);
+
+// Bytes amqp_encode_table() writes for a value, 0 for a kind it can't
+size_t fieldLength(const amqp_field_value_t& value) {
+  switch (value.kind) {
+    case AMQP_FIELD_KIND_BOOLEAN:
+    case AMQP_FIELD_KIND_I8:
+    case AMQP_FIELD_KIND_U8:
+      return 1 + 1;
+    case AMQP_FIELD_KIND_I16:
+    case AMQP_FIELD_KIND_U16:
+      return 1 + 2;
+    case AMQP_FIELD_KIND_I32:
+    case AMQP_FIELD_KIND_U32:
+    case AMQP_FIELD_KIND_F32:
+      return 1 + 4;
+    case AMQP_FIELD_KIND_I64:
+    case AMQP_FIELD_KIND_U64:
+    case AMQP_FIELD_KIND_F64:
+    case AMQP_FIELD_KIND_TIMESTAMP:
+      return 1 + 8;
+    case AMQP_FIELD_KIND_DECIMAL:
+      return 1 + 5;
+    case AMQP_FIELD_KIND_UTF8:
+    case AMQP_FIELD_KIND_BYTES:
+      return 1 + 4 + value.value.bytes.len;
+    case AMQP_FIELD_KIND_VOID:
+      return 1;
+    case AMQP_FIELD_KIND_ARRAY: {
+      size_t length = 1 + 4;
+      for (int i = 0; i < value.value.array.num_entries; i++) {
+        const size_t entry = fieldLength(value.value.array.entries[i]);
+        if (0 == entry) return 0;
+        length += entry;
+      }
+      return length;
+    }
+    case AMQP_FIELD_KIND_TABLE: {
+      const size_t table = tableLength(value.value.table);
+      return table ? 1 + table : 0;
+    }
+    default:
+      return 0;
+  }
+}
+
+// Bytes amqp_encode_table() writes for a table, 0 if it can't
+size_t tableLength(const amqp_table_t& table) {
+  size_t length = 4;
+  for (int i = 0; i < table.num_entries; i++) {
+    const amqp_table_entry_t& entry = table.entries[i];
+    const size_t value = fieldLength(entry.value);
+    if (entry.key.len > UINT8_MAX || 0 == value) return 0;
+    length += 1 + entry.key.len + value;
+  }
+  return length;
+}
+
+// Recorded properties, less the headers
+size_t propertiesLength(const amqp_basic_properties_t& properties) {
+  size_t length = sizeof(fixedProperties);
+  for (size_t i = 0; i < SHORT_PROPERTY_COUNT; i++) {
+    if (properties._flags & SHORT_PROPERTY_FLAGS[i]) {
+      length += 1 + (properties.*SHORT_PROPERTIES[i]).len;
+    }
+  }
+  return length;
+}
+
+bool shortPropertiesFit(const amqp_basic_properties_t& properties) {
+  for (size_t i = 0; i < SHORT_PROPERTY_COUNT; i++) {
+    if ((properties._flags & SHORT_PROPERTY_FLAGS[i]) &&
+        (properties.*SHORT_PROPERTIES[i]).len > UINT8_MAX) {
+      return false;
+    }
+  }
+  return true;
+}
+
+char* putBytes(char* out, const amqp_bytes_t& bytes) {
+  if (bytes.len != 0) memcpy(out, bytes.bytes, bytes.len);
+  return out + bytes.len;
+}
+
+char* putProperties(char* out, const amqp_basic_properties_t& properties) {
+  fixedProperties fixed;
+  fixed.m_flags = properties._flags;
+  fixed.m_deliveryMode = properties.delivery_mode;
+  fixed.m_priority = properties.priority;
+  fixed.m_reserved = 0;
+  fixed.m_timestamp = properties.timestamp;
+  memcpy(out, &fixed, sizeof(fixed));
+  out += sizeof(fixed);
+  for (size_t i = 0; i < SHORT_PROPERTY_COUNT; i++) {
+    if (0 == (properties._flags & SHORT_PROPERTY_FLAGS[i])) continue;
+    const amqp_bytes_t& value = properties.*SHORT_PROPERTIES[i];
+    *out++ = static_cast<char>(value.len);
+    out = putBytes(out, value);
+  }
+  return out;
+}
+
+// Takes length bytes off the front of [in, end)
+bool takeBytes(const char*& in, const char* end, size_t length,
+               amqp_bytes_t& bytes) {
+  if (static_cast<size_t>(end - in) < length) return false;
+  bytes.len = length;
+  bytes.bytes = const_cast<char*>(in);
+  in += length;
+  return true;
+}
+
+bool takeProperties(const char* in, const char* end, amqp_pool_t& pool,
+                    amqp_basic_properties_t& properties) {
+  fixedProperties fixed;
+  if (static_cast<size_t>(end - in) < sizeof(fixed)) return false;
+  memcpy(&fixed, in, sizeof(fixed));
+  in += sizeof(fixed);
+  properties._flags = fixed.m_flags;
+  properties.delivery_mode = fixed.m_deliveryMode;
+  properties.priority = fixed.m_priority;
+  properties.timestamp = fixed.m_timestamp;
+  for (size_t i = 0; i < SHORT_PROPERTY_COUNT; i++) {
+    if (0 == (properties._flags & SHORT_PROPERTY_FLAGS[i])) continue;
+    if (in == end) return false;
+    const size_t length = static_cast<uint8_t>(*in++);
+    if (false == takeBytes(in, end, length, properties.*SHORT_PROPERTIES[i])) {
+      return false;
+    }
+  }
+  if (properties._flags & AMQP_BASIC_HEADERS_FLAG) {
+    amqp_bytes_t encoded;
+    encoded.len = end - in;
+    encoded.bytes = const_cast<char*>(in);
+    size_t offset = 0;
+    if (amqp_decode_table(encoded, &pool, &properties.headers, &offset) < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool takeMessage(const char* record, amqp_pool_t& pool,
+                 capturedMessage& message) {
+  const auto& header =
+      *reinterpret_cast<const TrafficCapture::recordHeader*>(record);
+  const char* in = record + sizeof(header);
+  const char* end = record + header.m_length;
+  amqp_bytes_t properties;
+  if (false == takeBytes(in, end, header.m_exchangeLength,
+                         message.m_exchange) ||
+      false == takeBytes(in, end, header.m_routingKeyLength,
+                         message.m_routingKey) ||
+      false == takeBytes(in, end, header.m_propertiesLength, properties) ||
+      false == takeBytes(in, end, header.m_bodyLength, message.m_body)) {
+    return false;
+  }
+  memset(&message.m_properties, 0, sizeof(message.m_properties));
+  const char* begin = static_cast<const char*>(properties.bytes);
+  if (false == takeProperties(begin, begin + properties.len, pool,
+                              message.m_properties)) {
+    return false;
+  }
+  message.m_receivedNanos = header.m_receivedNanos;
+  message.m_realtimeNanos = header.m_realtimeNanos;
+  return true;
+}
+
+void waitUntil(uint64_t due) {
+  for (uint64_t now = LatencyHistogram::Now(); now < due;
+       now = LatencyHistogram::Now()) {
+    if (due - now > REPLAY_SPIN_NANOS) {
+      std::this_thread::sleep_for(
+          std::chrono::nanoseconds(due - now - REPLAY_SPIN_NANOS));
+    }
+  }
+}
+
+}  // namespace
+
+TrafficCapture::TrafficCapture()
+    : m_segmentBytes(CAPTURE_SEGMENT_BYTES),
+      m_nextSegment(0),
+      m_segment(nullptr),
+      m_recorded(0) {}
+
+TrafficCapture::~TrafficCapture() { Close(); }
+
+HARE_ERROR_E TrafficCapture::Open(const std::string& path,
+                                  size_t segmentBytes) {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  if (nullptr != m_segment) return HARE_ERROR_E::THREAD_ALREADY_RUNNING;
+  if (segmentBytes < sizeof(segmentHeader) + sizeof(recordHeader)) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  // Segments of an earlier capture would be replayed after ours
+  for (uint32_t index = 0; 0 == unlink(segmentName(path, index).c_str());
+       index++) {
+  }
+
+  m_path = path;
+  m_segmentBytes = segmentBytes;
+  m_nextSegment = 0;
+  m_recorded = 0;
+  return openSegment(0);
+}
+
+void TrafficCapture::Close() {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  closeSegment();
+}
+
+bool TrafficCapture::IsOpen() const {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  return nullptr != m_segment;
+}
+
+uint64_t TrafficCapture::Recorded() const {
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  return m_recorded;
+}
+
+HARE_ERROR_E TrafficCapture::openSegment(size_t minimumBytes) {
+  const size_t size =
+      std::max(m_segmentBytes, sizeof(segmentHeader) + minimumBytes);
+  const std::string name = segmentName(m_path, m_nextSegment);
+  int fd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG(LOG_ERROR, "Unable to create capture segment " + name + ", " +
+                       strerror(errno));
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+  void* map = MAP_FAILED;
+  if (0 == ftruncate(fd, size)) {
+    map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (MAP_FAILED == map) {
+    LOG(LOG_ERROR, "Unable to map capture segment " + name + ", " +
+                       strerror(errno));
+    unlink(name.c_str());
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  auto header = static_cast<segmentHeader*>(map);
+  memcpy(header->m_magic, CAPTURE_MAGIC, sizeof(header->m_magic));
+  header->m_version = CAPTURE_VERSION;
+  header->m_index = m_nextSegment++;
+  header->m_size = size;
+  header->m_used.store(0, std::memory_order_release);
+  m_segment = header;
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+void TrafficCapture::closeSegment() {
+  if (nullptr == m_segment) return;
+  const std::string name = segmentName(m_path, m_segment->m_index);
+  const uint64_t length = sizeof(segmentHeader) + m_segment->m_used.load();
+  munmap(m_segment, m_segment->m_size);
+  m_segment = nullptr;
+  if (0 != truncate(name.c_str(), length)) {
+    LOG(LOG_WARN, "Unable to trim capture segment " + name + ", " +
+                      strerror(errno));
+  }
+}
+
+HARE_ERROR_E TrafficCapture::Record(const amqp_envelope_t& envelope,
+                                    uint64_t receivedNanos) {
+  if (0 == receivedNanos) receivedNanos = LatencyHistogram::Now();
+  const amqp_basic_properties_t& properties = envelope.message.properties;
+  if (envelope.exchange.len > UINT16_MAX ||
+      envelope.routing_key.len > UINT16_MAX ||
+      false == shortPropertiesFit(properties)) {
+    return HARE_ERROR_E::INVALID_PARAMETERS;
+  }
+
+  size_t headersLength = 0;
+  if (properties._flags & AMQP_BASIC_HEADERS_FLAG) {
+    headersLength = tableLength(properties.headers);
+    if (0 == headersLength) {
+      LOG(LOG_ERROR, "Message headers can't be captured");
+      return HARE_ERROR_E::INVALID_PARAMETERS;
+    }
+  }
+  const size_t propertiesBytes = propertiesLength(properties) + headersLength;
+  const size_t length =
+      padded(sizeof(recordHeader) + envelope.exchange.len +
+             envelope.routing_key.len + propertiesBytes +
+             envelope.message.body.len);
+
+  const std::lock_guard<std::mutex> lock(m_mutex);
+  if (nullptr == m_segment) return HARE_ERROR_E::NOT_INITIALIZED;
+  uint64_t used = m_segment->m_used.load(std::memory_order_relaxed);
+  if (sizeof(segmentHeader) + used + length > m_segment->m_size) {
+    closeSegment();
+    const auto retCode = openSegment(length);
+    if (false == noError(retCode)) return retCode;
+    used = 0;
+  }
+
+  char* out = reinterpret_cast<char*>(m_segment + 1) + used;
+  recordHeader header;
+  header.m_length = length;
+  header.m_bodyLength = envelope.message.body.len;
+  header.m_receivedNanos = receivedNanos;
+  header.m_realtimeNanos = hare_realtime_nanos();
+  header.m_propertiesLength = propertiesBytes;
+  header.m_exchangeLength = envelope.exchange.len;
+  header.m_routingKeyLength = envelope.routing_key.len;
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  out = putBytes(out, envelope.exchange);
+  out = putBytes(out, envelope.routing_key);
+  out = putProperties(out, properties);
+  if (headersLength != 0) {
+    amqp_bytes_t buffer;
+    buffer.len = headersLength;
+    buffer.bytes = out;
+    size_t offset = 0;
+    if (amqp_encode_table(buffer,
+                          const_cast<amqp_table_t*>(&properties.headers),
+                          &offset) < 0 ||
+        offset != headersLength) {
+      // Never published, the next record goes over it
+      LOG(LOG_ERROR, "Message headers can't be captured");
+      return HARE_ERROR_E::INVALID_PARAMETERS;
+    }
+    out += headersLength;
+  }
+  putBytes(out, envelope.message.body);
+
+  m_segment->m_used.store(used + length, std::memory_order_release);
+  m_recorded++;
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+TrafficReplay::TrafficReplay() : m_messages(0), m_stop(false) {
+  init_amqp_pool(&m_pool, 4096);
+}
+
+TrafficReplay::~TrafficReplay() { Close(); }
+
+HARE_ERROR_E TrafficReplay::Open(const std::string& path) {
+  Close();
+  for (uint32_t index = 0;; index++) {
+    const std::string name = segmentName(path, index);
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) break;
+    struct stat status;
+    void* map = MAP_FAILED;
+    const off_t minimum = sizeof(TrafficCapture::segmentHeader);
+    if (0 == fstat(fd, &status) && status.st_size >= minimum) {
+      map = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (MAP_FAILED == map) break;
+
+    auto header = static_cast<const TrafficCapture::segmentHeader*>(map);
+    if (0 != memcmp(header->m_magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) ||
+        header->m_version != CAPTURE_VERSION) {
+      munmap(map, status.st_size);
+      break;
+    }
+    m_segments.push_back({header, static_cast<size_t>(status.st_size)});
+  }
+  if (m_segments.empty()) return HARE_ERROR_E::INVALID_PARAMETERS;
+
+  return replay([this](const capturedMessage&) { m_messages++; }, 0);
+}
+
+void TrafficReplay::Close() {
+  for (const auto& segment : m_segments) {
+    munmap(const_cast<TrafficCapture::segmentHeader*>(segment.m_header),
+           segment.m_size);
+  }
+  m_segments.clear();
+  m_messages = 0;
+  empty_amqp_pool(&m_pool);
+}
+
+uint64_t TrafficReplay::Size() const { return m_messages; }
+
+void TrafficReplay::Stop() { m_stop.store(true); }
+
+HARE_ERROR_E TrafficReplay::Replay(const TD_ReplaySink& sink, double speed) {
+  return replay(sink, speed);
+}
+
+HARE_ERROR_E TrafficReplay::Replay(Producer& producer, double speed) {
+  return replay(
+      [&producer](const capturedMessage& captured) {
+        amqp_envelope_t envelope;
+        memset(&envelope, 0, sizeof(envelope));
+        envelope.message.properties = captured.m_properties;
+        envelope.message.body = captured.m_body;
+        Message message(envelope);
+        producer.Send(hare_bytes_to_string(captured.m_exchange),
+                      hare_bytes_to_string(captured.m_routingKey), message);
+      },
+      speed);
+}
+
+HARE_ERROR_E TrafficReplay::Replay(ChannelHandler& handler, double speed) {
+  // A multithreaded handler's copies of the message copy the headers
+  return replay(
+      [&handler](const capturedMessage& captured) {
+        amqp_envelope_t envelope;
+        memset(&envelope, 0, sizeof(envelope));
+        envelope.message.properties = captured.m_properties;
+        envelope.message.body = captured.m_body;
+        Message message(envelope);
+        handler.Process({hare_bytes_to_string(captured.m_exchange),
+                         hare_bytes_to_string(captured.m_routingKey)},
+                        message, LatencyHistogram::Now());
+      },
+      speed);
+}
+
+HARE_ERROR_E TrafficReplay::replay(const TD_ReplaySink& sink, double speed) {
+  if (m_segments.empty()) return HARE_ERROR_E::NOT_INITIALIZED;
+  m_stop.store(false);
+
+  uint64_t start = 0;
+  uint64_t firstNanos = 0;
+  for (const auto& segment : m_segments) {
+    const char* records = reinterpret_cast<const char*>(segment.m_header + 1);
+    // The capture may still be writing the last segment
+    const uint64_t used =
+        std::min<uint64_t>(segment.m_header->m_used.load(),
+                           segment.m_size - sizeof(*segment.m_header));
+    for (uint64_t offset = 0; offset < used;) {
+      if (m_stop.load(std::memory_order_relaxed)) {
+        return HARE_ERROR_E::ALL_GOOD;
+      }
+      // Records are 8 byte aligned
+      auto& header = *reinterpret_cast<const TrafficCapture::recordHeader*>(
+          records + offset);
+      capturedMessage message;
+      if (used - offset < sizeof(header) || header.m_length < sizeof(header) ||
+          header.m_length > used - offset ||
+          false == takeMessage(records + offset, m_pool, message)) {
+        LOG(LOG_ERROR, "Capture damaged, replay stopped");
+        return HARE_ERROR_E::INVALID_PARAMETERS;
+      }
+
+      if (speed > 0) {
+        if (0 == start) {
+          start = LatencyHistogram::Now();
+          firstNanos = header.m_receivedNanos;
+        } else if (header.m_receivedNanos > firstNanos) {
+          waitUntil(start + static_cast<uint64_t>(
+                                (header.m_receivedNanos - firstNanos) / speed));
+        }
+      }
+      sink(message);
+      recycle_amqp_pool(&m_pool);
+      offset += header.m_length;
+    }
+  }
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+}  // namespace HareCpp
@@ -0,0 +1,123 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "UnixSocket.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+namespace HareCpp {
+namespace connection {
+
+UnixSocket::UnixSocket() : m_fd(-1) {}
+
+UnixSocket::~UnixSocket() { Close(true); }
+
+int UnixSocket::Open(const char* path, int, const struct timeval* timeout) {
+  Close(true);
+
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  auto length = strlen(path);
+  if (length == 0 || length >= sizeof(address.sun_path)) {
+    LOG(LOG_ERROR, "Unix socket path is empty or too long");
+    return AMQP_STATUS_BAD_URL;
+  }
+  memcpy(address.sun_path, path, length);
+  // Abstract sockets start with a NUL rather than living in the filesystem
+  if (path[0] == '@') address.sun_path[0] = '\0';
+  auto addressLength =
+      static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + length);
+
+  m_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (m_fd < 0) return AMQP_STATUS_SOCKET_ERROR;
+
+  int status = connect(m_fd, reinterpret_cast<sockaddr*>(&address),
+                       addressLength);
+  // A full listen backlog is the only way a local connect has to wait
+  if (status != 0 && (errno == EINPROGRESS || errno == EAGAIN)) {
+    int timeoutMillis = -1;
+    if (timeout != nullptr) {
+      timeoutMillis =
+          static_cast<int>(timeout->tv_sec * 1000 + timeout->tv_usec / 1000);
+    }
+    struct pollfd connecting;
+    connecting.fd = m_fd;
+    connecting.events = POLLOUT;
+    connecting.revents = 0;
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    if (poll(&connecting, 1, timeoutMillis) == 1 &&
+        getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 &&
+        error == 0) {
+      status = 0;
+    }
+  }
+
+  if (status != 0) {
+    close(m_fd);
+    m_fd = -1;
+    return AMQP_STATUS_SOCKET_ERROR;
+  }
+
+  fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+  return AMQP_STATUS_OK;
+}
+
+ssize_t UnixSocket::Send(const void* buffer, size_t length, int flags) {
+  if (m_fd < 0) return AMQP_STATUS_SOCKET_ERROR;
+  return plainSend(m_fd, buffer, length, flags);
+}
+
+ssize_t UnixSocket::Recv(void* buffer, size_t length, int) {
+  if (m_fd < 0) return AMQP_STATUS_SOCKET_ERROR;
+  return plainRecv(m_fd, buffer, length);
+}
+
+int UnixSocket::Close(bool) {
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+  return AMQP_STATUS_OK;
+}
+
+int UnixSocket::PollFd() const { return m_fd; }
+
+int UnixSocket::Fd() const { return m_fd; }
+
+}  // namespace connection
+}  // namespace HareCpp
@@ -0,0 +1,625 @@
+/*
+ * libharecpp - Wrapper Library around: rabbitmq-c - rabbitmq C library
+ *
+ * Copyright (c) 2020 Cody Williams
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "UringSocket.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__) && !defined(HARECPP_NO_IO_URING) && \
+    defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// Multishot recv and provided buffer rings are the newest things used here
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define HARE_HAVE_IO_URING 1
+#endif
+
+namespace HareCpp {
+namespace connection {
+
+namespace {
+// Tags on submissions, to tell completions apart
+constexpr uint64_t RECV_TAG = 1;
+constexpr uint64_t WRITE_TAG = 2;
+
+constexpr uint16_t RECV_BUFFER_GROUP = 0;
+
+// Connect to host:port, waiting at most timeout (forever if null)
+int connectTcp(const char* host, int port, const struct timeval* timeout) {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  char portString[16];
+  snprintf(portString, sizeof(portString), "%d", port);
+
+  struct addrinfo* addresses = nullptr;
+  if (getaddrinfo(host, portString, &hints, &addresses) != 0) return -1;
+
+  int timeoutMillis = -1;
+  if (timeout != nullptr) {
+    timeoutMillis =
+        static_cast<int>(timeout->tv_sec * 1000 + timeout->tv_usec / 1000);
+  }
+
+  int fd = -1;
+  for (auto* address = addresses; address != nullptr;
+       address = address->ai_next) {
+    fd = socket(address->ai_family,
+                address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                address->ai_protocol);
+    if (fd < 0) continue;
+
+    int status = connect(fd, address->ai_addr, address->ai_addrlen);
+    if (status != 0 && errno == EINPROGRESS) {
+      struct pollfd connecting;
+      connecting.fd = fd;
+      connecting.events = POLLOUT;
+      connecting.revents = 0;
+      int error = 0;
+      socklen_t errorLength = sizeof(error);
+      if (poll(&connecting, 1, timeoutMillis) == 1 &&
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLength) == 0 &&
+          error == 0) {
+        status = 0;
+      }
+    }
+
+    if (status == 0) break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+
+  if (fd >= 0) {
+    // Same as rabbitmq-c's TCP socket, and blocking from here on
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+  }
+  return fd;
+}
+}  // namespace
+
+#ifdef HARE_HAVE_IO_URING
+
+/**
+ * The rings shared with the kernel plus our buffers.  Laid out as described
+ * in io_uring_setup(2).
+ */
+struct UringSocket::ring {
+  ring()
+      : m_fd(-1),
+        m_sqRing(nullptr),
+        m_sqRingBytes(0),
+        m_cqRing(nullptr),
+        m_cqRingBytes(0),
+        m_sqes(nullptr),
+        m_sqesBytes(0),
+        m_sqTail(0),
+        m_sqSubmitted(0),
+        m_sendBuffer(nullptr),
+        m_sendBytes(0),
+        m_sendLength(0),
+        m_sendWritten(0),
+        m_writing(false),
+        m_bufferRing(nullptr),
+        m_bufferRingBytes(0),
+        m_recvBuffers(nullptr),
+        m_recvArmed(false),
+        m_eof(false),
+        m_error(0){};
+
+  int m_fd;
+  struct io_uring_params m_params;
+
+  void* m_sqRing;
+  size_t m_sqRingBytes;
+  void* m_cqRing;
+  size_t m_cqRingBytes;
+  struct io_uring_sqe* m_sqes;
+  size_t m_sqesBytes;
+
+  unsigned* m_sqHead;
+  unsigned* m_sqTailShared;
+  unsigned* m_sqMask;
+  unsigned* m_sqArray;
+  unsigned* m_cqHead;
+  unsigned* m_cqTail;
+  unsigned* m_cqMask;
+  struct io_uring_cqe* m_cqes;
+
+  unsigned m_sqTail;       // next entry we fill in
+  unsigned m_sqSubmitted;  // entries the kernel was told about
+
+  // Registered buffer 0, Send() copies in and a write fixed sends it out
+  char* m_sendBuffer;
+  size_t m_sendBytes;
+  size_t m_sendLength;
+  size_t m_sendWritten;
+  bool m_writing;
+
+  // Provided buffer ring for the multishot recv
+  struct io_uring_buf_ring* m_bufferRing;
+  size_t m_bufferRingBytes;
+  char* m_recvBuffers;
+  bool m_recvArmed;
+  bool m_eof;
+  int m_error;
+
+  struct io_uring_sqe* sqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqTail - head >= m_params.sq_entries) return nullptr;
+    auto index = m_sqTail & *m_sqMask;
+    auto* entry = &m_sqes[index];
+    memset(entry, 0, sizeof(*entry));
+    m_sqArray[index] = index;
+    m_sqTail++;
+    return entry;
+  }
+
+  unsigned unsubmitted() {
+    __atomic_store_n(m_sqTailShared, m_sqTail, __ATOMIC_RELEASE);
+    return m_sqTail - m_sqSubmitted;
+  }
+};
+
+namespace {
+void* mapAnonymous(size_t bytes) {
+  auto* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  return (memory == MAP_FAILED ? nullptr : memory);
+}
+
+int uringSetup(unsigned entries, struct io_uring_params* params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+}  // namespace
+
+bool UringSocket::Supported() {
+  static const bool supported = []() {
+    // IORING_SETUP_SINGLE_ISSUER arrived in 6.0 along with multishot recv,
+    // older kernels turn the flag down
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER;
+    int fd = uringSetup(2, &params);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+  }();
+  return supported;
+}
+
+bool UringSocket::setupRing() {
+  std::unique_ptr<ring> created(new ring());
+  auto& r = *created;
+
+  memset(&r.m_params, 0, sizeof(r.m_params));
+  r.m_fd = uringSetup(URING_QUEUE_DEPTH, &r.m_params);
+  if (r.m_fd < 0) return false;
+  m_ring = std::move(created);
+
+  auto& params = r.m_params;
+  r.m_sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  r.m_cqRingBytes =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) {
+    r.m_sqRingBytes = r.m_cqRingBytes =
+        std::max(r.m_sqRingBytes, r.m_cqRingBytes);
+  }
+
+  r.m_sqRing = mmap(nullptr, r.m_sqRingBytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r.m_fd, IORING_OFF_SQ_RING);
+  if (r.m_sqRing == MAP_FAILED) {
+    r.m_sqRing = nullptr;
+    return false;
+  }
+  if (singleMap) {
+    r.m_cqRing = r.m_sqRing;
+  } else {
+    r.m_cqRing = mmap(nullptr, r.m_cqRingBytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r.m_fd, IORING_OFF_CQ_RING);
+    if (r.m_cqRing == MAP_FAILED) {
+      r.m_cqRing = nullptr;
+      return false;
+    }
+  }
+
+  r.m_sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+  auto* sqes = mmap(nullptr, r.m_sqesBytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r.m_fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return false;
+  r.m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+  auto* sq = static_cast<char*>(r.m_sqRing);
+  r.m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  r.m_sqTailShared = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  r.m_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  r.m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  r.m_sqTail = r.m_sqSubmitted = *r.m_sqTailShared;
+
+  auto* cq = static_cast<char*>(r.m_cqRing);
+  r.m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  r.m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  r.m_cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  r.m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // Send buffer, registered so the kernel doesn't map it on every write
+  r.m_sendBytes = m_sendBufferBytes;
+  r.m_sendBuffer = static_cast<char*>(mapAnonymous(r.m_sendBytes));
+  if (r.m_sendBuffer == nullptr) return false;
+  struct iovec sendVector;
+  sendVector.iov_base = r.m_sendBuffer;
+  sendVector.iov_len = r.m_sendBytes;
+  if (uringRegister(r.m_fd, IORING_REGISTER_BUFFERS, &sendVector, 1) != 0) {
+    return false;
+  }
+
+  // Buffers the multishot recv picks from, handed back as they are read
+  r.m_bufferRingBytes = URING_RECV_BUFFERS * sizeof(struct io_uring_buf);
+  r.m_bufferRing =
+      static_cast<struct io_uring_buf_ring*>(mapAnonymous(r.m_bufferRingBytes));
+  r.m_recvBuffers = static_cast<char*>(
+      mapAnonymous(URING_RECV_BUFFERS * URING_RECV_BUFFER_BYTES));
+  if (r.m_bufferRing == nullptr || r.m_recvBuffers == nullptr) return false;
+
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = reinterpret_cast<uint64_t>(r.m_bufferRing);
+  registration.ring_entries = URING_RECV_BUFFERS;
+  registration.bgid = RECV_BUFFER_GROUP;
+  if (uringRegister(r.m_fd, IORING_REGISTER_PBUF_RING, &registration, 1) !=
+      0) {
+    return false;
+  }
+  r.m_bufferRing->tail = 0;
+  for (unsigned id = 0; id < URING_RECV_BUFFERS; id++) {
+    recycle(static_cast<uint16_t>(id));
+  }
+
+  return armRecv() && enter(0);
+}
+
+void UringSocket::teardownRing() {
+  if (m_ring == nullptr) return;
+  auto& r = *m_ring;
+
+  // Closing the ring cancels the multishot recv and drops the registrations
+  if (r.m_fd >= 0) close(r.m_fd);
+  if (r.m_sqes != nullptr) munmap(r.m_sqes, r.m_sqesBytes);
+  if (r.m_cqRing != nullptr && r.m_cqRing != r.m_sqRing) {
+    munmap(r.m_cqRing, r.m_cqRingBytes);
+  }
+  if (r.m_sqRing != nullptr) munmap(r.m_sqRing, r.m_sqRingBytes);
+  if (r.m_sendBuffer != nullptr) munmap(r.m_sendBuffer, r.m_sendBytes);
+  if (r.m_bufferRing != nullptr) munmap(r.m_bufferRing, r.m_bufferRingBytes);
+  if (r.m_recvBuffers != nullptr) {
+    munmap(r.m_recvBuffers, URING_RECV_BUFFERS * URING_RECV_BUFFER_BYTES);
+  }
+  m_ring.reset();
+  m_received.clear();
+}
+
+bool UringSocket::armRecv() {
+  auto* entry = m_ring->sqe();
+  if (entry == nullptr) return false;
+  entry->opcode = IORING_OP_RECV;
+  entry->fd = m_fd;
+  entry->ioprio = IORING_RECV_MULTISHOT;
+  entry->flags = IOSQE_BUFFER_SELECT;
+  entry->buf_group = RECV_BUFFER_GROUP;
+  entry->user_data = RECV_TAG;
+  m_ring->m_recvArmed = true;
+  return true;
+}
+
+bool UringSocket::enter(unsigned int waitFor) {
+  auto& r = *m_ring;
+  auto toSubmit = r.unsubmitted();
+  if (toSubmit == 0 && waitFor == 0) return true;
+
+  for (;;) {
+    m_syscalls++;
+    int submitted = static_cast<int>(
+        syscall(__NR_io_uring_enter, r.m_fd, toSubmit, waitFor,
+                (waitFor > 0 ? IORING_ENTER_GETEVENTS : 0), nullptr, 0));
+    if (submitted >= 0) {
+      r.m_sqSubmitted += submitted;
+      return true;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+    // Completions need reaping before the kernel takes more
+    reap();
+    toSubmit = r.unsubmitted();
+  }
+}
+
+void UringSocket::recycle(uint16_t bufferId) {
+  auto& r = *m_ring;
+  auto tail = r.m_bufferRing->tail;
+  // Not bufs[], the kernel header's flexible array trick gives it an offset
+  // of 8 when compiled as C++.  The ring is an array of io_uring_buf with the
+  // tail laid over the first entry's resv field.
+  auto* buffers = reinterpret_cast<struct io_uring_buf*>(r.m_bufferRing);
+  auto& buffer = buffers[tail & (URING_RECV_BUFFERS - 1)];
+  buffer.addr = reinterpret_cast<uint64_t>(r.m_recvBuffers +
+                                           bufferId * URING_RECV_BUFFER_BYTES);
+  buffer.len = URING_RECV_BUFFER_BYTES;
+  buffer.bid = bufferId;
+  __atomic_store_n(&r.m_bufferRing->tail, static_cast<uint16_t>(tail + 1),
+                   __ATOMIC_RELEASE);
+}
+
+bool UringSocket::writePending() {
+  auto& r = *m_ring;
+  auto* entry = r.sqe();
+  if (entry == nullptr) return false;
+  entry->opcode = IORING_OP_WRITE_FIXED;
+  entry->fd = m_fd;
+  entry->addr = reinterpret_cast<uint64_t>(r.m_sendBuffer + r.m_sendWritten);
+  entry->len = static_cast<uint32_t>(r.m_sendLength - r.m_sendWritten);
+  entry->buf_index = 0;
+  entry->user_data = WRITE_TAG;
+  r.m_writing = true;
+  return true;
+}
+
+void UringSocket::reap() {
+  auto& r = *m_ring;
+  unsigned head = *r.m_cqHead;
+  unsigned tail = __atomic_load_n(r.m_cqTail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    const auto& completion = r.m_cqes[head & *r.m_cqMask];
+
+    if (completion.user_data == WRITE_TAG) {
+      r.m_writing = false;
+      if (completion.res > 0) {
+        r.m_sendWritten += completion.res;
+      } else if (completion.res != -EINTR && completion.res != -EAGAIN) {
+        r.m_error = (completion.res == 0 ? EPIPE : -completion.res);
+      }
+      continue;
+    }
+
+    if (completion.user_data != RECV_TAG) continue;
+
+    if (0 == (completion.flags & IORING_CQE_F_MORE)) r.m_recvArmed = false;
+    if (completion.res > 0 && (completion.flags & IORING_CQE_F_BUFFER)) {
+      received data;
+      data.m_bufferId =
+          static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+      data.m_offset = 0;
+      data.m_length = completion.res;
+      m_received.push_back(data);
+    } else if (completion.res == 0) {
+      r.m_eof = true;
+    } else if (completion.res < 0 && completion.res != -ENOBUFS &&
+               completion.res != -EINTR) {
+      // ENOBUFS means rabbitmq-c is behind on reading, we re-arm once it
+      // hands buffers back
+      r.m_error = -completion.res;
+    }
+  }
+
+  __atomic_store_n(r.m_cqHead, head, __ATOMIC_RELEASE);
+}
+
+HARE_ERROR_E UringSocket::Flush() {
+  if (m_failed || m_closed) return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+  if (m_ring == nullptr) return HARE_ERROR_E::ALL_GOOD;
+
+  auto& r = *m_ring;
+  while (r.m_sendWritten < r.m_sendLength) {
+    if (false == r.m_writing && false == writePending()) {
+      // Queue is full of entries the kernel hasn't taken yet
+      if (false == enter(0)) break;
+      continue;
+    }
+    // Usually completes inline, the socket buffer has room
+    if (false == enter(1)) break;
+    reap();
+    if (r.m_error != 0) break;
+  }
+
+  if (r.m_sendWritten < r.m_sendLength) {
+    m_failed = true;
+    return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+  }
+  r.m_sendLength = r.m_sendWritten = 0;
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+ssize_t UringSocket::Send(const void* buffer, size_t length, int flags) {
+  if (m_failed || m_closed) return AMQP_STATUS_SOCKET_ERROR;
+  if (m_ring == nullptr) return plainSend(m_fd, buffer, length, flags);
+
+  auto& r = *m_ring;
+  auto* bytes = static_cast<const char*>(buffer);
+  size_t copied = 0;
+  while (copied < length) {
+    if (r.m_sendLength == r.m_sendBytes && false == noError(Flush())) {
+      return AMQP_STATUS_SOCKET_ERROR;
+    }
+    auto chunk = std::min(length - copied, r.m_sendBytes - r.m_sendLength);
+    memcpy(r.m_sendBuffer + r.m_sendLength, bytes + copied, chunk);
+    r.m_sendLength += chunk;
+    copied += chunk;
+  }
+  return static_cast<ssize_t>(length);
+}
+
+ssize_t UringSocket::Recv(void* buffer, size_t length, int) {
+  if (m_failed || m_closed) return AMQP_STATUS_SOCKET_ERROR;
+  if (m_ring == nullptr) return plainRecv(m_fd, buffer, length);
+
+  // Whoever is reading may be waiting on a reply to what they just sent
+  if (false == noError(Flush())) return AMQP_STATUS_SOCKET_ERROR;
+
+  auto& r = *m_ring;
+  reap();
+
+  auto* bytes = static_cast<char*>(buffer);
+  size_t copied = 0;
+  while (copied < length && false == m_received.empty()) {
+    auto& data = m_received.front();
+    auto chunk = std::min(length - copied, data.m_length - data.m_offset);
+    memcpy(bytes + copied,
+           r.m_recvBuffers + data.m_bufferId * URING_RECV_BUFFER_BYTES +
+               data.m_offset,
+           chunk);
+    data.m_offset += chunk;
+    copied += chunk;
+    if (data.m_offset == data.m_length) {
+      recycle(data.m_bufferId);
+      m_received.pop_front();
+    }
+  }
+
+  if (false == r.m_recvArmed && false == r.m_eof && r.m_error == 0) {
+    if (false == armRecv() || false == enter(0)) {
+      m_failed = true;
+      return AMQP_STATUS_SOCKET_ERROR;
+    }
+  }
+
+  if (copied > 0) return static_cast<ssize_t>(copied);
+  if (r.m_error != 0) {
+    m_failed = true;
+    return AMQP_STATUS_SOCKET_ERROR;
+  }
+  if (r.m_eof) return AMQP_STATUS_CONNECTION_CLOSED;
+  return AMQP_SOCKET_NEED_READ;
+}
+
+bool UringSocket::UsingRing() const { return m_ring != nullptr; }
+
+int UringSocket::PollFd() const {
+  return (m_ring != nullptr ? m_ring->m_fd : m_fd);
+}
+
+#else  // No io_uring, always plain send()/recv()
+
+struct UringSocket::ring {};
+
+bool UringSocket::Supported() { return false; }
+bool UringSocket::setupRing() { return false; }
+void UringSocket::teardownRing() {}
+bool UringSocket::armRecv() { return false; }
+bool UringSocket::enter(unsigned int) { return false; }
+void UringSocket::reap() {}
+void UringSocket::recycle(uint16_t) {}
+bool UringSocket::writePending() { return false; }
+
+HARE_ERROR_E UringSocket::Flush() {
+  if (m_failed || m_closed) return HARE_ERROR_E::SERVER_CONNECTION_FAILURE;
+  return HARE_ERROR_E::ALL_GOOD;
+}
+
+ssize_t UringSocket::Send(const void* buffer, size_t length, int flags) {
+  if (m_failed || m_closed) return AMQP_STATUS_SOCKET_ERROR;
+  return plainSend(m_fd, buffer, length, flags);
+}
+
+ssize_t UringSocket::Recv(void* buffer, size_t length, int) {
+  if (m_failed || m_closed) return AMQP_STATUS_SOCKET_ERROR;
+  return plainRecv(m_fd, buffer, length);
+}
+
+bool UringSocket::UsingRing() const { return false; }
+
+int UringSocket::PollFd() const { return m_fd; }
+
+#endif  // HARE_HAVE_IO_URING
+
+UringSocket::UringSocket(size_t sendBufferBytes)
+    : m_fd(-1),
+      m_sendBufferBytes(sendBufferBytes),
+      m_failed(false),
+      m_closed(false) {}
+
+UringSocket::~UringSocket() { Close(true); }
+
+int UringSocket::Open(const char* host, int port,
+                      const struct timeval* timeout) {
+  Close(true);
+  m_failed = m_closed = false;
+
+  m_fd = connectTcp(host, port, timeout);
+  if (m_fd < 0) return AMQP_STATUS_SOCKET_ERROR;
+
+  if (Supported() && false == setupRing()) {
+    LOG(LOG_WARN, "Unable to set up io_uring, using plain socket calls");
+    teardownRing();
+  }
+  return AMQP_STATUS_OK;
+}
+
+int UringSocket::Close(bool force) {
+  if (m_closed || m_fd < 0) {
+    m_closed = true;
+    return AMQP_STATUS_OK;
+  }
+  // A polite close sends what is still buffered first
+  if (false == force) Flush();
+  teardownRing();
+  close(m_fd);
+  m_fd = -1;
+  m_closed = true;
+  return AMQP_STATUS_OK;
+}
+
+int UringSocket::Fd() const { return m_fd; }
+
+}  // namespace connection
+}  // namespace HareCpp
@@ -0,0 +1,113 @@
+#include "gtest/gtest.h"
+#include "Codec.hpp"
+#include "Consumer.hpp"
+#include "Message.hpp"
+#include "Producer.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace {
+enum class codecSide : uint8_t { BUY = 1, SELL = 2 };
+
+struct codecTick {
+  uint64_t m_time;
+  double m_price;
+  int32_t m_venue;
+  codecSide m_side;
+  bool m_open;
+  char m_symbol[4];
+  uint16_t m_levels[2];
+};
+
+struct codecOther {
+  uint32_t m_value;
+};
+}  // namespace
+
+HARE_SCHEMA(codecTick, "application/x-harecpp-test-tick",
+            HARE_FIELD(codecTick, m_time), HARE_FIELD(codecTick, m_price),
+            HARE_FIELD(codecTick, m_venue), HARE_FIELD(codecTick, m_side),
+            HARE_FIELD(codecTick, m_open), HARE_FIELD(codecTick, m_symbol),
+            HARE_FIELD(codecTick, m_levels))
+
+HARE_SCHEMA(codecOther, "application/x-harecpp-test-other",
+            HARE_FIELD(codecOther, m_value))
+
+static_assert(HareCpp::Schema<codecTick>::Size() == 8 + 8 + 4 + 1 + 1 + 4 + 4,
+              "fields are packed");
+static_assert(false == HareCpp::Schema<std::string>::DESCRIBED,
+              "types without a schema aren't described");
+
+TEST(CodecTest, roundTrip) {
+  codecTick tick{1234567890123ull, 101.25, -7, codecSide::SELL, true,
+                 {'A', 'B', 'C', 'D'}, {3, 65535}};
+  HareCpp::Message message;
+  ASSERT_TRUE(HareCpp::hare_encode(tick, message));
+  ASSERT_EQ(HareCpp::Schema<codecTick>::Size(), message.Length());
+  ASSERT_TRUE(message.ContentTypeIs("application/x-harecpp-test-tick"));
+  ASSERT_EQ("application/x-harecpp-test-tick", message.ContentType());
+
+  codecTick decoded;
+  memset(&decoded, 0, sizeof(decoded));
+  ASSERT_TRUE(HareCpp::hare_decode(message, decoded));
+  ASSERT_EQ(tick.m_time, decoded.m_time);
+  ASSERT_EQ(tick.m_price, decoded.m_price);
+  ASSERT_EQ(tick.m_venue, decoded.m_venue);
+  ASSERT_TRUE(codecSide::SELL == decoded.m_side);
+  ASSERT_TRUE(decoded.m_open);
+  ASSERT_EQ(0, memcmp(tick.m_symbol, decoded.m_symbol, 4));
+  ASSERT_EQ(3, decoded.m_levels[0]);
+  ASSERT_EQ(65535, decoded.m_levels[1]);
+}
+
+TEST(CodecTest, littleEndianLayout) {
+  codecOther other{0x01020304};
+  HareCpp::Message message;
+  ASSERT_TRUE(HareCpp::hare_encode(other, message));
+  ASSERT_EQ(std::string("\x04\x03\x02\x01", 4), message.String());
+
+  // A copy of the Message decodes the same, so does one from another host
+  HareCpp::Message received(std::string("\x78\x56\x34\x12", 4));
+  ASSERT_TRUE(HareCpp::hare_decode(received, other));
+  ASSERT_EQ(0x12345678u, other.m_value);
+}
+
+TEST(CodecTest, encodeReusesMessage) {
+  HareCpp::Message message(std::string(MESSAGE_INLINE_BYTES * 4, 'x'));
+  message.SetCorrelationId(std::string("kept"));
+  codecOther other{42};
+  ASSERT_TRUE(HareCpp::hare_encode(other, message));
+  ASSERT_EQ(4u, message.Length());
+  ASSERT_TRUE(message.HasCorrelationId());
+
+  // Content type already right is left alone
+  ASSERT_TRUE(HareCpp::hare_encode(other, message));
+  ASSERT_TRUE(message.ContentTypeIs("application/x-harecpp-test-other"));
+}
+
+TEST(CodecTest, mismatchRejected) {
+  codecOther other{7};
+  HareCpp::Message wrongLength(std::string("\x01\x02\x03", 3));
+  ASSERT_FALSE(HareCpp::hare_decode(wrongLength, other));
+  ASSERT_EQ(7u, other.m_value);
+
+  HareCpp::Message wrongType(std::string("\x01\x02\x03\x04", 4));
+  wrongType.SetContentType("application/json");
+  ASSERT_FALSE(HareCpp::hare_decode(wrongType, other));
+  ASSERT_EQ(7u, other.m_value);
+
+  // A tick is never taken for another type, even one of the same length
+  codecTick tick{};
+  HareCpp::Message message;
+  ASSERT_TRUE(HareCpp::hare_encode(tick, message));
+  ASSERT_FALSE(HareCpp::hare_decode(message, other));
+}
+
+TEST(CodecTest, typedSubscribeNeedsInitialize) {
+  HareCpp::Consumer consumer;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::NOT_INITIALIZED,
+            consumer.Subscribe<codecOther>(
+                "amq.direct", "codec",
+                [](const codecOther&, const HareCpp::Message&) {}));
+}
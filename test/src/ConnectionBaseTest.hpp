@@ -0,0 +1,193 @@
+#include "ConnectionBase.hpp"
+#include "Constants.hpp"
+
+#include <chrono>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+TEST(ConnectionBaseTest, callsFailWithoutConnection) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::SERVER_CONNECTION_FAILURE,
+            connection.DeclareExchange(1, "noConnection", "direct"));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::SERVER_CONNECTION_FAILURE,
+            connection.Execute(1, [](amqp_connection_state_t) {
+              return HareCpp::HARE_ERROR_E::ALL_GOOD;
+            }));
+  amqp_envelope_t envelope;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::SERVER_CONNECTION_FAILURE,
+            connection.ConsumeMessage(envelope));
+}
+
+TEST(ConnectionBaseTest, unreachableBroker) {
+  HareCpp::connection::ConnectionBase connection("localhost", 1, USERNAME,
+                                                 PASSWORD);
+  ASSERT_NE(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+  ASSERT_FALSE(connection.IsConnected());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.CloseConnection());
+}
+
+TEST(ConnectionBaseTest, consumeDoesntBlockOtherChannels) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  connection.SetTimeout(3);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+
+  auto consumerId = connection.RegisterClient();
+  auto consumeChannel = connection.AllocateChannel(consumerId);
+  amqp_bytes_t queueName;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.OpenChannel(consumeChannel));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.DeclareQueue(consumeChannel,
+                                    HareCpp::helper::queueProperties(),
+                                    queueName));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.StartConsumption(consumeChannel, queueName));
+
+  // Nothing will ever arrive, so this sits out the whole timeout
+  std::thread consumer([&connection, consumerId]() {
+    amqp_envelope_t envelope;
+    connection.ConsumeMessage(envelope, consumerId);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto producerId = connection.RegisterClient();
+  auto channel = connection.AllocateChannel(producerId);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.OpenChannel(channel));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.DeclareExchange(channel, "notBlocked", "direct"));
+  std::chrono::duration<double> elapsedTime =
+      std::chrono::steady_clock::now() - start;
+  ASSERT_GT(1.0, elapsedTime.count());
+
+  consumer.join();
+  amqp_bytes_free(queueName);
+}
+
+TEST(ConnectionBaseTest, tuningValidated) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::connectionTuning tuning;
+  tuning.m_frameMax = 100;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            connection.SetTuning(tuning));
+  tuning = HareCpp::helper::connectionTuning();
+  tuning.m_heartbeatSeconds = -1;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            connection.SetTuning(tuning));
+  ASSERT_EQ(DEFAULT_FRAME_MAX, connection.Tuning().m_frameMax);
+}
+
+TEST(ConnectionBaseTest, tuningLimitsChannels) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::connectionTuning tuning;
+  tuning.m_channelMax = 2;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.SetTuning(tuning));
+  auto clientId = connection.RegisterClient();
+  ASSERT_EQ(1, connection.AllocateChannel(clientId));
+  ASSERT_EQ(2, connection.AllocateChannel(clientId));
+  ASSERT_EQ(-1, connection.AllocateChannel(clientId));
+}
+
+TEST(ConnectionBaseTest, suggestedFrameMaxWithoutPublishes) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::connectionTuning tuning;
+  tuning.m_frameMax = 8192;
+  tuning.m_autoFrameMax = true;
+  connection.SetTuning(tuning);
+  ASSERT_EQ(8192, connection.SuggestedFrameMax());
+}
+
+TEST(ConnectionBaseTest, negotiatedTuning) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::connectionTuning tuning;
+  tuning.m_frameMax = 8192;
+  tuning.m_heartbeatSeconds = 5;
+  connection.SetTuning(tuning);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+  ASSERT_EQ(8192, connection.FrameMax());
+  ASSERT_EQ(5, connection.Heartbeat());
+}
+
+TEST(ConnectionBaseTest, socketOptionsValidated) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::socketOptions options;
+  options.m_sendBufferBytes = -1;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            connection.SetSocketOptions(options));
+  options = HareCpp::helper::socketOptions();
+  options.m_flush = HareCpp::helper::tcpFlushStrategy::CORK_BATCHES;
+  options.m_keepAlive = true;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.SetSocketOptions(options));
+  ASSERT_EQ(HareCpp::helper::tcpFlushStrategy::CORK_BATCHES,
+            connection.SocketOptions().m_flush);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            connection.SetIoThreadAffinity({CPU_SETSIZE}));
+}
+
+TEST(ConnectionBaseTest, corkedRoundsStillDeliver) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::socketOptions options;
+  options.m_flush = HareCpp::helper::tcpFlushStrategy::CORK_BATCHES;
+  connection.SetSocketOptions(options);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+
+  // A declare is a round trip, it only completes if the corked round was sent
+  auto clientId = connection.RegisterClient();
+  auto channel = connection.AllocateChannel(clientId);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.OpenChannel(channel));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.DeclareExchange(channel, "harecppCorkTest", "direct"));
+}
+
+TEST(ConnectionBaseTest, ioUringTransport) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  HareCpp::helper::socketOptions options;
+  options.m_transport = HareCpp::helper::socketTransport::IO_URING;
+  connection.SetSocketOptions(options);
+  // Falls back to TCP on kernels without io_uring, either way it has to work
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+
+  auto clientId = connection.RegisterClient();
+  auto channel = connection.AllocateChannel(clientId);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.OpenChannel(channel));
+  amqp_bytes_t queueName = amqp_empty_bytes;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.DeclareQueue(channel, HareCpp::helper::queueProperties(),
+                                    queueName));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.BindQueue(channel, queueName, "amq.direct",
+                                 "harecppUringTest"));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.StartConsumption(channel, queueName));
+
+  const char body[] = "through io_uring";
+  HareCpp::helper::RawMessage message;
+  message.channel = channel;
+  message.exchange = amqp_cstring_bytes("amq.direct");
+  message.routing_key = amqp_cstring_bytes("harecppUringTest");
+  message.properties._flags = 0;
+  message.message.bytes = const_cast<char*>(body);
+  message.message.len = sizeof(body) - 1;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.PublishMessage(message));
+
+  amqp_envelope_t envelope;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.ConsumeMessage(envelope, clientId));
+  ASSERT_EQ(std::string(body),
+            std::string(static_cast<char*>(envelope.message.body.bytes),
+                        envelope.message.body.len));
+  amqp_destroy_envelope(&envelope);
+  amqp_bytes_free(queueName);
+}
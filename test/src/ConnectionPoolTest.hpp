@@ -0,0 +1,141 @@
+#include "ConnectionPool.hpp"
+#include "ProducerConsumerTester.hpp"
+#include "Constants.hpp"
+
+#include "gtest/gtest.h"
+
+TEST(ConnectionPoolTest, sameBrokerSharesConnection) {
+  auto& pool = HareCpp::connection::ConnectionPool::Instance();
+  auto first = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  auto second = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  ASSERT_EQ(first.get(), second.get());
+}
+
+TEST(ConnectionPoolTest, differentCredentialsDontShare) {
+  auto& pool = HareCpp::connection::ConnectionPool::Instance();
+  auto first = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  auto second = pool.Acquire(SERVER, PORT, "someoneElse", PASSWORD);
+  ASSERT_NE(first.get(), second.get());
+}
+
+TEST(ConnectionPoolTest, fullConnectionOpensAnother) {
+  auto& pool = HareCpp::connection::ConnectionPool::Instance();
+  pool.SetChannelsPerConnection(2);
+  auto first = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  auto clientId = first->RegisterClient();
+  ASSERT_LT(0, first->AllocateChannel(clientId));
+  ASSERT_LT(0, first->AllocateChannel(clientId));
+  auto second = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  ASSERT_NE(first.get(), second.get());
+  pool.SetChannelsPerConnection(
+      HareCpp::connection::ConnectionPool::DEFAULT_CHANNELS_PER_CONNECTION);
+}
+
+TEST(ConnectionPoolTest, clientsCountedBeforeAllocating) {
+  auto& pool = HareCpp::connection::ConnectionPool::Instance();
+  pool.SetChannelsPerConnection(2);
+  // As Producers/Consumers initialized back to back, no channels yet
+  auto first = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  first->RegisterClient();
+  auto second = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  second->RegisterClient();
+  auto third = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  ASSERT_EQ(first.get(), second.get());
+  ASSERT_NE(first.get(), third.get());
+  ASSERT_EQ(2, first->Load());
+  ASSERT_EQ(0, third->Load());
+  pool.SetChannelsPerConnection(
+      HareCpp::connection::ConnectionPool::DEFAULT_CHANNELS_PER_CONNECTION);
+}
+
+TEST(ConnectionPoolTest, unregisterGivesPlaceBack) {
+  auto& pool = HareCpp::connection::ConnectionPool::Instance();
+  pool.SetChannelsPerConnection(2);
+  auto first = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  auto clientId = first->RegisterClient();
+  auto second = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  ASSERT_EQ(first.get(), second.get());
+  auto secondId = second->RegisterClient();
+  ASSERT_EQ(2, first->Load());
+  first->UnregisterClient(clientId);
+  ASSERT_EQ(1, first->Load());
+  auto third = pool.Acquire(SERVER, PORT, USERNAME, PASSWORD);
+  ASSERT_EQ(first.get(), third.get());
+  second->UnregisterClient(secondId);
+  pool.SetChannelsPerConnection(
+      HareCpp::connection::ConnectionPool::DEFAULT_CHANNELS_PER_CONNECTION);
+}
+
+TEST(ConnectionPoolTest, releasedConnectionIsDropped) {
+  auto& pool = HareCpp::connection::ConnectionPool::Instance();
+  {
+    auto connection = pool.Acquire("poolTestHost", PORT, USERNAME, PASSWORD);
+    ASSERT_LT(0, pool.ConnectionCount());
+  }
+  auto before = pool.ConnectionCount();
+  auto connection = pool.Acquire("poolTestHost", PORT, USERNAME, PASSWORD);
+  ASSERT_EQ(before + 1, pool.ConnectionCount());
+}
+
+TEST(ConnectionPoolTest, channelsUniqueAcrossClients) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  auto producerId = connection.RegisterClient();
+  auto consumerId = connection.RegisterClient();
+  ASSERT_NE(producerId, consumerId);
+  auto first = connection.AllocateChannel(producerId);
+  auto second = connection.AllocateChannel(consumerId);
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(2, second);
+  ASSERT_EQ(2, connection.ChannelCount());
+}
+
+TEST(ConnectionPoolTest, releasedChannelIsReused) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  auto clientId = connection.RegisterClient();
+  auto first = connection.AllocateChannel(clientId);
+  connection.AllocateChannel(connection.RegisterClient());
+  connection.UnregisterClient(clientId);
+  ASSERT_EQ(first, connection.AllocateChannel(connection.RegisterClient()));
+}
+
+TEST(ConnectionPoolTest, unregisterReleasesChannels) {
+  HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                 PASSWORD);
+  auto clientId = connection.RegisterClient();
+  connection.AllocateChannel(clientId);
+  connection.AllocateChannel(clientId);
+  connection.UnregisterClient(clientId);
+  ASSERT_EQ(0, connection.ChannelCount());
+}
+
+class SharedConnectionTester : public ProducerConsumerTester {
+  public:
+    void SetUp() {
+      auto& pool = HareCpp::connection::ConnectionPool::Instance();
+      consumer.Initialize(pool.Acquire(SERVER, PORT, USERNAME, PASSWORD));
+      producer.Initialize(pool.Acquire(SERVER, PORT, USERNAME, PASSWORD));
+    }
+};
+
+TEST_F(SharedConnectionTester, producerConsumerShareConnection) {
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, consumer.Subscribe("sharedExchange", "test",
+                                 std::bind(&ProducerConsumerTester::defaultCallback,
+                                           this, std::placeholders::_1)));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, producer.DeclareExchange("sharedExchange"));
+
+  producer.Start();
+  consumer.Start();
+
+  auto start = std::chrono::system_clock::now();
+  while (GetDesiredMessageCount() < 5) {
+    auto newMessage = HareCpp::Message("hello world");
+    producer.Send("sharedExchange", "test", newMessage);
+
+    std::chrono::duration<double> elapsedTime =
+        std::chrono::system_clock::now() - start;
+    if (elapsedTime.count() > 10) break;
+  }
+  ASSERT_LE(5, GetDesiredMessageCount());
+}
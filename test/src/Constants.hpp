@@ -1,7 +1,8 @@
 #ifndef _CONSTANTS_HPP_
 #define _CONSTANTS_HPP_
-const std::string SERVER = "rabbit-serv";
+// main() points SERVER and PORT at the stand-in broker when run with --standin
+std::string SERVER = "rabbit-serv";
 const std::string USERNAME = "guest";
 const std::string PASSWORD = "guest";
-const int PORT = 5672;
+int PORT = 5672;
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "ConnectionBase.hpp"
+#include "EventLog.hpp"
+
+#include <unistd.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::string eventLogPath() {
+  return "/tmp/harecpp_eventlog_test_" + std::to_string(getpid());
+}
+
+// Decoded lines, the header line left out
+std::vector<std::string> decodedEvents(const std::string& path) {
+  std::stringstream text;
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            HareCpp::EventLog::Decode(path, text));
+  std::vector<std::string> lines;
+  std::string line;
+  while (std::getline(text, line)) {
+    if (line.empty() || line[0] != '#') lines.push_back(line);
+  }
+  return lines;
+}
+
+bool endsWith(const std::string& text, const std::string& end) {
+  return text.size() >= end.size() &&
+         0 == text.compare(text.size() - end.size(), end.size(), end);
+}
+
+}  // namespace
+
+TEST(EventLogTest, roundTrip) {
+  auto& eventLog = HareCpp::EventLog::Instance();
+  const auto path = eventLogPath();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, eventLog.Open(path, 64));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::THREAD_ALREADY_RUNNING,
+            eventLog.Open(path, 64));
+
+  eventLog.Record(HareCpp::EVENT_E::CONNECTED, 3, 0, 2);
+  eventLog.Record(HareCpp::EVENT_E::CHANNEL_OPENED, 3, 5, 0);
+  eventLog.Record(
+      HareCpp::EVENT_E::RPC_REPLY, 3, 5,
+      static_cast<int64_t>(HareCpp::HARE_ERROR_E::UNABLE_TO_OPEN_CHANNEL));
+  eventLog.Record(HareCpp::EVENT_E::DELIVERED, 3, 5, 128);
+  eventLog.Close();
+  // Closed, not recorded
+  eventLog.Record(HareCpp::EVENT_E::DISCONNECTED, 3, 0, 0);
+
+  auto events = decodedEvents(path);
+  ASSERT_EQ(4u, events.size());
+  EXPECT_TRUE(endsWith(events[0], "Z conn 3 ch 0 CONNECTED generation 2"))
+      << events[0];
+  EXPECT_TRUE(endsWith(events[1], " conn 3 ch 5 CHANNEL_OPENED"))
+      << events[1];
+  EXPECT_TRUE(endsWith(events[2], " RPC_REPLY UNABLE_TO_OPEN_CHANNEL"))
+      << events[2];
+  EXPECT_TRUE(endsWith(events[3], " DELIVERED 128 bytes")) << events[3];
+  // Wall clock times, in order
+  EXPECT_EQ('2', events[0][0]);
+  EXPECT_LE(events[0].substr(0, 30), events[3].substr(0, 30));
+  unlink(path.c_str());
+}
+
+TEST(EventLogTest, oldestOverwritten) {
+  auto& eventLog = HareCpp::EventLog::Instance();
+  const auto path = eventLogPath();
+  // Rounded up to 8
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, eventLog.Open(path, 5));
+  for (int i = 0; i < 20; i++) {
+    eventLog.Record(HareCpp::EVENT_E::PUBLISHED, 1, 0, i);
+  }
+  eventLog.Close();
+
+  std::stringstream text;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            HareCpp::EventLog::Decode(path, text));
+  EXPECT_NE(std::string::npos,
+            text.str().find("20 events recorded, last 8 kept"));
+  auto events = decodedEvents(path);
+  ASSERT_EQ(8u, events.size());
+  EXPECT_TRUE(endsWith(events.front(), "PUBLISHED 12 messages"));
+  EXPECT_TRUE(endsWith(events.back(), "PUBLISHED 19 messages"));
+  unlink(path.c_str());
+}
+
+TEST(EventLogTest, concurrentWriters) {
+  auto& eventLog = HareCpp::EventLog::Instance();
+  const auto path = eventLogPath();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, eventLog.Open(path, 4096));
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t <= 4; t++) {
+    threads.emplace_back([&eventLog, t]() {
+      for (int i = 0; i < 1000; i++) {
+        eventLog.Record(HareCpp::EVENT_E::CALLBACK, t, 1, i);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  eventLog.Close();
+  EXPECT_EQ(4000u, decodedEvents(path).size());
+  unlink(path.c_str());
+}
+
+TEST(EventLogTest, connectionEvents) {
+  auto& eventLog = HareCpp::EventLog::Instance();
+  const auto path = eventLogPath();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, eventLog.Open(path, 64));
+  std::string expected;
+  {
+    HareCpp::connection::ConnectionBase connection("localhost", 1, USERNAME,
+                                                   PASSWORD);
+    ASSERT_NE(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+    expected = "conn " + std::to_string(connection.EventLogId()) +
+               " ch 0 CONNECT_FAILED";
+  }
+  eventLog.Close();
+
+  bool found = false;
+  for (const auto& event : decodedEvents(path)) {
+    found |= (event.find(expected) != std::string::npos);
+  }
+  EXPECT_TRUE(found);
+  unlink(path.c_str());
+}
+
+TEST(EventLogTest, notAnEventLog) {
+  std::stringstream text;
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            HareCpp::EventLog::Decode("/nonexistent/harecpp", text));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            HareCpp::EventLog::Decode("/proc/self/cmdline", text));
+}
@@ -0,0 +1,404 @@
+#ifndef _FAULT_PROXY_HPP_
+#define _FAULT_PROXY_HPP_
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace HareTest {
+
+/**
+ * TCP proxy that sits between a client and the broker and breaks the
+ * connection on demand, to see how Producer and Consumer cope:
+ *
+ *   - Delay() holds every chunk back for a while, each way
+ *   - Drop() closes every connection cleanly (FIN) and turns new ones away
+ *   - Reset() aborts every connection (RST) and new ones as well
+ *   - BlackHole() stops passing anything on while keeping the connections
+ *     open, like a network partition; TCP backs up behind it and nothing is
+ *     lost if it heals in time
+ *   - Heal() goes back to passing everything through
+ *
+ * It listens on a loopback port and serves all connections from one thread.
+ *
+ *   HareTest::FaultProxy proxy("127.0.0.1", broker.Port());
+ *   producer.Initialize("127.0.0.1", proxy.Port(), "guest", "guest");
+ *   ...
+ *   proxy.Reset();
+ */
+class FaultProxy {
+ public:
+  enum class FAULT_E { NONE, DROP, RESET, BLACK_HOLE };
+
+  /**
+   * Start serving
+   * @param [in] host : where the broker is
+   * @param [in] port : its port
+   * @param [in] listenPort : loopback port to listen on, 0 picks a free one
+   */
+  FaultProxy(const std::string& host, int port, int listenPort = 0)
+      : m_host(host),
+        m_upstreamPort(port),
+        m_port(0),
+        m_listenFd(-1),
+        m_running(true),
+        m_fault(FAULT_E::NONE),
+        m_delayNanos(0),
+        m_accepted(0),
+        m_forwarded(0) {
+    m_listenFd = listenTcp(listenPort, m_port);
+    if (m_listenFd < 0) {
+      m_port = 0;
+      return;
+    }
+    m_thread = std::thread(&FaultProxy::serve, this);
+  }
+
+  ~FaultProxy() {
+    m_running = false;
+    if (m_thread.joinable()) m_thread.join();
+    for (auto& link : m_links) closeLink(*link, false);
+    if (m_listenFd >= 0) close(m_listenFd);
+  }
+
+  FaultProxy(const FaultProxy&) = delete;
+  FaultProxy& operator=(const FaultProxy&) = delete;
+
+  /**
+   * Loopback port being served, 0 if the proxy couldn't start
+   */
+  int Port() const { return m_port; }
+
+  /**
+   * Hold everything forwarded, either way, back by delay
+   */
+  void Delay(std::chrono::microseconds delay) {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_delayNanos = static_cast<uint64_t>(delay.count()) * 1000;
+  }
+
+  void Drop() { fault(FAULT_E::DROP); }
+  void Reset() { fault(FAULT_E::RESET); }
+  void BlackHole() { fault(FAULT_E::BLACK_HOLE); }
+
+  /**
+   * Pass everything through again, without delay
+   */
+  void Heal() {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_fault = FAULT_E::NONE;
+    m_delayNanos = 0;
+  }
+
+  /**
+   * Connections accepted so far, including those turned away
+   */
+  uint64_t Accepted() const { return m_accepted; }
+
+  /**
+   * Connections currently open through the proxy
+   */
+  size_t Open() {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_links.size();
+  }
+
+  /**
+   * Bytes passed on so far, both ways
+   */
+  uint64_t Forwarded() const { return m_forwarded; }
+
+ private:
+  static constexpr int POLL_INTERVAL_MS = 10;
+  // Don't read more from one side while this much is waiting for the other
+  static constexpr size_t MAX_PENDING_BYTES = 1 << 20;
+
+  struct delayedChunk {
+    uint64_t m_due;
+    std::string m_bytes;
+  };
+
+  // One direction of a link
+  struct pipe {
+    std::string m_pending;  // ready to write
+    std::deque<delayedChunk> m_delayed;
+  };
+
+  struct link {
+    int m_clientFd;
+    int m_brokerFd;
+    pipe m_toBroker;
+    pipe m_toClient;
+    bool m_closed;
+  };
+
+  static uint64_t nowNanos() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+  }
+
+  static int listenTcp(int port, int& boundPort) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    socklen_t length = sizeof(address);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        listen(fd, SOMAXCONN) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) !=
+            0) {
+      close(fd);
+      return -1;
+    }
+    boundPort = ntohs(address.sin_port);
+    return fd;
+  }
+
+  int connectUpstream() const {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* found = nullptr;
+    const std::string port = std::to_string(m_upstreamPort);
+    if (getaddrinfo(m_host.c_str(), port.c_str(), &hints, &found) != 0) {
+      return -1;
+    }
+    int fd = -1;
+    for (auto* candidate = found; candidate != nullptr && fd < 0;
+         candidate = candidate->ai_next) {
+      fd = socket(candidate->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (fd >= 0 &&
+          connect(fd, candidate->ai_addr, candidate->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(found);
+    if (fd >= 0) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+  }
+
+  // Close with RST instead of FIN
+  static void abortive(int fd) {
+    struct linger linger;
+    linger.l_onoff = 1;
+    linger.l_linger = 0;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(fd);
+  }
+
+  void closeLink(link& connection, bool reset) {
+    if (connection.m_closed) return;
+    connection.m_closed = true;
+    if (reset) {
+      abortive(connection.m_clientFd);
+      abortive(connection.m_brokerFd);
+    } else {
+      close(connection.m_clientFd);
+      close(connection.m_brokerFd);
+    }
+  }
+
+  void fault(FAULT_E type) {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    m_fault = type;
+    if (type == FAULT_E::DROP || type == FAULT_E::RESET) {
+      for (auto& connection : m_links) {
+        closeLink(*connection, type == FAULT_E::RESET);
+      }
+      reap();
+    }
+  }
+
+  void acceptClients() {
+    while (true) {
+      int fd = accept4(m_listenFd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+      m_accepted++;
+      if (m_fault == FAULT_E::DROP) {
+        close(fd);
+        continue;
+      }
+      if (m_fault == FAULT_E::RESET) {
+        abortive(fd);
+        continue;
+      }
+      const int brokerFd = connectUpstream();
+      if (brokerFd < 0) {
+        close(fd);
+        continue;
+      }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      m_links.emplace_back(new link());
+      m_links.back()->m_clientFd = fd;
+      m_links.back()->m_brokerFd = brokerFd;
+      m_links.back()->m_closed = false;
+    }
+  }
+
+  // Read what is there on from, false once it is closed
+  bool readInto(int from, pipe& to) {
+    char buffer[65536];
+    while (to.m_pending.size() < MAX_PENDING_BYTES) {
+      auto count = recv(from, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (count > 0) {
+        if (m_delayNanos != 0) {
+          to.m_delayed.push_back(
+              {nowNanos() + m_delayNanos, std::string(buffer, count)});
+        } else {
+          to.m_pending.append(buffer, count);
+        }
+        continue;
+      }
+      if (count < 0 && errno == EINTR) continue;
+      return count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+  }
+
+  // Write what is due to fd, false once it can't be written to
+  bool writeOut(int fd, pipe& from) {
+    const uint64_t now = nowNanos();
+    while (false == from.m_delayed.empty() &&
+           from.m_delayed.front().m_due <= now) {
+      from.m_pending += from.m_delayed.front().m_bytes;
+      from.m_delayed.pop_front();
+    }
+    while (false == from.m_pending.empty()) {
+      auto count = send(fd, from.m_pending.data(), from.m_pending.size(),
+                        MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (count > 0) {
+        m_forwarded += count;
+        from.m_pending.erase(0, count);
+        continue;
+      }
+      if (count < 0 && errno == EINTR) continue;
+      return count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+  }
+
+  void reap() {
+    m_links.erase(std::remove_if(m_links.begin(), m_links.end(),
+                                 [](const std::unique_ptr<link>& connection) {
+                                   return connection->m_closed;
+                                 }),
+                  m_links.end());
+  }
+
+  // Until the next delayed chunk is due, at most POLL_INTERVAL_MS
+  int pollTimeout() const {
+    uint64_t due = UINT64_MAX;
+    for (const auto& connection : m_links) {
+      for (const pipe* direction :
+           {&connection->m_toBroker, &connection->m_toClient}) {
+        if (false == direction->m_delayed.empty()) {
+          due = std::min(due, direction->m_delayed.front().m_due);
+        }
+      }
+    }
+    if (due == UINT64_MAX) return POLL_INTERVAL_MS;
+    const uint64_t now = nowNanos();
+    if (due <= now) return 0;
+    return static_cast<int>(
+        std::min<uint64_t>((due - now) / 1000000 + 1, POLL_INTERVAL_MS));
+  }
+
+  void serve() {
+    std::vector<struct pollfd> fds;
+    while (m_running) {
+      int timeout;
+      {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        const bool passing = (m_fault != FAULT_E::BLACK_HOLE);
+        fds.clear();
+        fds.push_back({m_listenFd, POLLIN, 0});
+        for (auto& connection : m_links) {
+          short toClient = 0, toBroker = 0;
+          if (passing) {
+            if (connection->m_toBroker.m_pending.size() < MAX_PENDING_BYTES)
+              toClient |= POLLIN;
+            if (connection->m_toClient.m_pending.size() < MAX_PENDING_BYTES)
+              toBroker |= POLLIN;
+            if (false == connection->m_toClient.m_pending.empty())
+              toClient |= POLLOUT;
+            if (false == connection->m_toBroker.m_pending.empty())
+              toBroker |= POLLOUT;
+          }
+          fds.push_back({connection->m_clientFd, toClient, 0});
+          fds.push_back({connection->m_brokerFd, toBroker, 0});
+        }
+        timeout = pollTimeout();
+      }
+
+      poll(fds.data(), fds.size(), timeout);
+
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      if (fds[0].revents & POLLIN) acceptClients();
+      // A black hole passes nothing on, and doesn't notice a close either
+      if (m_fault == FAULT_E::BLACK_HOLE) continue;
+      for (auto& connection : m_links) {
+        if (connection->m_closed) continue;
+        const bool open =
+            readInto(connection->m_clientFd, connection->m_toBroker) &&
+            readInto(connection->m_brokerFd, connection->m_toClient) &&
+            writeOut(connection->m_brokerFd, connection->m_toBroker) &&
+            writeOut(connection->m_clientFd, connection->m_toClient);
+        if (false == open) closeLink(*connection, false);
+      }
+      reap();
+    }
+  }
+
+  const std::string m_host;
+  const int m_upstreamPort;
+  int m_port;
+  int m_listenFd;
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+
+  // Guards everything below
+  std::mutex m_mutex;
+  FAULT_E m_fault;
+  uint64_t m_delayNanos;
+  std::vector<std::unique_ptr<link>> m_links;
+  std::atomic<uint64_t> m_accepted;
+  std::atomic<uint64_t> m_forwarded;
+};
+
+}  // namespace HareTest
+
+#endif
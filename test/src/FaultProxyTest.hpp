@@ -0,0 +1,214 @@
+#include "FaultProxy.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+/**
+ * Sends back whatever it is sent, on a loopback port
+ */
+class echoServer {
+ public:
+  echoServer() : m_port(0), m_running(true) {
+    m_listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), length) !=
+            0 ||
+        listen(m_listenFd, 16) != 0 ||
+        getsockname(m_listenFd, reinterpret_cast<sockaddr*>(&address),
+                    &length) != 0) {
+      return;
+    }
+    m_port = ntohs(address.sin_port);
+    m_thread = std::thread(&echoServer::serve, this);
+  }
+
+  ~echoServer() {
+    m_running = false;
+    if (m_thread.joinable()) m_thread.join();
+    for (int fd : m_clients) close(fd);
+    close(m_listenFd);
+  }
+
+  int Port() const { return m_port; }
+
+ private:
+  void serve() {
+    while (m_running) {
+      std::vector<struct pollfd> fds{{m_listenFd, POLLIN, 0}};
+      for (int fd : m_clients) fds.push_back({fd, POLLIN, 0});
+      poll(fds.data(), fds.size(), 10);
+      int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+      if (fd >= 0) m_clients.push_back(fd);
+      for (size_t i = 1; i < fds.size(); i++) {
+        if (0 == fds[i].revents) continue;
+        char buffer[4096];
+        auto count = recv(fds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (count > 0) {
+          send(fds[i].fd, buffer, count, MSG_NOSIGNAL);
+        } else if (count == 0 || errno != EAGAIN) {
+          close(fds[i].fd);
+          m_clients.erase(
+              std::find(m_clients.begin(), m_clients.end(), fds[i].fd));
+        }
+      }
+    }
+  }
+
+  int m_listenFd;
+  int m_port;
+  std::atomic<bool> m_running;
+  std::vector<int> m_clients;
+  std::thread m_thread;
+};
+
+// Blocking client socket, reads give up after a second
+int connectTo(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  return fd;
+}
+
+// What came back for text, or the recv() result if it wasn't all of it
+std::string roundTrip(int fd, const std::string& text) {
+  send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+  std::string received;
+  while (received.size() < text.size()) {
+    char buffer[256];
+    auto count = recv(fd, buffer, sizeof(buffer), 0);
+    if (count <= 0) {
+      return count == 0 ? "closed" : std::string("error ") + strerror(errno);
+    }
+    received.append(buffer, count);
+  }
+  return received;
+}
+
+}  // namespace
+
+TEST(FaultProxyTest, passesThrough) {
+  echoServer echo;
+  HareTest::FaultProxy proxy("127.0.0.1", echo.Port());
+  ASSERT_NE(0, proxy.Port());
+  int fd = connectTo(proxy.Port());
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ("hello", roundTrip(fd, "hello"));
+  const std::string big(200000, 'x');
+  EXPECT_EQ(big, roundTrip(fd, big));
+  EXPECT_EQ(1u, proxy.Open());
+  EXPECT_EQ(2 * (5 + big.size()), proxy.Forwarded());
+  close(fd);
+}
+
+TEST(FaultProxyTest, delay) {
+  echoServer echo;
+  HareTest::FaultProxy proxy("127.0.0.1", echo.Port());
+  int fd = connectTo(proxy.Port());
+  ASSERT_GE(fd, 0);
+  proxy.Delay(std::chrono::milliseconds(50));
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ("slow", roundTrip(fd, "slow"));
+  // Held back on the way there and on the way back
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(100));
+
+  proxy.Heal();
+  start = std::chrono::steady_clock::now();
+  EXPECT_EQ("fast", roundTrip(fd, "fast"));
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(50));
+  close(fd);
+}
+
+TEST(FaultProxyTest, drop) {
+  echoServer echo;
+  HareTest::FaultProxy proxy("127.0.0.1", echo.Port());
+  int fd = connectTo(proxy.Port());
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ("a", roundTrip(fd, "a"));
+  proxy.Drop();
+  // Without writing first, which would draw a reset
+  char buffer[16];
+  EXPECT_EQ(0, recv(fd, buffer, sizeof(buffer), 0));
+  close(fd);
+
+  // Turned away until healed
+  fd = connectTo(proxy.Port());
+  EXPECT_EQ(0, recv(fd, buffer, sizeof(buffer), 0));
+  close(fd);
+  proxy.Heal();
+  fd = connectTo(proxy.Port());
+  EXPECT_EQ("d", roundTrip(fd, "d"));
+  EXPECT_EQ(3u, proxy.Accepted());
+  close(fd);
+}
+
+TEST(FaultProxyTest, reset) {
+  echoServer echo;
+  HareTest::FaultProxy proxy("127.0.0.1", echo.Port());
+  int fd = connectTo(proxy.Port());
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ("a", roundTrip(fd, "a"));
+  proxy.Reset();
+  char buffer[16];
+  EXPECT_EQ(-1, recv(fd, buffer, sizeof(buffer), 0));
+  EXPECT_EQ(ECONNRESET, errno);
+  close(fd);
+  proxy.Heal();
+  fd = connectTo(proxy.Port());
+  EXPECT_EQ("b", roundTrip(fd, "b"));
+  close(fd);
+}
+
+TEST(FaultProxyTest, blackHole) {
+  echoServer echo;
+  HareTest::FaultProxy proxy("127.0.0.1", echo.Port());
+  int fd = connectTo(proxy.Port());
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ("a", roundTrip(fd, "a"));
+  proxy.BlackHole();
+  send(fd, "held", 4, MSG_NOSIGNAL);
+  struct pollfd readable = {fd, POLLIN, 0};
+  EXPECT_EQ(0, poll(&readable, 1, 200));
+
+  // Nothing was lost, only held up
+  proxy.Heal();
+  char buffer[16];
+  std::string received;
+  while (received.size() < 4) {
+    auto count = recv(fd, buffer, sizeof(buffer), 0);
+    if (count <= 0) break;
+    received.append(buffer, count);
+  }
+  EXPECT_EQ("held", received);
+  close(fd);
+}
@@ -0,0 +1,130 @@
+#include "gtest/gtest.h"
+#include "HeadersTable.hpp"
+#include "HelperStructs.hpp"
+#include "Message.hpp"
+
+namespace HareTest {
+
+inline std::string fieldString(const amqp_field_value_t* value) {
+  amqp_bytes_t bytes;
+  if (nullptr == value || false == HareCpp::hare_field_bytes(*value, bytes)) {
+    return "";
+  }
+  return std::string(static_cast<char*>(bytes.bytes), bytes.len);
+}
+
+}  // namespace HareTest
+
+TEST(HeadersTableTest, builderAddsEveryKind) {
+  const char raw[] = {'a', '\0', 'b'};
+  auto table = HareCpp::HeadersBuilder()
+                   .AddString("string", "value")
+                   .AddBytes("bytes", raw, sizeof(raw))
+                   .AddInt("int", -42)
+                   .AddDouble("double", 1.5)
+                   .AddBool("bool", true)
+                   .AddTimestamp("timestamp", 1600000000)
+                   .Build();
+  ASSERT_EQ(6, table.Size());
+  ASSERT_EQ("value", HareTest::fieldString(table.Find("string")));
+  ASSERT_EQ(std::string(raw, sizeof(raw)),
+            HareTest::fieldString(table.Find("bytes")));
+  int64_t integer = 0;
+  ASSERT_TRUE(HareCpp::hare_field_int(*table.Find("int"), integer));
+  ASSERT_EQ(-42, integer);
+  ASSERT_EQ(1.5, table.Find("double")->value.f64);
+  ASSERT_TRUE(HareCpp::hare_field_int(*table.Find("bool"), integer));
+  ASSERT_EQ(1, integer);
+  ASSERT_TRUE(HareCpp::hare_field_int(*table.Find("timestamp"), integer));
+  ASSERT_EQ(1600000000, integer);
+  ASSERT_EQ(nullptr, table.Find("missing"));
+}
+
+TEST(HeadersTableTest, builderGrowsPastArena) {
+  HareCpp::HeadersBuilder builder;
+  for (int i = 0; i < 200; i++) {
+    builder.AddString("key" + std::to_string(i), std::string(i, 'x'));
+  }
+  auto table = builder.Build();
+  ASSERT_EQ(200, table.Size());
+  ASSERT_EQ(0, builder.Size());
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(std::string(i, 'x'),
+              HareTest::fieldString(table.Find("key" + std::to_string(i))));
+  }
+}
+
+TEST(HeadersTableTest, copiesNestedTables) {
+  amqp_field_value_t items[2];
+  items[0].kind = AMQP_FIELD_KIND_UTF8;
+  items[0].value.bytes = amqp_cstring_bytes("first");
+  items[1].kind = AMQP_FIELD_KIND_I32;
+  items[1].value.i32 = 7;
+  amqp_table_entry_t inner[1];
+  inner[0].key = amqp_cstring_bytes("list");
+  inner[0].value.kind = AMQP_FIELD_KIND_ARRAY;
+  inner[0].value.value.array.num_entries = 2;
+  inner[0].value.value.array.entries = items;
+  amqp_table_entry_t outer[1];
+  outer[0].key = amqp_cstring_bytes("nested");
+  outer[0].value.kind = AMQP_FIELD_KIND_TABLE;
+  outer[0].value.value.table.num_entries = 1;
+  outer[0].value.value.table.entries = inner;
+  amqp_table_t original{1, outer};
+
+  HareCpp::HeadersTable table(original);
+  HareCpp::HeadersTable copy(table);
+  table = HareCpp::HeadersTable();
+  const auto* nested = copy.Find("nested");
+  ASSERT_NE(nullptr, nested);
+  ASSERT_NE(inner, nested->value.table.entries);
+  const auto* list = HareCpp::hare_table_find(nested->value.table, "list", 4);
+  ASSERT_NE(nullptr, list);
+  ASSERT_EQ(2, list->value.array.num_entries);
+  ASSERT_EQ("first", HareTest::fieldString(&list->value.array.entries[0]));
+  ASSERT_EQ(7, list->value.array.entries[1].value.i32);
+}
+
+TEST(HeadersTableTest, messageHeaders) {
+  HareCpp::Message message("Hello World");
+  ASSERT_FALSE(message.HasHeaders());
+  ASSERT_EQ(nullptr, message.Header("region"));
+  message.SetHeaders(
+      HareCpp::HeadersBuilder().AddString("region", "eu").AddInt("n", 2)
+          .Build());
+  ASSERT_TRUE(message.HasHeaders());
+  ASSERT_EQ(2, message.Headers().num_entries);
+
+  // The copy's headers are its own
+  HareCpp::Message copy(message);
+  message.ClearHeaders();
+  ASSERT_FALSE(message.HasHeaders());
+  amqp_bytes_t region;
+  ASSERT_TRUE(copy.HeaderBytes("region", region));
+  ASSERT_EQ("eu", std::string(static_cast<char*>(region.bytes), region.len));
+  int64_t n = 0;
+  ASSERT_TRUE(copy.HeaderInt("n", n));
+  ASSERT_EQ(2, n);
+  ASSERT_FALSE(copy.HeaderInt("region", n));
+
+  HareCpp::Message moved(std::move(copy));
+  ASSERT_TRUE(moved.HeaderInt("n", n));
+}
+
+TEST(HeadersTableTest, receivedHeadersAreNotCopied) {
+  amqp_table_entry_t entries[1];
+  entries[0].key = amqp_cstring_bytes("region");
+  entries[0].value.kind = AMQP_FIELD_KIND_UTF8;
+  entries[0].value.value.bytes = amqp_cstring_bytes("eu");
+  amqp_envelope_t envelope;
+  memset(&envelope, 0, sizeof(envelope));
+  envelope.message.properties._flags = AMQP_BASIC_HEADERS_FLAG;
+  envelope.message.properties.headers.num_entries = 1;
+  envelope.message.properties.headers.entries = entries;
+
+  HareCpp::Message message(envelope);
+  ASSERT_EQ(&entries[0].value, message.Header("region"));
+  HareCpp::Message copy(message);
+  ASSERT_NE(&entries[0].value, copy.Header("region"));
+  ASSERT_EQ("eu", HareTest::fieldString(copy.Header("region")));
+}
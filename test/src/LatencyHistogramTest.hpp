@@ -0,0 +1,152 @@
+#include "ChannelHandler.hpp"
+#include "LatencyHistogram.hpp"
+#include "ProducerConsumerTester.hpp"
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(LatencyHistogramTest, bucketsCoverEveryValue) {
+  // Exact below the sub-bucket count, within 1/16th above it
+  for (uint64_t value : {0ull, 1ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull,
+                         ~0ull}) {
+    const int index = HareCpp::LatencyHistogram::BucketIndex(value);
+    ASSERT_LT(index, HareCpp::LatencyHistogram::LATENCY_BUCKETS);
+    EXPECT_LE(HareCpp::LatencyHistogram::BucketLowest(index), value);
+    EXPECT_GE(HareCpp::LatencyHistogram::BucketHighest(index), value);
+    EXPECT_LE(HareCpp::LatencyHistogram::BucketHighest(index) -
+                  HareCpp::LatencyHistogram::BucketLowest(index),
+              value / 16);
+  }
+
+  // Neighbouring buckets meet without a gap
+  for (int i = 1; i < HareCpp::LatencyHistogram::LATENCY_BUCKETS; i++) {
+    EXPECT_EQ(HareCpp::LatencyHistogram::BucketHighest(i - 1) + 1,
+              HareCpp::LatencyHistogram::BucketLowest(i));
+  }
+}
+
+TEST(LatencyHistogramTest, percentiles) {
+  HareCpp::LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.Snapshot().Percentile(50));
+
+  for (uint64_t i = 1; i <= 1000; i++) histogram.Record(i * 1000);
+
+  auto snapshot = histogram.Snapshot();
+  EXPECT_EQ(1000u, snapshot.m_count);
+  EXPECT_DOUBLE_EQ(500500.0, snapshot.MeanNanos());
+  EXPECT_NEAR(500000.0, snapshot.Percentile(50), 500000.0 / 16);
+  EXPECT_NEAR(990000.0, snapshot.Percentile(99), 990000.0 / 16);
+  EXPECT_NEAR(1000.0, snapshot.MinNanos(), 1000.0 / 16);
+  EXPECT_NEAR(1000000.0, snapshot.MaxNanos(), 1000000.0 / 16);
+  EXPECT_EQ(snapshot.MaxNanos(), snapshot.Percentile(100));
+}
+
+TEST(LatencyHistogramTest, snapshotAndReset) {
+  HareCpp::LatencyHistogram histogram;
+  histogram.Record(10);
+  histogram.Record(20);
+
+  auto first = histogram.SnapshotAndReset();
+  EXPECT_EQ(2u, first.m_count);
+  EXPECT_EQ(30u, first.m_sumNanos);
+  EXPECT_EQ(0u, histogram.Snapshot().m_count);
+
+  histogram.Record(5);
+  histogram.Reset();
+  EXPECT_EQ(0u, histogram.Snapshot().m_count);
+  EXPECT_EQ(0u, histogram.Snapshot().m_sumNanos);
+}
+
+TEST(LatencyHistogramTest, concurrentRecordsAllCounted) {
+  HareCpp::LatencyHistogram histogram;
+  std::vector<std::thread> threads;
+  uint64_t drained = 0;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&histogram, t]() {
+      for (int i = 0; i < 100000; i++) histogram.Record(t * 100 + i % 100);
+    });
+  }
+  // Snapshots taken while recording don't lose anything
+  for (int i = 0; i < 10; i++) drained += histogram.SnapshotAndReset().m_count;
+  for (auto& thread : threads) thread.join();
+  drained += histogram.SnapshotAndReset().m_count;
+  EXPECT_EQ(400000u, drained);
+}
+
+TEST(LatencyHistogramTest, channelHandlerRecordsDispatchAndCallback) {
+  HareCpp::ChannelHandler handler;
+  HareCpp::TD_Callback callback = [](const HareCpp::Message&) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  };
+  HareCpp::HashableBindingPair pair{"amq.direct", "histogram"};
+  handler.AddChannelProcessor(pair, callback);
+  EXPECT_EQ(nullptr, handler.CallbackDurationHistogram({"amq.direct", "x"}));
+
+  HareCpp::Message message(std::string("payload"));
+  handler.Process(pair, message, HareCpp::LatencyHistogram::Now());
+  // Unknown arrival time, only the callback is timed
+  handler.Process(pair, message);
+
+  EXPECT_EQ(1u, handler.DispatchDelayHistogram().Snapshot().m_count);
+  auto duration = handler.CallbackDurationHistogram(pair)->Snapshot();
+  EXPECT_EQ(2u, duration.m_count);
+  EXPECT_GE(duration.MinNanos(), 2000000u * 15 / 16);
+}
+
+TEST(LatencyHistogramTest, sendTimeHeaderLookup) {
+  amqp_table_entry_t entries[2];
+  entries[0].key = amqp_cstring_bytes("x-other");
+  entries[0].value.kind = AMQP_FIELD_KIND_I64;
+  entries[0].value.value.i64 = 1;
+  entries[1].key = amqp_cstring_bytes(SEND_TIME_HEADER);
+  entries[1].value.kind = AMQP_FIELD_KIND_I64;
+  entries[1].value.value.i64 = 1600000000123456789ll;
+
+  amqp_basic_properties_t properties;
+  properties._flags = AMQP_BASIC_HEADERS_FLAG;
+  properties.headers.num_entries = 2;
+  properties.headers.entries = entries;
+
+  int64_t sentNanos = 0;
+  ASSERT_TRUE(HareCpp::hare_send_time(properties, sentNanos));
+  EXPECT_EQ(1600000000123456789ll, sentNanos);
+
+  // Only as a signed 64 bit value, which is how it is sent
+  entries[1].value.kind = AMQP_FIELD_KIND_UTF8;
+  EXPECT_FALSE(HareCpp::hare_send_time(properties, sentNanos));
+  properties._flags = 0;
+  EXPECT_FALSE(HareCpp::hare_send_time(properties, sentNanos));
+}
+
+TEST_F(ProducerConsumerTester, latencyHistogramsEndToEnd) {
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            consumer.Subscribe(
+                "amq.direct", "latencyHistograms",
+                std::bind(&ProducerConsumerTester::defaultCallback, this,
+                          std::placeholders::_1)));
+  producer.SetSendTimeStamping(true);
+  producer.Start();
+  consumer.Start();
+
+  auto start = std::chrono::steady_clock::now();
+  while (GetDesiredMessageCount() < 5 &&
+         std::chrono::steady_clock::now() - start < std::chrono::seconds(7)) {
+    HareCpp::Message message("hello world");
+    producer.Send("amq.direct", "latencyHistograms", message);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  ASSERT_GE(GetDesiredMessageCount(), 5);
+
+  EXPECT_GE(producer.QueueDwellHistogram().Snapshot().m_count, 5u);
+  EXPECT_GE(consumer.DispatchDelayHistogram().Snapshot().m_count, 5u);
+  auto oneWay =
+      consumer.OneWayLatencyHistogram("amq.direct", "latencyHistograms");
+  ASSERT_NE(nullptr, oneWay);
+  auto snapshot = oneWay->Snapshot();
+  EXPECT_EQ(static_cast<uint64_t>(GetDesiredMessageCount()), snapshot.m_count);
+  // Same host, same clock: well under a second
+  EXPECT_LT(snapshot.MaxNanos(), 1000000000u);
+  EXPECT_EQ(nullptr, consumer.OneWayLatencyHistogram("amq.direct", "none"));
+}
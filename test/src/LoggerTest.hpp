@@ -0,0 +1,143 @@
+#include "Logger.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+/**
+ * Collects every record while alive, with the test binary's usual settings
+ * (nothing logged, console sink) put back afterwards
+ */
+class capturedLog {
+ public:
+  explicit capturedLog(int level) {
+    HareCpp::FLUSH_LOG();
+    HareCpp::CLEAR_LOG_SINKS();
+    HareCpp::ADD_LOG_SINK([this](const HareCpp::logRecord& record) {
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      m_records.push_back(record);
+    });
+    HareCpp::SET_DEBUG_LEVEL(level);
+  }
+
+  ~capturedLog() {
+    HareCpp::SET_DEBUG_LEVEL(HareCpp::LOG_NONE);
+    HareCpp::FLUSH_LOG();
+    HareCpp::CLEAR_LOG_SINKS();
+    HareCpp::ADD_LOG_SINK(HareCpp::CONSOLE_LOG_SINK);
+  }
+
+  std::vector<HareCpp::logRecord> Records() {
+    HareCpp::FLUSH_LOG();
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_records;
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::vector<HareCpp::logRecord> m_records;
+};
+
+int evaluated = 0;
+const char* countEvaluation() {
+  evaluated++;
+  return "evaluated";
+}
+
+}  // namespace
+
+TEST(LoggerTest, disabledLevelsNotEvaluated) {
+  capturedLog log(HareCpp::LOG_WARN);
+  evaluated = 0;
+  LOG(HareCpp::LOG_INFO, countEvaluation());
+  LOGF(HareCpp::LOG_DETAILED, "%s", countEvaluation());
+  EXPECT_EQ(0, evaluated);
+  EXPECT_TRUE(log.Records().empty());
+
+  LOG(HareCpp::LOG_WARN, countEvaluation());
+  EXPECT_EQ(1, evaluated);
+  EXPECT_EQ(1u, log.Records().size());
+}
+
+TEST(LoggerTest, recordsReachSinks) {
+  capturedLog log(HareCpp::LOG_TEST);
+  const int line = __LINE__ + 1;
+  LOGF(HareCpp::LOG_ERROR, "channel %d closed by %s", 7, "broker");
+  LOG(HareCpp::LOG_INFO, std::string("from a string"));
+  HareCpp::LOG_SIMPLE(HareCpp::LOG_WARN, "simple");
+  LOGF(HareCpp::LOG_INFO, "%s", std::string(1000, 'x').c_str());
+
+  auto records = log.Records();
+  ASSERT_EQ(4u, records.size());
+  EXPECT_EQ(HareCpp::LOG_ERROR, records[0].m_level);
+  EXPECT_STREQ("channel 7 closed by broker", records[0].m_message);
+  EXPECT_EQ(line, records[0].m_line);
+  EXPECT_STREQ(__FILE__, records[0].m_file);
+  EXPECT_GT(records[0].m_realtimeNanos, 0);
+  EXPECT_STREQ("from a string", records[1].m_message);
+  EXPECT_EQ(nullptr, records[2].m_file);
+  // Cut to fit, still terminated
+  EXPECT_EQ(static_cast<size_t>(HareCpp::LOG_RECORD_MESSAGE_SIZE - 1),
+            std::string(records[3].m_message).size());
+}
+
+TEST(LoggerTest, orderedPerThread) {
+  capturedLog log(HareCpp::LOG_TEST);
+  const int perThread = 100;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < perThread; i++) {
+        LOGF(HareCpp::LOG_INFO, "%d %d", t, i);
+        // Stay under the ring size without relying on the writer's timing
+        if (i % 50 == 49) HareCpp::FLUSH_LOG();
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  auto records = log.Records();
+  ASSERT_EQ(4u * perThread, records.size());
+  std::vector<int> next(4, 0);
+  for (const auto& record : records) {
+    int t, i;
+    ASSERT_EQ(2, sscanf(record.m_message, "%d %d", &t, &i));
+    EXPECT_EQ(next[t], i);
+    next[t] = i + 1;
+  }
+}
+
+TEST(LoggerTest, fullRingDropsInsteadOfBlocking) {
+  std::atomic<bool> blocked(false);
+  std::atomic<bool> release(false);
+  capturedLog log(HareCpp::LOG_TEST);
+  HareCpp::ADD_LOG_SINK([&](const HareCpp::logRecord&) {
+    blocked = true;
+    while (false == release) std::this_thread::yield();
+  });
+
+  // The writer gets stuck in the sink with the first record still in the ring
+  const auto droppedBefore = HareCpp::LOG_DROPPED();
+  LOG(HareCpp::LOG_ERROR, "first");
+  while (false == blocked) std::this_thread::yield();
+  for (int i = 0; i < HareCpp::LOG_RING_RECORDS + 10; i++) {
+    LOG(HareCpp::LOG_INFO, "more");
+  }
+  EXPECT_GE(HareCpp::LOG_DROPPED() - droppedBefore, 11u);
+  release = true;
+
+  bool reported = false;
+  for (const auto& record : log.Records()) {
+    reported |= (HareCpp::LOG_WARN == record.m_level &&
+                 nullptr != strstr(record.m_message, "log records dropped"));
+  }
+  EXPECT_TRUE(reported);
+}
@@ -1,6 +1,8 @@
 #include "gtest/gtest.h"
 #include "Message.hpp"
 #include <string.h>
+#include <type_traits>
+#include <vector>
 
 TEST(MessageTest, createBlankMessage) {
   HareCpp::Message message;
@@ -90,7 +92,8 @@ TEST(MessageTest, setCorrelationId) {
 
 TEST(MessageTest, setCorrelationIdChar) {
   HareCpp::Message message;
-  const char* tmp = std::string("blah").c_str(); //Because lazy
+  const std::string blah("blah");
+  const char* tmp = blah.c_str();
   message.SetCorrelationId(tmp);
   ASSERT_TRUE(message.HasCorrelationId());
 }
@@ -135,4 +138,118 @@ TEST(MessageTest, copyMessageModifyCopy) {
   HareCpp::Message message2 = message1;
   message2.SetPayload("blah");
   ASSERT_FALSE(message1.Length() == message2.Length());
-}
\ No newline at end of file
+}
+
+TEST(MessageTest, inlinePayloadCopiedIntoCopy) {
+  HareCpp::Message message1(std::string(MESSAGE_INLINE_BYTES, 'a'));
+  HareCpp::Message message2{message1};
+  ASSERT_EQ(MESSAGE_INLINE_BYTES, message2.Length());
+  ASSERT_NE(message1.Payload(), message2.Payload());
+  ASSERT_EQ(message1.String(), message2.String());
+}
+
+TEST(MessageTest, payloadPastInlineSize) {
+  const std::string payload(MESSAGE_INLINE_BYTES + 1, 'a');
+  HareCpp::Message message(payload);
+  ASSERT_EQ(payload, message.String());
+  message.SetPayload("short");
+  ASSERT_EQ(std::string("short"), message.String());
+}
+
+TEST(MessageTest, binaryPayload) {
+  const std::string payload("hello\0world", 11);
+  HareCpp::Message message(payload);
+  ASSERT_EQ(payload.size(), message.Length());
+  ASSERT_EQ(payload, message.String());
+  ASSERT_EQ('\0', message.Payload()[message.Length()]);
+}
+
+TEST(MessageTest, moveIsNoexcept) {
+  ASSERT_TRUE(std::is_nothrow_move_constructible<HareCpp::Message>::value);
+  ASSERT_TRUE(std::is_nothrow_move_assignable<HareCpp::Message>::value);
+}
+
+TEST(MessageTest, moveConstructor) {
+  const std::string payload(MESSAGE_INLINE_BYTES * 4, 'a');
+  HareCpp::Message message1(payload);
+  message1.SetCorrelationId("blah");
+  const char* bytes = message1.Payload();
+  HareCpp::Message message2{std::move(message1)};
+  ASSERT_EQ(bytes, message2.Payload());
+  ASSERT_EQ(payload, message2.String());
+  ASSERT_TRUE(message2.HasCorrelationId());
+  ASSERT_EQ(0, message1.Length());
+  ASSERT_FALSE(message1.HasCorrelationId());
+}
+
+TEST(MessageTest, moveInlinePayload) {
+  HareCpp::Message message1("Hello World");
+  HareCpp::Message message2{std::move(message1)};
+  ASSERT_EQ("Hello World", message2.String());
+  ASSERT_EQ(0, strcmp("Hello World", message2.Payload()));
+  ASSERT_EQ(nullptr, message1.Payload());
+}
+
+TEST(MessageTest, copyAssignment) {
+  HareCpp::Message message1("Hello World");
+  message1.SetReplyTo("blah");
+  HareCpp::Message message2(std::string(MESSAGE_INLINE_BYTES + 1, 'a'));
+  message2 = message1;
+  message1.SetReplyTo("other");
+  ASSERT_EQ("Hello World", message2.String());
+  ASSERT_EQ(std::string("blah"), message2.ReplyTo());
+  message2 = message2;
+  ASSERT_EQ("Hello World", message2.String());
+}
+
+TEST(MessageTest, moveAssignment) {
+  HareCpp::Message message1(std::string(MESSAGE_INLINE_BYTES + 1, 'a'));
+  HareCpp::Message message2("Hello World");
+  message2 = std::move(message1);
+  ASSERT_EQ(MESSAGE_INLINE_BYTES + 1, message2.Length());
+  ASSERT_EQ(0, message1.Length());
+}
+
+TEST(MessageTest, messagesInVector) {
+  std::vector<HareCpp::Message> messages;
+  for (int i = 0; i < 100; i++) {
+    messages.emplace_back(std::to_string(i) +
+                          std::string(i % 2 ? MESSAGE_INLINE_BYTES : 1, 'a'));
+  }
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(std::to_string(i) +
+                  std::string(i % 2 ? MESSAGE_INLINE_BYTES : 1, 'a'),
+              messages[i].String());
+  }
+}
+
+TEST(MessageTest, fragments) {
+  const std::string header("head");
+  HareCpp::SharedPayload data(std::string(1000, 'd'));
+  HareCpp::Message message("replaced");
+  message.AddFragment(header.data(), header.size());
+  message.AddFragment(data);
+  message.AddFragment("", 0);
+  ASSERT_TRUE(message.IsFragmented());
+  ASSERT_EQ(2u, message.Fragments().size());
+  ASSERT_EQ(header.data(), message.Fragments()[0].m_data);
+  ASSERT_EQ(data.Data(), message.Fragments()[1].m_data);
+  ASSERT_EQ(1004u, message.Length());
+  ASSERT_EQ(nullptr, message.Payload());
+  ASSERT_EQ("head" + std::string(1000, 'd'), message.String());
+  ASSERT_EQ(2, data.UseCount());
+
+  // Copies point at the same bytes, borrowed or retained
+  HareCpp::Message copy(message);
+  ASSERT_EQ(header.data(), copy.Fragments()[0].m_data);
+  ASSERT_EQ(3, data.UseCount());
+  HareCpp::Message moved(std::move(copy));
+  ASSERT_FALSE(copy.IsFragmented());
+  ASSERT_EQ(1004u, moved.Length());
+  ASSERT_EQ(3, data.UseCount());
+
+  message.SetPayload("whole");
+  ASSERT_FALSE(message.IsFragmented());
+  ASSERT_EQ("whole", message.String());
+  ASSERT_EQ(2, data.UseCount());
+}
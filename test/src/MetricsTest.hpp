@@ -0,0 +1,151 @@
+#include "ConnectionBase.hpp"
+#include "Metrics.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// GET / from the Prometheus endpoint on loopback, the whole response
+std::string scrapePrometheus(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  std::string response;
+  if (0 == connect(fd, reinterpret_cast<sockaddr*>(&address),
+                   sizeof(address))) {
+    const std::string request = "GET /metrics HTTP/1.1\r\nHost: x\r\n\r\n";
+    send(fd, request.data(), request.size(), 0);
+    char buffer[4096];
+    ssize_t bytes;
+    while ((bytes = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      response.append(buffer, bytes);
+    }
+  }
+  close(fd);
+  return response;
+}
+
+}  // namespace
+
+TEST(MetricsTest, shardedCounterSumsThreads) {
+  HareCpp::ShardedCounter counter;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&counter]() {
+      for (int i = 0; i < 10000; i++) counter.Add(1);
+      counter.Add(-500);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(8 * (10000 - 500), counter.Value());
+}
+
+TEST(MetricsTest, prometheusText) {
+  auto& metrics = HareCpp::MetricsRegistry::Instance();
+  const auto published =
+      metrics.Value(HareCpp::METRIC_E::MESSAGES_PUBLISHED);
+  metrics.Add(HareCpp::METRIC_E::MESSAGES_PUBLISHED, 3);
+  metrics.RpcError(HareCpp::HARE_ERROR_E::NO_RPC_REPLY);
+
+  const auto text = metrics.PrometheusText();
+  EXPECT_NE(std::string::npos,
+            text.find("# TYPE harecpp_messages_published_total counter\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("\nharecpp_messages_published_total " +
+                      std::to_string(published + 3) + "\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("# TYPE harecpp_send_queue_depth gauge\n"));
+  EXPECT_NE(std::string::npos,
+            text.find("harecpp_rpc_errors_total{code=\"NO_RPC_REPLY\"} " +
+                      std::to_string(metrics.RpcErrors(
+                          HareCpp::HARE_ERROR_E::NO_RPC_REPLY)) +
+                      "\n"));
+  EXPECT_EQ(std::string::npos, text.find("ALL_GOOD"));
+}
+
+TEST(MetricsTest, channelsAllocatedGauge) {
+  auto& metrics = HareCpp::MetricsRegistry::Instance();
+  const auto before = metrics.Value(HareCpp::METRIC_E::CHANNELS_ALLOCATED);
+  {
+    HareCpp::connection::ConnectionBase connection(SERVER, PORT, USERNAME,
+                                                   PASSWORD);
+    auto clientId = connection.RegisterClient();
+    connection.AllocateChannel(clientId);
+    connection.AllocateChannel(connection.RegisterClient());
+    EXPECT_EQ(before + 2,
+              metrics.Value(HareCpp::METRIC_E::CHANNELS_ALLOCATED));
+    connection.UnregisterClient(clientId);
+    EXPECT_EQ(before + 1,
+              metrics.Value(HareCpp::METRIC_E::CHANNELS_ALLOCATED));
+  }
+  // The connection went with one still handed out
+  EXPECT_EQ(before, metrics.Value(HareCpp::METRIC_E::CHANNELS_ALLOCATED));
+}
+
+TEST(MetricsTest, prometheusEndpoint) {
+  auto& metrics = HareCpp::MetricsRegistry::Instance();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            metrics.StartPrometheusEndpoint(0));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::THREAD_ALREADY_RUNNING,
+            metrics.StartPrometheusEndpoint(0));
+  const int port = metrics.PrometheusPort();
+  ASSERT_GT(port, 0);
+
+  const auto response = scrapePrometheus(port);
+  EXPECT_EQ(0u, response.find("HTTP/1.1 200 OK\r\n"));
+  EXPECT_NE(std::string::npos,
+            response.find("Content-Type: text/plain; version=0.0.4"));
+  EXPECT_NE(std::string::npos,
+            response.find("\r\n\r\n# HELP harecpp_messages_published_total"));
+
+  metrics.StopPrometheusEndpoint();
+  EXPECT_EQ(0, metrics.PrometheusPort());
+  EXPECT_EQ("", scrapePrometheus(port));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            metrics.StartPrometheusEndpoint(0, "not an address"));
+}
+
+TEST(MetricsTest, statsFileRoundTrip) {
+  auto& metrics = HareCpp::MetricsRegistry::Instance();
+  const std::string path =
+      "/tmp/harecpp_metrics_test_" + std::to_string(getpid());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, metrics.StartStatsFile(path, 10));
+  metrics.Add(HareCpp::METRIC_E::CONNECTS, 7);
+  const auto expected = metrics.Value(HareCpp::METRIC_E::CONNECTS);
+  // A couple of intervals for the writer thread to pick it up
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::vector<std::pair<std::string, int64_t> > values;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            HareCpp::MetricsRegistry::ReadStatsFile(path, values));
+  EXPECT_EQ(metrics.Values().size(), values.size());
+  bool found = false;
+  for (const auto& value : values) {
+    if (value.first == "harecpp_connects_total") {
+      found = true;
+      EXPECT_EQ(expected, value.second);
+    }
+  }
+  EXPECT_TRUE(found);
+
+  metrics.StopStatsFile();
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            HareCpp::MetricsRegistry::ReadStatsFile(path, values));
+  unlink(path.c_str());
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            HareCpp::MetricsRegistry::ReadStatsFile(path, values));
+}
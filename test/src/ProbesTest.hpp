@@ -0,0 +1,82 @@
+#include "Logger.hpp"
+#include "Probes.hpp"
+
+#include <elf.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// The file mapped at address, i.e. libharecpp.so or the test binary itself
+std::string objectContaining(uintptr_t address) {
+  std::ifstream maps("/proc/self/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream fields(line);
+    std::string range, permissions, offset, device, inode, path;
+    fields >> range >> permissions >> offset >> device >> inode >> path;
+    const auto dash = range.find('-');
+    const uintptr_t low = std::stoull(range.substr(0, dash), nullptr, 16);
+    const uintptr_t high = std::stoull(range.substr(dash + 1), nullptr, 16);
+    if (address >= low && address < high) return path;
+  }
+  return "";
+}
+
+// Names of the harecpp probes in the .note.stapsdt section of an ELF file
+std::set<std::string> harecppProbes(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  const std::string elf((std::istreambuf_iterator<char>(file)),
+                        std::istreambuf_iterator<char>());
+  std::set<std::string> probes;
+  if (elf.size() < sizeof(Elf64_Ehdr)) return probes;
+  auto header = reinterpret_cast<const Elf64_Ehdr*>(elf.data());
+  auto sections = reinterpret_cast<const Elf64_Shdr*>(elf.data() +
+                                                      header->e_shoff);
+  const char* names = elf.data() + sections[header->e_shstrndx].sh_offset;
+
+  for (int i = 0; i < header->e_shnum; i++) {
+    if (std::string(names + sections[i].sh_name) != ".note.stapsdt") continue;
+    size_t offset = sections[i].sh_offset;
+    const size_t end = offset + sections[i].sh_size;
+    while (offset + sizeof(Elf64_Nhdr) <= end) {
+      auto note = reinterpret_cast<const Elf64_Nhdr*>(elf.data() + offset);
+      const size_t nameOffset = offset + sizeof(Elf64_Nhdr);
+      const size_t descOffset = nameOffset + ((note->n_namesz + 3) & ~3u);
+      // Three addresses, then provider, name and arguments
+      const char* provider = elf.data() + descOffset + 3 * sizeof(uint64_t);
+      const char* probe = provider + strlen(provider) + 1;
+      if (std::string(provider) == "harecpp") probes.insert(probe);
+      offset = descOffset + ((note->n_descsz + 3) & ~3u);
+    }
+  }
+  return probes;
+}
+
+}  // namespace
+
+TEST(ProbesTest, probesInLibrary) {
+#ifndef HARE_HAVE_USDT
+  GTEST_SKIP() << "built without <sys/sdt.h>";
+#endif
+  const auto library =
+      objectContaining(reinterpret_cast<uintptr_t>(&HareCpp::FLUSH_LOG));
+  ASSERT_FALSE(library.empty());
+  const auto probes = harecppProbes(library);
+  for (const char* expected :
+       {"connect_start", "connect_done", "close_connection", "publish_start",
+        "publish_done", "publish_batch_start", "publish_batch_done",
+        "deliver", "producer_batch", "producer_sent", "callback_start",
+        "callback_done"}) {
+    EXPECT_EQ(1u, probes.count(expected)) << expected << " in " << library;
+  }
+}
@@ -124,3 +124,15 @@ TEST(ProducerTest, queueSizeTwo) {
   ASSERT_EQ(2, producer.QueueSize());
 }
 
+
+TEST(ProducerTest, cpuAffinity) {
+  HareCpp::Producer producer;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            producer.SetCpuAffinity({-1}));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, producer.SetCpuAffinity({0}));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, producer.Initialize(
+    SERVER, PORT, USERNAME, PASSWORD
+  ));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, producer.Start());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, producer.SetCpuAffinity({}));
+}
@@ -17,7 +17,7 @@ class ProducerConsumerTester : public ::testing::Test {
   public:
     HareCpp::Consumer consumer;
     HareCpp::Producer producer;
-    void SetUp() { consumer.Initialize(SERVER); producer.Initialize(SERVER);}
+    void SetUp() { consumer.Initialize(SERVER, PORT); producer.Initialize(SERVER, PORT);}
 
     ProducerConsumerTester() : m_desiredMessageCount(0), m_undesiredMessageCount(0), m_desiredMessage("hello world"){};
 
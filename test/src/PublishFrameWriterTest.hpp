@@ -0,0 +1,220 @@
+#include "PublishFrameWriter.hpp"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+// Everything written to one end of a socketpair, read on its own thread so a
+// large write doesn't fill up the socket and block
+class SocketCapture {
+ public:
+  SocketCapture() {
+    socketpair(AF_UNIX, SOCK_STREAM, 0, m_sockets);
+    m_reader = std::thread([this]() {
+      char buffer[4096];
+      ssize_t count;
+      while ((count = read(m_sockets[1], buffer, sizeof(buffer))) > 0) {
+        m_bytes.append(buffer, count);
+      }
+    });
+  }
+  ~SocketCapture() {
+    if (m_reader.joinable()) Finish();
+  }
+  int WriteEnd() const { return m_sockets[0]; }
+  // Call once the write end has been closed
+  std::string Finish() {
+    m_reader.join();
+    close(m_sockets[1]);
+    return m_bytes;
+  }
+
+ private:
+  int m_sockets[2];
+  std::thread m_reader;
+  std::string m_bytes;
+};
+
+HareCpp::helper::RawMessage publishMessage(int channel, const char* exchange,
+                                           const char* routingKey,
+                                           const std::string& body) {
+  HareCpp::helper::RawMessage message;
+  message.channel = channel;
+  message.exchange = amqp_cstring_bytes(exchange);
+  message.routing_key = amqp_cstring_bytes(routingKey);
+  memset(&message.properties, 0, sizeof(message.properties));
+  message.message.bytes = const_cast<char*>(body.data());
+  message.message.len = body.size();
+  return message;
+}
+
+// What rabbitmq-c puts on the wire for the same publishes
+std::string rabbitmqcBytes(
+    std::vector<HareCpp::helper::RawMessage>& messages, size_t& frameMax) {
+  SocketCapture capture;
+  auto conn = amqp_new_connection();
+  auto socket = amqp_tcp_socket_new(conn);
+  amqp_tcp_socket_set_sockfd(socket, capture.WriteEnd());
+  frameMax = amqp_get_frame_max(conn);
+  for (auto& message : messages) {
+    amqp_basic_publish(conn, message.channel, message.exchange,
+                       message.routing_key, 0, 0, &message.properties,
+                       message.message);
+  }
+  // Closes the socket as well
+  amqp_destroy_connection(conn);
+  return capture.Finish();
+}
+}  // namespace
+
+TEST(PublishFrameWriterTest, sameBytesAsRabbitmqc) {
+  const std::string small = "hello world";
+  const std::string empty;
+  const std::string large(300000, 'x');
+
+  std::vector<HareCpp::helper::RawMessage> messages;
+  messages.push_back(publishMessage(1, "amq.direct", "plain", small));
+
+  // Every property rabbitmq-c knows how to encode
+  amqp_table_entry_t entries[2];
+  entries[0].key = amqp_cstring_bytes("stringHeader");
+  entries[0].value.kind = AMQP_FIELD_KIND_UTF8;
+  entries[0].value.value.bytes = amqp_cstring_bytes("value");
+  entries[1].key = amqp_cstring_bytes("intHeader");
+  entries[1].value.kind = AMQP_FIELD_KIND_I32;
+  entries[1].value.value.i32 = -42;
+
+  auto full = publishMessage(2, "harecpp", "full.properties", small);
+  full.properties._flags =
+      AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_CONTENT_ENCODING_FLAG |
+      AMQP_BASIC_HEADERS_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG |
+      AMQP_BASIC_PRIORITY_FLAG | AMQP_BASIC_CORRELATION_ID_FLAG |
+      AMQP_BASIC_REPLY_TO_FLAG | AMQP_BASIC_EXPIRATION_FLAG |
+      AMQP_BASIC_MESSAGE_ID_FLAG | AMQP_BASIC_TIMESTAMP_FLAG |
+      AMQP_BASIC_TYPE_FLAG | AMQP_BASIC_USER_ID_FLAG | AMQP_BASIC_APP_ID_FLAG |
+      AMQP_BASIC_CLUSTER_ID_FLAG;
+  full.properties.content_type = amqp_cstring_bytes("text/plain");
+  full.properties.content_encoding = amqp_cstring_bytes("identity");
+  full.properties.headers.num_entries = 2;
+  full.properties.headers.entries = entries;
+  full.properties.delivery_mode = 2;
+  full.properties.priority = 5;
+  full.properties.correlation_id = amqp_cstring_bytes("correlation");
+  full.properties.reply_to = amqp_cstring_bytes("replies");
+  full.properties.expiration = amqp_cstring_bytes("60000");
+  full.properties.message_id = amqp_cstring_bytes("id-1");
+  full.properties.timestamp = 1600000000ULL;
+  full.properties.type = amqp_cstring_bytes("type");
+  full.properties.user_id = amqp_cstring_bytes("guest");
+  full.properties.app_id = amqp_cstring_bytes("harecpp");
+  full.properties.cluster_id = amqp_cstring_bytes("cluster");
+  messages.push_back(full);
+
+  // Same route and template as the first, only the timestamp and body change
+  auto stamped = publishMessage(3, "amq.topic", "stamped", small);
+  stamped.properties._flags =
+      AMQP_BASIC_TIMESTAMP_FLAG | AMQP_BASIC_DELIVERY_MODE_FLAG;
+  stamped.properties.delivery_mode = 1;
+  stamped.properties.timestamp = 1;
+  messages.push_back(stamped);
+  stamped.properties.timestamp = 0x0102030405060708ULL;
+  stamped.message.bytes = const_cast<char*>(large.data());
+  stamped.message.len = large.size();
+  messages.push_back(stamped);
+
+  messages.push_back(publishMessage(1, "amq.direct", "plain", empty));
+
+  size_t frameMax;
+  auto expected = rabbitmqcBytes(messages, frameMax);
+  ASSERT_LT(large.size(), expected.size());
+
+  HareCpp::connection::PublishFrameWriter writer(frameMax);
+  for (auto& message : messages) {
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, writer.Add(message));
+  }
+  ASSERT_EQ(messages.size(), writer.Pending());
+  ASSERT_EQ(expected, writer.Encoded());
+}
+
+TEST(PublishFrameWriterTest, flushWritesEverything) {
+  const std::string body(50000, 'y');
+  HareCpp::connection::PublishFrameWriter writer(4096);
+  for (int i = 0; i < 20; i++) {
+    auto message = publishMessage(1, "amq.direct", "flush", body);
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, writer.Add(message));
+  }
+  auto expected = writer.Encoded();
+
+  SocketCapture capture;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, writer.Flush(capture.WriteEnd()));
+  close(capture.WriteEnd());
+  ASSERT_EQ(expected, capture.Finish());
+  ASSERT_EQ(0u, writer.Pending());
+}
+
+TEST(PublishFrameWriterTest, flushGivesUpOnStalledSocket) {
+  const std::string body(1 << 20, 'z');
+  HareCpp::connection::PublishFrameWriter writer(4096);
+  auto message = publishMessage(1, "amq.direct", "stalled", body);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, writer.Add(message));
+
+  // Nobody reads the other end, as with a broker blocking publishers
+  int sockets[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+  fcntl(sockets[0], F_SETFL, fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+  const auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::SERVER_CONNECTION_FAILURE,
+            writer.Flush(sockets[0], 200));
+  ASSERT_GT(std::chrono::seconds(5), std::chrono::steady_clock::now() - start);
+  ASSERT_EQ(0u, writer.Pending());
+  close(sockets[0]);
+  close(sockets[1]);
+}
+
+TEST(PublishFrameWriterTest, oversizedRoutingKeyRejected) {
+  const std::string routingKey(300, 'k');
+  HareCpp::connection::PublishFrameWriter writer;
+  auto message = publishMessage(1, "amq.direct", routingKey.c_str(), "body");
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::PUBLISH_ERROR, writer.Add(message));
+  ASSERT_EQ(0u, writer.Pending());
+  ASSERT_TRUE(writer.Encoded().empty());
+}
+
+TEST(PublishFrameWriterTest, fragmentsSameBytesAsOneBody) {
+  const std::string header(16, 'h');
+  const std::string metadata(5000, 'm');
+  const std::string data(9000, 'd');
+  const std::string joined = header + metadata + data;
+
+  HareCpp::connection::PublishFrameWriter expected(4096);
+  auto whole = publishMessage(1, "amq.direct", "fragments", joined);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, expected.Add(whole));
+
+  // Frames end in the middle of the second and third fragments
+  HareCpp::connection::PublishFrameWriter writer(4096);
+  auto fragmented = publishMessage(1, "amq.direct", "fragments", "");
+  fragmented.fragments.push_back(
+      {header.data(), header.size(), HareCpp::SharedPayload()});
+  fragmented.fragments.push_back(
+      {metadata.data(), metadata.size(), HareCpp::SharedPayload()});
+  HareCpp::SharedPayload retained(data);
+  fragmented.fragments.push_back(
+      {retained.Data(), retained.Length(), retained});
+  fragmented.message.bytes = nullptr;
+  fragmented.message.len = joined.size();
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, writer.Add(fragmented));
+  ASSERT_EQ(expected.Encoded(), writer.Encoded());
+
+  // Fragments not adding up to the length aren't published
+  fragmented.message.len++;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::PUBLISH_ERROR, writer.Add(fragmented));
+  ASSERT_EQ(1u, writer.Pending());
+}
@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+#include "HelperStructs.hpp"
+#include "Message.hpp"
+#include "SharedPayload.hpp"
+
+TEST(SharedPayloadTest, copiesBytes) {
+  const std::string bytes("hello\0world", 11);
+  HareCpp::SharedPayload payload(bytes);
+  ASSERT_EQ(bytes.size(), payload.Length());
+  ASSERT_EQ(bytes, std::string(payload.Data(), payload.Length()));
+  ASSERT_NE(bytes.data(), payload.Data());
+  ASSERT_EQ(1, payload.UseCount());
+}
+
+TEST(SharedPayloadTest, messagesShareOneBuffer) {
+  HareCpp::SharedPayload payload(std::string(1024 * 1024, 'x'));
+  HareCpp::Message message1(payload);
+  HareCpp::Message message2{message1};
+  HareCpp::Message message3;
+  message3.SetPayload(payload);
+  ASSERT_EQ(payload.Data(), message1.Payload());
+  ASSERT_EQ(payload.Data(), message2.Payload());
+  ASSERT_EQ(payload.Data(), message3.Payload());
+  ASSERT_EQ(4, payload.UseCount());
+
+  HareCpp::Message message4{std::move(message1)};
+  ASSERT_EQ(payload.Data(), message4.Payload());
+  ASSERT_FALSE(message1.PayloadIsShared());
+  ASSERT_EQ(4, payload.UseCount());
+  message2.SetPayload("small");
+  ASSERT_EQ(3, payload.UseCount());
+}
+
+TEST(SharedPayloadTest, sharePayloadHandsOverAllocation) {
+  HareCpp::Message message(std::string(MESSAGE_INLINE_BYTES + 1, 'x'));
+  const char* bytes = message.Payload();
+  auto shared = message.SharePayload();
+  ASSERT_EQ(bytes, shared.Data());
+  ASSERT_TRUE(message.PayloadIsShared());
+  ASSERT_EQ(bytes, message.SharePayload().Data());
+  ASSERT_EQ(2, shared.UseCount());
+}
+
+TEST(SharedPayloadTest, sharePayloadCopiesInline) {
+  HareCpp::Message message("Hello World");
+  auto shared = message.SharePayload();
+  ASSERT_NE(message.Payload(), shared.Data());
+  ASSERT_FALSE(message.PayloadIsShared());
+  ASSERT_EQ("Hello World", std::string(shared.Data(), shared.Length()));
+  ASSERT_TRUE(HareCpp::Message().SharePayload().Empty());
+}
+
+TEST(SharedPayloadTest, releasedWithLastPublish) {
+  HareCpp::SharedPayload payload(std::string(4096, 'x'));
+  std::vector<HareCpp::helper::RawMessage> queued(12);
+  for (auto& raw : queued) {
+    raw.exchange = amqp_empty_bytes;
+    raw.routing_key = amqp_empty_bytes;
+    raw.properties._flags = 0;
+    raw.shared_payload = payload;
+    raw.message = payload.Bytes();
+  }
+  ASSERT_EQ(13, payload.UseCount());
+  for (auto& raw : queued) HareCpp::helper::hare_free_message_risky(raw);
+  ASSERT_EQ(1, payload.UseCount());
+}
@@ -0,0 +1,1508 @@
+#ifndef _STAND_IN_BROKER_HPP_
+#define _STAND_IN_BROKER_HPP_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace HareTest {
+
+/**
+ * Just enough of an AMQP 0-9-1 broker to run the tests and benchmarks without
+ * a RabbitMQ server.  It lives in the calling process, listens on a loopback
+ * port (and a Unix socket if asked) and serves every connection from one
+ * thread, so runs are reproducible:
+ *
+ *   - direct, topic and fanout exchanges, plus the default exchange and the
+ *     amq.direct/amq.topic/amq.fanout ones
+ *   - queues (server named, exclusive, auto-delete), bindings, purge, delete
+ *   - publish with mandatory returns, consume with round robin between
+ *     consumers, basic.qos prefetch, ack/nack/reject with requeue
+ *   - publisher confirms and heartbeats
+ *
+ * Everything is kept in memory; durability flags are accepted and ignored.
+ * Errors are reported the way RabbitMQ reports them, closing the channel or
+ * the connection with the same reply codes.
+ *
+ *   HareTest::StandInBroker broker;
+ *   producer.Initialize("127.0.0.1", broker.Port(), "guest", "guest");
+ */
+class StandInBroker {
+ public:
+  /**
+   * Start serving
+   * @param [in] port : loopback port to listen on, 0 picks a free one
+   * @param [in] unixPath : also listen on this Unix socket when not empty, a
+   *                        leading '@' names an abstract socket
+   * @param [in] username : the only login accepted
+   * @param [in] password : its password
+   */
+  explicit StandInBroker(int port = 0, const std::string& unixPath = "",
+                         const std::string& username = "guest",
+                         const std::string& password = "guest")
+      : m_username(username),
+        m_password(password),
+        m_unixPath(unixPath),
+        m_port(0),
+        m_tcpFd(-1),
+        m_unixFd(-1),
+        m_running(true),
+        m_published(0),
+        m_delivered(0),
+        m_generatedNames(0) {
+    declareExchange("amq.direct", exchangeType::DIRECT);
+    declareExchange("amq.topic", exchangeType::TOPIC);
+    declareExchange("amq.fanout", exchangeType::FANOUT);
+
+    int boundPort = 0;
+    m_tcpFd = listenTcp(port, boundPort);
+    if (false == unixPath.empty()) m_unixFd = listenUnix(unixPath);
+    if (m_tcpFd < 0 || (false == unixPath.empty() && m_unixFd < 0)) return;
+
+    m_port = boundPort;
+    m_thread = std::thread(&StandInBroker::serve, this);
+  }
+
+  ~StandInBroker() {
+    m_running = false;
+    if (m_thread.joinable()) m_thread.join();
+    for (auto& entry : m_connections) close(entry.first);
+    if (m_tcpFd >= 0) close(m_tcpFd);
+    if (m_unixFd >= 0) {
+      close(m_unixFd);
+      if (m_unixPath[0] != '@') unlink(m_unixPath.c_str());
+    }
+  }
+
+  StandInBroker(const StandInBroker&) = delete;
+  StandInBroker& operator=(const StandInBroker&) = delete;
+
+  /**
+   * Loopback port being served, 0 if the broker couldn't start
+   */
+  int Port() const { return m_port; }
+
+  const std::string& UnixPath() const { return m_unixPath; }
+
+  /**
+   * Messages routed to at least one queue so far
+   */
+  uint64_t Published() const { return m_published; }
+
+  /**
+   * Deliveries sent to consumers so far, redeliveries included
+   */
+  uint64_t Delivered() const { return m_delivered; }
+
+  bool HasQueue(const std::string& queue) {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queues.count(queue) != 0;
+  }
+
+  /**
+   * Messages waiting in a queue, not counting unacknowledged deliveries
+   */
+  size_t QueueDepth(const std::string& queue) {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_queues.find(queue);
+    return found == m_queues.end() ? 0 : found->second.m_messages.size();
+  }
+
+  size_t ConnectionCount() {
+    const std::lock_guard<std::mutex> lock(m_mutex);
+    return m_connections.size();
+  }
+
+ private:
+  enum : uint8_t {
+    FRAME_METHOD = 1,
+    FRAME_HEADER = 2,
+    FRAME_BODY = 3,
+    FRAME_HEARTBEAT = 8,
+    FRAME_END = 0xCE
+  };
+
+  enum : uint32_t {
+    CONNECTION_START = 0x000A000A,
+    CONNECTION_START_OK = 0x000A000B,
+    CONNECTION_TUNE = 0x000A001E,
+    CONNECTION_TUNE_OK = 0x000A001F,
+    CONNECTION_OPEN = 0x000A0028,
+    CONNECTION_OPEN_OK = 0x000A0029,
+    CONNECTION_CLOSE = 0x000A0032,
+    CONNECTION_CLOSE_OK = 0x000A0033,
+    CHANNEL_OPEN = 0x0014000A,
+    CHANNEL_OPEN_OK = 0x0014000B,
+    CHANNEL_FLOW = 0x00140014,
+    CHANNEL_FLOW_OK = 0x00140015,
+    CHANNEL_CLOSE = 0x00140028,
+    CHANNEL_CLOSE_OK = 0x00140029,
+    EXCHANGE_DECLARE = 0x0028000A,
+    EXCHANGE_DECLARE_OK = 0x0028000B,
+    EXCHANGE_DELETE = 0x00280014,
+    EXCHANGE_DELETE_OK = 0x00280015,
+    QUEUE_DECLARE = 0x0032000A,
+    QUEUE_DECLARE_OK = 0x0032000B,
+    QUEUE_BIND = 0x00320014,
+    QUEUE_BIND_OK = 0x00320015,
+    QUEUE_PURGE = 0x0032001E,
+    QUEUE_PURGE_OK = 0x0032001F,
+    QUEUE_DELETE = 0x00320028,
+    QUEUE_DELETE_OK = 0x00320029,
+    QUEUE_UNBIND = 0x00320032,
+    QUEUE_UNBIND_OK = 0x00320033,
+    BASIC_QOS = 0x003C000A,
+    BASIC_QOS_OK = 0x003C000B,
+    BASIC_CONSUME = 0x003C0014,
+    BASIC_CONSUME_OK = 0x003C0015,
+    BASIC_CANCEL = 0x003C001E,
+    BASIC_CANCEL_OK = 0x003C001F,
+    BASIC_PUBLISH = 0x003C0028,
+    BASIC_RETURN = 0x003C0032,
+    BASIC_DELIVER = 0x003C003C,
+    BASIC_ACK = 0x003C0050,
+    BASIC_REJECT = 0x003C005A,
+    BASIC_NACK = 0x003C0078,
+    CONFIRM_SELECT = 0x0055000A,
+    CONFIRM_SELECT_OK = 0x0055000B
+  };
+
+  enum : uint16_t {
+    NO_ROUTE = 312,
+    ACCESS_REFUSED = 403,
+    NOT_FOUND = 404,
+    RESOURCE_LOCKED = 405,
+    PRECONDITION_FAILED = 406,
+    FRAME_ERROR = 501,
+    SYNTAX_ERROR = 502,
+    COMMAND_INVALID = 503,
+    CHANNEL_ERROR = 504,
+    UNEXPECTED_FRAME = 505,
+    NOT_ALLOWED = 530,
+    NOT_IMPLEMENTED = 540
+  };
+
+  static constexpr uint16_t CHANNEL_MAX = 2047;
+  static constexpr uint32_t FRAME_MAX = 131072;
+  static constexpr size_t FRAME_OVERHEAD = 8;
+  // Stop delivering to a connection while this much is waiting to be written
+  static constexpr size_t OUTPUT_HIGH_WATER = 1 << 20;
+  static constexpr int POLL_INTERVAL_MS = 50;
+
+  enum class exchangeType { DIRECT, TOPIC, FANOUT };
+
+  // Reads method arguments, any overrun leaves Ok() false
+  class wireReader {
+   public:
+    wireReader(const char* data, size_t size)
+        : m_data(reinterpret_cast<const uint8_t*>(data)),
+          m_left(size),
+          m_ok(true){};
+
+    bool Ok() const { return m_ok; }
+
+    uint8_t Octet() {
+      if (false == take(1)) return 0;
+      return m_data[-1];
+    }
+    uint16_t Short() {
+      if (false == take(2)) return 0;
+      return static_cast<uint16_t>(m_data[-2] << 8 | m_data[-1]);
+    }
+    uint32_t Long() {
+      if (false == take(4)) return 0;
+      return static_cast<uint32_t>(m_data[-4]) << 24 |
+             static_cast<uint32_t>(m_data[-3]) << 16 |
+             static_cast<uint32_t>(m_data[-2]) << 8 | m_data[-1];
+    }
+    uint64_t LongLong() {
+      uint64_t high = Long();
+      return high << 32 | Long();
+    }
+    std::string ShortString() { return bytes(Octet()); }
+    std::string LongString() { return bytes(Long()); }
+    // Tables are accepted but nothing here looks inside them
+    void SkipTable() { bytes(Long()); }
+
+   private:
+    bool take(size_t count) {
+      if (false == m_ok || count > m_left) {
+        m_ok = false;
+        return false;
+      }
+      m_data += count;
+      m_left -= count;
+      return true;
+    }
+    std::string bytes(size_t count) {
+      if (false == take(count)) return std::string();
+      return std::string(reinterpret_cast<const char*>(m_data - count),
+                         count);
+    }
+
+    const uint8_t* m_data;
+    size_t m_left;
+    bool m_ok;
+  };
+
+  struct message {
+    std::string m_exchange;
+    std::string m_routingKey;
+    // Content header payload exactly as published, properties included
+    std::string m_header;
+    std::string m_body;
+  };
+
+  struct queued {
+    std::shared_ptr<const message> m_message;
+    bool m_redelivered;
+  };
+
+  struct connection;
+  struct channel;
+
+  struct consumer {
+    connection* m_connection;
+    channel* m_channel;
+    std::string m_tag;
+    std::string m_queue;
+    bool m_noAck;
+    uint16_t m_prefetch;
+    uint32_t m_unacked;
+  };
+
+  struct unacked {
+    std::string m_queue;
+    queued m_entry;
+    std::shared_ptr<consumer> m_consumer;
+  };
+
+  struct channel {
+    explicit channel(uint16_t id)
+        : m_id(id),
+          m_closing(false),
+          m_active(true),
+          m_prefetch(0),
+          m_consumerPrefetch(0),
+          m_deliveryTag(0),
+          m_confirming(false),
+          m_publishSeq(0),
+          m_confirmedSeq(0),
+          m_publishing(false),
+          m_mandatory(false),
+          m_bodySize(0),
+          m_hasHeader(false){};
+    uint16_t m_id;
+    bool m_closing;
+    bool m_active;
+    // basic.qos global=true limit, and the one given to new consumers
+    uint16_t m_prefetch;
+    uint16_t m_consumerPrefetch;
+    uint64_t m_deliveryTag;
+    std::map<uint64_t, unacked> m_unacked;
+    std::map<std::string, std::shared_ptr<consumer>> m_consumers;
+    bool m_confirming;
+    uint64_t m_publishSeq;
+    uint64_t m_confirmedSeq;
+    // Content of the basic.publish being received
+    bool m_publishing;
+    bool m_mandatory;
+    std::string m_exchange;
+    std::string m_routingKey;
+    uint64_t m_bodySize;
+    bool m_hasHeader;
+    std::string m_header;
+    std::string m_body;
+  };
+
+  enum class stage { PROTOCOL_HEADER, START_OK, TUNE_OK, OPEN, RUNNING };
+
+  struct connection {
+    explicit connection(int fd)
+        : m_fd(fd),
+          m_stage(stage::PROTOCOL_HEADER),
+          m_frameMax(FRAME_MAX),
+          m_heartbeat(0),
+          m_closing(false),
+          m_closeAfterFlush(false),
+          m_dead(false),
+          m_lastSent(std::chrono::steady_clock::now()){};
+    int m_fd;
+    stage m_stage;
+    uint32_t m_frameMax;
+    uint16_t m_heartbeat;
+    // connection.close sent, waiting for close-ok
+    bool m_closing;
+    bool m_closeAfterFlush;
+    bool m_dead;
+    std::chrono::steady_clock::time_point m_lastSent;
+    std::string m_in;
+    std::string m_out;
+    std::map<uint16_t, std::unique_ptr<channel>> m_channels;
+  };
+
+  struct binding {
+    std::string m_queue;
+    std::string m_key;
+  };
+
+  struct exchange {
+    exchangeType m_type;
+    std::vector<binding> m_bindings;
+  };
+
+  struct queue {
+    std::string m_name;
+    std::deque<queued> m_messages;
+    std::vector<std::shared_ptr<consumer>> m_consumers;
+    size_t m_nextConsumer;
+    // Owning connection of an exclusive queue
+    connection* m_owner;
+    bool m_autoDelete;
+  };
+
+  static void put8(std::string& out, uint8_t value) {
+    out.push_back(static_cast<char>(value));
+  }
+  static void put16(std::string& out, uint16_t value) {
+    put8(out, value >> 8);
+    put8(out, value & 0xFF);
+  }
+  static void put32(std::string& out, uint32_t value) {
+    put16(out, value >> 16);
+    put16(out, value & 0xFFFF);
+  }
+  static void put64(std::string& out, uint64_t value) {
+    put32(out, value >> 32);
+    put32(out, value & 0xFFFFFFFF);
+  }
+  static void putShortString(std::string& out, const std::string& value) {
+    put8(out, static_cast<uint8_t>(std::min<size_t>(value.size(), 255)));
+    out.append(value, 0, 255);
+  }
+  static void putLongString(std::string& out, const std::string& value) {
+    put32(out, value.size());
+    out.append(value);
+  }
+  static void putTableEntry(std::string& out, const std::string& key,
+                            char type, const std::string& value) {
+    putShortString(out, key);
+    out.push_back(type);
+    out.append(value);
+  }
+  static std::string longString(const std::string& value) {
+    std::string out;
+    putLongString(out, value);
+    return out;
+  }
+
+  static int listenTcp(int port, int& boundPort) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    socklen_t length = sizeof(address);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        listen(fd, SOMAXCONN) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) !=
+            0) {
+      close(fd);
+      return -1;
+    }
+    boundPort = ntohs(address.sin_port);
+    return fd;
+  }
+
+  static int listenUnix(const std::string& path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (path.size() >= sizeof(address.sun_path)) return -1;
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.data(), path.size());
+    socklen_t length = offsetof(struct sockaddr_un, sun_path) + path.size();
+    if (path[0] == '@') {
+      address.sun_path[0] = '\0';
+    } else {
+      unlink(path.c_str());
+      length += 1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) != 0 ||
+        listen(fd, SOMAXCONN) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  void serve() {
+    std::vector<struct pollfd> fds;
+    while (m_running) {
+      fds.clear();
+      fds.push_back({m_tcpFd, POLLIN, 0});
+      if (m_unixFd >= 0) fds.push_back({m_unixFd, POLLIN, 0});
+      const size_t listeners = fds.size();
+      {
+        const std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_connections) {
+          short events = POLLIN;
+          if (false == entry.second->m_out.empty()) events |= POLLOUT;
+          fds.push_back({entry.first, events, 0});
+        }
+      }
+
+      int ready = poll(fds.data(), fds.size(), POLL_INTERVAL_MS);
+
+      const std::lock_guard<std::mutex> lock(m_mutex);
+      for (size_t i = 0; ready > 0 && i < fds.size(); ++i) {
+        if (0 == fds[i].revents) continue;
+        if (i < listeners) {
+          acceptFrom(fds[i].fd);
+          continue;
+        }
+        auto found = m_connections.find(fds[i].fd);
+        if (found == m_connections.end()) continue;
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+          readFrom(*found->second);
+        }
+      }
+      reap();
+      for (auto& entry : m_queues) dispatch(entry.second);
+      sendHeartbeats();
+      for (auto& entry : m_connections) flush(*entry.second);
+      reap();
+    }
+  }
+
+  void acceptFrom(int listenFd) {
+    while (true) {
+      int fd = accept4(listenFd, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      m_connections[fd].reset(new connection(fd));
+    }
+  }
+
+  void readFrom(connection& conn) {
+    char buffer[65536];
+    // Bounded, so one busy publisher can't keep the others waiting
+    for (int reads = 0; reads < 16; ++reads) {
+      auto count = recv(conn.m_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (count > 0) {
+        conn.m_in.append(buffer, count);
+        continue;
+      }
+      if (count < 0 && errno == EINTR) continue;
+      if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        conn.m_dead = true;
+      }
+      break;
+    }
+    processInput(conn);
+  }
+
+  void flush(connection& conn) {
+    size_t sent = 0;
+    while (sent < conn.m_out.size()) {
+      auto count = send(conn.m_fd, conn.m_out.data() + sent,
+                        conn.m_out.size() - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (count < 0 && errno == EINTR) continue;
+      if (count < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) conn.m_dead = true;
+        break;
+      }
+      sent += count;
+    }
+    conn.m_out.erase(0, sent);
+    if (conn.m_out.empty() && conn.m_closeAfterFlush) conn.m_dead = true;
+  }
+
+  void reap() {
+    for (auto it = m_connections.begin(); it != m_connections.end();) {
+      if (false == it->second->m_dead) {
+        ++it;
+        continue;
+      }
+      connection& conn = *it->second;
+      for (auto& entry : conn.m_channels) releaseChannel(conn, *entry.second);
+      std::vector<std::string> exclusive;
+      for (auto& entry : m_queues) {
+        if (entry.second.m_owner == &conn) exclusive.push_back(entry.first);
+      }
+      for (auto& name : exclusive) deleteQueue(name);
+      close(conn.m_fd);
+      it = m_connections.erase(it);
+    }
+  }
+
+  void sendHeartbeats() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto& entry : m_connections) {
+      connection& conn = *entry.second;
+      if (0 == conn.m_heartbeat) continue;
+      auto interval = std::chrono::milliseconds(conn.m_heartbeat * 500);
+      if (now - conn.m_lastSent < interval) {
+        continue;
+      }
+      std::string frame;
+      put8(frame, FRAME_HEARTBEAT);
+      put16(frame, 0);
+      put32(frame, 0);
+      put8(frame, FRAME_END);
+      write(conn, frame);
+    }
+  }
+
+  void write(connection& conn, const std::string& bytes) {
+    conn.m_out.append(bytes);
+    conn.m_lastSent = std::chrono::steady_clock::now();
+  }
+
+  void processInput(connection& conn) {
+    static const char PROTOCOL_HEADER[] = {'A', 'M', 'Q', 'P', 0, 0, 9, 1};
+    size_t offset = 0;
+    if (conn.m_stage == stage::PROTOCOL_HEADER) {
+      if (conn.m_in.size() < sizeof(PROTOCOL_HEADER)) return;
+      if (memcmp(conn.m_in.data(), PROTOCOL_HEADER, sizeof(PROTOCOL_HEADER))) {
+        // Tell the client which version is spoken here and hang up
+        write(conn, std::string(PROTOCOL_HEADER, sizeof(PROTOCOL_HEADER)));
+        conn.m_closeAfterFlush = true;
+        conn.m_in.clear();
+        return;
+      }
+      offset = sizeof(PROTOCOL_HEADER);
+      sendStart(conn);
+    }
+
+    while (false == conn.m_closeAfterFlush &&
+           conn.m_in.size() - offset >= FRAME_OVERHEAD) {
+      const char* frame = conn.m_in.data() + offset;
+      const auto* header = reinterpret_cast<const uint8_t*>(frame);
+      uint8_t type = header[0];
+      uint16_t channelId = static_cast<uint16_t>(header[1] << 8 | header[2]);
+      uint32_t size = static_cast<uint32_t>(header[3]) << 24 |
+                      static_cast<uint32_t>(header[4]) << 16 |
+                      static_cast<uint32_t>(header[5]) << 8 | header[6];
+      if (size > conn.m_frameMax) {
+        connectionError(conn, FRAME_ERROR, "frame too large", 0);
+        conn.m_closeAfterFlush = true;
+        break;
+      }
+      if (conn.m_in.size() - offset < size + FRAME_OVERHEAD) break;
+      if (header[7 + size] != FRAME_END) {
+        connectionError(conn, FRAME_ERROR, "bad frame end", 0);
+        conn.m_closeAfterFlush = true;
+        break;
+      }
+      offset += size + FRAME_OVERHEAD;
+      handleFrame(conn, type, channelId, frame + 7, size);
+    }
+    conn.m_in.erase(0, offset);
+
+    // One confirm per channel for everything routed from this read
+    for (auto& entry : conn.m_channels) {
+      channel& ch = *entry.second;
+      if (ch.m_confirming && ch.m_publishSeq > ch.m_confirmedSeq) {
+        std::string args;
+        put64(args, ch.m_publishSeq);
+        put8(args, ch.m_publishSeq - ch.m_confirmedSeq > 1 ? 1 : 0);
+        sendMethod(conn, ch.m_id, BASIC_ACK, args);
+        ch.m_confirmedSeq = ch.m_publishSeq;
+      }
+    }
+  }
+
+  void handleFrame(connection& conn, uint8_t type, uint16_t channelId,
+                   const char* payload, uint32_t size) {
+    if (type == FRAME_HEARTBEAT) return;
+    if (type == FRAME_METHOD) {
+      if (size < 4) {
+        connectionError(conn, FRAME_ERROR, "short method frame", 0);
+        return;
+      }
+      wireReader args(payload + 4, size - 4);
+      wireReader id(payload, 4);
+      handleMethod(conn, channelId, id.Long(), args);
+      return;
+    }
+    if (type != FRAME_HEADER && type != FRAME_BODY) {
+      connectionError(conn, FRAME_ERROR, "unknown frame type", 0);
+      return;
+    }
+    if (conn.m_closing) return;
+
+    auto found = conn.m_channels.find(channelId);
+    if (found == conn.m_channels.end()) {
+      connectionError(conn, CHANNEL_ERROR, "content on a closed channel", 0);
+      return;
+    }
+    channel& ch = *found->second;
+    if (ch.m_closing) return;
+    if (false == ch.m_publishing || (type == FRAME_HEADER) == ch.m_hasHeader) {
+      connectionError(conn, UNEXPECTED_FRAME, "unexpected content frame", 0);
+      return;
+    }
+
+    if (type == FRAME_HEADER) {
+      wireReader header(payload, size);
+      header.Long();  // class and weight
+      ch.m_bodySize = header.LongLong();
+      if (false == header.Ok()) {
+        connectionError(conn, FRAME_ERROR, "short content header", 0);
+        return;
+      }
+      ch.m_header.assign(payload, size);
+      ch.m_hasHeader = true;
+      ch.m_body.clear();
+      ch.m_body.reserve(ch.m_bodySize);
+    } else {
+      ch.m_body.append(payload, size);
+      if (ch.m_body.size() > ch.m_bodySize) {
+        connectionError(conn, FRAME_ERROR, "body larger than announced", 0);
+        return;
+      }
+    }
+    if (ch.m_body.size() == ch.m_bodySize) publish(conn, ch);
+  }
+
+  void handleMethod(connection& conn, uint16_t channelId, uint32_t method,
+                    wireReader& args) {
+    if (conn.m_closing) {
+      if (method == CONNECTION_CLOSE) sendMethod(conn, 0, CONNECTION_CLOSE_OK);
+      if (method == CONNECTION_CLOSE || method == CONNECTION_CLOSE_OK) {
+        conn.m_closeAfterFlush = true;
+      }
+      return;
+    }
+    if (0 == channelId) {
+      handleConnectionMethod(conn, method, args);
+      return;
+    }
+    if (conn.m_stage != stage::RUNNING) {
+      connectionError(conn, CHANNEL_ERROR, "connection not open", method);
+      return;
+    }
+
+    auto found = conn.m_channels.find(channelId);
+    if (method == CHANNEL_OPEN) {
+      if (found != conn.m_channels.end() || channelId > CHANNEL_MAX) {
+        connectionError(conn, CHANNEL_ERROR, "channel already open", method);
+        return;
+      }
+      conn.m_channels[channelId].reset(new channel(channelId));
+      sendMethod(conn, channelId, CHANNEL_OPEN_OK, longString(""));
+      return;
+    }
+    if (found == conn.m_channels.end()) {
+      // Answer to a close both sides sent at once
+      if (method == CHANNEL_CLOSE_OK) return;
+      connectionError(conn, CHANNEL_ERROR, "expected 'channel.open'", method);
+      return;
+    }
+    channel& ch = *found->second;
+    if (ch.m_closing) {
+      // Everything but the close handshake is dropped until close-ok
+      if (method == CHANNEL_CLOSE) {
+        sendMethod(conn, channelId, CHANNEL_CLOSE_OK);
+      }
+      if (method == CHANNEL_CLOSE || method == CHANNEL_CLOSE_OK) {
+        conn.m_channels.erase(found);
+      }
+      return;
+    }
+    if (ch.m_publishing) {
+      connectionError(conn, UNEXPECTED_FRAME, "expected content", method);
+      return;
+    }
+
+    handleChannelMethod(conn, ch, method, args);
+    if (false == args.Ok() && false == conn.m_closing) {
+      connectionError(conn, SYNTAX_ERROR, "truncated arguments", method);
+    }
+  }
+
+  void handleConnectionMethod(connection& conn, uint32_t method,
+                              wireReader& args) {
+    switch (method) {
+      case CONNECTION_START_OK: {
+        if (conn.m_stage != stage::START_OK) break;
+        args.SkipTable();
+        std::string mechanism = args.ShortString();
+        std::string response = args.LongString();
+        // PLAIN: "\0user\0password"
+        std::string expected = std::string(1, '\0') + m_username +
+                               std::string(1, '\0') + m_password;
+        if (mechanism != "PLAIN" || response != expected) {
+          connectionError(conn, ACCESS_REFUSED,
+                          "ACCESS_REFUSED - Login was refused using "
+                          "authentication mechanism PLAIN",
+                          method);
+          return;
+        }
+        std::string tune;
+        put16(tune, CHANNEL_MAX);
+        put32(tune, FRAME_MAX);
+        put16(tune, 0);
+        sendMethod(conn, 0, CONNECTION_TUNE, tune);
+        conn.m_stage = stage::TUNE_OK;
+        return;
+      }
+      case CONNECTION_TUNE_OK: {
+        if (conn.m_stage != stage::TUNE_OK) break;
+        args.Short();
+        uint32_t frameMax = args.Long();
+        conn.m_heartbeat = args.Short();
+        if (frameMax != 0 && frameMax < FRAME_MAX) conn.m_frameMax = frameMax;
+        conn.m_stage = stage::OPEN;
+        return;
+      }
+      case CONNECTION_OPEN: {
+        if (conn.m_stage != stage::OPEN) break;
+        sendMethod(conn, 0, CONNECTION_OPEN_OK, std::string(1, '\0'));
+        conn.m_stage = stage::RUNNING;
+        return;
+      }
+      case CONNECTION_CLOSE:
+        sendMethod(conn, 0, CONNECTION_CLOSE_OK);
+        conn.m_closeAfterFlush = true;
+        return;
+      default:
+        break;
+    }
+    connectionError(conn, COMMAND_INVALID, "unexpected connection method",
+                    method);
+  }
+
+  void handleChannelMethod(connection& conn, channel& ch, uint32_t method,
+                           wireReader& args) {
+    switch (method) {
+      case CHANNEL_CLOSE:
+        releaseChannel(conn, ch);
+        sendMethod(conn, ch.m_id, CHANNEL_CLOSE_OK);
+        conn.m_channels.erase(ch.m_id);
+        return;
+      case CHANNEL_FLOW: {
+        ch.m_active = args.Octet() & 1;
+        std::string active;
+        put8(active, ch.m_active ? 1 : 0);
+        sendMethod(conn, ch.m_id, CHANNEL_FLOW_OK, active);
+        return;
+      }
+      case EXCHANGE_DECLARE:
+        exchangeDeclare(conn, ch, args);
+        return;
+      case EXCHANGE_DELETE:
+        exchangeDelete(conn, ch, args);
+        return;
+      case QUEUE_DECLARE:
+        queueDeclare(conn, ch, args);
+        return;
+      case QUEUE_BIND:
+      case QUEUE_UNBIND:
+        queueBind(conn, ch, args, method == QUEUE_BIND);
+        return;
+      case QUEUE_PURGE:
+      case QUEUE_DELETE:
+        queueRemove(conn, ch, args, method == QUEUE_DELETE);
+        return;
+      case BASIC_QOS: {
+        args.Long();  // prefetch-size, not limited here
+        uint16_t count = args.Short();
+        if (args.Octet() & 1) {
+          ch.m_prefetch = count;
+        } else {
+          ch.m_consumerPrefetch = count;
+        }
+        sendMethod(conn, ch.m_id, BASIC_QOS_OK);
+        return;
+      }
+      case BASIC_CONSUME:
+        basicConsume(conn, ch, args);
+        return;
+      case BASIC_CANCEL: {
+        std::string tag = args.ShortString();
+        bool noWait = args.Octet() & 1;
+        auto found = ch.m_consumers.find(tag);
+        if (found != ch.m_consumers.end()) {
+          auto cancelled = found->second;
+          ch.m_consumers.erase(found);
+          removeConsumer(cancelled);
+        }
+        if (false == noWait) {
+          std::string reply;
+          putShortString(reply, tag);
+          sendMethod(conn, ch.m_id, BASIC_CANCEL_OK, reply);
+        }
+        return;
+      }
+      case BASIC_PUBLISH: {
+        args.Short();
+        ch.m_exchange = args.ShortString();
+        ch.m_routingKey = args.ShortString();
+        ch.m_mandatory = args.Octet() & 1;
+        if (false == args.Ok()) return;
+        if (false == ch.m_exchange.empty() &&
+            m_exchanges.count(ch.m_exchange) == 0) {
+          channelError(conn, ch, NOT_FOUND,
+                       "NOT_FOUND - no exchange '" + ch.m_exchange + "'",
+                       method);
+          return;
+        }
+        ch.m_publishing = true;
+        ch.m_hasHeader = false;
+        return;
+      }
+      case BASIC_ACK: {
+        uint64_t tag = args.LongLong();
+        settle(conn, ch, tag, args.Octet() & 1, false, method);
+        return;
+      }
+      case BASIC_NACK: {
+        uint64_t tag = args.LongLong();
+        uint8_t bits = args.Octet();
+        settle(conn, ch, tag, bits & 1, bits & 2, method);
+        return;
+      }
+      case BASIC_REJECT: {
+        uint64_t tag = args.LongLong();
+        settle(conn, ch, tag, false, args.Octet() & 1, method);
+        return;
+      }
+      case CONFIRM_SELECT:
+        ch.m_confirming = true;
+        if (0 == (args.Octet() & 1)) {
+          sendMethod(conn, ch.m_id, CONFIRM_SELECT_OK);
+        }
+        return;
+      default:
+        connectionError(conn, NOT_IMPLEMENTED,
+                        "NOT_IMPLEMENTED - method not supported by the "
+                        "stand-in broker",
+                        method);
+        return;
+    }
+  }
+
+  void exchangeDeclare(connection& conn, channel& ch, wireReader& args) {
+    args.Short();
+    std::string name = args.ShortString();
+    std::string typeName = args.ShortString();
+    uint8_t bits = args.Octet();
+    args.SkipTable();
+    if (false == args.Ok()) return;
+    bool passive = bits & 1;
+    bool noWait = bits & 16;
+
+    auto found = m_exchanges.find(name);
+    if (passive || name.empty()) {
+      if (found == m_exchanges.end() && false == name.empty()) {
+        channelError(conn, ch, NOT_FOUND,
+                     "NOT_FOUND - no exchange '" + name + "'",
+                     EXCHANGE_DECLARE);
+        return;
+      }
+    } else {
+      exchangeType type;
+      if (typeName == "direct") {
+        type = exchangeType::DIRECT;
+      } else if (typeName == "topic") {
+        type = exchangeType::TOPIC;
+      } else if (typeName == "fanout") {
+        type = exchangeType::FANOUT;
+      } else {
+        connectionError(conn, COMMAND_INVALID,
+                        "COMMAND_INVALID - unknown exchange type '" +
+                            typeName + "'",
+                        EXCHANGE_DECLARE);
+        return;
+      }
+      if (found != m_exchanges.end() && found->second.m_type != type) {
+        channelError(conn, ch, PRECONDITION_FAILED,
+                     "PRECONDITION_FAILED - inequivalent arg 'type' for "
+                     "exchange '" + name + "'",
+                     EXCHANGE_DECLARE);
+        return;
+      }
+      if (found == m_exchanges.end()) {
+        if (0 == name.compare(0, 4, "amq.")) {
+          channelError(conn, ch, ACCESS_REFUSED,
+                       "ACCESS_REFUSED - exchange name '" + name +
+                           "' contains reserved prefix 'amq.*'",
+                       EXCHANGE_DECLARE);
+          return;
+        }
+        declareExchange(name, type);
+      }
+    }
+    if (false == noWait) sendMethod(conn, ch.m_id, EXCHANGE_DECLARE_OK);
+  }
+
+  void exchangeDelete(connection& conn, channel& ch, wireReader& args) {
+    args.Short();
+    std::string name = args.ShortString();
+    uint8_t bits = args.Octet();
+    if (false == args.Ok()) return;
+    bool ifUnused = bits & 1;
+    bool noWait = bits & 2;
+
+    if (name.empty() || 0 == name.compare(0, 4, "amq.")) {
+      channelError(conn, ch, ACCESS_REFUSED,
+                   "ACCESS_REFUSED - operation not permitted on exchange '" +
+                       name + "'",
+                   EXCHANGE_DELETE);
+      return;
+    }
+    auto found = m_exchanges.find(name);
+    if (found != m_exchanges.end()) {
+      if (ifUnused && false == found->second.m_bindings.empty()) {
+        channelError(conn, ch, PRECONDITION_FAILED,
+                     "PRECONDITION_FAILED - exchange '" + name + "' in use",
+                     EXCHANGE_DELETE);
+        return;
+      }
+      m_exchanges.erase(found);
+    }
+    if (false == noWait) sendMethod(conn, ch.m_id, EXCHANGE_DELETE_OK);
+  }
+
+  void queueDeclare(connection& conn, channel& ch, wireReader& args) {
+    args.Short();
+    std::string name = args.ShortString();
+    uint8_t bits = args.Octet();
+    args.SkipTable();
+    if (false == args.Ok()) return;
+    bool passive = bits & 1;
+    bool exclusive = bits & 4;
+    bool autoDelete = bits & 8;
+    bool noWait = bits & 16;
+
+    if (name.empty() && false == passive) {
+      name = "amq.gen-" + std::to_string(++m_generatedNames);
+    }
+    auto found = m_queues.find(name);
+    if (found == m_queues.end()) {
+      if (passive) {
+        channelError(conn, ch, NOT_FOUND,
+                     "NOT_FOUND - no queue '" + name + "'", QUEUE_DECLARE);
+        return;
+      }
+      queue& created = m_queues[name];
+      created.m_name = name;
+      created.m_nextConsumer = 0;
+      created.m_owner = exclusive ? &conn : nullptr;
+      created.m_autoDelete = autoDelete;
+      found = m_queues.find(name);
+    } else if (false == ownedBy(found->second, conn)) {
+      lockedError(conn, ch, name, QUEUE_DECLARE);
+      return;
+    }
+
+    if (noWait) return;
+    std::string reply;
+    putShortString(reply, name);
+    put32(reply, found->second.m_messages.size());
+    put32(reply, found->second.m_consumers.size());
+    sendMethod(conn, ch.m_id, QUEUE_DECLARE_OK, reply);
+  }
+
+  void queueBind(connection& conn, channel& ch, wireReader& args, bool bind) {
+    const uint32_t method = bind ? QUEUE_BIND : QUEUE_UNBIND;
+    args.Short();
+    std::string queueName = args.ShortString();
+    std::string exchangeName = args.ShortString();
+    std::string key = args.ShortString();
+    bool noWait = bind ? (args.Octet() & 1) : false;
+    args.SkipTable();
+    if (false == args.Ok()) return;
+
+    auto foundQueue = m_queues.find(queueName);
+    if (foundQueue == m_queues.end()) {
+      channelError(conn, ch, NOT_FOUND,
+                   "NOT_FOUND - no queue '" + queueName + "'", method);
+      return;
+    }
+    if (false == ownedBy(foundQueue->second, conn)) {
+      lockedError(conn, ch, queueName, method);
+      return;
+    }
+    if (exchangeName.empty()) {
+      channelError(conn, ch, ACCESS_REFUSED,
+                   "ACCESS_REFUSED - operation not permitted on the default "
+                   "exchange",
+                   method);
+      return;
+    }
+    auto foundExchange = m_exchanges.find(exchangeName);
+    if (foundExchange == m_exchanges.end()) {
+      channelError(conn, ch, NOT_FOUND,
+                   "NOT_FOUND - no exchange '" + exchangeName + "'", method);
+      return;
+    }
+
+    auto& bindings = foundExchange->second.m_bindings;
+    auto existing = std::find_if(
+        bindings.begin(), bindings.end(), [&](const binding& candidate) {
+          return candidate.m_queue == queueName && candidate.m_key == key;
+        });
+    if (bind && existing == bindings.end()) {
+      bindings.push_back({queueName, key});
+    } else if (false == bind && existing != bindings.end()) {
+      bindings.erase(existing);
+    }
+
+    if (false == noWait) {
+      sendMethod(conn, ch.m_id, bind ? QUEUE_BIND_OK : QUEUE_UNBIND_OK);
+    }
+  }
+
+  void queueRemove(connection& conn, channel& ch, wireReader& args,
+                   bool remove) {
+    const uint32_t method = remove ? QUEUE_DELETE : QUEUE_PURGE;
+    args.Short();
+    std::string name = args.ShortString();
+    uint8_t bits = args.Octet();
+    if (false == args.Ok()) return;
+    bool ifUnused = remove && (bits & 1);
+    bool ifEmpty = remove && (bits & 2);
+    bool noWait = remove ? (bits & 4) : (bits & 1);
+
+    size_t count = 0;
+    auto found = m_queues.find(name);
+    if (found != m_queues.end()) {
+      queue& target = found->second;
+      if (false == ownedBy(target, conn)) {
+        lockedError(conn, ch, name, method);
+        return;
+      }
+      if ((ifUnused && false == target.m_consumers.empty()) ||
+          (ifEmpty && false == target.m_messages.empty())) {
+        channelError(conn, ch, PRECONDITION_FAILED,
+                     "PRECONDITION_FAILED - queue '" + name + "' in use",
+                     method);
+        return;
+      }
+      count = target.m_messages.size();
+      if (remove) {
+        deleteQueue(name);
+      } else {
+        target.m_messages.clear();
+      }
+    } else if (false == remove) {
+      channelError(conn, ch, NOT_FOUND, "NOT_FOUND - no queue '" + name + "'",
+                   method);
+      return;
+    }
+
+    if (noWait) return;
+    std::string reply;
+    put32(reply, count);
+    sendMethod(conn, ch.m_id, remove ? QUEUE_DELETE_OK : QUEUE_PURGE_OK,
+               reply);
+  }
+
+  void basicConsume(connection& conn, channel& ch, wireReader& args) {
+    args.Short();
+    std::string queueName = args.ShortString();
+    std::string tag = args.ShortString();
+    uint8_t bits = args.Octet();
+    args.SkipTable();
+    if (false == args.Ok()) return;
+    bool noAck = bits & 2;
+    bool exclusive = bits & 4;
+    bool noWait = bits & 8;
+
+    auto found = m_queues.find(queueName);
+    if (found == m_queues.end()) {
+      channelError(conn, ch, NOT_FOUND,
+                   "NOT_FOUND - no queue '" + queueName + "'", BASIC_CONSUME);
+      return;
+    }
+    queue& target = found->second;
+    if (false == ownedBy(target, conn)) {
+      lockedError(conn, ch, queueName, BASIC_CONSUME);
+      return;
+    }
+    if (exclusive && false == target.m_consumers.empty()) {
+      channelError(conn, ch, ACCESS_REFUSED,
+                   "ACCESS_REFUSED - queue '" + queueName +
+                       "' in exclusive use",
+                   BASIC_CONSUME);
+      return;
+    }
+    if (tag.empty()) tag = "amq.ctag-" + std::to_string(++m_generatedNames);
+    if (ch.m_consumers.count(tag) != 0) {
+      connectionError(conn, NOT_ALLOWED,
+                      "NOT_ALLOWED - attempt to reuse consumer tag '" + tag +
+                          "'",
+                      BASIC_CONSUME);
+      return;
+    }
+
+    std::shared_ptr<consumer> added(new consumer{
+        &conn, &ch, tag, queueName, noAck, ch.m_consumerPrefetch, 0});
+    ch.m_consumers[tag] = added;
+    target.m_consumers.push_back(added);
+
+    if (noWait) return;
+    std::string reply;
+    putShortString(reply, tag);
+    sendMethod(conn, ch.m_id, BASIC_CONSUME_OK, reply);
+  }
+
+  void publish(connection& conn, channel& ch) {
+    std::shared_ptr<message> published(new message);
+    published->m_exchange.swap(ch.m_exchange);
+    published->m_routingKey.swap(ch.m_routingKey);
+    published->m_header.swap(ch.m_header);
+    published->m_body.swap(ch.m_body);
+    ch.m_publishing = false;
+    ch.m_hasHeader = false;
+
+    auto targets = route(published->m_exchange, published->m_routingKey);
+    for (auto* target : targets) {
+      target->m_messages.push_back({published, false});
+    }
+    if (false == targets.empty()) {
+      ++m_published;
+    } else if (ch.m_mandatory) {
+      std::string args;
+      put16(args, NO_ROUTE);
+      putShortString(args, "NO_ROUTE");
+      putShortString(args, published->m_exchange);
+      putShortString(args, published->m_routingKey);
+      sendMethod(conn, ch.m_id, BASIC_RETURN, args);
+      sendContent(conn, ch.m_id, *published);
+    }
+    if (ch.m_confirming) ++ch.m_publishSeq;
+  }
+
+  std::vector<queue*> route(const std::string& exchangeName,
+                            const std::string& key) {
+    std::vector<queue*> targets;
+    if (exchangeName.empty()) {
+      auto found = m_queues.find(key);
+      if (found != m_queues.end()) targets.push_back(&found->second);
+      return targets;
+    }
+
+    auto found = m_exchanges.find(exchangeName);
+    if (found == m_exchanges.end()) return targets;
+    const exchange& source = found->second;
+    for (const auto& candidate : source.m_bindings) {
+      bool matches = source.m_type == exchangeType::FANOUT ||
+                     (source.m_type == exchangeType::DIRECT &&
+                      candidate.m_key == key) ||
+                     (source.m_type == exchangeType::TOPIC &&
+                      topicMatches(candidate.m_key, key));
+      if (false == matches) continue;
+      auto bound = m_queues.find(candidate.m_queue);
+      if (bound == m_queues.end()) continue;
+      if (std::find(targets.begin(), targets.end(), &bound->second) ==
+          targets.end()) {
+        targets.push_back(&bound->second);
+      }
+    }
+    return targets;
+  }
+
+  static std::vector<std::string> words(const std::string& key) {
+    std::vector<std::string> split;
+    if (key.empty()) return split;
+    size_t start = 0;
+    while (true) {
+      size_t dot = key.find('.', start);
+      split.push_back(key.substr(start, dot - start));
+      if (dot == std::string::npos) return split;
+      start = dot + 1;
+    }
+  }
+
+  static bool wordsMatch(const std::vector<std::string>& pattern, size_t p,
+                         const std::vector<std::string>& key, size_t k) {
+    if (p == pattern.size()) return k == key.size();
+    if (pattern[p] == "#") {
+      for (size_t rest = k; rest <= key.size(); ++rest) {
+        if (wordsMatch(pattern, p + 1, key, rest)) return true;
+      }
+      return false;
+    }
+    if (k == key.size()) return false;
+    if (pattern[p] != "*" && pattern[p] != key[k]) return false;
+    return wordsMatch(pattern, p + 1, key, k + 1);
+  }
+
+  static bool topicMatches(const std::string& pattern,
+                           const std::string& key) {
+    return wordsMatch(words(pattern), 0, words(key), 0);
+  }
+
+  bool canDeliver(const consumer& target) const {
+    const connection& conn = *target.m_connection;
+    const channel& ch = *target.m_channel;
+    if (conn.m_closing || conn.m_closeAfterFlush || conn.m_dead ||
+        ch.m_closing || false == ch.m_active ||
+        conn.m_out.size() >= OUTPUT_HIGH_WATER) {
+      return false;
+    }
+    if (target.m_noAck) return true;
+    return (0 == target.m_prefetch || target.m_unacked < target.m_prefetch) &&
+           (0 == ch.m_prefetch || ch.m_unacked.size() < ch.m_prefetch);
+  }
+
+  void dispatch(queue& source) {
+    while (false == source.m_messages.empty() &&
+           false == source.m_consumers.empty()) {
+      bool delivered = false;
+      for (size_t tried = 0; tried < source.m_consumers.size(); ++tried) {
+        auto& target =
+            source.m_consumers[source.m_nextConsumer++ %
+                               source.m_consumers.size()];
+        if (false == canDeliver(*target)) continue;
+        deliver(source, target, source.m_messages.front());
+        source.m_messages.pop_front();
+        delivered = true;
+        break;
+      }
+      if (false == delivered) return;
+    }
+  }
+
+  void deliver(queue& source, const std::shared_ptr<consumer>& target,
+               const queued& entry) {
+    connection& conn = *target->m_connection;
+    channel& ch = *target->m_channel;
+    uint64_t tag = ++ch.m_deliveryTag;
+
+    std::string args;
+    putShortString(args, target->m_tag);
+    put64(args, tag);
+    put8(args, entry.m_redelivered ? 1 : 0);
+    putShortString(args, entry.m_message->m_exchange);
+    putShortString(args, entry.m_message->m_routingKey);
+    sendMethod(conn, ch.m_id, BASIC_DELIVER, args);
+    sendContent(conn, ch.m_id, *entry.m_message);
+
+    if (false == target->m_noAck) {
+      ch.m_unacked[tag] = unacked{source.m_name, entry, target};
+      ++target->m_unacked;
+    }
+    ++m_delivered;
+  }
+
+  void settle(connection& conn, channel& ch, uint64_t tag, bool multiple,
+              bool requeue, uint32_t method) {
+    std::vector<unacked> settled;
+    if (multiple) {
+      auto last = 0 == tag ? ch.m_unacked.end() : ch.m_unacked.upper_bound(tag);
+      for (auto it = ch.m_unacked.begin(); it != last; ++it) {
+        settled.push_back(std::move(it->second));
+      }
+      ch.m_unacked.erase(ch.m_unacked.begin(), last);
+    } else {
+      auto found = ch.m_unacked.find(tag);
+      if (found == ch.m_unacked.end()) {
+        channelError(conn, ch, PRECONDITION_FAILED,
+                     "PRECONDITION_FAILED - unknown delivery tag " +
+                         std::to_string(tag),
+                     method);
+        return;
+      }
+      settled.push_back(std::move(found->second));
+      ch.m_unacked.erase(found);
+    }
+
+    for (auto& entry : settled) --entry.m_consumer->m_unacked;
+    if (false == requeue) return;
+    // Back at the head of their queues, in the order they were delivered
+    for (auto it = settled.rbegin(); it != settled.rend(); ++it) {
+      auto found = m_queues.find(it->m_queue);
+      if (found == m_queues.end()) continue;
+      it->m_entry.m_redelivered = true;
+      found->second.m_messages.push_front(it->m_entry);
+    }
+  }
+
+  void removeConsumer(const std::shared_ptr<consumer>& removed) {
+    auto found = m_queues.find(removed->m_queue);
+    if (found == m_queues.end()) return;
+    auto& consumers = found->second.m_consumers;
+    consumers.erase(std::remove(consumers.begin(), consumers.end(), removed),
+                    consumers.end());
+    if (found->second.m_autoDelete && consumers.empty()) {
+      deleteQueue(removed->m_queue);
+    }
+  }
+
+  // Cancel a channel's consumers and requeue what they hadn't acknowledged
+  void releaseChannel(connection& conn, channel& ch) {
+    auto consumers = std::move(ch.m_consumers);
+    ch.m_consumers.clear();
+    for (auto& entry : consumers) removeConsumer(entry.second);
+    settle(conn, ch, 0, true, true, 0);
+    ch.m_publishing = false;
+  }
+
+  void deleteQueue(const std::string& name) {
+    auto found = m_queues.find(name);
+    if (found == m_queues.end()) return;
+    for (auto& entry : m_exchanges) {
+      auto& bindings = entry.second.m_bindings;
+      bindings.erase(std::remove_if(bindings.begin(), bindings.end(),
+                                    [&](const binding& candidate) {
+                                      return candidate.m_queue == name;
+                                    }),
+                     bindings.end());
+    }
+    for (auto& entry : found->second.m_consumers) {
+      entry->m_channel->m_consumers.erase(entry->m_tag);
+    }
+    m_queues.erase(found);
+  }
+
+  void declareExchange(const std::string& name, exchangeType type) {
+    exchange& declared = m_exchanges[name];
+    declared.m_type = type;
+  }
+
+  static bool ownedBy(const queue& target, const connection& conn) {
+    return target.m_owner == nullptr || target.m_owner == &conn;
+  }
+
+  void lockedError(connection& conn, channel& ch, const std::string& name,
+                   uint32_t method) {
+    channelError(conn, ch, RESOURCE_LOCKED,
+                 "RESOURCE_LOCKED - cannot obtain exclusive access to locked "
+                 "queue '" + name + "'",
+                 method);
+  }
+
+  void channelError(connection& conn, channel& ch, uint16_t code,
+                    const std::string& text, uint32_t method) {
+    releaseChannel(conn, ch);
+    ch.m_closing = true;
+    sendMethod(conn, ch.m_id, CHANNEL_CLOSE,
+               closeArguments(code, text, method));
+  }
+
+  void connectionError(connection& conn, uint16_t code,
+                       const std::string& text, uint32_t method) {
+    if (conn.m_closing) return;
+    conn.m_closing = true;
+    sendMethod(conn, 0, CONNECTION_CLOSE, closeArguments(code, text, method));
+  }
+
+  static std::string closeArguments(uint16_t code, const std::string& text,
+                                    uint32_t method) {
+    std::string args;
+    put16(args, code);
+    putShortString(args, text);
+    put32(args, method);
+    return args;
+  }
+
+  void sendStart(connection& conn) {
+    std::string capabilities;
+    putTableEntry(capabilities, "publisher_confirms", 't', std::string(1, 1));
+    putTableEntry(capabilities, "basic.nack", 't', std::string(1, 1));
+    putTableEntry(capabilities, "per_consumer_qos", 't', std::string(1, 1));
+    std::string properties;
+    putTableEntry(properties, "product", 'S',
+                  longString("HareCpp stand-in broker"));
+    putTableEntry(properties, "capabilities", 'F', longString(capabilities));
+
+    std::string args;
+    put8(args, 0);
+    put8(args, 9);
+    putLongString(args, properties);
+    putLongString(args, "PLAIN");
+    putLongString(args, "en_US");
+    sendMethod(conn, 0, CONNECTION_START, args);
+    conn.m_stage = stage::START_OK;
+  }
+
+  void sendMethod(connection& conn, uint16_t channelId, uint32_t method,
+                  const std::string& args = std::string()) {
+    std::string frame;
+    frame.reserve(args.size() + FRAME_OVERHEAD + 4);
+    put8(frame, FRAME_METHOD);
+    put16(frame, channelId);
+    put32(frame, args.size() + 4);
+    put32(frame, method);
+    frame.append(args);
+    put8(frame, FRAME_END);
+    write(conn, frame);
+  }
+
+  void sendContent(connection& conn, uint16_t channelId,
+                   const message& content) {
+    std::string frames;
+    frames.reserve(content.m_header.size() + content.m_body.size() +
+                   FRAME_OVERHEAD * 2);
+    put8(frames, FRAME_HEADER);
+    put16(frames, channelId);
+    put32(frames, content.m_header.size());
+    frames.append(content.m_header);
+    put8(frames, FRAME_END);
+
+    const size_t chunk = conn.m_frameMax - FRAME_OVERHEAD;
+    for (size_t sent = 0; sent < content.m_body.size(); sent += chunk) {
+      size_t length = std::min(chunk, content.m_body.size() - sent);
+      put8(frames, FRAME_BODY);
+      put16(frames, channelId);
+      put32(frames, length);
+      frames.append(content.m_body, sent, length);
+      put8(frames, FRAME_END);
+    }
+    write(conn, frames);
+  }
+
+  const std::string m_username;
+  const std::string m_password;
+  const std::string m_unixPath;
+  int m_port;
+  int m_tcpFd;
+  int m_unixFd;
+  std::atomic<bool> m_running;
+  std::atomic<uint64_t> m_published;
+  std::atomic<uint64_t> m_delivered;
+  uint64_t m_generatedNames;
+
+  // Everything below belongs to the serving thread while it holds m_mutex
+  std::mutex m_mutex;
+  std::map<int, std::unique_ptr<connection>> m_connections;
+  std::map<std::string, exchange> m_exchanges;
+  std::map<std::string, queue> m_queues;
+  std::thread m_thread;
+};
+
+}  // namespace HareTest
+
+#endif
@@ -0,0 +1,300 @@
+#include "StandInBroker.hpp"
+
+#include <amqp.h>
+#include <amqp_framing.h>
+#include <amqp_tcp_socket.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "Consumer.hpp"
+#include "Producer.hpp"
+#include "gtest/gtest.h"
+
+namespace {
+// Plain rabbitmq-c connection with channel 1 open, for the broker features
+// HareCpp itself doesn't use
+class RawClient {
+ public:
+  RawClient(int port, const std::string& password = "guest")
+      : m_conn(amqp_new_connection()), m_open(false) {
+    amqp_socket_t* socket = amqp_tcp_socket_new(m_conn);
+    if (socket == nullptr ||
+        amqp_socket_open(socket, "127.0.0.1", port) != AMQP_STATUS_OK) {
+      return;
+    }
+    auto login = amqp_login(m_conn, "/", 0, 131072, 0, AMQP_SASL_METHOD_PLAIN,
+                            "guest", password.c_str());
+    if (login.reply_type != AMQP_RESPONSE_NORMAL) return;
+    amqp_channel_open(m_conn, 1);
+    m_open = Ok();
+  }
+  ~RawClient() {
+    if (m_open) {
+      amqp_channel_close(m_conn, 1, AMQP_REPLY_SUCCESS);
+      amqp_connection_close(m_conn, AMQP_REPLY_SUCCESS);
+    }
+    amqp_destroy_connection(m_conn);
+  }
+
+  bool IsOpen() const { return m_open; }
+
+  // Whether the last synchronous call was answered normally
+  bool Ok() {
+    return amqp_get_rpc_reply(m_conn).reply_type == AMQP_RESPONSE_NORMAL;
+  }
+
+  // Id of the method that closed the channel or connection, 0 if none did
+  amqp_method_number_t ClosedBy() {
+    auto reply = amqp_get_rpc_reply(m_conn);
+    if (reply.reply_type != AMQP_RESPONSE_SERVER_EXCEPTION) return 0;
+    return reply.reply.id;
+  }
+
+  std::string DeclareQueue(const std::string& name = "") {
+    auto* declared =
+        amqp_queue_declare(m_conn, 1, amqp_cstring_bytes(name.c_str()), 0, 0,
+                           0, 0, amqp_empty_table);
+    if (declared == nullptr) return std::string();
+    return std::string(static_cast<char*>(declared->queue.bytes),
+                       declared->queue.len);
+  }
+
+  bool Bind(const std::string& queue, const std::string& exchange,
+            const std::string& key) {
+    amqp_queue_bind(m_conn, 1, amqp_cstring_bytes(queue.c_str()),
+                    amqp_cstring_bytes(exchange.c_str()),
+                    amqp_cstring_bytes(key.c_str()), amqp_empty_table);
+    return Ok();
+  }
+
+  bool Consume(const std::string& queue, bool noAck) {
+    amqp_basic_consume(m_conn, 1, amqp_cstring_bytes(queue.c_str()),
+                       amqp_empty_bytes, 0, noAck ? 1 : 0, 0,
+                       amqp_empty_table);
+    return Ok();
+  }
+
+  int Publish(const std::string& exchange, const std::string& key,
+              const std::string& body, bool mandatory = false) {
+    return amqp_basic_publish(m_conn, 1, amqp_cstring_bytes(exchange.c_str()),
+                              amqp_cstring_bytes(key.c_str()),
+                              mandatory ? 1 : 0, 0, nullptr,
+                              amqp_cstring_bytes(body.c_str()));
+  }
+
+  // Next delivery's body, empty when nothing arrived within the timeout
+  std::string Receive(uint64_t& deliveryTag, bool& redelivered,
+                      int timeoutMs = 1000) {
+    amqp_maybe_release_buffers(m_conn);
+    amqp_envelope_t envelope;
+    struct timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    auto reply = amqp_consume_message(m_conn, &envelope, &timeout, 0);
+    if (reply.reply_type != AMQP_RESPONSE_NORMAL) return std::string();
+    deliveryTag = envelope.delivery_tag;
+    redelivered = envelope.redelivered;
+    std::string body(static_cast<char*>(envelope.message.body.bytes),
+                     envelope.message.body.len);
+    amqp_destroy_envelope(&envelope);
+    return body;
+  }
+
+  std::string Receive(int timeoutMs = 1000) {
+    uint64_t deliveryTag;
+    bool redelivered;
+    return Receive(deliveryTag, redelivered, timeoutMs);
+  }
+
+  // Next method frame on channel 1, 0 when none arrived within a second
+  amqp_method_number_t NextMethod() {
+    amqp_frame_t frame;
+    struct timeval timeout = {1, 0};
+    if (amqp_simple_wait_frame_noblock(m_conn, &frame, &timeout) !=
+            AMQP_STATUS_OK ||
+        frame.frame_type != AMQP_FRAME_METHOD) {
+      return 0;
+    }
+    return frame.payload.method.id;
+  }
+
+  amqp_connection_state_t Connection() { return m_conn; }
+
+ private:
+  amqp_connection_state_t m_conn;
+  bool m_open;
+};
+}  // namespace
+
+TEST(StandInBrokerTest, listensOnLoopback) {
+  HareTest::StandInBroker broker;
+  ASSERT_NE(0, broker.Port());
+  RawClient client(broker.Port());
+  ASSERT_TRUE(client.IsOpen());
+}
+
+TEST(StandInBrokerTest, refusesWrongPassword) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port(), "wrong");
+  ASSERT_FALSE(client.IsOpen());
+}
+
+TEST(StandInBrokerTest, routesByExchangeType) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  ASSERT_TRUE(client.IsOpen());
+
+  auto queue = client.DeclareQueue();
+  ASSERT_FALSE(queue.empty());
+  ASSERT_TRUE(client.Bind(queue, "amq.direct", "exact"));
+  ASSERT_TRUE(client.Bind(queue, "amq.topic", "logs.*.error"));
+  ASSERT_TRUE(client.Bind(queue, "amq.fanout", ""));
+  ASSERT_TRUE(client.Consume(queue, true));
+
+  client.Publish("amq.direct", "other", "skipped");
+  client.Publish("amq.direct", "exact", "direct");
+  client.Publish("amq.topic", "logs.a.b.error", "skipped");
+  client.Publish("amq.topic", "logs.db.error", "topic");
+  client.Publish("amq.fanout", "anything", "fanout");
+  client.Publish("", queue, "default");
+
+  ASSERT_EQ("direct", client.Receive());
+  ASSERT_EQ("topic", client.Receive());
+  ASSERT_EQ("fanout", client.Receive());
+  ASSERT_EQ("default", client.Receive());
+  ASSERT_EQ("", client.Receive(100));
+}
+
+TEST(StandInBrokerTest, topicWildcards) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  auto queue = client.DeclareQueue();
+  ASSERT_TRUE(client.Bind(queue, "amq.topic", "#.audit"));
+  ASSERT_TRUE(client.Consume(queue, true));
+
+  client.Publish("amq.topic", "audit", "zero words");
+  client.Publish("amq.topic", "a.b.c.audit", "many words");
+  client.Publish("amq.topic", "audit.not", "wrong tail");
+  ASSERT_EQ("zero words", client.Receive());
+  ASSERT_EQ("many words", client.Receive());
+  ASSERT_EQ("", client.Receive(100));
+}
+
+TEST(StandInBrokerTest, prefetchHoldsBackUntilAck) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  auto queue = client.DeclareQueue();
+  amqp_basic_qos(client.Connection(), 1, 0, 1, 0);
+  ASSERT_TRUE(client.Ok());
+  ASSERT_TRUE(client.Consume(queue, false));
+
+  client.Publish("", queue, "first");
+  client.Publish("", queue, "second");
+  uint64_t tag;
+  bool redelivered;
+  ASSERT_EQ("first", client.Receive(tag, redelivered));
+  ASSERT_EQ("", client.Receive(200));
+  ASSERT_EQ(1u, broker.QueueDepth(queue));
+
+  ASSERT_EQ(0, amqp_basic_ack(client.Connection(), 1, tag, 0));
+  ASSERT_EQ("second", client.Receive());
+}
+
+TEST(StandInBrokerTest, nackRequeuesAsRedelivered) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  auto queue = client.DeclareQueue();
+  ASSERT_TRUE(client.Consume(queue, false));
+  client.Publish("", queue, "again");
+
+  uint64_t tag;
+  bool redelivered = true;
+  ASSERT_EQ("again", client.Receive(tag, redelivered));
+  ASSERT_FALSE(redelivered);
+  ASSERT_EQ(0, amqp_basic_nack(client.Connection(), 1, tag, 0, 1));
+  ASSERT_EQ("again", client.Receive(tag, redelivered));
+  ASSERT_TRUE(redelivered);
+
+  ASSERT_EQ(0, amqp_basic_reject(client.Connection(), 1, tag, 0));
+  ASSERT_EQ("", client.Receive(100));
+  ASSERT_EQ(0u, broker.QueueDepth(queue));
+}
+
+TEST(StandInBrokerTest, unackedReturnToQueueOnClose) {
+  HareTest::StandInBroker broker;
+  std::string queue;
+  {
+    RawClient client(broker.Port());
+    queue = client.DeclareQueue("standInRequeue");
+    ASSERT_TRUE(client.Consume(queue, false));
+    client.Publish("", queue, "kept");
+    ASSERT_EQ("kept", client.Receive());
+  }
+  RawClient other(broker.Port());
+  ASSERT_TRUE(other.Consume(queue, true));
+  uint64_t tag;
+  bool redelivered = false;
+  ASSERT_EQ("kept", other.Receive(tag, redelivered));
+  ASSERT_TRUE(redelivered);
+}
+
+TEST(StandInBrokerTest, confirmsPublishes) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  auto queue = client.DeclareQueue();
+  amqp_confirm_select(client.Connection(), 1);
+  ASSERT_TRUE(client.Ok());
+
+  ASSERT_EQ(AMQP_STATUS_OK, client.Publish("", queue, "confirmed"));
+  ASSERT_EQ(static_cast<amqp_method_number_t>(AMQP_BASIC_ACK_METHOD),
+            client.NextMethod());
+  ASSERT_EQ(1u, broker.Published());
+}
+
+TEST(StandInBrokerTest, returnsUnroutableMandatory) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  ASSERT_EQ(AMQP_STATUS_OK,
+            client.Publish("amq.direct", "nobodyHome", "lost", true));
+  ASSERT_EQ(static_cast<amqp_method_number_t>(AMQP_BASIC_RETURN_METHOD),
+            client.NextMethod());
+  ASSERT_EQ(0u, broker.Published());
+}
+
+TEST(StandInBrokerTest, reportsErrorsLikeRabbit) {
+  HareTest::StandInBroker broker;
+  RawClient client(broker.Port());
+  amqp_queue_declare(client.Connection(), 1, amqp_cstring_bytes("missing"), 1,
+                     0, 0, 0, amqp_empty_table);
+  ASSERT_EQ(static_cast<amqp_method_number_t>(AMQP_CHANNEL_CLOSE_METHOD),
+            client.ClosedBy());
+}
+
+TEST(StandInBrokerTest, producerToConsumer) {
+  HareTest::StandInBroker broker;
+  std::atomic<int> received(0);
+  HareCpp::Consumer consumer;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            consumer.Initialize("127.0.0.1", broker.Port()));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            consumer.Subscribe("amq.topic", "standIn.#",
+                               [&received](const HareCpp::Message& message) {
+                                 if (std::string(message.Payload()) == "hi") {
+                                   ++received;
+                                 }
+                               }));
+  HareCpp::Producer producer;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            producer.Initialize("127.0.0.1", broker.Port()));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, consumer.Start());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, producer.Start());
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (received < 3 && std::chrono::steady_clock::now() < deadline) {
+    HareCpp::Message message("hi");
+    producer.Send("amq.topic", "standIn.test", message);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_GE(received.load(), 3);
+}
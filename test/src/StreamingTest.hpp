@@ -0,0 +1,331 @@
+#include "HeadersTable.hpp"
+#include "Producer.hpp"
+#include "Streaming.hpp"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::string streamDirectory() {
+  const std::string directory =
+      "/tmp/harecpp_stream_test_" + std::to_string(getpid());
+  mkdir(directory.c_str(), 0755);
+  return directory;
+}
+
+std::string streamBytes(size_t length) {
+  std::string bytes(length, '\0');
+  for (size_t i = 0; i < length; i++) bytes[i] = static_cast<char>(i * 7 + 3);
+  return bytes;
+}
+
+std::string fileContents(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+bool fileExists(const std::string& path) {
+  return 0 == access(path.c_str(), F_OK);
+}
+
+// Every chunk of a stream of bytes, as StreamSender would send them
+std::vector<HareCpp::Message> streamChunks(const std::string& streamId,
+                                           const std::string& bytes,
+                                           size_t chunkBytes) {
+  HareCpp::Producer producer;
+  HareCpp::StreamSender sender(producer, chunkBytes);
+  std::vector<HareCpp::Message> chunks(
+      HareCpp::StreamSender::ChunkCount(bytes.size(), chunkBytes));
+  for (size_t i = 0; i < chunks.size(); i++) {
+    EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+              sender.BuildChunk(
+                  streamId, bytes.size(), i,
+                  [&bytes](uint64_t offset, char* out, size_t length) {
+                    memcpy(out, bytes.data() + offset, length);
+                    return true;
+                  },
+                  chunks[i]));
+  }
+  return chunks;
+}
+
+}  // namespace
+
+TEST(StreamingTest, chunkHeaders) {
+  auto chunks = streamChunks("headers", streamBytes(2500), 1000);
+  ASSERT_EQ(3u, chunks.size());
+  ASSERT_EQ(500u, chunks[2].Length());
+  int64_t value = 0;
+  ASSERT_TRUE(chunks[2].HeaderInt(STREAM_CHUNK_HEADER, value));
+  ASSERT_EQ(2, value);
+  ASSERT_TRUE(chunks[2].HeaderInt(STREAM_LENGTH_HEADER, value));
+  ASSERT_EQ(2500, value);
+  ASSERT_TRUE(chunks[2].HeaderInt(STREAM_CHUNK_BYTES_HEADER, value));
+  ASSERT_EQ(1000, value);
+  amqp_bytes_t streamId;
+  ASSERT_TRUE(chunks[2].HeaderBytes(STREAM_ID_HEADER, streamId));
+  ASSERT_EQ("headers", HareCpp::hare_bytes_to_string(streamId));
+
+  HareCpp::Producer producer;
+  HareCpp::StreamSender sender(producer, 1000);
+  HareCpp::Message message;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            sender.BuildChunk("headers", 2500, 3,
+                              [](uint64_t, char*, size_t) { return true; },
+                              message));
+  ASSERT_EQ(1u, HareCpp::StreamSender::ChunkCount(0, 1000));
+}
+
+TEST(StreamingTest, fileOutOfOrderWithLoss) {
+  const std::string directory = streamDirectory();
+  const std::string path = directory + "/lossy";
+  const std::string bytes = streamBytes(10000);
+  auto chunks = streamChunks("lossy", bytes, 1024);
+  ASSERT_EQ(10u, chunks.size());
+
+  std::vector<std::string> done;
+  HareCpp::StreamReceiver receiver(
+      directory, [&done](const std::string& streamId) {
+        done.push_back(streamId);
+      });
+  for (size_t i = chunks.size(); i-- > 0;) {
+    if (i != 3 && i != 7) {
+      ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[i]));
+    }
+  }
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[0]));
+  ASSERT_EQ((std::vector<uint64_t>{3, 7}), receiver.Missing("lossy"));
+  ASSERT_EQ((std::vector<uint64_t>{3}), receiver.Missing("lossy", 1));
+  ASSERT_EQ(1u, receiver.InProgress());
+  ASSERT_TRUE(done.empty());
+
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[7]));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[3]));
+  ASSERT_EQ(std::vector<std::string>{"lossy"}, done);
+  ASSERT_EQ(0u, receiver.InProgress());
+  ASSERT_TRUE(receiver.Missing("lossy").empty());
+  ASSERT_EQ(bytes, fileContents(path));
+  ASSERT_FALSE(fileExists(path + ".progress"));
+
+  // A late resend of a finished stream leaves it be
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[5]));
+  ASSERT_EQ(bytes, fileContents(path));
+  ASSERT_EQ(1u, done.size());
+  unlink(path.c_str());
+}
+
+TEST(StreamingTest, fileResumedByNewReceiver) {
+  const std::string directory = streamDirectory();
+  const std::string path = directory + "/resumed";
+  const std::string bytes = streamBytes(5000);
+  auto chunks = streamChunks("resumed", bytes, 1000);
+  {
+    HareCpp::StreamReceiver receiver(directory);
+    for (size_t i = 0; i < 3; i++) {
+      ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[i]));
+    }
+  }
+  ASSERT_TRUE(fileExists(path + ".progress"));
+
+  bool finished = false;
+  HareCpp::StreamReceiver receiver(
+      directory, [&finished](const std::string&) { finished = true; });
+  ASSERT_EQ((std::vector<uint64_t>{3, 4}), receiver.Missing("resumed"));
+  ASSERT_TRUE(receiver.Missing("neverSent").empty());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[4]));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[3]));
+  ASSERT_TRUE(finished);
+  ASSERT_EQ(bytes, fileContents(path));
+  ASSERT_FALSE(fileExists(path + ".progress"));
+  unlink(path.c_str());
+}
+
+TEST(StreamingTest, finishedStreamSeenByNewReceiver) {
+  const std::string directory = streamDirectory();
+  const std::string path = directory + "/again";
+  const std::string bytes = streamBytes(3000);
+  auto chunks = streamChunks("again", bytes, 1000);
+  {
+    HareCpp::StreamReceiver receiver(directory);
+    for (auto& chunk : chunks) {
+      ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunk));
+    }
+  }
+  ASSERT_FALSE(fileExists(path + ".progress"));
+
+  // A redelivery after a restart leaves the finished file be
+  bool finished = false;
+  HareCpp::StreamReceiver receiver(
+      directory, [&finished](const std::string&) { finished = true; });
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[1]));
+  ASSERT_EQ(bytes, fileContents(path));
+  ASSERT_FALSE(fileExists(path + ".progress"));
+  ASSERT_EQ(0u, receiver.InProgress());
+  ASSERT_FALSE(finished);
+  unlink(path.c_str());
+}
+
+TEST(StreamingTest, resendOfNothingMissingSendsNothing) {
+  const std::string bytes = streamBytes(3000);
+  HareCpp::StreamReceiver receiver(
+      [](const std::string&, const char*, size_t, uint64_t) {});
+  for (auto& chunk : streamChunks("sent", bytes, 1000)) {
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunk));
+  }
+
+  // Not started, sent chunks stay queued in it
+  HareCpp::Producer producer;
+  HareCpp::StreamSender sender(producer, 1000, 100);
+  auto read = [&bytes](uint64_t offset, char* out, size_t length) {
+    memcpy(out, bytes.data() + offset, length);
+    return true;
+  };
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            sender.Send("amq.direct", "stream", "sent", bytes.size(), read,
+                        receiver.Missing("sent")));
+  ASSERT_EQ(0, producer.QueueSize());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            sender.Send("amq.direct", "stream", "sent", bytes.size(), read));
+  ASSERT_EQ(3, producer.QueueSize());
+}
+
+TEST(StreamingTest, finishedIdsBounded) {
+  std::vector<std::string> done;
+  HareCpp::StreamReceiver receiver(
+      [](const std::string&, const char*, size_t, uint64_t) {},
+      [&done](const std::string& streamId) { done.push_back(streamId); });
+  const auto first = streamChunks("finished0", "x", 1000);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(first[0]));
+  HareCpp::Message latest;
+  for (size_t i = 1; i <= STREAM_FINISHED_IDS; i++) {
+    latest = streamChunks("finished" + std::to_string(i), "x", 1000)[0];
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(latest));
+  }
+  ASSERT_EQ(STREAM_FINISHED_IDS + 1, done.size());
+
+  // The most recent is still known, the oldest has been forgotten
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(latest));
+  ASSERT_EQ(STREAM_FINISHED_IDS + 1, done.size());
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(first[0]));
+  ASSERT_EQ(STREAM_FINISHED_IDS + 2, done.size());
+}
+
+TEST(StreamingTest, callbackInOrder) {
+  const std::string bytes = streamBytes(4096 + 10);
+  auto chunks = streamChunks("ordered", bytes, 512);
+  ASSERT_EQ(9u, chunks.size());
+
+  std::string received;
+  uint64_t expectedOffset = 0;
+  bool finished = false;
+  HareCpp::StreamReceiver receiver(
+      [&](const std::string& streamId, const char* data, size_t length,
+          uint64_t offset) {
+        EXPECT_EQ("ordered", streamId);
+        EXPECT_EQ(expectedOffset, offset);
+        received.append(data, length);
+        expectedOffset += length;
+      },
+      [&finished](const std::string&) { finished = true; });
+
+  const size_t order[] = {1, 2, 0, 3, 5, 6, 7, 8};
+  for (auto i : order) {
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[i]));
+  }
+  ASSERT_EQ(bytes.substr(0, 4 * 512), received);
+  ASSERT_EQ((std::vector<uint64_t>{4}), receiver.Missing("ordered"));
+  ASSERT_FALSE(finished);
+
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[4]));
+  ASSERT_EQ(bytes, received);
+  ASSERT_TRUE(finished);
+}
+
+TEST(StreamingTest, rejectsWhatDoesNotFit) {
+  HareCpp::StreamReceiver receiver(
+      [](const std::string&, const char*, size_t, uint64_t) {});
+  HareCpp::Message plain("not a chunk");
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS, receiver.Receive(plain));
+
+  auto chunks = streamChunks("shape", streamBytes(3000), 1000);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[1]));
+  // Same stream id, another length
+  auto other = streamChunks("shape", streamBytes(2000), 1000);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            receiver.Receive(other[0]));
+  chunks[0].SetPayload("short");
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            receiver.Receive(chunks[0]));
+
+  HareCpp::StreamReceiver files(streamDirectory());
+  auto escaping = streamChunks("../escape", streamBytes(10), 1000);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            files.Receive(escaping[0]));
+}
+
+TEST(StreamingTest, rejectsOversizedShape) {
+  // A chunk of a stream far too finely cut to keep track of
+  HareCpp::Message hostile("x");
+  hostile.SetHeaders(HareCpp::HeadersBuilder()
+                         .AddString(STREAM_ID_HEADER, "huge")
+                         .AddInt(STREAM_LENGTH_HEADER, int64_t(1) << 62)
+                         .AddInt(STREAM_CHUNK_BYTES_HEADER, 1)
+                         .AddInt(STREAM_CHUNK_HEADER, 0)
+                         .Build());
+
+  HareCpp::StreamReceiver receiver(
+      [](const std::string&, const char*, size_t, uint64_t) {});
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            receiver.Receive(hostile));
+  ASSERT_TRUE(receiver.Missing("huge").empty());
+
+  const std::string directory = streamDirectory();
+  HareCpp::StreamReceiver files(directory);
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS, files.Receive(hostile));
+  ASSERT_FALSE(fileExists(directory + "/huge.progress"));
+}
+
+TEST(StreamingTest, truncatedFileNotResumed) {
+  const std::string directory = streamDirectory();
+  const std::string path = directory + "/truncated";
+  auto chunks = streamChunks("truncated", streamBytes(5000), 1000);
+  {
+    HareCpp::StreamReceiver receiver(directory);
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[0]));
+  }
+  ASSERT_EQ(0, truncate(path.c_str(), 100));
+
+  HareCpp::StreamReceiver receiver(directory);
+  ASSERT_TRUE(receiver.Missing("truncated").empty());
+  // Starts over rather than writing past the end of the file
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[3]));
+  ASSERT_EQ((std::vector<uint64_t>{0, 1, 2, 4}), receiver.Missing("truncated"));
+  unlink(path.c_str());
+  unlink((path + ".progress").c_str());
+}
+
+TEST(StreamingTest, emptyStream) {
+  const std::string directory = streamDirectory();
+  auto chunks = streamChunks("empty", "", 1000);
+  ASSERT_EQ(1u, chunks.size());
+  bool finished = false;
+  HareCpp::StreamReceiver receiver(
+      directory, [&finished](const std::string&) { finished = true; });
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, receiver.Receive(chunks[0]));
+  ASSERT_TRUE(finished);
+  ASSERT_TRUE(fileExists(directory + "/empty"));
+  ASSERT_EQ("", fileContents(directory + "/empty"));
+  unlink((directory + "/empty").c_str());
+  rmdir(directory.c_str());
+}
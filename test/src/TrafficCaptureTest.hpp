@@ -0,0 +1,239 @@
+#include "ChannelHandler.hpp"
+#include "LatencyHistogram.hpp"
+#include "TrafficCapture.hpp"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::string capturePath() {
+  return "/tmp/harecpp_capture_test_" + std::to_string(getpid());
+}
+
+bool segmentExists(const std::string& path, const char* suffix) {
+  return 0 == access((path + suffix).c_str(), F_OK);
+}
+
+void removeCapture(const std::string& path) {
+  for (int index = 0;; index++) {
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%06d", index);
+    if (0 != unlink((path + suffix).c_str())) break;
+  }
+}
+
+/**
+ * A delivery as amqp_consume_message() would fill it in, pointing at the
+ * strings given
+ */
+struct testEnvelope {
+  testEnvelope(const std::string& exchange, const std::string& routingKey,
+               const std::string& body)
+      : m_exchange(exchange), m_routingKey(routingKey), m_body(body) {
+    memset(&m_envelope, 0, sizeof(m_envelope));
+    m_envelope.exchange = amqp_cstring_bytes(m_exchange.c_str());
+    m_envelope.routing_key = amqp_cstring_bytes(m_routingKey.c_str());
+    m_envelope.message.body.len = m_body.size();
+    m_envelope.message.body.bytes = &m_body[0];
+  }
+
+  std::string m_exchange;
+  std::string m_routingKey;
+  std::string m_body;
+  amqp_envelope_t m_envelope;
+};
+
+std::string bytesString(const amqp_bytes_t& bytes) {
+  return std::string(static_cast<const char*>(bytes.bytes), bytes.len);
+}
+
+}  // namespace
+
+TEST(TrafficCaptureTest, roundTrip) {
+  const auto path = capturePath();
+  HareCpp::TrafficCapture capture;
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::NOT_INITIALIZED,
+            capture.Record(testEnvelope("ex", "key", "x").m_envelope));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, capture.Open(path));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::THREAD_ALREADY_RUNNING,
+            capture.Open(path));
+
+  testEnvelope first("orders", "orders.created", "{\"id\": 1}");
+  auto& properties = first.m_envelope.message.properties;
+  properties._flags = AMQP_BASIC_CONTENT_TYPE_FLAG |
+                      AMQP_BASIC_CORRELATION_ID_FLAG |
+                      AMQP_BASIC_DELIVERY_MODE_FLAG |
+                      AMQP_BASIC_TIMESTAMP_FLAG | AMQP_BASIC_APP_ID_FLAG;
+  properties.content_type = amqp_cstring_bytes("application/json");
+  properties.correlation_id = amqp_cstring_bytes("abc-123");
+  properties.delivery_mode = AMQP_DELIVERY_PERSISTENT;
+  properties.timestamp = 1600000000;
+  properties.app_id = amqp_cstring_bytes("");
+  testEnvelope second("orders", "orders.deleted", "");
+
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            capture.Record(first.m_envelope, 1000));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            capture.Record(second.m_envelope, 2000));
+  EXPECT_EQ(2u, capture.Recorded());
+  capture.Close();
+  EXPECT_FALSE(capture.IsOpen());
+
+  HareCpp::TrafficReplay replay;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, replay.Open(path));
+  EXPECT_EQ(2u, replay.Size());
+
+  std::vector<std::string> seen;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            replay.Replay(
+                [&seen](const HareCpp::capturedMessage& message) {
+                  seen.push_back(bytesString(message.m_exchange) + " " +
+                                 bytesString(message.m_routingKey) + " " +
+                                 bytesString(message.m_body));
+                  if (seen.size() == 1) {
+                    const auto& properties = message.m_properties;
+                    EXPECT_EQ(1000u, message.m_receivedNanos);
+                    EXPECT_NE(0, message.m_realtimeNanos);
+                    EXPECT_EQ(static_cast<amqp_flags_t>(
+                                  AMQP_BASIC_CONTENT_TYPE_FLAG |
+                                  AMQP_BASIC_CORRELATION_ID_FLAG |
+                                  AMQP_BASIC_DELIVERY_MODE_FLAG |
+                                  AMQP_BASIC_TIMESTAMP_FLAG |
+                                  AMQP_BASIC_APP_ID_FLAG),
+                              properties._flags);
+                    EXPECT_EQ("application/json",
+                              bytesString(properties.content_type));
+                    EXPECT_EQ("abc-123",
+                              bytesString(properties.correlation_id));
+                    EXPECT_EQ(AMQP_DELIVERY_PERSISTENT,
+                              properties.delivery_mode);
+                    EXPECT_EQ(1600000000u, properties.timestamp);
+                    EXPECT_EQ(0u, properties.app_id.len);
+                  } else {
+                    EXPECT_EQ(0u, message.m_properties._flags);
+                  }
+                },
+                0));
+  ASSERT_EQ(2u, seen.size());
+  EXPECT_EQ("orders orders.created {\"id\": 1}", seen[0]);
+  EXPECT_EQ("orders orders.deleted ", seen[1]);
+  replay.Close();
+  removeCapture(path);
+}
+
+TEST(TrafficCaptureTest, segments) {
+  const auto path = capturePath();
+  HareCpp::TrafficCapture capture;
+  // Room for a couple of 100 byte messages per segment
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, capture.Open(path, 512));
+  for (int i = 0; i < 10; i++) {
+    testEnvelope envelope("ex", "key", std::string(100, 'a' + i));
+    EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+              capture.Record(envelope.m_envelope));
+  }
+  // Bigger than a segment, gets one of its own
+  testEnvelope huge("ex", "key", std::string(4096, 'z'));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, capture.Record(huge.m_envelope));
+  capture.Close();
+  EXPECT_TRUE(segmentExists(path, ".000003"));
+
+  HareCpp::TrafficReplay replay;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, replay.Open(path));
+  EXPECT_EQ(11u, replay.Size());
+  std::string firstBytes;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            replay.Replay(
+                [&firstBytes](const HareCpp::capturedMessage& message) {
+                  firstBytes += static_cast<char*>(message.m_body.bytes)[0];
+                },
+                0));
+  EXPECT_EQ("abcdefghijz", firstBytes);
+  replay.Close();
+
+  // A new capture at the same path leaves nothing of the old one behind
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, capture.Open(path, 512));
+  capture.Close();
+  EXPECT_FALSE(segmentExists(path, ".000001"));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, replay.Open(path));
+  EXPECT_EQ(0u, replay.Size());
+  replay.Close();
+  removeCapture(path);
+
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS, replay.Open(path));
+}
+
+TEST(TrafficCaptureTest, pacing) {
+  const auto path = capturePath();
+  HareCpp::TrafficCapture capture;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, capture.Open(path));
+  const uint64_t millisecond = 1000000;
+  for (uint64_t at : {1 * millisecond, 41 * millisecond, 81 * millisecond}) {
+    testEnvelope envelope("ex", "key", "x");
+    capture.Record(envelope.m_envelope, at);
+  }
+  capture.Close();
+
+  HareCpp::TrafficReplay replay;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, replay.Open(path));
+  auto replayFor = [&replay](double speed) {
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+              replay.Replay([](const HareCpp::capturedMessage&) {}, speed));
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  };
+  EXPECT_GE(replayFor(1), 80);
+  const auto doubled = replayFor(2);
+  EXPECT_GE(doubled, 40);
+  EXPECT_LT(doubled, 80);
+  EXPECT_LT(replayFor(0), 40);
+
+  // Stopped from the sink, i.e. as another thread would
+  int replayed = 0;
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            replay.Replay(
+                [&](const HareCpp::capturedMessage&) {
+                  replayed++;
+                  replay.Stop();
+                },
+                0));
+  EXPECT_EQ(1, replayed);
+  replay.Close();
+  removeCapture(path);
+}
+
+TEST(TrafficCaptureTest, replayIntoChannelHandler) {
+  const auto path = capturePath();
+  HareCpp::TrafficCapture capture;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, capture.Open(path));
+  testEnvelope wanted("orders", "orders.created", "wanted");
+  testEnvelope other("orders", "orders.deleted", "not subscribed");
+  capture.Record(wanted.m_envelope);
+  capture.Record(other.m_envelope);
+  capture.Record(wanted.m_envelope);
+  capture.Close();
+
+  HareCpp::ChannelHandler handler;
+  handler.SetMultiThreaded(false);
+  std::vector<std::string> received;
+  HareCpp::TD_Callback callback = [&received](
+                                      const HareCpp::Message& message) {
+    received.push_back(message.String());
+  };
+  handler.AddChannelProcessor({"orders", "orders.created"}, callback);
+
+  HareCpp::TrafficReplay replay;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, replay.Open(path));
+  EXPECT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, replay.Replay(handler, 0));
+  EXPECT_EQ(std::vector<std::string>({"wanted", "wanted"}), received);
+  replay.Close();
+  removeCapture(path);
+}
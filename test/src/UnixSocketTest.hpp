@@ -0,0 +1,111 @@
+#include "ConnectionBase.hpp"
+#include "UnixSocket.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace {
+// Echoes one connection on a Unix socket path ('@' for abstract)
+class UnixEcho {
+ public:
+  explicit UnixEcho(const std::string& path) : m_path(path) {
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.data(), path.size());
+    if (path[0] == '@') address.sun_path[0] = '\0';
+    if (path[0] != '@') unlink(path.c_str());
+    bind(m_listenFd, reinterpret_cast<sockaddr*>(&address),
+         offsetof(struct sockaddr_un, sun_path) + path.size());
+    listen(m_listenFd, 1);
+
+    m_echo = std::thread([this]() {
+      int client = accept(m_listenFd, nullptr, nullptr);
+      char buffer[4096];
+      ssize_t count;
+      while ((count = read(client, buffer, sizeof(buffer))) > 0) {
+        if (write(client, buffer, count) != count) break;
+      }
+      close(client);
+    });
+  }
+  ~UnixEcho() {
+    m_echo.join();
+    close(m_listenFd);
+    if (m_path[0] != '@') unlink(m_path.c_str());
+  }
+
+ private:
+  std::string m_path;
+  int m_listenFd;
+  std::thread m_echo;
+};
+
+std::string echoThrough(const std::string& path) {
+  UnixEcho echo(path);
+  HareCpp::connection::UnixSocket socket;
+  struct timeval timeout = {2, 0};
+  if (socket.Open(path.c_str(), 0, &timeout) != AMQP_STATUS_OK) return "";
+
+  const std::string sent = "over a unix socket";
+  socket.Send(sent.data(), 5, HareCpp::connection::AMQP_SOCKET_FLAG_MORE);
+  socket.Send(sent.data() + 5, sent.size() - 5, 0);
+
+  std::string received;
+  char buffer[64];
+  while (received.size() < sent.size()) {
+    auto count = socket.Recv(buffer, sizeof(buffer), 0);
+    if (count == HareCpp::connection::AMQP_SOCKET_NEED_READ) {
+      struct pollfd readable;
+      readable.fd = socket.PollFd();
+      readable.events = POLLIN;
+      readable.revents = 0;
+      if (poll(&readable, 1, 2000) != 1) break;
+      continue;
+    }
+    if (count <= 0) break;
+    received.append(buffer, count);
+  }
+  socket.Close(false);
+  return received;
+}
+}  // namespace
+
+TEST(UnixSocketTest, echoesOverPath) {
+  auto path = "/tmp/harecppUnixTest" + std::to_string(getpid());
+  ASSERT_EQ("over a unix socket", echoThrough(path));
+}
+
+TEST(UnixSocketTest, echoesOverAbstractName) {
+  auto path = "@harecppUnixTest" + std::to_string(getpid());
+  ASSERT_EQ("over a unix socket", echoThrough(path));
+}
+
+TEST(UnixSocketTest, missingPath) {
+  HareCpp::connection::UnixSocket socket;
+  struct timeval timeout = {1, 0};
+  ASSERT_EQ(AMQP_STATUS_SOCKET_ERROR,
+            socket.Open("/tmp/harecppNobodyListens", 0, &timeout));
+  ASSERT_EQ(AMQP_STATUS_BAD_URL, socket.Open("", 0, &timeout));
+}
+
+TEST(UnixSocketTest, transportNeedsPath) {
+  HareCpp::connection::ConnectionBase connection("localhost", 5672, "guest",
+                                                 "guest");
+  HareCpp::helper::socketOptions options;
+  options.m_transport = HareCpp::helper::socketTransport::UNIX;
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::INVALID_PARAMETERS,
+            connection.SetSocketOptions(options));
+  options.m_unixPath = "/tmp/harecppNobodyListens";
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD,
+            connection.SetSocketOptions(options));
+  ASSERT_NE(HareCpp::HARE_ERROR_E::ALL_GOOD, connection.Connect());
+}
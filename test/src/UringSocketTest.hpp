@@ -0,0 +1,158 @@
+#include "UringSocket.hpp"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace {
+// Accepts one connection on a loopback port and echoes everything back, or
+// hangs up straight away
+class LoopbackEcho {
+ public:
+  explicit LoopbackEcho(bool echo = true) : m_port(0) {
+    m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), length);
+    listen(m_listenFd, 1);
+    getsockname(m_listenFd, reinterpret_cast<sockaddr*>(&address), &length);
+    m_port = ntohs(address.sin_port);
+
+    m_echo = std::thread([this, echo]() {
+      int client = accept(m_listenFd, nullptr, nullptr);
+      int one = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      char buffer[4096];
+      ssize_t count;
+      while (echo && (count = read(client, buffer, sizeof(buffer))) > 0) {
+        if (write(client, buffer, count) != count) break;
+      }
+      close(client);
+    });
+  }
+  ~LoopbackEcho() {
+    m_echo.join();
+    close(m_listenFd);
+  }
+  int Port() const { return m_port; }
+
+ private:
+  int m_listenFd;
+  int m_port;
+  std::thread m_echo;
+};
+
+// Read until length bytes arrived, waiting on PollFd() like rabbitmq-c does
+std::string receive(HareCpp::connection::UringSocket& socket, size_t length) {
+  std::string received;
+  char buffer[1024];
+  while (received.size() < length) {
+    auto count = socket.Recv(buffer, sizeof(buffer), 0);
+    if (count == HareCpp::connection::AMQP_SOCKET_NEED_READ) {
+      struct pollfd readable;
+      readable.fd = socket.PollFd();
+      readable.events = POLLIN;
+      readable.revents = 0;
+      if (poll(&readable, 1, 2000) != 1) break;
+      continue;
+    }
+    if (count <= 0) break;
+    received.append(buffer, count);
+  }
+  return received;
+}
+}  // namespace
+
+TEST(UringSocketTest, echoesWhatWasSent) {
+  LoopbackEcho echo;
+  HareCpp::connection::UringSocket socket;
+  struct timeval timeout = {2, 0};
+  ASSERT_EQ(AMQP_STATUS_OK, socket.Open("127.0.0.1", echo.Port(), &timeout));
+  ASSERT_EQ(HareCpp::connection::UringSocket::Supported(), socket.UsingRing());
+
+  std::string sent;
+  for (int i = 0; i < 100; i++) {
+    std::string frame = "frame " + std::to_string(i) + ";";
+    ASSERT_EQ(static_cast<ssize_t>(frame.size()),
+              socket.Send(frame.data(), frame.size(),
+                          HareCpp::connection::AMQP_SOCKET_FLAG_MORE));
+    sent += frame;
+  }
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, socket.Flush());
+  ASSERT_EQ(sent, receive(socket, sent.size()));
+
+  if (socket.UsingRing()) {
+    // 100 sends went out together, nowhere near a syscall each
+    ASSERT_LT(socket.SyscallCount(), 20u);
+  }
+  socket.Close(false);
+}
+
+TEST(UringSocketTest, sendLargerThanBuffer) {
+  LoopbackEcho echo;
+  HareCpp::connection::UringSocket socket(4096);
+  struct timeval timeout = {2, 0};
+  ASSERT_EQ(AMQP_STATUS_OK, socket.Open("127.0.0.1", echo.Port(), &timeout));
+
+  std::string sent(100000, 'x');
+  for (size_t i = 0; i < sent.size(); i++) sent[i] = 'a' + i % 26;
+  ASSERT_EQ(static_cast<ssize_t>(sent.size()),
+            socket.Send(sent.data(), sent.size(), 0));
+  ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, socket.Flush());
+  ASSERT_EQ(sent, receive(socket, sent.size()));
+  socket.Close(false);
+}
+
+TEST(UringSocketTest, receiveBuffersAreReused) {
+  LoopbackEcho echo;
+  HareCpp::connection::UringSocket socket;
+  struct timeval timeout = {2, 0};
+  ASSERT_EQ(AMQP_STATUS_OK, socket.Open("127.0.0.1", echo.Port(), &timeout));
+
+  // Well past URING_RECV_BUFFERS * URING_RECV_BUFFER_BYTES in total
+  std::string sent(65536, 'r');
+  for (int round = 0; round < 32; round++) {
+    ASSERT_EQ(static_cast<ssize_t>(sent.size()),
+              socket.Send(sent.data(), sent.size(), 0));
+    ASSERT_EQ(HareCpp::HARE_ERROR_E::ALL_GOOD, socket.Flush());
+    ASSERT_EQ(sent, receive(socket, sent.size()));
+  }
+  socket.Close(false);
+}
+
+TEST(UringSocketTest, peerCloseIsReported) {
+  LoopbackEcho hangUp(false);
+  HareCpp::connection::UringSocket socket;
+  struct timeval timeout = {2, 0};
+  ASSERT_EQ(AMQP_STATUS_OK, socket.Open("127.0.0.1", hangUp.Port(), &timeout));
+
+  char buffer[16];
+  ssize_t status = HareCpp::connection::AMQP_SOCKET_NEED_READ;
+  while (status == HareCpp::connection::AMQP_SOCKET_NEED_READ) {
+    struct pollfd readable;
+    readable.fd = socket.PollFd();
+    readable.events = POLLIN;
+    readable.revents = 0;
+    poll(&readable, 1, 2000);
+    status = socket.Recv(buffer, sizeof(buffer), 0);
+  }
+  ASSERT_EQ(AMQP_STATUS_CONNECTION_CLOSED, status);
+  socket.Close(true);
+  ASSERT_EQ(AMQP_STATUS_SOCKET_ERROR, socket.Recv(buffer, sizeof(buffer), 0));
+}
+
+TEST(UringSocketTest, unreachable) {
+  HareCpp::connection::UringSocket socket;
+  struct timeval timeout = {1, 0};
+  ASSERT_EQ(AMQP_STATUS_SOCKET_ERROR, socket.Open("127.0.0.1", 1, &timeout));
+}
@@ -6,9 +6,36 @@
 #include "DeclareExchangeTest.hpp"
 #include "MultiSubscribeTest.hpp"
 #include "RestartTest.hpp"
+#include "ConnectionPoolTest.hpp"
+#include "ConnectionBaseTest.hpp"
+#include "PublishFrameWriterTest.hpp"
+#include "UringSocketTest.hpp"
+#include "UnixSocketTest.hpp"
+#include "StandInBrokerTest.hpp"
+#include "LatencyHistogramTest.hpp"
+#include "MetricsTest.hpp"
+#include "LoggerTest.hpp"
+#include "EventLogTest.hpp"
+#include "ProbesTest.hpp"
+#include "TrafficCaptureTest.hpp"
+#include "FaultProxyTest.hpp"
+#include "SharedPayloadTest.hpp"
+#include "HeadersTableTest.hpp"
+#include "CodecTest.hpp"
+#include "StreamingTest.hpp"
 
 int main(int argc, char** argv) {
   HareCpp::SET_DEBUG_LEVEL(HareCpp::LOG_NONE);
   ::testing::InitGoogleTest(&argc, argv);
+
+  // --standin: no RabbitMQ needed, everything talks to an in-process broker
+  std::unique_ptr<HareTest::StandInBroker> broker;
+  for (int i = 1; i < argc; i++) {
+    if (0 == strcmp(argv[i], "--standin")) {
+      broker.reset(new HareTest::StandInBroker());
+      SERVER = "127.0.0.1";
+      PORT = broker->Port();
+    }
+  }
   return RUN_ALL_TESTS();
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+
+#include "EventLog.hpp"
+
+/**
+ * Prints the event log files written by HareCpp::EventLog as text, one event
+ * per line, oldest first.  Works on the file of a process that is still
+ * running too.
+ */
+int main(int argc, char** argv) {
+  if (argc < 2 || 0 == strcmp(argv[1], "--help")) {
+    printf("Usage: %s eventlog [eventlog ...]\n", argv[0]);
+    return argc < 2 ? 1 : 0;
+  }
+
+  int status = 0;
+  for (int i = 1; i < argc; i++) {
+    if (argc > 2) std::cout << "## " << argv[i] << "\n";
+    if (false ==
+        HareCpp::noError(HareCpp::EventLog::Decode(argv[i], std::cout))) {
+      fprintf(stderr, "%s: not a HareCpp event log\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
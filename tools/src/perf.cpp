@@ -0,0 +1,590 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Consumer.hpp"
+#include "LatencyHistogram.hpp"
+#include "Producer.hpp"
+
+#include "StandInBroker.hpp"
+
+/**
+ * Load generator in the spirit of RabbitMQ's PerfTest, built on HareCpp's own
+ * Producer and Consumer: a number of producers publish as fast as allowed to
+ * an exchange, a number of consumers each take everything published off
+ * their own queues, and throughput and publish to callback latency are
+ * printed every interval and summed up at the end.
+ *
+ * Every message starts with the time it was sent, the producer that sent it
+ * and its sequence number, so latencies are measured on one clock and
+ * --in-flight can hold a producer back until its messages have arrived.
+ */
+namespace {
+
+// Front of every payload
+struct payloadHeader {
+  uint64_t m_sentNanos;
+  uint32_t m_producer;
+  uint32_t m_sequence;
+};
+
+// m_producer of the messages sent while waiting for the consumers to be
+// subscribed, m_sequence is the routing key they went to
+constexpr uint32_t WARMUP_PRODUCER = UINT32_MAX;
+
+/**
+ * Payload sizes to pick from: one size, every size in a range equally
+ * likely, or a list of sizes with weights
+ */
+class sizeDistribution {
+ public:
+  sizeDistribution() : m_sizes{1000}, m_uniform(false) {}
+
+  /**
+   * @param [in] spec : "1000", "100-10000" or "100:80,4096:15,65536:5"
+   * @returns false if it isn't one of those
+   */
+  bool Parse(const std::string& spec) {
+    m_sizes.clear();
+    std::vector<double> weights;
+    m_uniform = false;
+    char* end = nullptr;
+    const char* at = spec.c_str();
+    if (spec.find('-') != std::string::npos) {
+      m_sizes.push_back(strtoull(at, &end, 10));
+      if (*end != '-') return false;
+      m_sizes.push_back(strtoull(end + 1, &end, 10));
+      m_uniform = true;
+      return *end == '\0' && m_sizes[0] <= m_sizes[1];
+    }
+    while (true) {
+      m_sizes.push_back(strtoull(at, &end, 10));
+      if (end == at) return false;
+      double weight = 1;
+      if (*end == ':') {
+        at = end + 1;
+        weight = strtod(at, &end);
+        if (end == at || weight <= 0) return false;
+      }
+      weights.push_back(weight);
+      if (*end == '\0') break;
+      if (*end != ',') return false;
+      at = end + 1;
+    }
+    m_weights = std::discrete_distribution<size_t>(weights.begin(),
+                                                   weights.end());
+    return true;
+  }
+
+  size_t Next(std::mt19937_64& random) {
+    if (m_uniform) {
+      return std::uniform_int_distribution<size_t>(m_sizes[0],
+                                                   m_sizes[1])(random);
+    }
+    return m_sizes.size() == 1 ? m_sizes[0] : m_sizes[m_weights(random)];
+  }
+
+  std::string Describe() const {
+    if (m_uniform) {
+      return std::to_string(m_sizes[0]) + "-" + std::to_string(m_sizes[1]) +
+             " B";
+    }
+    std::string sizes;
+    for (size_t size : m_sizes) {
+      sizes += (sizes.empty() ? "" : ",") + std::to_string(size);
+    }
+    return sizes + " B";
+  }
+
+ private:
+  std::vector<size_t> m_sizes;
+  std::discrete_distribution<size_t> m_weights;
+  bool m_uniform;
+};
+
+struct perfConfig {
+  perfConfig()
+      : m_server("localhost"),
+        m_port(5672),
+        m_username("guest"),
+        m_password("guest"),
+        m_producers(1),
+        m_consumers(1),
+        m_seconds(10),
+        m_interval(1),
+        m_rate(0),
+        m_inFlight(0),
+        m_queued(10000),
+        m_exchange("harecpp.perf"),
+        m_type("direct"),
+        m_routingKey("perf"),
+        m_routingKeys(1),
+        m_standIn(false) {}
+  std::string m_server;
+  int m_port;
+  std::string m_username;
+  std::string m_password;
+  int m_producers;
+  int m_consumers;
+  int m_seconds;
+  int m_interval;
+  double m_rate;     // per producer, messages a second, 0 for no limit
+  int m_inFlight;    // per producer, sent but not consumed, 0 for no limit
+  int m_queued;      // per producer, waiting in Producer::Send()'s queue
+  sizeDistribution m_sizes;
+  std::string m_exchange;
+  std::string m_type;
+  std::string m_routingKey;
+  int m_routingKeys;
+  bool m_standIn;
+  std::string m_jsonPath;
+
+  std::string RoutingKey(uint32_t index) const {
+    return m_routingKeys == 1 ? m_routingKey
+                              : m_routingKey + "." + std::to_string(index);
+  }
+
+  // What each consumer binds its queue(s) with
+  std::vector<std::string> BindingKeys() const {
+    if (m_type == "fanout") return {""};
+    if (m_type == "topic" && m_routingKeys > 1) return {m_routingKey + ".*"};
+    std::vector<std::string> keys;
+    for (int i = 0; i < m_routingKeys; i++) keys.push_back(RoutingKey(i));
+    return keys;
+  }
+};
+
+/**
+ * Counted by the producer threads and the consumers' callbacks, read by the
+ * reporting thread
+ */
+struct perfStats {
+  explicit perfStats(int producers)
+      : m_sent(0),
+        m_sentBytes(0),
+        m_received(0),
+        m_receivedBytes(0),
+        m_delivered(new std::atomic<uint64_t>[producers]) {
+    for (int i = 0; i < producers; i++) m_delivered[i] = 0;
+  }
+  std::atomic<uint64_t> m_sent;
+  std::atomic<uint64_t> m_sentBytes;
+  std::atomic<uint64_t> m_received;
+  std::atomic<uint64_t> m_receivedBytes;
+  // Per producer, deliveries over all consumers
+  std::unique_ptr<std::atomic<uint64_t>[]> m_delivered;
+  HareCpp::LatencyHistogram m_intervalLatency;
+  HareCpp::LatencyHistogram m_totalLatency;
+};
+
+/**
+ * One Consumer with its queue(s) bound to every routing key the producers
+ * use, and what it has seen of the warm-up
+ */
+class perfConsumer {
+ public:
+  perfConsumer(const perfConfig& config, perfStats& stats)
+      : m_stats(stats), m_bindings(config.BindingKeys().size()) {}
+
+  HareCpp::HARE_ERROR_E Start(const perfConfig& config) {
+    auto retCode = m_consumer.Initialize(config.m_server, config.m_port,
+                                         config.m_username, config.m_password);
+    for (const auto& key : config.BindingKeys()) {
+      if (false == HareCpp::noError(retCode)) break;
+      retCode = m_consumer.Subscribe(
+          config.m_exchange, key,
+          [this](const HareCpp::Message& message) { received(message); });
+    }
+    if (HareCpp::noError(retCode)) retCode = m_consumer.Start();
+    return retCode;
+  }
+
+  void Stop() { m_consumer.Stop(); }
+
+  /**
+   * Every binding has had a warm-up message through it
+   */
+  bool Ready() const {
+    const std::lock_guard<std::mutex> lock(m_warmupMutex);
+    return m_warmedUp.size() >= m_bindings;
+  }
+
+ private:
+  void received(const HareCpp::Message& message) {
+    payloadHeader header;
+    if (message.Length() < sizeof(header)) return;
+    memcpy(&header, message.Payload(), sizeof(header));
+    if (header.m_producer == WARMUP_PRODUCER) {
+      const std::lock_guard<std::mutex> lock(m_warmupMutex);
+      m_warmedUp.insert(header.m_sequence);
+      return;
+    }
+    const uint64_t now = HareCpp::LatencyHistogram::Now();
+    const uint64_t latency =
+        now > header.m_sentNanos ? now - header.m_sentNanos : 0;
+    m_stats.m_intervalLatency.Record(latency);
+    m_stats.m_totalLatency.Record(latency);
+    m_stats.m_receivedBytes += message.Length();
+    m_stats.m_received++;
+    m_stats.m_delivered[header.m_producer]++;
+  }
+
+  perfStats& m_stats;
+  const size_t m_bindings;
+  HareCpp::Consumer m_consumer;
+  mutable std::mutex m_warmupMutex;
+  // Routing keys warm-up messages came in on; for topic and fanout all of
+  // them arrive on the one binding
+  std::set<uint32_t> m_warmedUp;
+};
+
+void usage(const char* program) {
+  printf(
+      "Usage: %s [options]\n"
+      "  --server host, --port n, --user name, --password password\n"
+      "                      broker, localhost:5672 guest/guest by default\n"
+      "  --standin           run against the built in stand-in broker\n"
+      "  --producers n       producers, each on its own connection (1)\n"
+      "  --consumers n       consumers, each on its own connection and\n"
+      "                      queue(s), each gets every message (1)\n"
+      "  --seconds n         how long to publish for (10)\n"
+      "  --interval n        seconds between progress lines (1)\n"
+      "  --size spec         payload bytes: 1000, a range 100-10000, or\n"
+      "                      weighted sizes 100:80,4096:15,65536:5 (1000);\n"
+      "                      at least %zu\n"
+      "  --rate r            messages a second per producer, 0 for as fast\n"
+      "                      as possible (0)\n"
+      "  --in-flight n       messages per producer sent but not yet\n"
+      "                      consumed, 0 for no limit (0)\n"
+      "  --queue n           messages per producer waiting to be sent (10000)\n"
+      "  --exchange name     exchange to publish to (harecpp.perf)\n"
+      "  --type type         its type, direct, topic or fanout (direct)\n"
+      "  --routing-key key   routing key (perf)\n"
+      "  --routing-keys n    spread over key.0 to key.n-1 in turn (1)\n"
+      "  --json file         write the results as JSON as well\n",
+      program, sizeof(payloadHeader));
+}
+
+bool parseArguments(int argc, char** argv, perfConfig& config) {
+  for (int i = 1; i < argc; i++) {
+    const bool hasValue = (i + 1 < argc);
+    if (0 == strcmp(argv[i], "--server") && hasValue) {
+      config.m_server = argv[++i];
+    } else if (0 == strcmp(argv[i], "--port") && hasValue) {
+      config.m_port = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--user") && hasValue) {
+      config.m_username = argv[++i];
+    } else if (0 == strcmp(argv[i], "--password") && hasValue) {
+      config.m_password = argv[++i];
+    } else if (0 == strcmp(argv[i], "--standin")) {
+      config.m_standIn = true;
+    } else if (0 == strcmp(argv[i], "--producers") && hasValue) {
+      config.m_producers = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--consumers") && hasValue) {
+      config.m_consumers = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--seconds") && hasValue) {
+      config.m_seconds = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--interval") && hasValue) {
+      config.m_interval = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--size") && hasValue) {
+      if (false == config.m_sizes.Parse(argv[++i])) return false;
+    } else if (0 == strcmp(argv[i], "--rate") && hasValue) {
+      config.m_rate = atof(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--in-flight") && hasValue) {
+      config.m_inFlight = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--queue") && hasValue) {
+      config.m_queued = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--exchange") && hasValue) {
+      config.m_exchange = argv[++i];
+    } else if (0 == strcmp(argv[i], "--type") && hasValue) {
+      config.m_type = argv[++i];
+    } else if (0 == strcmp(argv[i], "--routing-key") && hasValue) {
+      config.m_routingKey = argv[++i];
+    } else if (0 == strcmp(argv[i], "--routing-keys") && hasValue) {
+      config.m_routingKeys = atoi(argv[++i]);
+    } else if (0 == strcmp(argv[i], "--json") && hasValue) {
+      config.m_jsonPath = argv[++i];
+    } else {
+      return false;
+    }
+  }
+  return config.m_producers > 0 && config.m_consumers >= 0 &&
+         config.m_seconds > 0 && config.m_interval > 0 &&
+         config.m_rate >= 0 && config.m_inFlight >= 0 &&
+         config.m_queued > 0 && config.m_routingKeys > 0 &&
+         (config.m_type == "direct" || config.m_type == "topic" ||
+          config.m_type == "fanout");
+}
+
+void sendPayload(HareCpp::Producer& producer, const perfConfig& config,
+                 std::string& payload, const payloadHeader& header,
+                 uint32_t routingKey) {
+  memcpy(&payload[0], &header, sizeof(header));
+  HareCpp::Message message(payload);
+  producer.Send(config.m_exchange, config.RoutingKey(routingKey), message);
+}
+
+/**
+ * Publish until running goes false, keeping to the rate, in-flight and queue
+ * limits
+ */
+void produce(HareCpp::Producer& producer, uint32_t id,
+             const perfConfig& config, perfStats& stats,
+             const std::atomic<bool>& running) {
+  std::mt19937_64 random(id);
+  sizeDistribution sizes = config.m_sizes;
+  std::string payload;
+  const uint64_t start = HareCpp::LatencyHistogram::Now();
+  for (uint32_t sequence = 0; running; sequence++) {
+    if (config.m_rate > 0) {
+      const uint64_t due =
+          start + static_cast<uint64_t>(sequence * 1e9 / config.m_rate);
+      uint64_t now = HareCpp::LatencyHistogram::Now();
+      while (running && now < due) {
+        std::this_thread::sleep_for(
+            std::chrono::nanoseconds(std::min<uint64_t>(due - now, 1000000)));
+        now = HareCpp::LatencyHistogram::Now();
+      }
+    }
+    if (config.m_inFlight > 0 && config.m_consumers > 0) {
+      while (running &&
+             sequence - stats.m_delivered[id] / config.m_consumers >=
+                 static_cast<uint64_t>(config.m_inFlight)) {
+        std::this_thread::yield();
+      }
+    }
+    while (running && producer.QueueSize() >= config.m_queued) {
+      std::this_thread::yield();
+    }
+    if (false == running) break;
+
+    payload.resize(std::max(sizes.Next(random), sizeof(payloadHeader)));
+    const payloadHeader header{HareCpp::LatencyHistogram::Now(), id,
+                               sequence};
+    sendPayload(producer, config, payload, header,
+                sequence % config.m_routingKeys);
+    stats.m_sentBytes += payload.size();
+    stats.m_sent++;
+  }
+}
+
+/**
+ * Keep sending a warm-up message down every routing key until every
+ * consumer has had one through each of its bindings
+ */
+bool warmUp(HareCpp::Producer& producer, const perfConfig& config,
+            const std::vector<std::unique_ptr<perfConsumer>>& consumers) {
+  std::string payload(sizeof(payloadHeader), '\0');
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (std::chrono::steady_clock::now() < deadline) {
+    bool ready = true;
+    for (const auto& consumer : consumers) ready = ready && consumer->Ready();
+    if (ready) return true;
+    for (int key = 0; key < config.m_routingKeys; key++) {
+      const payloadHeader header{0, WARMUP_PRODUCER,
+                                 static_cast<uint32_t>(key)};
+      sendPayload(producer, config, payload, header, key);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  return false;
+}
+
+double micros(uint64_t nanos) { return nanos / 1000.0; }
+
+void printInterval(double elapsed, uint64_t sent, uint64_t received,
+                   uint64_t receivedBytes, double seconds,
+                   const HareCpp::LatencyHistogram::snapshot& latency) {
+  printf("%7.1fs %12.0f %12.0f %10.2f %10.1f %10.1f %10.1f %10.1f\n", elapsed,
+         sent / seconds, received / seconds,
+         receivedBytes / seconds / (1024 * 1024),
+         micros(latency.Percentile(50)), micros(latency.Percentile(99)),
+         micros(latency.Percentile(99.9)), micros(latency.MaxNanos()));
+  fflush(stdout);
+}
+
+struct perfResult {
+  std::string m_metric;
+  double m_value;
+  std::string m_unit;
+};
+
+bool writeJson(const std::string& path, const perfConfig& config,
+               const std::vector<perfResult>& results) {
+  FILE* out = fopen(path.c_str(), "w");
+  if (out == nullptr) return false;
+  fprintf(out,
+          "{\n  \"producers\": %d,\n  \"consumers\": %d,\n"
+          "  \"seconds\": %d,\n  \"size\": \"%s\",\n  \"rate\": %g,\n"
+          "  \"inFlight\": %d,\n  \"exchangeType\": \"%s\",\n"
+          "  \"routingKeys\": %d,\n  \"results\": [",
+          config.m_producers, config.m_consumers, config.m_seconds,
+          config.m_sizes.Describe().c_str(), config.m_rate,
+          config.m_inFlight, config.m_type.c_str(), config.m_routingKeys);
+  for (size_t i = 0; i < results.size(); i++) {
+    fprintf(out, "%s\n    {\"metric\": \"%s\", \"value\": %.3f, "
+                 "\"unit\": \"%s\"}",
+            i == 0 ? "" : ",", results[i].m_metric.c_str(),
+            results[i].m_value, results[i].m_unit.c_str());
+  }
+  fprintf(out, "\n  ]\n}\n");
+  return 0 == fclose(out);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  HareCpp::SET_DEBUG_LEVEL(HareCpp::LOG_NONE);
+
+  perfConfig config;
+  if (false == parseArguments(argc, argv, config)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::unique_ptr<HareTest::StandInBroker> broker;
+  if (config.m_standIn) {
+    broker.reset(new HareTest::StandInBroker(0, "", config.m_username,
+                                             config.m_password));
+    if (0 == broker->Port()) {
+      fprintf(stderr, "Couldn't start the stand-in broker\n");
+      return 1;
+    }
+    config.m_server = "127.0.0.1";
+    config.m_port = broker->Port();
+  }
+
+  perfStats stats(config.m_producers);
+  std::vector<std::unique_ptr<HareCpp::Producer>> producers;
+  for (int i = 0; i < config.m_producers; i++) {
+    producers.emplace_back(new HareCpp::Producer);
+    auto& producer = *producers.back();
+    if (false == HareCpp::noError(producer.Initialize(
+                     config.m_server, config.m_port, config.m_username,
+                     config.m_password)) ||
+        false == HareCpp::noError(
+                     producer.DeclareExchange(config.m_exchange,
+                                              config.m_type)) ||
+        false == HareCpp::noError(producer.Start())) {
+      fprintf(stderr, "Producer %d couldn't connect to %s:%d\n", i,
+              config.m_server.c_str(), config.m_port);
+      return 1;
+    }
+  }
+  std::vector<std::unique_ptr<perfConsumer>> consumers;
+  for (int i = 0; i < config.m_consumers; i++) {
+    consumers.emplace_back(new perfConsumer(config, stats));
+    if (false == HareCpp::noError(consumers.back()->Start(config))) {
+      fprintf(stderr, "Consumer %d couldn't connect to %s:%d\n", i,
+              config.m_server.c_str(), config.m_port);
+      return 1;
+    }
+  }
+  if (false == warmUp(*producers[0], config, consumers)) {
+    fprintf(stderr, "Consumers never received anything, is %s a %s "
+                    "exchange?\n",
+            config.m_exchange.c_str(), config.m_type.c_str());
+    return 1;
+  }
+  // Stragglers from the warm-up
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  printf("harecpp_perf: %d producer(s), %d consumer(s), %s, %s exchange %s, "
+         "%d routing key(s), %d s\n",
+         config.m_producers, config.m_consumers,
+         config.m_sizes.Describe().c_str(), config.m_type.c_str(),
+         config.m_exchange.c_str(), config.m_routingKeys, config.m_seconds);
+  printf("%8s %12s %12s %10s %10s %10s %10s %10s\n", "time", "sent msg/s",
+         "recv msg/s", "recv MiB/s", "p50 us", "p99 us", "p99.9 us",
+         "max us");
+
+  std::atomic<bool> running(true);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < config.m_producers; i++) {
+    threads.emplace_back(produce, std::ref(*producers[i]),
+                         static_cast<uint32_t>(i), std::cref(config),
+                         std::ref(stats), std::cref(running));
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  auto elapsedSince = [](std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         from)
+        .count();
+  };
+  uint64_t lastSent = 0, lastReceived = 0, lastReceivedBytes = 0;
+  auto lastReport = start;
+  for (int tick = 1; tick * config.m_interval <= config.m_seconds; tick++) {
+    std::this_thread::sleep_until(
+        start + std::chrono::seconds(tick * config.m_interval));
+    const uint64_t sent = stats.m_sent, received = stats.m_received,
+                   receivedBytes = stats.m_receivedBytes;
+    printInterval(elapsedSince(start), sent - lastSent,
+                  received - lastReceived, receivedBytes - lastReceivedBytes,
+                  elapsedSince(lastReport),
+                  stats.m_intervalLatency.SnapshotAndReset());
+    lastSent = sent;
+    lastReceived = received;
+    lastReceivedBytes = receivedBytes;
+    lastReport = std::chrono::steady_clock::now();
+  }
+  running = false;
+  for (auto& thread : threads) thread.join();
+  const double seconds = elapsedSince(start);
+  const uint64_t sent = stats.m_sent;
+  const uint64_t receivedInTime = stats.m_received;
+
+  // Whatever is still in flight, so losses can be told from slowness
+  const uint64_t expected = sent * config.m_consumers;
+  const auto drained =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (stats.m_received < expected &&
+         std::chrono::steady_clock::now() < drained) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  for (auto& consumer : consumers) consumer->Stop();
+  for (auto& producer : producers) producer->Stop();
+
+  const auto latency = stats.m_totalLatency.Snapshot();
+  const std::vector<perfResult> results = {
+      {"sent", sent / seconds, "msg/s"},
+      {"sent", stats.m_sentBytes / seconds / (1024 * 1024), "MiB/s"},
+      {"received", receivedInTime / seconds, "msg/s"},
+      {"received", stats.m_receivedBytes / seconds / (1024 * 1024), "MiB/s"},
+      {"lost", static_cast<double>(expected -
+                                   std::min<uint64_t>(expected,
+                                                      stats.m_received)),
+       "msg"},
+      {"latency mean", micros(latency.MeanNanos()), "us"},
+      {"latency p50", micros(latency.Percentile(50)), "us"},
+      {"latency p90", micros(latency.Percentile(90)), "us"},
+      {"latency p99", micros(latency.Percentile(99)), "us"},
+      {"latency p99.9", micros(latency.Percentile(99.9)), "us"},
+      {"latency max", micros(latency.MaxNanos()), "us"},
+  };
+  printf("== summary\n");
+  for (const auto& result : results) {
+    printf("  %-20s %14.2f %s\n", result.m_metric.c_str(), result.m_value,
+           result.m_unit.c_str());
+  }
+
+  if (false == config.m_jsonPath.empty() &&
+      false == writeJson(config.m_jsonPath, config, results)) {
+    fprintf(stderr, "Couldn't write %s\n", config.m_jsonPath.c_str());
+    return 1;
+  }
+  return (config.m_consumers > 0 && 0 == stats.m_received) ? 1 : 0;
+}